@@ -0,0 +1,89 @@
+/** Benchmarks for the conversions into containers from memory resources.
+ *
+ * The same requests, each a list of strings and a list of lists of integers,
+ * are converted into native containers many times.  The containers take their
+ * storage either directly from the global allocator or from a request arena
+ * released after each request.  Besides the timings, the allocations passed
+ * to the global allocator are counted for each request.
+ */
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/arena.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const long N_REQUESTS = 10000;
+
+using Strs = std::pmr::vector<std::pmr::string>;
+
+using Rows = std::pmr::vector<std::pmr::vector<long>>;
+
+/** Makes the request to be converted.
+ */
+
+static Handle make_request()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    bench::run_code(bench::compile(R"(
+names = ['name of the field number %d' % i for i in range(16)]
+rows = [list(range(i, i + 8)) for i in range(16)]
+)"),
+        globals);
+    return Handle("(OO)", PyDict_GetItemString(globals, "names"),
+        PyDict_GetItemString(globals, "rows"));
+}
+
+/** Converts a request with the containers from the given resource.
+ */
+
+static std::size_t convert(PyObject* request, std::pmr::memory_resource* res)
+{
+    Handle names(PyTuple_GET_ITEM(request, 0), BORROW);
+    Handle rows(PyTuple_GET_ITEM(request, 1), BORROW);
+    auto strs = as_in<Strs>(names, res);
+    auto nums = as_in<Rows>(rows, res);
+    return strs.size() + nums.size();
+}
+
+CPYPP_BENCH(convert_global_alloc)
+{
+    Handle request = make_request();
+    Counting_resource counting{};
+    std::size_t total = 0;
+
+    run.measure(
+        [&]() {
+            for (long i = 0; i < N_REQUESTS; ++i) {
+                total += convert(request, &counting);
+            }
+        },
+        N_REQUESTS);
+    run.count("allocs", static_cast<double>(counting.n_allocs()) / N_REQUESTS);
+}
+
+CPYPP_BENCH(convert_arena)
+{
+    Handle request = make_request();
+    Counting_resource counting{};
+    Request_arena<> arena(&counting);
+    std::size_t total = 0;
+
+    run.measure(
+        [&]() {
+            for (long i = 0; i < N_REQUESTS; ++i) {
+                total += convert(request, arena.resource());
+                arena.release();
+            }
+        },
+        N_REQUESTS);
+    run.count("allocs", static_cast<double>(counting.n_allocs()) / N_REQUESTS);
+}
@@ -0,0 +1,267 @@
+/** @file baseline.hpp
+ *
+ * Baselines of the benchmark timings stored as JSON
+ *
+ * A baseline keeps all the timings of each benchmark case, along with their
+ * summaries for people reading the file, like
+ *
+ *     {"cases": {"name": {"median": 1.5, "ci_low": 1.4, "ci_high": 1.6,
+ *         "samples": [1.5, ...]}}}
+ *
+ * Only the samples are read back.  The reader here is a small one for JSON in
+ * general, which skips everything else.
+ */
+
+#ifndef CPYPP_BENCH_BASELINE_HPP
+#define CPYPP_BENCH_BASELINE_HPP
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stats.hpp"
+
+namespace bench {
+
+/** Timings of the benchmark cases by their names.
+ */
+
+using Baseline = std::map<std::string, std::vector<double>>;
+
+/** Saves the baseline into the file of the given path.
+ *
+ * False is returned when the file cannot be written.
+ */
+
+inline bool save_baseline(const char* path, const Baseline& baseline)
+{
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::fprintf(file, "{\"cases\": {");
+    bool if_first = true;
+    for (const auto& i : baseline) {
+        Summary summary = summarize(i.second);
+        std::fprintf(file,
+            "%s\n  \"%s\": {\"median\": %.17g, \"ci_low\": %.17g, "
+            "\"ci_high\": %.17g,\n    \"samples\": [",
+            if_first ? "" : ",", i.first.c_str(), summary.median,
+            summary.ci_low, summary.ci_high);
+        for (std::size_t j = 0; j < i.second.size(); ++j) {
+            std::fprintf(file, "%s%.17g", j == 0 ? "" : ", ", i.second[j]);
+        }
+        std::fprintf(file, "]}");
+        if_first = false;
+    }
+    std::fprintf(file, "\n}}\n");
+    return std::fclose(file) == 0;
+}
+
+/** Reader of the baselines in JSON.
+ */
+
+class Baseline_reader {
+public:
+    explicit Baseline_reader(std::string content)
+        : content_{ std::move(content) }
+    {
+    }
+
+    /** Reads the baseline, with false returned for malformed content.
+     */
+
+    bool read(Baseline& baseline)
+    {
+        if (!expect('{')) {
+            return false;
+        }
+        return members([&](const std::string& key) {
+            if (key != "cases") {
+                return skip();
+            }
+            if (!expect('{')) {
+                return false;
+            }
+            return members([&](const std::string& name) {
+                if (!expect('{')) {
+                    return false;
+                }
+                return members([&](const std::string& field) {
+                    if (field != "samples") {
+                        return skip();
+                    }
+                    return numbers(baseline[name]);
+                });
+            });
+        });
+    }
+
+private:
+    void space()
+    {
+        while (pos_ < content_.size()
+            && std::isspace(static_cast<unsigned char>(content_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    bool expect(char c)
+    {
+        space();
+        if (pos_ < content_.size() && content_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c)
+    {
+        space();
+        return pos_ < content_.size() && content_[pos_] == c;
+    }
+
+    /** Reads the members of an object after its opening brace.
+     */
+
+    template <typename F> bool members(F&& action)
+    {
+        if (expect('}')) {
+            return true;
+        }
+        do {
+            std::string key{};
+            if (!string(key) || !expect(':') || !action(key)) {
+                return false;
+            }
+        } while (expect(','));
+        return expect('}');
+    }
+
+    bool string(std::string& out)
+    {
+        if (!expect('"')) {
+            return false;
+        }
+        while (pos_ < content_.size() && content_[pos_] != '"') {
+            char c = content_[pos_++];
+            if (c == '\\' && pos_ < content_.size()) {
+                c = content_[pos_++];
+            }
+            out.push_back(c);
+        }
+        return expect('"');
+    }
+
+    bool number(double& out)
+    {
+        space();
+        const char* begin = content_.c_str() + pos_;
+        char* end = nullptr;
+        out = std::strtod(begin, &end);
+        if (end == begin) {
+            return false;
+        }
+        pos_ += end - begin;
+        return true;
+    }
+
+    bool numbers(std::vector<double>& out)
+    {
+        if (!expect('[')) {
+            return false;
+        }
+        if (expect(']')) {
+            return true;
+        }
+        do {
+            double value;
+            if (!number(value)) {
+                return false;
+            }
+            out.push_back(value);
+        } while (expect(','));
+        return expect(']');
+    }
+
+    /** Skips any value.
+     */
+
+    bool skip()
+    {
+        std::string str{};
+        double value;
+        if (peek('"')) {
+            return string(str);
+        } else if (expect('{')) {
+            return members([&](const std::string&) { return skip(); });
+        } else if (expect('[')) {
+            if (expect(']')) {
+                return true;
+            }
+            do {
+                if (!skip()) {
+                    return false;
+                }
+            } while (expect(','));
+            return expect(']');
+        } else if (number(value)) {
+            return true;
+        }
+        for (const char* i : { "true", "false", "null" }) {
+            if (content_.compare(pos_, std::strlen(i), i) == 0) {
+                pos_ += std::strlen(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string content_;
+    std::size_t pos_ = 0;
+};
+
+/** Outcomes of loading a baseline.
+ *
+ * A baseline file that is missing is to be saved, while one that cannot be
+ * read or parsed is to be left alone.
+ */
+
+enum class Load_res { LOADED, MISSING, MALFORMED };
+
+/** Loads the baseline from the file of the given path.
+ */
+
+inline Load_res load_baseline(const char* path, Baseline& baseline)
+{
+    std::FILE* file = std::fopen(path, "r");
+    if (file == nullptr) {
+        return errno == ENOENT ? Load_res::MISSING : Load_res::MALFORMED;
+    }
+    std::string content{};
+    char buf[4096];
+    std::size_t n_read;
+    while ((n_read = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+        content.append(buf, n_read);
+    }
+    bool if_failed = std::ferror(file) != 0;
+    std::fclose(file);
+    if (if_failed || !Baseline_reader(std::move(content)).read(baseline)) {
+        return Load_res::MALFORMED;
+    }
+    return Load_res::LOADED;
+}
+
+// End of namespace bench
+}
+
+#endif
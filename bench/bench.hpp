@@ -0,0 +1,149 @@
+/** @file bench.hpp
+ *
+ * Minimal utilities for the benchmarks of cpypp
+ *
+ * Benchmark cases are plain functions registered by `CPYPP_BENCH`, which are
+ * run by the driver in `benchmain.cpp` after the Python interpreter is
+ * started.  Each case can prepare its data freely, and only the parts given to
+ * `Run::measure` are timed.  The driver calls each case a few times and
+ * reports the distribution of the timings per item.
+ */
+
+#ifndef CPYPP_BENCH_HPP
+#define CPYPP_BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace bench {
+
+/** The timings collected for a benchmark case.
+ */
+
+class Run {
+public:
+    /** Times an action.
+     *
+     * The time is recorded divided by the given number of items processed by
+     * the action.
+     */
+
+    template <typename F> void measure(F&& action, std::size_t n_items = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        action();
+        auto end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double, std::nano> elapsed = end - start;
+        samples_.push_back(elapsed.count() / n_items);
+    }
+
+    /** Gets the timings in nanoseconds per item.
+     */
+
+    const std::vector<double>& samples() const noexcept { return samples_; }
+
+    /** Reports a count per item besides the timings, like allocations.
+     *
+     * The last value reported for each name is shown by the driver.
+     */
+
+    void count(const char* name, double per_item)
+    {
+        for (auto& i : counts_) {
+            if (std::strcmp(i.first, name) == 0) {
+                i.second = per_item;
+                return;
+            }
+        }
+        counts_.emplace_back(name, per_item);
+    }
+
+    /** Gets the counts reported.
+     */
+
+    const std::vector<std::pair<const char*, double>>& counts() const noexcept
+    {
+        return counts_;
+    }
+
+private:
+    std::vector<double> samples_;
+    std::vector<std::pair<const char*, double>> counts_;
+};
+
+using Bench_fn = void (*)(Run&);
+
+/** Flag for the cases starting threads or processes of their own.
+ *
+ * The cases flagged are run on all the CPUs allowed for the driver, even when
+ * the driver is pinned to a single CPU, since the threads started take the
+ * CPUs of the thread starting them.
+ */
+
+constexpr bool THREADED = true;
+
+struct Bench_case {
+    const char* name;
+    Bench_fn fn;
+    bool if_threaded;
+};
+
+/** Gets all the registered benchmark cases.
+ */
+
+std::vector<Bench_case>& registry();
+
+struct Registrar {
+    Registrar(const char* name, Bench_fn fn, bool if_threaded = false)
+    {
+        registry().push_back({ name, fn, if_threaded });
+    }
+};
+
+/** Compiles Python source code to be run by `run_code`.
+ */
+
+inline cpypp::Handle compile(const char* src)
+{
+    return { Py_CompileString(src, "<bench>", Py_file_input) };
+}
+
+/** Runs compiled Python code with the given namespace.
+ */
+
+inline void run_code(PyObject* code, PyObject* globals)
+{
+    cpypp::Handle res(PyEval_EvalCode(code, globals, globals));
+}
+
+// End of namespace bench
+}
+
+/** Defines and registers a benchmark case.
+ *
+ * The macro is to be followed by the body of the case, where the timings can
+ * be collected by the `run` object.
+ */
+
+#define CPYPP_BENCH(name)                                                      \
+    static void name(bench::Run&);                                             \
+    static bench::Registrar name##_registrar(#name, name);                     \
+    static void name(bench::Run& run)
+
+/** Defines and registers a benchmark case starting threads.
+ */
+
+#define CPYPP_BENCH_THREADED(name)                                             \
+    static void name(bench::Run&);                                             \
+    static bench::Registrar name##_registrar(#name, name, bench::THREADED);    \
+    static void name(bench::Run& run)
+
+#endif
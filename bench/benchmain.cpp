@@ -0,0 +1,318 @@
+/** Driver running the registered benchmark cases.
+ *
+ * Cases with names containing any of the arguments not starting with `--` are
+ * run, or all cases when no such argument is given.  Each case is run a few
+ * times for warming up, with the timings dropped, and then repeatedly with
+ * the timings summarized by their medians with the 95% confidence intervals.
+ * The options are
+ *
+ * - `--cpu N` pins the driver to the given CPU, or to the last CPU it is
+ *   allowed to run on for `auto`, while the cases starting threads are still
+ *   run on all the CPUs allowed,
+ * - `--warmup N` and `--repeats N` set the number of runs of each case,
+ * - `--save PATH` saves the timings as a JSON baseline,
+ * - `--compare PATH` compares the timings with the baseline, which is saved
+ *   when the file does not exist yet, while a file that cannot be read is
+ *   an error and left alone,
+ * - `--threshold X` and `--alpha X` set the relative slowdown of the medians
+ *   and the significance level of the one-sided Mann-Whitney U test, for
+ *   both of which a case is taken to have regressed.
+ *
+ * The exit status is non-zero when any case fails or regresses, or the
+ * baseline to compare with cannot be read.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <Python.h>
+
+#include "baseline.hpp"
+#include "bench.hpp"
+#include "stats.hpp"
+
+std::vector<bench::Bench_case>& bench::registry()
+{
+    static std::vector<Bench_case> cases{};
+    return cases;
+}
+
+namespace {
+
+/** Options of the driver.
+ */
+
+struct Options {
+    const char* cpu = nullptr;
+    int n_warmups = 2;
+    int n_repeats = 5;
+    const char* save = nullptr;
+    const char* compare = nullptr;
+    double threshold = 0.05;
+    double alpha = 0.01;
+    std::vector<const char*> filters;
+};
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strncmp(arg, "--", 2) != 0) {
+            options.filters.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--cpu") == 0) {
+            options.cpu = value;
+        } else if (std::strcmp(arg, "--warmup") == 0) {
+            options.n_warmups = std::max(std::atoi(value), 0);
+        } else if (std::strcmp(arg, "--repeats") == 0) {
+            options.n_repeats = std::max(std::atoi(value), 1);
+        } else if (std::strcmp(arg, "--save") == 0) {
+            options.save = value;
+        } else if (std::strcmp(arg, "--compare") == 0) {
+            options.compare = value;
+        } else if (std::strcmp(arg, "--threshold") == 0) {
+            options.threshold = std::atof(value);
+        } else if (std::strcmp(arg, "--alpha") == 0) {
+            options.alpha = std::atof(value);
+        } else {
+            std::fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool selected(const char* name, const Options& options)
+{
+    if (options.filters.empty()) {
+        return true;
+    }
+    for (const char* i : options.filters) {
+        if (std::strstr(name, i) != nullptr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef __linux__
+/** CPUs the driver is allowed to run on before it is pinned.
+ */
+
+cpu_set_t allowed_cpus;
+#endif
+
+/** CPU the driver is pinned to, or -1 when it is not pinned.
+ */
+
+int pinned_cpu = -1;
+
+/** Sets the CPUs of the current thread, to the one pinned to or to all the
+ * ones allowed.
+ *
+ * Threads started by the current thread take its CPUs.  Nothing is done when
+ * the driver is not pinned.
+ */
+
+void set_pinned(bool if_pinned)
+{
+#ifdef __linux__
+    if (pinned_cpu < 0) {
+        return;
+    }
+    cpu_set_t cpus = allowed_cpus;
+    if (if_pinned) {
+        CPU_ZERO(&cpus);
+        CPU_SET(pinned_cpu, &cpus);
+    }
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+#else
+    (void)if_pinned;
+#endif
+}
+
+/** Pins the current thread to a CPU.
+ *
+ * The CPU pinned to is returned, or -1 when pinning is not possible.
+ */
+
+int pin_cpu(const char* cpu)
+{
+#ifdef __linux__
+    CPU_ZERO(&allowed_cpus);
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
+        return -1;
+    }
+
+    int target = -1;
+    if (std::strcmp(cpu, "auto") == 0) {
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &allowed_cpus)) {
+                target = i;
+            }
+        }
+    } else {
+        target = std::atoi(cpu);
+    }
+    if (target < 0 || target >= CPU_SETSIZE) {
+        return -1;
+    }
+
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(target, &pinned);
+    if (sched_setaffinity(0, sizeof(pinned), &pinned) != 0) {
+        return -1;
+    }
+    pinned_cpu = target;
+    return target;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
+
+/** Runs a case, with the timings after the warmup returned.
+ */
+
+bool run_case(const bench::Bench_case& bench_case, const Options& options,
+    std::vector<double>& samples,
+    std::vector<std::pair<const char*, double>>& counts)
+{
+    try {
+        for (int i = 0; i < options.n_warmups; ++i) {
+            bench::Run warmup{};
+            bench_case.fn(warmup);
+        }
+        bench::Run run{};
+        for (int i = 0; i < options.n_repeats; ++i) {
+            bench_case.fn(run);
+        }
+        samples = run.samples();
+        counts = run.counts();
+        return true;
+    } catch (const cpypp::Exc_set&) {
+        PyErr_Print();
+        return false;
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options{};
+    if (!parse_options(argc, argv, options)) {
+        return 2;
+    }
+    if (options.cpu != nullptr) {
+        int cpu = pin_cpu(options.cpu);
+        if (cpu < 0) {
+            std::fprintf(stderr, "Failed to pin to CPU %s\n", options.cpu);
+        } else {
+            std::printf("Pinned to CPU %d\n", cpu);
+        }
+    }
+
+    bench::Baseline baseline{};
+    bool if_comparing = false;
+    if (options.compare != nullptr) {
+        switch (bench::load_baseline(options.compare, baseline)) {
+        case bench::Load_res::LOADED:
+            if_comparing = true;
+            break;
+        case bench::Load_res::MISSING:
+            std::printf("No baseline at %s, to be saved\n", options.compare);
+            break;
+        case bench::Load_res::MALFORMED:
+            std::fprintf(stderr, "Failed to read the baseline at %s\n",
+                options.compare);
+            return 2;
+        }
+    }
+
+    Py_Initialize();
+
+    int status = 0;
+    bench::Baseline current{};
+    std::printf("%-32s %12s %25s", "case", "median ns/it", "95% CI");
+    if (if_comparing) {
+        std::printf(" %12s %8s %8s", "base median", "change", "p");
+    }
+    std::printf("\n");
+
+    for (const auto& i : bench::registry()) {
+        if (!selected(i.name, options)) {
+            continue;
+        }
+
+        std::vector<double> samples{};
+        std::vector<std::pair<const char*, double>> counts{};
+        // The threads started by the case would otherwise all be pinned to
+        // the CPU of the driver.
+        if (i.if_threaded) {
+            set_pinned(false);
+        }
+        bool if_run = run_case(i, options, samples, counts);
+        if (i.if_threaded) {
+            set_pinned(true);
+        }
+        if (!if_run) {
+            status = 1;
+            continue;
+        }
+        if (samples.empty()) {
+            continue;
+        }
+        current[i.name] = samples;
+
+        bench::Summary summary = bench::summarize(samples);
+        std::printf("%-32s %12.2f [%11.2f, %11.2f]", i.name, summary.median,
+            summary.ci_low, summary.ci_high);
+
+        auto base = baseline.find(i.name);
+        if (if_comparing && base != baseline.end() && !base->second.empty()) {
+            bench::Summary base_summary = bench::summarize(base->second);
+            double change = summary.median / base_summary.median - 1;
+            double p = bench::mann_whitney_greater(samples, base->second);
+            bool if_regressed = change > options.threshold && p < options.alpha;
+            std::printf(" %12.2f %+7.1f%% %8.2g%s", base_summary.median,
+                change * 100, p, if_regressed ? "  REGRESSED" : "");
+            if (if_regressed) {
+                status = 1;
+            }
+        } else if (if_comparing) {
+            std::printf(" %12s", "new");
+        }
+        for (const auto& j : counts) {
+            std::printf("  %s/it=%.2f", j.first, j.second);
+        }
+        std::printf("\n");
+    }
+
+    Py_Finalize();
+
+    const char* save = options.save;
+    if (save == nullptr && options.compare != nullptr && !if_comparing) {
+        save = options.compare;
+    }
+    if (save != nullptr && !bench::save_baseline(save, current)) {
+        std::fprintf(stderr, "Failed to save the baseline to %s\n", save);
+        status = 1;
+    }
+    return status;
+}
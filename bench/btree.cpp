@@ -0,0 +1,132 @@
+/** Benchmarks for the ordered maps with native keys.
+ *
+ * The B-tree maps are compared with the common Python idiom of keeping sorted
+ * lists of keys and values by the `bisect` module, both for insertion in
+ * random order and for range queries.
+ */
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/btree_map.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const long N_KEYS = 100000;
+
+static const long N_QUERIES = 1000;
+
+/** Makes the namespace for the Python code of the benchmarks.
+ *
+ * Shuffled keys are given as `keys`, with `n_queries` range queries to be
+ * made for ranges of width `width`.
+ */
+
+static Handle make_globals()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(
+        globals, "IntBtreeMap", Btree_map<std::int64_t>::type().tp_obj());
+    PyDict_SetItemString(globals, "n_keys", Handle(N_KEYS));
+    PyDict_SetItemString(globals, "n_queries", Handle(N_QUERIES));
+
+    bench::run_code(bench::compile(R"(
+import array
+import bisect
+import random
+
+random.seed(42)
+keys = random.sample(range(n_keys * 10), n_keys)
+width = 100
+)"),
+        globals);
+    return globals;
+}
+
+CPYPP_BENCH(btree_insert_native)
+{
+    std::mt19937_64 gen(42);
+    std::vector<std::int64_t> keys(N_KEYS);
+    for (auto& i : keys) {
+        i = static_cast<std::int64_t>(gen() % (N_KEYS * 10));
+    }
+
+    Btree<std::int64_t, long> tree{};
+    run.measure(
+        [&]() {
+            for (auto i : keys) {
+                *tree.emplace(i).first = i;
+            }
+        },
+        N_KEYS);
+}
+
+CPYPP_BENCH(btree_insert_python)
+{
+    Handle globals = make_globals();
+    Handle code = bench::compile(R"(
+m = IntBtreeMap()
+for k in keys:
+    m[k] = k
+)");
+    run.measure([&]() { bench::run_code(code, globals); }, N_KEYS);
+}
+
+CPYPP_BENCH(bisect_insert_python)
+{
+    Handle globals = make_globals();
+    Handle code = bench::compile(R"(
+ks = []
+vs = []
+for k in keys:
+    i = bisect.bisect_left(ks, k)
+    ks.insert(i, k)
+    vs.insert(i, k)
+)");
+    run.measure([&]() { bench::run_code(code, globals); }, N_KEYS);
+}
+
+CPYPP_BENCH(btree_range_python)
+{
+    Handle globals = make_globals();
+    bench::run_code(bench::compile(R"(
+m = IntBtreeMap()
+m.load_sorted(array.array('q', sorted(keys)), sorted(keys))
+los = keys[:n_queries]
+)"),
+        globals);
+
+    Handle code = bench::compile(R"(
+for lo in los:
+    for k, v in m.irange_items(lo, lo + width):
+        pass
+)");
+    run.measure([&]() { bench::run_code(code, globals); }, N_QUERIES);
+}
+
+CPYPP_BENCH(bisect_range_python)
+{
+    Handle globals = make_globals();
+    bench::run_code(bench::compile(R"(
+ks = sorted(keys)
+vs = list(ks)
+los = keys[:n_queries]
+)"),
+        globals);
+
+    Handle code = bench::compile(R"(
+for lo in los:
+    i = bisect.bisect_left(ks, lo)
+    j = bisect.bisect_right(ks, lo + width)
+    for k, v in zip(ks[i:j], vs[i:j]):
+        pass
+)");
+    run.measure([&]() { bench::run_code(code, globals); }, N_QUERIES);
+}
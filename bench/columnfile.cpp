@@ -0,0 +1,92 @@
+/** Benchmarks for the files of native columns.
+ *
+ * The same columns, of integers and of strings, are loaded either from a
+ * pickle of their lists or from a column file.  Each load of the column file
+ * opens it, gets both columns and decodes the last string, while the load of
+ * the pickle rebuilds all of the objects.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/column_file.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const long N_ITEMS = 500000;
+
+static const long N_OPENS = 1000;
+
+/** Makes the columns as Python lists.
+ */
+
+static Handle make_columns()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "n_items", Handle(N_ITEMS));
+    bench::run_code(bench::compile(R"(
+columns = {
+    'ids': [i * 7919 for i in range(n_items)],
+    'names': ['reference entry number %d' % i for i in range(n_items)],
+}
+)"),
+        globals);
+    return Handle(PyDict_GetItemString(globals, "columns"), NEW);
+}
+
+CPYPP_BENCH(load_pickle)
+{
+    Handle pickle(PyImport_ImportModule("pickle"));
+    Handle dumped(PyObject_CallMethod(
+        pickle, "dumps", "Oi", make_columns().get(), 5));
+
+    long total = 0;
+    run.measure([&]() {
+        Handle columns(PyObject_CallMethod(pickle, "loads", "O", dumped.get()));
+        Handle ids(PyDict_GetItemString(columns, "ids"), NEW);
+        Handle names(PyDict_GetItemString(columns, "names"), NEW);
+        total += PyList_GET_SIZE(ids.get()) + PyList_GET_SIZE(names.get());
+    });
+}
+
+CPYPP_BENCH(load_column_file)
+{
+    char path[] = "/tmp/cpypp-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    {
+        Handle funcs(PyModule_New("funcs"));
+        PyModule_AddFunctions(funcs, column_file_methods());
+        Handle written(PyObject_CallMethod(
+            funcs, "write_columns", "sO", path, make_columns().get()));
+    }
+
+    Handle type(Column_file::type().tp_obj(), NEW);
+    Handle ids_key(PyUnicode_FromString("ids"));
+    Handle names_key(PyUnicode_FromString("names"));
+    long total = 0;
+    run.measure(
+        [&]() {
+            for (long i = 0; i < N_OPENS; ++i) {
+                Handle columns(PyObject_CallFunction(type, "s", path));
+                Handle ids(PyObject_GetItem(columns, ids_key));
+                Handle names(PyObject_GetItem(columns, names_key));
+                Handle last(PySequence_GetItem(names, N_ITEMS - 1));
+                total += PyObject_Length(ids) + PyObject_Length(last);
+            }
+        },
+        N_OPENS);
+    std::remove(path);
+}
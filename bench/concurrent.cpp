@@ -0,0 +1,196 @@
+/** Benchmarks for the concurrent hash maps.
+ *
+ * Native threads increment counters for random keys in a shared table, with
+ * the number of threads going from one to eight.  The sharded table is
+ * compared with a hash map guarded by a single mutex, which is the native
+ * counterpart of a dictionary shared by many threads.  The same sweep is made
+ * with Python threads, incrementing either a dictionary guarded by a
+ * `threading.Lock` or the concurrent map.  The timings are for the
+ * wall-clock time divided by the total number of increments, so that perfect
+ * scaling halves them with doubled threads.
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/concurrent_map.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const long N_KEYS = 10000;
+
+static const long N_INCREMENTS = 200000;
+
+/** Runs the given increment action from the given number of threads.
+ *
+ * The action is called with a key for each increment.
+ */
+
+template <typename F> static void run_threads(int n_threads, F&& increment)
+{
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            std::mt19937_64 gen(i);
+            for (long j = 0; j < N_INCREMENTS; ++j) {
+                increment(static_cast<std::int64_t>(gen() % N_KEYS));
+            }
+        });
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+}
+
+template <int N_THREADS> static void sharded_increment(bench::Run& run)
+{
+    Concurrent_table<std::int64_t> table{};
+    run.measure(
+        [&]() {
+            run_threads(N_THREADS, [&](std::int64_t key) {
+                std::int64_t res;
+                table.increment(key, 1, res);
+            });
+        },
+        N_THREADS * N_INCREMENTS);
+}
+
+template <int N_THREADS> static void locked_increment(bench::Run& run)
+{
+    std::mutex mutex{};
+    std::unordered_map<std::int64_t, std::int64_t> map{};
+    run.measure(
+        [&]() {
+            run_threads(N_THREADS, [&](std::int64_t key) {
+                std::lock_guard<std::mutex> guard(mutex);
+                ++map[key];
+            });
+        },
+        N_THREADS * N_INCREMENTS);
+}
+
+static bench::Registrar sharded_1(
+    "sharded_increment_1", sharded_increment<1>, bench::THREADED);
+static bench::Registrar sharded_2(
+    "sharded_increment_2", sharded_increment<2>, bench::THREADED);
+static bench::Registrar sharded_4(
+    "sharded_increment_4", sharded_increment<4>, bench::THREADED);
+static bench::Registrar sharded_8(
+    "sharded_increment_8", sharded_increment<8>, bench::THREADED);
+
+static bench::Registrar locked_1(
+    "locked_increment_1", locked_increment<1>, bench::THREADED);
+static bench::Registrar locked_2(
+    "locked_increment_2", locked_increment<2>, bench::THREADED);
+static bench::Registrar locked_4(
+    "locked_increment_4", locked_increment<4>, bench::THREADED);
+static bench::Registrar locked_8(
+    "locked_increment_8", locked_increment<8>, bench::THREADED);
+
+CPYPP_BENCH(concurrent_map_increment_python)
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "IntConcurrentMap",
+        Concurrent_map<std::int64_t>::type().tp_obj());
+    PyDict_SetItemString(globals, "n_keys", Handle(N_KEYS));
+    PyDict_SetItemString(globals, "n_increments", Handle(N_INCREMENTS));
+    bench::run_code(bench::compile(R"(
+import random
+
+random.seed(42)
+keys = [random.randrange(n_keys) for _ in range(n_increments)]
+m = IntConcurrentMap()
+)"),
+        globals);
+
+    Handle code = bench::compile(R"(
+for k in keys:
+    m.increment(k)
+)");
+    run.measure([&]() { bench::run_code(code, globals); }, N_INCREMENTS);
+}
+
+static const long N_PYTHON_INCREMENTS = 20000;
+
+/** Increments counters from the given number of Python threads.
+ *
+ * The counters are in a dictionary guarded by a lock, or in the concurrent
+ * map for the sharded ones.
+ */
+
+template <int N_THREADS, bool IF_SHARDED>
+static void python_threads_increment(bench::Run& run)
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "IntConcurrentMap",
+        Concurrent_map<std::int64_t>::type().tp_obj());
+    PyDict_SetItemString(globals, "n_keys", Handle(N_KEYS));
+    PyDict_SetItemString(globals, "n_increments", Handle(N_PYTHON_INCREMENTS));
+    PyDict_SetItemString(globals, "n_threads", Handle(long(N_THREADS)));
+    PyDict_SetItemString(
+        globals, "if_sharded", Handle(PyBool_FromLong(IF_SHARDED)));
+    bench::run_code(bench::compile(R"(
+import random
+import threading
+
+random.seed(42)
+keys = [random.randrange(n_keys) for _ in range(n_increments)]
+
+def increment_dict(counts, lock):
+    for k in keys:
+        with lock:
+            counts[k] = counts.get(k, 0) + 1
+
+def increment_map(counts):
+    increment = counts.increment
+    for k in keys:
+        increment(k)
+
+def run():
+    if if_sharded:
+        target, args = increment_map, (IntConcurrentMap(),)
+    else:
+        target, args = increment_dict, ({}, threading.Lock())
+    threads = [
+        threading.Thread(target=target, args=args) for _ in range(n_threads)
+    ]
+    for i in threads:
+        i.start()
+    for i in threads:
+        i.join()
+)"),
+        globals);
+
+    Handle code = bench::compile("run()");
+    run.measure([&]() { bench::run_code(code, globals); },
+        N_THREADS * N_PYTHON_INCREMENTS);
+}
+
+static bench::Registrar python_dict_1("python_dict_increment_1",
+    python_threads_increment<1, false>, bench::THREADED);
+static bench::Registrar python_dict_2("python_dict_increment_2",
+    python_threads_increment<2, false>, bench::THREADED);
+static bench::Registrar python_dict_4("python_dict_increment_4",
+    python_threads_increment<4, false>, bench::THREADED);
+static bench::Registrar python_dict_8("python_dict_increment_8",
+    python_threads_increment<8, false>, bench::THREADED);
+
+static bench::Registrar python_map_1("python_map_increment_1",
+    python_threads_increment<1, true>, bench::THREADED);
+static bench::Registrar python_map_2("python_map_increment_2",
+    python_threads_increment<2, true>, bench::THREADED);
+static bench::Registrar python_map_4("python_map_increment_4",
+    python_threads_increment<4, true>, bench::THREADED);
+static bench::Registrar python_map_8("python_map_increment_8",
+    python_threads_increment<8, true>, bench::THREADED);
@@ -0,0 +1,100 @@
+/** Benchmarks for the executor of batched calls.
+ *
+ * Eight native threads call a trivial Python function many times, either each
+ * taking the GIL by `PyGILState_Ensure` for every call, or by submitting the
+ * calls to a batching executor with different sizes of batches.  The timings
+ * are for the wall-clock time divided by the total number of calls.
+ */
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/executor.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const int N_THREADS = 8;
+
+static const long N_CALLS = 2000;
+
+/** Makes the Python function to be called.
+ */
+
+static Handle make_callback()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    bench::run_code(bench::compile(R"(
+def callback(x):
+    return x + 1
+)"),
+        globals);
+    return { PyDict_GetItemString(globals, "callback"), NEW };
+}
+
+/** Runs the action from all the threads, with the GIL released.
+ */
+
+template <typename F> static void run_threads(F&& action)
+{
+    Py_BEGIN_ALLOW_THREADS;
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < N_THREADS; ++i) {
+        threads.emplace_back(action);
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+    Py_END_ALLOW_THREADS;
+}
+
+CPYPP_BENCH_THREADED(gilstate_call)
+{
+    Handle callback = make_callback();
+    run.measure(
+        [&]() {
+            run_threads([&]() {
+                for (long i = 0; i < N_CALLS; ++i) {
+                    PyGILState_STATE state = PyGILState_Ensure();
+                    Handle res(PyObject_CallFunction(callback, "l", i));
+                    PyGILState_Release(state);
+                }
+            });
+        },
+        N_THREADS * N_CALLS);
+}
+
+template <std::size_t MAX_BATCH> static void batched_call(bench::Run& run)
+{
+    Handle callback = make_callback();
+    Batch_executor executor(MAX_BATCH);
+    executor.start();
+    run.measure(
+        [&]() {
+            run_threads([&]() {
+                std::vector<std::future<long>> results{};
+                results.reserve(N_CALLS);
+                for (long i = 0; i < N_CALLS; ++i) {
+                    results.push_back(executor.submit<long>(callback, i));
+                }
+                for (auto& i : results) {
+                    i.get();
+                }
+            });
+        },
+        N_THREADS * N_CALLS);
+    executor.stop();
+}
+
+static bench::Registrar batched_1(
+    "batched_call_1", batched_call<1>, bench::THREADED);
+static bench::Registrar batched_16(
+    "batched_call_16", batched_call<16>, bench::THREADED);
+static bench::Registrar batched_256(
+    "batched_call_256", batched_call<256>, bench::THREADED);
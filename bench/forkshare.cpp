@@ -0,0 +1,155 @@
+/** Benchmarks for the sharing of data with forked workers.
+ *
+ * The parent holds a list of strings and a list of integers, or the same data
+ * in a string column and a frozen buffer.  A forked worker reads all of the
+ * data once, and the growth of its private dirty memory during the reading
+ * is reported as the count `private_kb`, besides the time for the whole
+ * worker from the fork to its exit.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/fork_share.hpp>
+#include <cpypp/str_column.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const long N_ITEMS = 200000;
+
+/** Gets the private dirty memory of the current process in kilobytes.
+ */
+
+static long private_dirty_kb()
+{
+    std::FILE* file = std::fopen("/proc/self/smaps_rollup", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    char line[256];
+    long res = 0;
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        if (std::strncmp(line, "Private_Dirty:", 14) == 0) {
+            res = std::strtol(line + 14, nullptr, 10);
+        }
+    }
+    std::fclose(file);
+    return res;
+}
+
+/** Runs the reading in a forked worker, with its memory growth returned.
+ */
+
+template <typename F> static long run_worker(F&& reader)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    PyOS_BeforeFork();
+    pid_t pid = fork();
+    if (pid == 0) {
+        PyOS_AfterFork_Child();
+        long before = private_dirty_kb();
+        volatile std::int64_t sink = reader();
+        (void)sink;
+        long growth = private_dirty_kb() - before;
+        ssize_t n_written = write(fds[1], &growth, sizeof(growth));
+        _exit(n_written == sizeof(growth) ? 0 : 1);
+    }
+    PyOS_AfterFork_Parent();
+
+    close(fds[1]);
+    long growth = -1;
+    if (pid < 0 || read(fds[0], &growth, sizeof(growth)) != sizeof(growth)) {
+        growth = -1;
+    }
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+    return growth;
+}
+
+/** Makes the data shared in Python objects.
+ */
+
+static Handle make_data()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "n_items", Handle(N_ITEMS));
+    bench::run_code(bench::compile(R"(
+names = ['reference entry number %d' % i for i in range(n_items)]
+ids = [i * 7919 for i in range(n_items)]
+)"),
+        globals);
+    return globals;
+}
+
+CPYPP_BENCH(fork_read_objects)
+{
+    Handle globals = make_data();
+    Handle names(PyDict_GetItemString(globals, "names"), NEW);
+    Handle ids(PyDict_GetItemString(globals, "ids"), NEW);
+    prepare_fork();
+
+    long growth = 0;
+    run.measure([&]() {
+        growth = run_worker([&]() {
+            std::int64_t res = 0;
+            for (Py_ssize_t i = 0; i < N_ITEMS; ++i) {
+                Handle name(PyList_GET_ITEM(names.get(), i), NEW);
+                Handle id(PyList_GET_ITEM(ids.get(), i), NEW);
+                res += PyUnicode_GET_LENGTH(name.get()) + id.as<long>();
+            }
+            return res;
+        });
+    });
+    run.count("private_kb", static_cast<double>(growth));
+    Handle unfrozen(PyRun_String("__import__('gc').unfreeze()",
+        Py_eval_input, PyEval_GetBuiltins(), nullptr));
+}
+
+CPYPP_BENCH(fork_read_native)
+{
+    Handle names;
+    Handle ids;
+    {
+        Handle globals = make_data();
+        names = Handle(PyObject_CallFunctionObjArgs(Str_column::type().tp_obj(),
+            PyDict_GetItemString(globals, "names"), nullptr));
+        Handle id_list(PyDict_GetItemString(globals, "ids"), NEW);
+        auto id_vec = id_list.as<std::vector<long>>();
+        ids = Frozen_buffer::create(id_vec.data(), id_vec.size());
+    }
+    prepare_fork();
+
+    long growth = 0;
+    run.measure([&]() {
+        growth = run_worker([&]() {
+            const Packed_strs& strs = Str_column::strs(names);
+            auto id_arr = static_cast<const long*>(Frozen_buffer::data(ids));
+            std::int64_t res = 0;
+            for (std::size_t i = 0; i < strs.size(); ++i) {
+                res += strs.item(i).second + id_arr[i];
+            }
+            return res;
+        });
+    });
+    run.count("private_kb", static_cast<double>(growth));
+    Handle unfrozen(PyRun_String("__import__('gc').unfreeze()",
+        Py_eval_input, PyEval_GetBuiltins(), nullptr));
+}
@@ -0,0 +1,129 @@
+/** @file stats.hpp
+ *
+ * Statistics for comparing the timings of benchmark runs
+ *
+ * The timings of benchmarks on shared machines are far from normal, with long
+ * tails from interruptions.  So only rank-based statistics are used here: the
+ * median with its distribution-free confidence interval from the order
+ * statistics, and the Mann-Whitney U test for a shift between two runs.
+ */
+
+#ifndef CPYPP_BENCH_STATS_HPP
+#define CPYPP_BENCH_STATS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace bench {
+
+/** Summary of the timings of a benchmark case.
+ */
+
+struct Summary {
+    std::size_t n = 0;
+    double median = 0;
+    double ci_low = 0;
+    double ci_high = 0;
+    double min = 0;
+};
+
+/** Summarizes the timings, with the confidence interval of the median.
+ *
+ * The interval is between the order statistics around the median whose ranks
+ * cover the median with the given two-sided normal quantile, which is 1.96
+ * for the 95% confidence level, by the normal approximation of the binomial
+ * distribution.
+ */
+
+inline Summary summarize(std::vector<double> samples, double z = 1.96)
+{
+    Summary res{};
+    res.n = samples.size();
+    if (samples.empty()) {
+        return res;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::size_t n = samples.size();
+    res.median = n % 2 == 1
+        ? samples[n / 2]
+        : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    res.min = samples.front();
+
+    double half_width = z * std::sqrt(static_cast<double>(n)) / 2;
+    double low = std::floor(n / 2.0 - half_width);
+    double high = std::ceil(n / 2.0 + half_width);
+    res.ci_low = samples[static_cast<std::size_t>(std::max(low, 1.0)) - 1];
+    res.ci_high = samples[static_cast<std::size_t>(
+                              std::min(high, static_cast<double>(n)))
+        - 1];
+    return res;
+}
+
+/** Tests if the first samples tend to be larger than the second ones.
+ *
+ * The one-sided p-value of the Mann-Whitney U test is returned, by the normal
+ * approximation with the correction for ties and continuity, which is good
+ * for the tens of samples taken for the benchmarks.
+ */
+
+inline double mann_whitney_greater(
+    const std::vector<double>& first, const std::vector<double>& second)
+{
+    std::size_t n1 = first.size();
+    std::size_t n2 = second.size();
+    if (n1 == 0 || n2 == 0) {
+        return 1.0;
+    }
+
+    struct Ranked {
+        double value;
+        bool if_first;
+    };
+    std::vector<Ranked> all{};
+    for (double i : first) {
+        all.push_back({ i, true });
+    }
+    for (double i : second) {
+        all.push_back({ i, false });
+    }
+    std::sort(all.begin(), all.end(),
+        [](const Ranked& a, const Ranked& b) { return a.value < b.value; });
+
+    // Ranks from one, with ties given their average rank.
+    double rank_sum = 0;
+    double tie_sum = 0;
+    std::size_t n = all.size();
+    for (std::size_t i = 0; i < n;) {
+        std::size_t j = i;
+        while (j < n && all[j].value == all[i].value) {
+            ++j;
+        }
+        double rank = (i + 1 + j) / 2.0;
+        for (std::size_t k = i; k < j; ++k) {
+            if (all[k].if_first) {
+                rank_sum += rank;
+            }
+        }
+        double t = static_cast<double>(j - i);
+        tie_sum += t * t * t - t;
+        i = j;
+    }
+
+    double u = rank_sum - n1 * (n1 + 1) / 2.0;
+    double mean = n1 * n2 / 2.0;
+    double var = n1 * n2 / 12.0
+        * ((n + 1) - tie_sum / (static_cast<double>(n) * (n - 1)));
+    if (var <= 0) {
+        return 1.0;
+    }
+    double z = (u - mean - 0.5) / std::sqrt(var);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+// End of namespace bench
+}
+
+#endif
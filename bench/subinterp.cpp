@@ -0,0 +1,72 @@
+/** Benchmarks for the pools of sub-interpreters.
+ *
+ * A CPU-bound pure-Python function is called on many items, either serially
+ * in the main interpreter, or mapped over pools of different numbers of
+ * sub-interpreters.  The timings are for the wall-clock time divided by the
+ * number of calls.  The pools only scale with the number of cores from Python
+ * 3.12, where each sub-interpreter has its own GIL.
+ */
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/subinterp_pool.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const char* WORK_CODE = R"(
+def work(n):
+    total = 0
+    for i in range(n):
+        total += i * i % 7
+    return total
+)";
+
+static const long N_CALLS = 64;
+
+static const long WORK_SIZE = 20000;
+
+/** Makes the list of arguments for the calls.
+ */
+
+static Handle make_items()
+{
+    Handle items(PyList_New(0));
+    for (long i = 0; i < N_CALLS; ++i) {
+        PyList_Append(items, Handle("l", WORK_SIZE));
+    }
+    return items;
+}
+
+CPYPP_BENCH(serial_work)
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    bench::run_code(bench::compile(WORK_CODE), globals);
+    Handle work(PyDict_GetItemString(globals, "work"), NEW);
+    Handle items = make_items();
+
+    run.measure(
+        [&]() {
+            for (const auto& i : items) {
+                work.call(i.get());
+            }
+        },
+        N_CALLS);
+}
+
+template <std::size_t N_INTERPS> static void pooled_work(bench::Run& run)
+{
+    Interp_pool pool(N_INTERPS, WORK_CODE);
+    Handle items = make_items();
+    run.measure([&]() { pool.map("__main__:work", items); }, N_CALLS);
+}
+
+static bench::Registrar pooled_1(
+    "subinterp_work_1", pooled_work<1>, bench::THREADED);
+static bench::Registrar pooled_2(
+    "subinterp_work_2", pooled_work<2>, bench::THREADED);
+static bench::Registrar pooled_4(
+    "subinterp_work_4", pooled_work<4>, bench::THREADED);
@@ -0,0 +1,86 @@
+/** Benchmarks for the pools of workers with persistent thread states.
+ *
+ * Native threads take the GIL for many short calls of a trivial Python
+ * function, either by `PyGILState_Ensure` on threads without thread states,
+ * which creates and destroys a thread state for each acquisition, or by
+ * `Gil_acquire` in the workers of a pool reusing their thread states.  The
+ * timings are for the wall-clock time divided by the total number of calls.
+ */
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/worker_pool.hpp>
+
+#include "bench.hpp"
+
+using namespace cpypp;
+
+static const int N_THREADS = 4;
+
+static const long N_CALLS = 2000;
+
+/** Makes the Python function to be called.
+ */
+
+static Handle make_callback()
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    bench::run_code(bench::compile(R"(
+def callback(x):
+    return x + 1
+)"),
+        globals);
+    return { PyDict_GetItemString(globals, "callback"), NEW };
+}
+
+CPYPP_BENCH_THREADED(gilstate_threads)
+{
+    Handle callback = make_callback();
+    run.measure(
+        [&]() {
+            Gil_release released{};
+            std::vector<std::thread> threads{};
+            for (int i = 0; i < N_THREADS; ++i) {
+                threads.emplace_back([&]() {
+                    for (long j = 0; j < N_CALLS; ++j) {
+                        PyGILState_STATE state = PyGILState_Ensure();
+                        Handle res(PyObject_CallFunction(callback, "l", j));
+                        PyGILState_Release(state);
+                    }
+                });
+            }
+            for (auto& i : threads) {
+                i.join();
+            }
+        },
+        N_THREADS * N_CALLS);
+}
+
+CPYPP_BENCH_THREADED(pooled_workers)
+{
+    Handle callback = make_callback();
+    Worker_pool pool(N_THREADS);
+    run.measure(
+        [&]() {
+            std::vector<std::future<void>> results{};
+            for (int i = 0; i < N_THREADS; ++i) {
+                results.push_back(pool.submit([&]() {
+                    for (long j = 0; j < N_CALLS; ++j) {
+                        Gil_acquire acquired{};
+                        Handle res(PyObject_CallFunction(callback, "l", j));
+                    }
+                }));
+            }
+            Gil_release released{};
+            for (auto& i : results) {
+                i.get();
+            }
+        },
+        N_THREADS * N_CALLS);
+}
@@ -2,8 +2,11 @@
  *
  * A simple wrapper of CPython C API for C++
  *
- * This is only header file for the project.  Everything is defined inside the
- * `cpypp` namespace.  It can simply be included in files where it is needed.
+ * This is the main header file for the project.  Everything is defined inside
+ * the `cpypp` namespace.  It can simply be included in files where it is
+ * needed.  Heavier optional facilities built on top of the utilities here, like
+ * native container types exposed to Python, live in separate headers under the
+ * `cpypp` directory, which can be included only when they are used.
  *
  * The both the contents of this file and their tests are roughly sectioned in
  * the same way as the organization of the CPython C API documentation.
@@ -13,11 +16,85 @@
 #define CPYPP_CPYPP_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <Python.h>
 
+//
+// Static probes
+//
+
+/* With `CPYPP_USDT` defined, USDT probes of the provider `cpypp` are placed at
+ * the boundaries between native code and Python, for tools like `perf` or
+ * `bpftrace` to attach to.  Each probe site only costs a `nop` instruction
+ * while no tool is attached, and no runtime library is needed.  The probes
+ * are defined by `sys/sdt.h` when it is available.  Otherwise, for x86-64 ELF
+ * targets, the notes are emitted by inline assembly in the same format.  All
+ * arguments are given as 64-bit integers.  Without `CPYPP_USDT`, or on other
+ * targets, the probes are compiled out.
+ */
+
+#if defined(CPYPP_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CPYPP_PROBE0(name) DTRACE_PROBE(cpypp, name)
+#define CPYPP_PROBE1(name, a1)                                                 \
+    DTRACE_PROBE1(cpypp, name, (long long)(a1))
+#define CPYPP_PROBE2(name, a1, a2)                                             \
+    DTRACE_PROBE2(cpypp, name, (long long)(a1), (long long)(a2))
+#define CPYPP_HAS_PROBES 1
+#elif defined(__x86_64__) && defined(__ELF__)
+#define CPYPP_SDT_NOTE(name, args, ...)                                        \
+    __asm__ __volatile__(                                                      \
+        "990: nop\n"                                                           \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                          \
+        ".balign 4\n"                                                          \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                     \
+        "991: .asciz \"stapsdt\"\n"                                            \
+        "992: .balign 4\n"                                                     \
+        "993: .8byte 990b\n"                                                   \
+        ".8byte _.stapsdt.base\n"                                              \
+        ".8byte 0\n"                                                           \
+        ".asciz \"cpypp\"\n"                                                   \
+        ".asciz \"" #name "\"\n"                                               \
+        ".asciz \"" args "\"\n"                                                \
+        "994: .balign 4\n"                                                     \
+        ".popsection\n"                                                        \
+        ".ifndef _.stapsdt.base\n"                                             \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\","                      \
+        ".stapsdt.base,comdat\n"                                               \
+        ".weak _.stapsdt.base\n"                                               \
+        ".hidden _.stapsdt.base\n"                                             \
+        "_.stapsdt.base: .space 1\n"                                           \
+        ".size _.stapsdt.base, 1\n"                                            \
+        ".popsection\n"                                                        \
+        ".endif\n" ::__VA_ARGS__)
+#define CPYPP_PROBE0(name) CPYPP_SDT_NOTE(name, "")
+#define CPYPP_PROBE1(name, a1)                                                 \
+    CPYPP_SDT_NOTE(name, "-8@%0", "nor"((long long)(a1)))
+#define CPYPP_PROBE2(name, a1, a2)                                             \
+    CPYPP_SDT_NOTE(name, "-8@%0 -8@%1", "nor"((long long)(a1)),              \
+        "nor"((long long)(a2)))
+#define CPYPP_HAS_PROBES 1
+#endif
+#endif
+
+#ifndef CPYPP_HAS_PROBES
+#define CPYPP_PROBE0(name) ((void)0)
+#define CPYPP_PROBE1(name, a1) ((void)0)
+#define CPYPP_PROBE2(name, a1, a2) ((void)0)
+#endif
+
 namespace cpypp {
 
 /** C++ exception signalling that a Python exception has been set.
@@ -55,6 +132,118 @@ inline int check_exc()
     return 0;
 }
 
+/** Runs an action with C++ exceptions translated into Python exceptions.
+ *
+ * This is intended for the top-level C++ functions directly called by the
+ * Python interpreter, like the slots and methods of extension types, where no
+ * C++ exception is allowed to escape.  The result of the given action is
+ * returned when it finishes normally.  When `Exc_set` is thrown, the given
+ * error value is returned with the Python exception left as it is.  For other
+ * C++ exceptions, a Python `MemoryError`, `RuntimeError` or `SystemError` is
+ * set according to their type before the error value is returned.
+ */
+
+template <typename F, typename R = decltype(std::declval<F&>()())>
+R catch_exc(F&& action, typename std::decay<R>::type err) noexcept
+{
+    CPYPP_PROBE0(trampoline__entry);
+    try {
+        return action();
+    } catch (const Exc_set&) {
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& exc) {
+        PyErr_SetString(PyExc_RuntimeError, exc.what());
+    } catch (...) {
+        PyErr_SetString(PyExc_SystemError, "unknown C++ exception");
+    }
+    CPYPP_PROBE0(trampoline__error);
+    return err;
+}
+
+//
+// Tracing hooks
+//
+
+/** Kinds of spans at the boundaries of native code and Python.
+ */
+
+enum class Span_kind { CALL, CONVERT, GIL_WAIT, SCOPE };
+
+/** Tracer of the spans at the boundaries of native code and Python.
+ *
+ * After a tracer is installed, `begin` and `end` are called on the thread of
+ * the span for calls by `Handle::call`, conversions by `Handle::as`, and the
+ * waits for the GIL by the guards.  The object of the span is given to
+ * `begin` when there is one, like the callable or the object converted, which
+ * can only be touched when the GIL is held.  Without any tracer installed, the
+ * cost is a single atomic load at each boundary.
+ *
+ * The installed tracer needs to be kept alive until no boundary can be using
+ * it any more, after it is uninstalled.
+ */
+
+class Span_tracer {
+public:
+    virtual ~Span_tracer() = default;
+
+    virtual void begin(Span_kind kind, PyObject* obj) noexcept = 0;
+
+    virtual void end(Span_kind kind) noexcept = 0;
+
+    /** Gets the installed tracer, or null.
+     */
+
+    static Span_tracer* installed() noexcept
+    {
+        return slot().load(std::memory_order_acquire);
+    }
+
+    /** Installs a tracer, which can be null, with the previous returned.
+     */
+
+    static Span_tracer* install(Span_tracer* tracer) noexcept
+    {
+        return slot().exchange(tracer, std::memory_order_acq_rel);
+    }
+
+private:
+    static std::atomic<Span_tracer*>& slot() noexcept
+    {
+        static std::atomic<Span_tracer*> tracer{ nullptr };
+        return tracer;
+    }
+};
+
+/** Scope of a span at the boundaries, traced by the installed tracer.
+ */
+
+class Boundary_span {
+public:
+    Boundary_span(Span_kind kind, PyObject* obj) noexcept
+        : tracer_{ Span_tracer::installed() }
+        , kind_{ kind }
+    {
+        if (tracer_ != nullptr) {
+            tracer_->begin(kind, obj);
+        }
+    }
+
+    Boundary_span(const Boundary_span&) = delete;
+    Boundary_span& operator=(const Boundary_span&) = delete;
+
+    ~Boundary_span()
+    {
+        if (tracer_ != nullptr) {
+            tracer_->end(kind_);
+        }
+    }
+
+private:
+    Span_tracer* tracer_;
+    Span_kind kind_;
+};
+
 //
 // Forward declaration of some types.
 //
@@ -359,8 +548,11 @@ public:
 
     template <typename T> T as() const
     {
+        CPYPP_PROBE2(convert__entry, ref_, sizeof(T));
+        Boundary_span span(Span_kind::CONVERT, ref_);
         T res;
         as(res);
+        CPYPP_PROBE1(convert__return, ref_);
         return res;
     }
 
@@ -405,6 +597,45 @@ public:
         return;
     }
 
+    // Calls.
+
+    /** Calls the handled object with the given positional arguments.
+     *
+     * Handles and raw object pointers are given to the call as they are, with
+     * the raw pointers only borrowed.  C strings are given as Python strings,
+     * while other native values are converted by the constructors of Handle.
+     * `Exc_set` will be thrown if the call failed.
+     */
+
+    template <typename... Args> Handle call(Args&&... args) const
+    {
+        // The trailing empty handle keeps the array non-empty.
+        Handle handles[] = { call_arg(std::forward<Args>(args))..., Handle() };
+        constexpr std::size_t n_args = sizeof...(Args);
+
+#if PY_VERSION_HEX >= 0x03090000
+        // The leading slot allows the callee to prepend the bound object.
+        PyObject* argv[n_args + 1];
+        for (std::size_t i = 0; i < n_args; ++i) {
+            argv[i + 1] = handles[i].get();
+        }
+        CPYPP_PROBE2(call__entry, ref_, n_args);
+        Boundary_span span(Span_kind::CALL, ref_);
+        PyObject* res = PyObject_Vectorcall(
+            get(), argv + 1, n_args | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
+#else
+        Handle argv(PyTuple_New(n_args));
+        for (std::size_t i = 0; i < n_args; ++i) {
+            PyTuple_SET_ITEM(argv.get(), i, handles[i].get_new());
+        }
+        CPYPP_PROBE2(call__entry, ref_, n_args);
+        Boundary_span span(Span_kind::CALL, ref_);
+        PyObject* res = PyObject_CallObject(get(), argv);
+#endif
+        CPYPP_PROBE2(call__return, ref_, res);
+        return Handle(res);
+    }
+
     // Python object comparisons
     //
     // The C++ comparison operators are all mapped into the corresponding
@@ -581,6 +812,23 @@ public:
         check_exc();
     }
 
+    /** Builds a built-in Python float object.
+     */
+
+    Handle(double v)
+        : Handle(PyFloat_FromDouble(v))
+    {
+    }
+
+    /** Reads a Python float, or any object convertible to it, into a double.
+     */
+
+    void as(double& out) const
+    {
+        out = PyFloat_AsDouble(ref_);
+        check_exc();
+    }
+
     //
     // Sequence objects
     //
@@ -590,6 +838,55 @@ public:
 
     bool check_tuple() const noexcept { return PyTuple_Check(get()); }
 
+    /** Builds a Python str object from UTF-8 encoded contents.
+     */
+
+    Handle(const std::string& v)
+        : Handle(PyUnicode_FromStringAndSize(
+              v.data(), static_cast<Py_ssize_t>(v.size())))
+    {
+    }
+
+    /** Reads a Python str object into its UTF-8 encoded contents.
+     *
+     * Strings with any allocator are accepted, with the storage taken from
+     * the allocator of the given string.
+     */
+
+    template <typename Traits, typename Alloc>
+    void as(std::basic_string<char, Traits, Alloc>& out) const
+    {
+        Py_ssize_t size;
+        const char* content = PyUnicode_AsUTF8AndSize(ref_, &size);
+        if (content == nullptr) {
+            throw Exc_set();
+        }
+        out.assign(content, static_cast<std::size_t>(size));
+    }
+
+    /** Reads a Python sequence into a vector of native values.
+     *
+     * Each item is read by the `as` method for the value type, which can be
+     * vectors again.  The items are constructed by the allocator of the
+     * vector, so that allocators like the polymorphic allocators of the
+     * standard library are passed on to nested containers.
+     */
+
+    template <typename T, typename Alloc>
+    void as(std::vector<T, Alloc>& out) const
+    {
+        Handle items(PySequence_Fast(ref_, "sequence expected"));
+        Py_ssize_t size = PySequence_Fast_GET_SIZE(items.get());
+        PyObject** objs = PySequence_Fast_ITEMS(items.get());
+
+        out.clear();
+        out.reserve(static_cast<std::size_t>(size));
+        for (Py_ssize_t i = 0; i < size; ++i) {
+            out.emplace_back();
+            Handle(objs[i], BORROW).as(out.back());
+        }
+    }
+
     //
     // Container objects
     //
@@ -603,6 +900,22 @@ public:
     //
 
 private:
+    //
+    // Arguments of calls.
+    //
+
+    static Handle call_arg(PyObject* arg) noexcept { return { arg, BORROW }; }
+
+    static Handle call_arg(const char* arg)
+    {
+        return Handle(PyUnicode_FromString(arg));
+    }
+
+    template <typename T> static Handle call_arg(T&& arg)
+    {
+        return Handle(std::forward<T>(arg));
+    }
+
     //
     // Reference counting handling.
     //
@@ -839,6 +1152,187 @@ inline Iter_handle Handle::begin() const
 
 inline Iter_handle Handle::end() const noexcept { return Iter_handle{}; }
 
+//
+// Utilities for buffer protocol
+//
+
+/** Gets the struct-module format of native items of the given kind and size.
+ *
+ * Null is returned when there is no single-character format for them.
+ */
+
+inline const char* native_format(
+    bool if_float, bool if_signed, std::size_t size) noexcept
+{
+    if (if_float) {
+        return size == 4 ? "f" : size == 8 ? "d" : nullptr;
+    }
+    static const char* const signed_codes[] = { "b", "h", "i", "q" };
+    static const char* const unsigned_codes[] = { "B", "H", "I", "Q" };
+    int idx = size == 1 ? 0
+        : size == 2     ? 1
+        : size == 4     ? 2
+        : size == 8     ? 3
+                        : -1;
+    if (idx < 0) {
+        return nullptr;
+    }
+    return if_signed ? signed_codes[idx] : unsigned_codes[idx];
+}
+
+/** Gets the struct-module format of a native arithmetic type.
+ */
+
+template <typename T> const char* native_format() noexcept
+{
+    static_assert(std::is_arithmetic<T>::value, "Arithmetic type expected");
+    return native_format(std::is_floating_point<T>::value,
+        std::is_signed<T>::value, sizeof(T));
+}
+
+/** Views into the memory of objects supporting the buffer protocol.
+ *
+ * The buffer is requested from the exporter on construction and released on
+ * destruction, in the same spirit as the handles for Python objects.  Objects
+ * of this class can be moved but not copied.
+ *
+ * Native code can get typed access to the memory by `as_array`, which checks
+ * the item format and size against the requested native type.  This is
+ * primarily intended for the bulk operations taking arrays from Python code,
+ * for instance from `array.array`, `memoryview` or NumPy arrays.
+ */
+
+class Buffer {
+public:
+    /** Requests a buffer from the given object.
+     *
+     * By default a C-contiguous buffer with format information is requested.
+     * `PyBUF_WRITABLE` can be added to the flags for buffers to be written.
+     * `Exc_set` is thrown when the object cannot give such a buffer.
+     */
+
+    Buffer(PyObject* obj, int flags = PyBUF_FORMAT | PyBUF_C_CONTIGUOUS)
+    {
+        if (PyObject_GetBuffer(obj, &view_, flags) != 0) {
+            throw Exc_set{};
+        }
+        if_acquired_ = true;
+    }
+
+    /** Constructs a buffer by taking over another one.
+     */
+
+    Buffer(Buffer&& other) noexcept
+        : view_(other.view_)
+        , if_acquired_{ other.if_acquired_ }
+    {
+        other.if_acquired_ = false;
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    /** Releases the buffer to its exporter.
+     */
+
+    ~Buffer()
+    {
+        if (if_acquired_) {
+            PyBuffer_Release(&view_);
+        }
+    }
+
+    /** Gets the raw pointer to the memory.
+     */
+
+    void* data() const noexcept { return view_.buf; }
+
+    /** Gets the total number of bytes in the buffer.
+     */
+
+    Py_ssize_t nbytes() const noexcept { return view_.len; }
+
+    /** Gets the number of items in the buffer.
+     */
+
+    Py_ssize_t size() const noexcept
+    {
+        return view_.itemsize > 0 ? view_.len / view_.itemsize : 0;
+    }
+
+    /** If the buffer is read-only.
+     */
+
+    bool readonly() const noexcept { return view_.readonly != 0; }
+
+    /** Gets the underlying CPython buffer structure.
+     */
+
+    const Py_buffer& view() const noexcept { return view_; }
+
+    /** Tests if the items in the buffer can be taken as the given type.
+     *
+     * The struct-module format of the buffer has to be a single native item
+     * of the same kind (signed, unsigned or floating-point) and size as the
+     * given arithmetic type.  Buffers without format are taken to be unsigned
+     * bytes.
+     */
+
+    template <typename T> bool holds() const noexcept
+    {
+        static_assert(std::is_arithmetic<T>::value, "Arithmetic type expected");
+
+        const char* fmt = view_.format == nullptr ? "B" : view_.format;
+#if PY_LITTLE_ENDIAN
+        const char native_order = '<';
+#else
+        const char native_order = '>';
+#endif
+        if (*fmt == '@' || *fmt == '=' || *fmt == native_order) {
+            ++fmt;
+        }
+        if (fmt[0] == '\0' || fmt[1] != '\0'
+            || view_.itemsize != (Py_ssize_t)sizeof(T)) {
+            return false;
+        }
+
+        const char* codes = std::is_floating_point<T>::value
+            ? "efd"
+            : std::is_signed<T>::value ? "bhilqn" : "BHILQNc?";
+        return std::strchr(codes, fmt[0]) != nullptr;
+    }
+
+    /** Gets the memory as an array of the given type.
+     *
+     * A Python `TypeError` is set and `Exc_set` thrown when the buffer does
+     * not hold items of the requested type.
+     */
+
+    template <typename T> T* as_array() const
+    {
+        if (!holds<T>()) {
+            PyErr_Format(PyExc_TypeError,
+                "buffer of format '%s' and item size %zd is not compatible "
+                "with the native type of size %zu",
+                view_.format == nullptr ? "B" : view_.format, view_.itemsize,
+                sizeof(T));
+            throw Exc_set{};
+        }
+        return static_cast<T*>(view_.buf);
+    }
+
+private:
+    /** The CPython buffer structure.
+     */
+
+    Py_buffer view_;
+
+    /** If the buffer needs to be released.
+     */
+
+    bool if_acquired_ = false;
+};
+
 //
 // Utilities for fundamental objects
 //
@@ -875,6 +1369,24 @@ public:
     {
     }
 
+    /** Constructs a type object with the given name and basic size.
+     *
+     * All the other slots are left empty, to be filled by the action given to
+     * `make_ready`.  This is more convenient than spelling out the full
+     * initializer list for types with only a few slots set.
+     */
+
+    Static_type(const char* name, Py_ssize_t basicsize)
+        : tp_{}
+    {
+        // Only the header is from the initializer of the interpreter, with
+        // all the slots value-initialized.
+        PyVarObject head[] = { PyVarObject_HEAD_INIT(nullptr, 0) };
+        tp_.ob_base = head[0];
+        tp_.tp_name = name;
+        tp_.tp_basicsize = basicsize;
+    }
+
     /** Constructs an empty object.
      *
      * The result will be considered to be not ready by default.
@@ -1083,6 +1595,434 @@ public:
     }
 };
 
+//
+// Utilities for thread states and the GIL
+//
+
+/** The thread state bound to the current thread.
+ *
+ * Native threads living long, like the workers in thread pools, can create a
+ * thread state once and bind it here, so that `Gil_acquire` reuses it rather
+ * than creating a new thread state for each acquisition of the GIL.  The depth
+ * counts the nested `Gil_acquire` guards holding the GIL by the bound state.
+ */
+
+struct Thread_binding {
+    PyThreadState* tstate = nullptr;
+    int depth = 0;
+
+    /** When the GIL was last taken by a guard, while a `Gil_observer` is
+     * installed, or zero.
+     */
+
+    std::int64_t held_since = 0;
+
+    /** Gets the binding for the current thread.
+     */
+
+    static Thread_binding& current() noexcept
+    {
+        static thread_local Thread_binding binding{};
+        return binding;
+    }
+};
+
+/** Tests if the current thread holds the GIL.
+ *
+ * Different from `PyGILState_Check`, this also works for the thread states
+ * bound in `Thread_binding`, like those of sub-interpreters.  Before Python
+ * 3.12, the current thread state is global rather than for each thread.  So it
+ * is compared with the thread states known for the current thread, which
+ * misses other thread states created by the thread on its own.
+ */
+
+inline bool holds_gil() noexcept
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    return PyThreadState_GetUnchecked() != nullptr;
+#elif PY_VERSION_HEX >= 0x030C0000
+    return _PyThreadState_UncheckedGet() != nullptr;
+#else
+    PyThreadState* curr = _PyThreadState_UncheckedGet();
+    return curr != nullptr
+        && (curr == Thread_binding::current().tstate
+            || curr == PyGILState_GetThisThreadState());
+#endif
+}
+
+/** Observer of the GIL taken and released by the guards.
+ *
+ * After an observer is installed, `acquired` is called on the thread of a
+ * guard right after the guard takes the GIL, with the time in nanoseconds
+ * spent waiting for it.  `released` is called right before a guard releases
+ * the GIL, with the time it has been held since it was taken by a guard.
+ * Without any observer installed, the guards make no timing at all.
+ *
+ * The installed observer needs to be kept alive until no guard can be using
+ * it any more, after it is uninstalled.
+ */
+
+class Gil_observer {
+public:
+    virtual ~Gil_observer() = default;
+
+    virtual void acquired(std::int64_t wait_ns) noexcept = 0;
+
+    virtual void released(std::int64_t hold_ns) noexcept = 0;
+
+    /** Gets the installed observer, or null.
+     */
+
+    static Gil_observer* installed() noexcept
+    {
+        return slot().load(std::memory_order_acquire);
+    }
+
+    /** Installs an observer, which can be null, with the previous returned.
+     */
+
+    static Gil_observer* install(Gil_observer* observer) noexcept
+    {
+        return slot().exchange(observer, std::memory_order_acq_rel);
+    }
+
+    /** Gets the current time in nanoseconds on the monotonic clock.
+     */
+
+    static std::int64_t now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Reporting by the guards, which also fires the static probes and the
+    // spans of waiting for the GIL.
+
+    /** Reports the GIL taken by the current thread since the given time.
+     */
+
+    static void notify_acquired(std::int64_t since) noexcept
+    {
+        CPYPP_PROBE0(gil__acquired);
+        Span_tracer* tracer = Span_tracer::installed();
+        if (tracer != nullptr) {
+            tracer->end(Span_kind::GIL_WAIT);
+        }
+        Gil_observer* observer = installed();
+        if (observer == nullptr) {
+            return;
+        }
+        std::int64_t curr = now();
+        Thread_binding::current().held_since = curr;
+        observer->acquired(since != 0 ? curr - since : 0);
+    }
+
+    /** Reports the GIL to be released by the current thread.
+     */
+
+    static void notify_released() noexcept
+    {
+        CPYPP_PROBE0(gil__release);
+        std::int64_t& held_since = Thread_binding::current().held_since;
+        Gil_observer* observer = installed();
+        if (observer != nullptr && held_since != 0) {
+            observer->released(now() - held_since);
+        }
+        held_since = 0;
+    }
+
+    /** Gets the time to start waiting for the GIL, zero without observers.
+     */
+
+    static std::int64_t start_wait() noexcept
+    {
+        CPYPP_PROBE0(gil__acquire);
+        Span_tracer* tracer = Span_tracer::installed();
+        if (tracer != nullptr) {
+            tracer->begin(Span_kind::GIL_WAIT, nullptr);
+        }
+        return installed() != nullptr ? now() : 0;
+    }
+
+private:
+    static std::atomic<Gil_observer*>& slot() noexcept
+    {
+        static std::atomic<Gil_observer*> observer{ nullptr };
+        return observer;
+    }
+};
+
+/** Guard holding the GIL during its lifetime.
+ *
+ * The thread state bound to the current thread in `Thread_binding` is used
+ * when there is one, which also works for sub-interpreters.  Otherwise, the
+ * GIL is taken by `PyGILState_Ensure`, which creates a new thread state for
+ * threads not created by Python.  The guards can be nested.
+ */
+
+class Gil_acquire {
+public:
+    Gil_acquire()
+        : binding_{ Thread_binding::current() }
+    {
+        if (binding_.tstate == nullptr) {
+            if_taken_ = !holds_gil();
+            std::int64_t since = if_taken_ ? Gil_observer::start_wait() : 0;
+            state_ = PyGILState_Ensure();
+            if (if_taken_) {
+                Gil_observer::notify_acquired(since);
+            }
+        } else if (binding_.depth++ == 0) {
+            if_taken_ = true;
+            std::int64_t since = Gil_observer::start_wait();
+            PyEval_RestoreThread(binding_.tstate);
+            Gil_observer::notify_acquired(since);
+        }
+    }
+
+    Gil_acquire(const Gil_acquire&) = delete;
+    Gil_acquire& operator=(const Gil_acquire&) = delete;
+
+    ~Gil_acquire()
+    {
+        if (if_taken_) {
+            Gil_observer::notify_released();
+        }
+        if (binding_.tstate == nullptr) {
+            PyGILState_Release(state_);
+        } else if (--binding_.depth == 0) {
+            PyEval_SaveThread();
+        }
+    }
+
+private:
+    Thread_binding& binding_;
+    PyGILState_STATE state_;
+    bool if_taken_ = false;
+};
+
+/** Guard releasing the GIL during its lifetime.
+ *
+ * This is the guard version of `Py_BEGIN_ALLOW_THREADS` and
+ * `Py_END_ALLOW_THREADS`, with the GIL taken again when it is destructed.
+ * `Gil_acquire` guards can be nested inside.
+ */
+
+class Gil_release {
+public:
+    Gil_release()
+        : depth_{ Thread_binding::current().depth }
+        , tstate_{ save() }
+    {
+        Thread_binding::current().depth = 0;
+    }
+
+    Gil_release(const Gil_release&) = delete;
+    Gil_release& operator=(const Gil_release&) = delete;
+
+    ~Gil_release()
+    {
+        std::int64_t since = Gil_observer::start_wait();
+        PyEval_RestoreThread(tstate_);
+        Gil_observer::notify_acquired(since);
+        Thread_binding::current().depth = depth_;
+    }
+
+private:
+    static PyThreadState* save() noexcept
+    {
+        Gil_observer::notify_released();
+        return PyEval_SaveThread();
+    }
+
+    int depth_;
+    PyThreadState* tstate_;
+};
+
+/** Python exception captured for transport across threads.
+ *
+ * The current Python exception lives in the thread state, and `Exc_set`
+ * carries no information about it.  So an exception raised on one thread is
+ * lost when it is not handled there.  The exception can be captured here as an
+ * object instead, which can be moved or copied to other threads, for instance
+ * inside `std::exception_ptr`, and set as the current exception there again.
+ *
+ * The GIL is taken by `Gil_acquire` when needed, so the captured exceptions
+ * can be created and destructed on any thread.
+ */
+
+class Captured_exc {
+public:
+    /** Captures the current Python exception, which is cleared.
+     *
+     * A `SystemError` is captured when there is no current exception, like
+     * when it is lost with the thread state holding it.
+     */
+
+    static Captured_exc capture()
+    {
+        Captured_exc res{};
+        with_gil([&]() { res.exc_ = fetch(); });
+        return res;
+    }
+
+    Captured_exc(const Captured_exc& other) noexcept
+        : exc_{ other.exc_ }
+    {
+        if (exc_ != nullptr) {
+            with_gil([&]() { Py_INCREF(exc_); });
+        }
+    }
+
+    Captured_exc(Captured_exc&& other) noexcept
+        : exc_{ other.exc_ }
+    {
+        other.exc_ = nullptr;
+    }
+
+    Captured_exc& operator=(Captured_exc other) noexcept
+    {
+        std::swap(exc_, other.exc_);
+        return *this;
+    }
+
+    ~Captured_exc()
+    {
+        if (exc_ != nullptr) {
+            with_gil([&]() { Py_DECREF(exc_); });
+        }
+    }
+
+    /** Gets the captured exception object as a borrowed reference.
+     */
+
+    PyObject* get() const noexcept { return exc_; }
+
+    /** Sets the captured exception as the current exception.
+     *
+     * The GIL needs to be held.  The captured exception is kept, so that it
+     * can be restored again.
+     */
+
+    void restore() const noexcept
+    {
+        if (exc_ == nullptr) {
+            return;
+        }
+        Py_INCREF(exc_);
+#if PY_VERSION_HEX >= 0x030C0000
+        PyErr_SetRaisedException(exc_);
+#else
+        PyObject* type = reinterpret_cast<PyObject*>(Py_TYPE(exc_));
+        Py_INCREF(type);
+        PyErr_Restore(type, exc_, PyException_GetTraceback(exc_));
+#endif
+    }
+
+    /** Restores the captured exception and throws `Exc_set`.
+     */
+
+    [[noreturn]] void rethrow() const
+    {
+        restore();
+        throw Exc_set{};
+    }
+
+private:
+    Captured_exc() noexcept = default;
+
+    template <typename F> static void with_gil(F&& action) noexcept
+    {
+        if (holds_gil()) {
+            action();
+        } else {
+            Gil_acquire acquired{};
+            action();
+        }
+    }
+
+    /** Fetches the current exception as a normalized exception object.
+     */
+
+    static PyObject* fetch() noexcept
+    {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_SystemError, "no Python exception is set");
+        }
+#if PY_VERSION_HEX >= 0x030C0000
+        return PyErr_GetRaisedException();
+#else
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        PyErr_NormalizeException(&type, &value, &traceback);
+        if (traceback != nullptr) {
+            PyException_SetTraceback(value, traceback);
+            Py_DECREF(traceback);
+        }
+        Py_XDECREF(type);
+        return value;
+#endif
+    }
+
+    PyObject* exc_ = nullptr;
+};
+
+//
+// Utilities for profiling
+//
+
+/** Enables the perf trampoline of the interpreter before initialization.
+ *
+ * For embedding applications, this sets the configuration for the
+ * interpreter to call Python functions through small trampolines known to
+ * `perf`, so that Python frames show up with their names in the native stacks
+ * recorded by `perf record`, mixed with the C++ frames.  False is returned
+ * when it is not supported, before Python 3.12 or on platforms other than
+ * Linux.
+ */
+
+inline bool enable_perf_profiling(PyConfig& config) noexcept
+{
+#if PY_VERSION_HEX >= 0x030C0000 && defined(__linux__)
+    config.perf_profiling = 1;
+    return true;
+#else
+    (void)config;
+    return false;
+#endif
+}
+
+/** Activates the perf trampoline of the running interpreter.
+ *
+ * This is the runtime version of `enable_perf_profiling`, by
+ * `sys.activate_stack_trampoline`, with the GIL held.  False is returned when
+ * the trampoline is not supported, without any Python exception set.
+ */
+
+inline bool enable_perf_trampoline()
+{
+    Handle sys(PyImport_ImportModule("sys"));
+    if (!PyObject_HasAttrString(sys, "activate_stack_trampoline")) {
+        return false;
+    }
+    Handle res(
+        PyObject_CallMethod(sys, "activate_stack_trampoline", "s", "perf"));
+    return true;
+}
+
+/** Deactivates the perf trampoline of the running interpreter, if any.
+ */
+
+inline void disable_perf_trampoline()
+{
+    Handle sys(PyImport_ImportModule("sys"));
+    if (PyObject_HasAttrString(sys, "deactivate_stack_trampoline")) {
+        Handle res(
+            PyObject_CallMethod(sys, "deactivate_stack_trampoline", nullptr));
+    }
+}
+
 // End of namespace cpypp
 }
 
@@ -0,0 +1,148 @@
+/** @file arena.hpp
+ *
+ * Memory resources for the native containers from conversions
+ *
+ * Converting the arguments of a request into native strings and vectors
+ * takes many small allocations from the global allocator, which are all freed
+ * again when the request is done.  Since `Handle::as` fills strings and
+ * vectors with any allocators, the conversions can take their storage from
+ * the polymorphic memory resources of C++17 instead.  The arena here keeps a
+ * monotonic buffer for each request, which is released in one shot.
+ *
+ * Unlike the rest of cpypp, this header requires C++17.
+ */
+
+#ifndef CPYPP_ARENA_HPP
+#define CPYPP_ARENA_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Reads a Python object into a native container from a memory resource.
+ *
+ * The container is constructed with the allocator for the resource, so it
+ * needs to be one of the `std::pmr` containers, like `std::pmr::string` or
+ * `std::pmr::vector<std::pmr::string>`.
+ */
+
+template <typename T>
+T as_in(const Handle& handle, std::pmr::memory_resource* res)
+{
+    T out{ typename T::allocator_type(res) };
+    handle.as(out);
+    return out;
+}
+
+/** Memory resource counting the allocations passed on to another resource.
+ */
+
+class Counting_resource : public std::pmr::memory_resource {
+public:
+    explicit Counting_resource(
+        std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : upstream_{ upstream }
+    {
+    }
+
+    /** Gets the number of allocations made.
+     */
+
+    std::size_t n_allocs() const noexcept { return n_allocs_; }
+
+    /** Gets the number of bytes allocated in total.
+     */
+
+    std::size_t n_bytes() const noexcept { return n_bytes_; }
+
+    /** Resets the counts to zero.
+     */
+
+    void reset() noexcept
+    {
+        n_allocs_ = 0;
+        n_bytes_ = 0;
+    }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void* res = upstream_->allocate(bytes, alignment);
+        ++n_allocs_;
+        n_bytes_ += bytes;
+        return res;
+    }
+
+    void do_deallocate(
+        void* ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        upstream_->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const
+        noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    std::size_t n_allocs_ = 0;
+    std::size_t n_bytes_ = 0;
+};
+
+/** Arena for the scratch space of a request.
+ *
+ * Allocations are served from a monotonic buffer, which starts in the arena
+ * itself and grows geometrically from the upstream resource.  Deallocations
+ * are no-ops, and all the memory is released at once by `release` or the
+ * destruction of the arena.  The arena is not thread-safe, so it is meant to
+ * be local to a request on a single thread.
+ */
+
+template <std::size_t Inline_size = 4096> class Request_arena {
+public:
+    explicit Request_arena(
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : buffer_(inline_, Inline_size, upstream)
+    {
+    }
+
+    Request_arena(const Request_arena&) = delete;
+    Request_arena& operator=(const Request_arena&) = delete;
+
+    /** Gets the memory resource for the containers to allocate from.
+     */
+
+    std::pmr::memory_resource* resource() noexcept { return &buffer_; }
+
+    /** Reads a Python object into a container allocated from the arena.
+     */
+
+    template <typename T> T as(const Handle& handle)
+    {
+        return as_in<T>(handle, resource());
+    }
+
+    /** Releases all the memory allocated from the arena.
+     *
+     * Containers allocated from the arena must not be used afterward.
+     */
+
+    void release() noexcept { buffer_.release(); }
+
+private:
+    alignas(std::max_align_t) unsigned char inline_[Inline_size];
+    std::pmr::monotonic_buffer_resource buffer_;
+};
+
+// End of namespace cpypp
+}
+
+#endif
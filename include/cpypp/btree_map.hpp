@@ -0,0 +1,1218 @@
+/** @file btree_map.hpp
+ *
+ * Ordered maps with native keys for range queries
+ *
+ * Sorted Python lists maintained by `bisect` need linear time for each
+ * insertion.  The B+ tree here keeps native keys in nodes spanning a few cache
+ * lines, which gives logarithmic insertion and deletion and cache-friendly
+ * in-order scans along the linked leaves.
+ *
+ * The tree itself is available to C++ code as `Btree`, while `Btree_map`
+ * exposes it to Python as static types implementing the mapping protocol, with
+ * lazy iterators over key ranges.
+ */
+
+#ifndef CPYPP_BTREE_MAP_HPP
+#define CPYPP_BTREE_MAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** B+ tree from ordered native keys to values.
+ *
+ * The entries are stored in the leaves, which are linked in key order, while
+ * the inner nodes only hold the separating keys.  The keys of each node take
+ * about `node_bytes` bytes, four cache lines by default, so that a node can be
+ * searched with a few cache misses.  For 64-bit keys this gives 32 keys per
+ * node, and a tree of a hundred million entries is only six levels deep.
+ *
+ * Removal does not merge nodes that become sparse.  Only nodes becoming empty
+ * are released.  This keeps removal simple and fast, at the cost of some
+ * memory for workloads removing most of the entries in scattered places.
+ *
+ * Pointers to values and cursors are invalidated by any insertion or removal.
+ */
+
+template <typename K, typename V, std::size_t node_bytes = 256> class Btree {
+public:
+    /** The maximum number of keys in a node.
+     */
+
+    static constexpr std::size_t fanout
+        = node_bytes / sizeof(K) < 4 ? 4 : node_bytes / sizeof(K);
+
+private:
+    struct Node {
+        bool if_leaf;
+        std::size_t n;
+        K keys[fanout + 1];
+    };
+
+    struct Leaf : Node {
+        V values[fanout + 1];
+        Leaf* prev;
+        Leaf* next;
+    };
+
+    struct Inner : Node {
+        Node* children[fanout + 2];
+    };
+
+public:
+    /** Positions of entries in the tree.
+     *
+     * Cursors are ordered by the keys of the entries.  The past-the-end cursor
+     * is not valid.
+     */
+
+    class Cursor {
+    public:
+        Cursor() noexcept = default;
+
+        bool valid() const noexcept { return leaf_ != nullptr; }
+
+        const K& key() const noexcept { return leaf_->keys[idx_]; }
+
+        V& value() const noexcept { return leaf_->values[idx_]; }
+
+        /** Moves to the next entry.
+         */
+
+        void advance() noexcept
+        {
+            ++idx_;
+            normalize();
+        }
+
+    private:
+        friend class Btree;
+
+        Cursor(Leaf* leaf, std::size_t idx) noexcept
+            : leaf_{ leaf }
+            , idx_{ idx }
+        {
+            normalize();
+        }
+
+        void normalize() noexcept
+        {
+            if (leaf_ != nullptr && idx_ >= leaf_->n) {
+                leaf_ = leaf_->next;
+                idx_ = 0;
+            }
+        }
+
+        Leaf* leaf_ = nullptr;
+        std::size_t idx_ = 0;
+    };
+
+    Btree() noexcept = default;
+
+    Btree(const Btree&) = delete;
+    Btree& operator=(const Btree&) = delete;
+
+    /** Constructs a tree by taking over the entries of another one.
+     *
+     * The other tree is left empty.
+     */
+
+    Btree(Btree&& other) noexcept { swap(other); }
+
+    Btree& operator=(Btree&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~Btree() { clear(); }
+
+    void swap(Btree& other) noexcept
+    {
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+        std::swap(n_leaves_, other.n_leaves_);
+        std::swap(n_inners_, other.n_inners_);
+    }
+
+    /** Gets the number of entries.
+     */
+
+    std::size_t size() const noexcept { return size_; }
+
+    /** Gets the number of bytes taken by the nodes.
+     */
+
+    std::size_t memory_usage() const noexcept
+    {
+        return n_leaves_ * sizeof(Leaf) + n_inners_ * sizeof(Inner);
+    }
+
+    /** Finds the value for a key, or a null pointer when it is absent.
+     */
+
+    V* find(const K& key) const noexcept
+    {
+        Cursor pos = lower_bound(key);
+        if (pos.valid() && !(key < pos.key())) {
+            return &pos.value();
+        }
+        return nullptr;
+    }
+
+    /** Finds the value for a key, inserting a default one when absent.
+     *
+     * The pointer to the value is returned along with if it is newly
+     * inserted.
+     */
+
+    std::pair<V*, bool> emplace(const K& key)
+    {
+        if (root_ == nullptr) {
+            root_ = new_leaf();
+        }
+
+        V* slot = nullptr;
+        Split split{ K{}, nullptr };
+        bool inserted = insert(root_, key, slot, split);
+
+        if (split.right != nullptr) {
+            Inner* root = new_inner();
+            root->n = 1;
+            root->keys[0] = std::move(split.key);
+            root->children[0] = root_;
+            root->children[1] = split.right;
+            root_ = root;
+        }
+
+        if (inserted) {
+            ++size_;
+        }
+        return { slot, inserted };
+    }
+
+    /** Removes a key with its value moved out.
+     *
+     * False is returned when the key is not present.
+     */
+
+    bool take(const K& key, V& out)
+    {
+        if (root_ == nullptr) {
+            return false;
+        }
+
+        bool if_empty = false;
+        if (!remove(root_, key, out, if_empty)) {
+            return false;
+        }
+        --size_;
+
+        if (if_empty) {
+            free_node(root_);
+            root_ = nullptr;
+        }
+        while (root_ != nullptr && !root_->if_leaf && root_->n == 0) {
+            Inner* old = static_cast<Inner*>(root_);
+            root_ = old->children[0];
+            delete old;
+            --n_inners_;
+        }
+        return true;
+    }
+
+    /** Removes all the entries.
+     */
+
+    void clear() noexcept
+    {
+        if (root_ != nullptr) {
+            free_tree(root_);
+        }
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    /** Fills an empty tree with entries sorted by strictly increasing keys.
+     *
+     * Any existing entries are removed first.  The values are moved from the
+     * given array.  The leaves are filled completely, which is the best for
+     * trees mostly read afterwards.
+     */
+
+    void load_sorted(const K* keys, V* values, std::size_t n)
+    {
+        clear();
+        if (n == 0) {
+            return;
+        }
+
+        std::vector<Node*> level;
+        std::vector<K> mins;
+        Leaf* prev = nullptr;
+        for (std::size_t i = 0; i < n; i += fanout) {
+            Leaf* leaf = new_leaf();
+            leaf->n = std::min(fanout, n - i);
+            std::copy(keys + i, keys + i + leaf->n, leaf->keys);
+            std::move(values + i, values + i + leaf->n, leaf->values);
+            leaf->prev = prev;
+            if (prev != nullptr) {
+                prev->next = leaf;
+            }
+            prev = leaf;
+
+            level.push_back(leaf);
+            mins.push_back(keys[i]);
+        }
+        size_ = n;
+
+        while (level.size() > 1) {
+            std::vector<Node*> parents;
+            std::vector<K> parent_mins;
+            for (std::size_t i = 0; i < level.size(); i += fanout + 1) {
+                Inner* inner = new_inner();
+                std::size_t n_children
+                    = std::min(fanout + 1, level.size() - i);
+                inner->n = n_children - 1;
+                for (std::size_t j = 0; j < n_children; ++j) {
+                    inner->children[j] = level[i + j];
+                    if (j > 0) {
+                        inner->keys[j - 1] = std::move(mins[i + j]);
+                    }
+                }
+
+                parents.push_back(inner);
+                parent_mins.push_back(std::move(mins[i]));
+            }
+            level.swap(parents);
+            mins.swap(parent_mins);
+        }
+        root_ = level.front();
+    }
+
+    //
+    // Cursors
+    //
+
+    /** Gets the cursor to the first entry.
+     */
+
+    Cursor begin() const noexcept
+    {
+        Node* node = root_;
+        if (node == nullptr) {
+            return {};
+        }
+        while (!node->if_leaf) {
+            node = static_cast<Inner*>(node)->children[0];
+        }
+        return { static_cast<Leaf*>(node), 0 };
+    }
+
+    /** Gets the cursor to the first entry with key not less than the given.
+     */
+
+    Cursor lower_bound(const K& key) const noexcept
+    {
+        Leaf* leaf = find_leaf(key);
+        if (leaf == nullptr) {
+            return {};
+        }
+        auto pos = std::lower_bound(leaf->keys, leaf->keys + leaf->n, key);
+        return { leaf, static_cast<std::size_t>(pos - leaf->keys) };
+    }
+
+    /** Gets the cursor to the first entry with key greater than the given.
+     */
+
+    Cursor upper_bound(const K& key) const noexcept
+    {
+        Leaf* leaf = find_leaf(key);
+        if (leaf == nullptr) {
+            return {};
+        }
+        auto pos = std::upper_bound(leaf->keys, leaf->keys + leaf->n, key);
+        return { leaf, static_cast<std::size_t>(pos - leaf->keys) };
+    }
+
+private:
+    /** Information about the splitting of a node.
+     *
+     * The new node on the right, when any, is to be inserted into the parent
+     * with the given separating key.
+     */
+
+    struct Split {
+        K key;
+        Node* right;
+    };
+
+    Leaf* new_leaf()
+    {
+        Leaf* leaf = new Leaf();
+        leaf->if_leaf = true;
+        leaf->n = 0;
+        leaf->prev = nullptr;
+        leaf->next = nullptr;
+        ++n_leaves_;
+        return leaf;
+    }
+
+    Inner* new_inner()
+    {
+        Inner* inner = new Inner();
+        inner->if_leaf = false;
+        inner->n = 0;
+        ++n_inners_;
+        return inner;
+    }
+
+    /** Releases a single node, with leaves unlinked from their neighbours.
+     */
+
+    void free_node(Node* node) noexcept
+    {
+        if (node->if_leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            if (leaf->prev != nullptr) {
+                leaf->prev->next = leaf->next;
+            }
+            if (leaf->next != nullptr) {
+                leaf->next->prev = leaf->prev;
+            }
+            delete leaf;
+            --n_leaves_;
+        } else {
+            delete static_cast<Inner*>(node);
+            --n_inners_;
+        }
+    }
+
+    void free_tree(Node* node) noexcept
+    {
+        if (!node->if_leaf) {
+            Inner* inner = static_cast<Inner*>(node);
+            for (std::size_t i = 0; i <= inner->n; ++i) {
+                free_tree(inner->children[i]);
+            }
+            delete inner;
+            --n_inners_;
+        } else {
+            delete static_cast<Leaf*>(node);
+            --n_leaves_;
+        }
+    }
+
+    /** Gets the leaf where the given key should be.
+     *
+     * A key equal to a separator is always in the subtree on the right.
+     */
+
+    Leaf* find_leaf(const K& key) const noexcept
+    {
+        Node* node = root_;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        while (!node->if_leaf) {
+            Inner* inner = static_cast<Inner*>(node);
+            Node** child = inner->children
+                + (std::upper_bound(inner->keys, inner->keys + inner->n, key)
+                    - inner->keys);
+            node = *child;
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    bool insert(Node* node, const K& key, V*& slot, Split& split)
+    {
+        if (node->if_leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            std::size_t n = leaf->n;
+            std::size_t pos = std::lower_bound(leaf->keys, leaf->keys + n, key)
+                - leaf->keys;
+            if (pos < n && !(key < leaf->keys[pos])) {
+                slot = &leaf->values[pos];
+                return false;
+            }
+
+            std::move_backward(
+                leaf->keys + pos, leaf->keys + n, leaf->keys + n + 1);
+            std::move_backward(
+                leaf->values + pos, leaf->values + n, leaf->values + n + 1);
+            leaf->keys[pos] = key;
+            leaf->values[pos] = V{};
+            ++leaf->n;
+            slot = &leaf->values[pos];
+
+            if (leaf->n > fanout) {
+                split_leaf(leaf, pos, slot, split);
+            }
+            return true;
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        std::size_t n = inner->n;
+        std::size_t idx
+            = std::upper_bound(inner->keys, inner->keys + n, key) - inner->keys;
+
+        Split child_split{ K{}, nullptr };
+        bool inserted = insert(inner->children[idx], key, slot, child_split);
+        if (child_split.right != nullptr) {
+            std::move_backward(
+                inner->keys + idx, inner->keys + n, inner->keys + n + 1);
+            std::move_backward(inner->children + idx + 1,
+                inner->children + n + 1, inner->children + n + 2);
+            inner->keys[idx] = std::move(child_split.key);
+            inner->children[idx + 1] = child_split.right;
+            ++inner->n;
+
+            if (inner->n > fanout) {
+                split_inner(inner, split);
+            }
+        }
+        return inserted;
+    }
+
+    void split_leaf(Leaf* leaf, std::size_t pos, V*& slot, Split& split)
+    {
+        Leaf* right = new_leaf();
+        std::size_t half = leaf->n / 2;
+        right->n = leaf->n - half;
+        std::move(leaf->keys + half, leaf->keys + leaf->n, right->keys);
+        std::move(leaf->values + half, leaf->values + leaf->n, right->values);
+        leaf->n = half;
+
+        right->next = leaf->next;
+        if (right->next != nullptr) {
+            right->next->prev = right;
+        }
+        right->prev = leaf;
+        leaf->next = right;
+
+        if (pos >= half) {
+            slot = &right->values[pos - half];
+        }
+        split.key = right->keys[0];
+        split.right = right;
+    }
+
+    void split_inner(Inner* inner, Split& split)
+    {
+        Inner* right = new_inner();
+        std::size_t n = inner->n;
+        std::size_t mid = n / 2;
+        right->n = n - mid - 1;
+        std::move(inner->keys + mid + 1, inner->keys + n, right->keys);
+        std::copy(inner->children + mid + 1, inner->children + n + 1,
+            right->children);
+        inner->n = mid;
+
+        split.key = std::move(inner->keys[mid]);
+        split.right = right;
+    }
+
+    /** Removes a key from the subtree.
+     *
+     * The flag is set when the subtree becomes empty.  It is the
+     * responsibility of the caller to release the node in that case.
+     */
+
+    bool remove(Node* node, const K& key, V& out, bool& if_empty)
+    {
+        if (node->if_leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            std::size_t n = leaf->n;
+            std::size_t pos = std::lower_bound(leaf->keys, leaf->keys + n, key)
+                - leaf->keys;
+            if (pos == n || key < leaf->keys[pos]) {
+                return false;
+            }
+
+            out = std::move(leaf->values[pos]);
+            std::move(leaf->keys + pos + 1, leaf->keys + n, leaf->keys + pos);
+            std::move(
+                leaf->values + pos + 1, leaf->values + n, leaf->values + pos);
+            leaf->values[n - 1] = V{};
+            --leaf->n;
+            if_empty = leaf->n == 0;
+            return true;
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        std::size_t n = inner->n;
+        std::size_t idx
+            = std::upper_bound(inner->keys, inner->keys + n, key) - inner->keys;
+
+        bool if_child_empty = false;
+        if (!remove(inner->children[idx], key, out, if_child_empty)) {
+            return false;
+        }
+        if (!if_child_empty) {
+            return true;
+        }
+
+        free_node(inner->children[idx]);
+        if (n == 0) {
+            if_empty = true;
+            return true;
+        }
+
+        // The separator on the left of the child is removed, unless it is the
+        // first child.
+        std::size_t key_idx = idx > 0 ? idx - 1 : 0;
+        std::move(inner->keys + key_idx + 1, inner->keys + n,
+            inner->keys + key_idx);
+        std::copy(inner->children + idx + 1, inner->children + n + 1,
+            inner->children + idx);
+        --inner->n;
+        return true;
+    }
+
+    Node* root_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t n_leaves_ = 0;
+    std::size_t n_inners_ = 0;
+};
+
+template <typename K, typename V, std::size_t node_bytes>
+constexpr std::size_t Btree<K, V, node_bytes>::fanout;
+
+/** Conversion of the keys of B-tree maps from and to Python objects.
+ *
+ * The static types for the maps are also named here.
+ */
+
+template <typename K> struct Btree_key;
+
+template <> struct Btree_key<std::int64_t> {
+    static const char* name() noexcept { return "cpypp.IntBtreeMap"; }
+
+    static std::int64_t from_py(PyObject* obj)
+    {
+        long long res = PyLong_AsLongLong(obj);
+        if (res == -1) {
+            check_exc();
+        }
+        return res;
+    }
+
+    static Handle to_py(std::int64_t v) { return { PyLong_FromLongLong(v) }; }
+};
+
+template <> struct Btree_key<double> {
+    static const char* name() noexcept { return "cpypp.FloatBtreeMap"; }
+
+    static double from_py(PyObject* obj)
+    {
+        double res = PyFloat_AsDouble(obj);
+        if (res == -1.0) {
+            check_exc();
+        }
+        if (std::isnan(res)) {
+            PyErr_SetString(PyExc_ValueError, "NaN cannot be used as key");
+            throw Exc_set{};
+        }
+        return res;
+    }
+
+    static Handle to_py(double v) { return { PyFloat_FromDouble(v) }; }
+};
+
+template <> struct Btree_key<std::string> {
+    static const char* name() noexcept { return "cpypp.BytesBtreeMap"; }
+
+    static std::string from_py(PyObject* obj)
+    {
+        Buffer buf(obj, PyBUF_SIMPLE);
+        return { static_cast<const char*>(buf.data()),
+            static_cast<std::size_t>(buf.nbytes()) };
+    }
+
+    static Handle to_py(const std::string& v)
+    {
+        return { PyBytes_FromStringAndSize(
+            v.data(), static_cast<Py_ssize_t>(v.size())) };
+    }
+};
+
+/** Python ordered mapping types backed by B+ trees.
+ *
+ * The key type can be `std::int64_t`, `double` or `std::string`, giving the
+ * Python types `IntBtreeMap`, `FloatBtreeMap` and `BytesBtreeMap` with keys
+ * of Python integers, floats and bytes-like objects respectively.  The values
+ * can be arbitrary Python objects.  Iteration is always in the order of the
+ * keys.  Besides the usual mapping protocol and the dictionary methods `get`,
+ * `pop`, `keys`, `values`, `items` and `clear`, the types have
+ *
+ * - `irange(lo=None, hi=None, inclusive=(True, True))` giving a lazy iterator
+ *   over the keys within the given bounds, where a bound of `None` is
+ *   unbounded.  `irange_items` takes the same arguments for the key-value
+ *   pairs.
+ *
+ * - `load_sorted(keys, values)` filling an empty map from keys in strictly
+ *   increasing order and an iterable of values.  The keys can be given as an
+ *   iterable, or as a buffer of the native type for integer and float keys.
+ *
+ * Any insertion or removal of keys invalidates the existing iterators, which
+ * then raise `RuntimeError` on the next step.
+ */
+
+template <typename K> class Btree_map {
+public:
+    using Tree = Btree<K, Handle>;
+    using Conv = Btree_key<K>;
+
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Tree tree;
+
+        /** Version of the key set, bumped on insertion and removal.
+         */
+
+        std::size_t version;
+    };
+
+    /** Gets the static type of the maps.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp(Conv::name(), sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_contains = contains;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+            map_methods.mp_ass_subscript = ass_subscript;
+
+            static PyMethodDef methods[] = {
+                { "get", (PyCFunction)py_get, METH_VARARGS,
+                    "Gets the value for a key, or the default." },
+                { "pop", (PyCFunction)py_pop, METH_VARARGS,
+                    "Removes a key and returns its value." },
+                { "keys", (PyCFunction)py_keys, METH_NOARGS,
+                    "Iterates over the keys in order." },
+                { "values", (PyCFunction)py_values, METH_NOARGS,
+                    "Iterates over the values in the order of the keys." },
+                { "items", (PyCFunction)py_items, METH_NOARGS,
+                    "Iterates over the key-value pairs in order." },
+                { "clear", (PyCFunction)py_clear, METH_NOARGS,
+                    "Removes all the entries." },
+                { "irange", (PyCFunction)(void (*)(void))py_irange,
+                    METH_VARARGS | METH_KEYWORDS,
+                    "Iterates over the keys within the bounds." },
+                { "irange_items", (PyCFunction)(void (*)(void))py_irange_items,
+                    METH_VARARGS | METH_KEYWORDS,
+                    "Iterates over the key-value pairs within the bounds." },
+                { "load_sorted", (PyCFunction)py_load_sorted, METH_VARARGS,
+                    "Fills an empty map from sorted keys and values." },
+                { "__sizeof__", (PyCFunction)py_sizeof, METH_NOARGS,
+                    "Gets the size of the map in bytes." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+            tp->tp_doc = "Ordered map from native keys to objects.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_traverse = traverse;
+            tp->tp_clear = clear;
+            tp->tp_repr = repr;
+            tp->tp_iter = iter;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new empty map.
+     */
+
+    static Handle create()
+    {
+        return { PyObject_CallObject(type().tp_obj(), nullptr) };
+    }
+
+    /** Tests if the given object is a map of this kind.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the native tree inside a map.
+     *
+     * The given object must be a map of this kind.  Any insertion or removal
+     * of keys through the tree needs to be followed by `touch`.
+     */
+
+    static Tree& tree(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->tree;
+    }
+
+    /** Invalidates the iterators over a map after changes to its keys.
+     */
+
+    static void touch(PyObject* obj) noexcept
+    {
+        ++reinterpret_cast<Obj*>(obj)->version;
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { nullptr };
+        if (!PyArg_ParseTupleAndKeywords(
+                args, kwds, "", const_cast<char**>(kwlist))) {
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        new (&obj(self)->tree) Tree();
+        obj(self)->version = 0;
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        PyObject_GC_UnTrack(self);
+        tree(self).~Tree();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static int traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        for (auto i = tree(self).begin(); i.valid(); i.advance()) {
+            Py_VISIT(i.value().get());
+        }
+        return 0;
+    }
+
+    static int clear(PyObject* self)
+    {
+        // The values are released only after the map is already empty, in
+        // case their finalizers come back to the map.
+        Tree removed;
+        removed.swap(tree(self));
+        touch(self);
+        return 0;
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object with %zu entries>",
+            Py_TYPE(self)->tp_name, tree(self).size());
+    }
+
+    //
+    // Mapping protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(tree(self).size());
+    }
+
+    static int contains(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() {
+                return tree(self).find(Conv::from_py(key)) != nullptr ? 1 : 0;
+            },
+            -1);
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                const Handle* v = tree(self).find(Conv::from_py(key));
+                if (v == nullptr) {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    return nullptr;
+                }
+                return v->get_new();
+            },
+            nullptr);
+    }
+
+    static int ass_subscript(PyObject* self, PyObject* key, PyObject* value)
+    {
+        return catch_exc(
+            [&]() {
+                K k = Conv::from_py(key);
+                if (value == nullptr) {
+                    Handle removed;
+                    if (!tree(self).take(k, removed)) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return -1;
+                    }
+                    touch(self);
+                    return 0;
+                }
+
+                auto res = tree(self).emplace(k);
+                *res.first = Handle(value, NEW);
+                if (res.second) {
+                    touch(self);
+                }
+                return 0;
+            },
+            -1);
+    }
+
+    //
+    // Dictionary methods
+    //
+
+    static PyObject* py_get(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* dflt = Py_None;
+        if (!PyArg_ParseTuple(args, "O|O:get", &key, &dflt)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                const Handle* v = tree(self).find(Conv::from_py(key));
+                PyObject* res = v != nullptr ? v->get() : dflt;
+                Py_INCREF(res);
+                return res;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_pop(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* dflt = nullptr;
+        if (!PyArg_ParseTuple(args, "O|O:pop", &key, &dflt)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Handle v;
+                if (!tree(self).take(Conv::from_py(key), v)) {
+                    if (dflt == nullptr) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return nullptr;
+                    }
+                    Py_INCREF(dflt);
+                    return dflt;
+                }
+                touch(self);
+                return v.release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_clear(PyObject* self, PyObject*)
+    {
+        clear(self);
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_sizeof(PyObject* self, PyObject*)
+    {
+        return PyLong_FromSize_t(sizeof(Obj) + tree(self).memory_usage());
+    }
+
+    static PyObject* py_load_sorted(PyObject* self, PyObject* args)
+    {
+        PyObject* keys;
+        PyObject* values;
+        if (!PyArg_ParseTuple(args, "OO:load_sorted", &keys, &values)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                if (tree(self).size() != 0) {
+                    PyErr_SetString(PyExc_ValueError, "map is not empty");
+                    return nullptr;
+                }
+
+                std::vector<K> key_vec = read_keys(keys);
+                for (std::size_t i = 1; i < key_vec.size(); ++i) {
+                    if (!(key_vec[i - 1] < key_vec[i])) {
+                        PyErr_SetString(PyExc_ValueError,
+                            "keys are not strictly increasing");
+                        return nullptr;
+                    }
+                }
+
+                std::vector<Handle> value_vec;
+                value_vec.reserve(key_vec.size());
+                for (const auto& i : Handle(values, BORROW)) {
+                    value_vec.push_back(i);
+                }
+                if (value_vec.size() != key_vec.size()) {
+                    PyErr_SetString(PyExc_ValueError,
+                        "keys and values of different lengths");
+                    return nullptr;
+                }
+
+                tree(self).load_sorted(
+                    key_vec.data(), value_vec.data(), key_vec.size());
+                touch(self);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    template <typename T = K>
+    static typename std::enable_if<std::is_arithmetic<T>::value,
+        std::vector<K>>::type
+    read_keys(PyObject* keys)
+    {
+        if (!PyObject_CheckBuffer(keys)) {
+            return read_key_objs(keys);
+        }
+
+        Buffer buf(keys);
+        const K* arr = buf.as_array<K>();
+        std::vector<K> res(arr, arr + buf.size());
+        for (auto i : res) {
+            if (i != i) {
+                PyErr_SetString(PyExc_ValueError, "NaN cannot be used as key");
+                throw Exc_set{};
+            }
+        }
+        return res;
+    }
+
+    template <typename T = K>
+    static typename std::enable_if<!std::is_arithmetic<T>::value,
+        std::vector<K>>::type
+    read_keys(PyObject* keys)
+    {
+        return read_key_objs(keys);
+    }
+
+    static std::vector<K> read_key_objs(PyObject* keys)
+    {
+        std::vector<K> res;
+        for (const auto& i : Handle(keys, BORROW)) {
+            res.push_back(Conv::from_py(i));
+        }
+        return res;
+    }
+
+    //
+    // Iteration
+    //
+
+    enum Iter_kind { KEYS, VALUES, ITEMS };
+
+    /** The layout of the iterators over the maps.
+     *
+     * The upper bound is only used when `if_hi` is set.
+     */
+
+    struct Iter_obj {
+        PyObject_HEAD
+
+        PyObject* map;
+        typename Tree::Cursor pos;
+        std::size_t version;
+        Iter_kind kind;
+        bool if_hi;
+        bool hi_inclusive;
+        K hi;
+    };
+
+    static Static_type& iter_type()
+    {
+        static Static_type tp("cpypp.BtreeMapIterator", sizeof(Iter_obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+            tp->tp_dealloc = iter_dealloc;
+            tp->tp_traverse = iter_traverse;
+            tp->tp_iter = PyObject_SelfIter;
+            tp->tp_iternext = iter_next;
+        });
+
+        return tp;
+    }
+
+    static Iter_obj* new_iter(PyObject* self, Iter_kind kind)
+    {
+        auto it = PyObject_GC_New(Iter_obj, iter_type().tp());
+        if (it == nullptr) {
+            throw Exc_set{};
+        }
+        new (&it->pos) typename Tree::Cursor(tree(self).begin());
+        new (&it->hi) K();
+        Py_INCREF(self);
+        it->map = self;
+        it->version = obj(self)->version;
+        it->kind = kind;
+        it->if_hi = false;
+        it->hi_inclusive = false;
+        PyObject_GC_Track(it);
+        return it;
+    }
+
+    static PyObject* make_iter(PyObject* self, Iter_kind kind)
+    {
+        return catch_exc(
+            [&]() { return reinterpret_cast<PyObject*>(new_iter(self, kind)); },
+            nullptr);
+    }
+
+    static PyObject* iter(PyObject* self) { return make_iter(self, KEYS); }
+
+    static PyObject* py_keys(PyObject* self, PyObject*)
+    {
+        return make_iter(self, KEYS);
+    }
+
+    static PyObject* py_values(PyObject* self, PyObject*)
+    {
+        return make_iter(self, VALUES);
+    }
+
+    static PyObject* py_items(PyObject* self, PyObject*)
+    {
+        return make_iter(self, ITEMS);
+    }
+
+    static PyObject* py_irange(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        return irange(self, args, kwds, KEYS);
+    }
+
+    static PyObject* py_irange_items(
+        PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        return irange(self, args, kwds, ITEMS);
+    }
+
+    static PyObject* irange(
+        PyObject* self, PyObject* args, PyObject* kwds, Iter_kind kind)
+    {
+        static const char* kwlist[] = { "lo", "hi", "inclusive", nullptr };
+        PyObject* lo = Py_None;
+        PyObject* hi = Py_None;
+        int lo_inclusive = 1;
+        int hi_inclusive = 1;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO(pp):irange",
+                const_cast<char**>(kwlist), &lo, &hi, &lo_inclusive,
+                &hi_inclusive)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                Iter_obj* it = new_iter(self, kind);
+                Handle res(reinterpret_cast<PyObject*>(it));
+
+                if (lo != Py_None) {
+                    K lo_key = Conv::from_py(lo);
+                    it->pos = lo_inclusive ? tree(self).lower_bound(lo_key)
+                                           : tree(self).upper_bound(lo_key);
+                }
+                if (hi != Py_None) {
+                    it->hi = Conv::from_py(hi);
+                    it->if_hi = true;
+                    it->hi_inclusive = hi_inclusive != 0;
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+
+    static void iter_dealloc(PyObject* self)
+    {
+        PyObject_GC_UnTrack(self);
+        auto it = reinterpret_cast<Iter_obj*>(self);
+        Py_DECREF(it->map);
+        it->hi.~K();
+        PyObject_GC_Del(self);
+    }
+
+    static int iter_traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        Py_VISIT(reinterpret_cast<Iter_obj*>(self)->map);
+        return 0;
+    }
+
+    static PyObject* iter_next(PyObject* self)
+    {
+        auto it = reinterpret_cast<Iter_obj*>(self);
+        if (obj(it->map)->version != it->version) {
+            PyErr_SetString(
+                PyExc_RuntimeError, "map changed size during iteration");
+            return nullptr;
+        }
+
+        auto& pos = it->pos;
+        if (!pos.valid()) {
+            return nullptr;
+        }
+        if (it->if_hi
+            && (it->hi_inclusive ? it->hi < pos.key()
+                                 : !(pos.key() < it->hi))) {
+            pos = typename Tree::Cursor();
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                auto curr = pos;
+                pos.advance();
+                switch (it->kind) {
+                case KEYS:
+                    return Conv::to_py(curr.key()).release();
+                case VALUES:
+                    return curr.value().get_new();
+                default: {
+                    Handle key = Conv::to_py(curr.key());
+                    return PyTuple_Pack(2, key.get(), curr.value().get());
+                }
+                }
+            },
+            nullptr);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,706 @@
+/** @file callable.hpp
+ *
+ * Python callables wrapping C++ callables
+ *
+ * C++ callbacks, like the keys for sorting or the handlers of events, are
+ * often to be given to Python code as callables.  `make_callable` boxes any
+ * C++ callable with a fixed signature, like lambdas, function objects and
+ * function pointers, into a Python object called by the vectorcall protocol.
+ * The callable is stored inline in the object, so that no other allocation is
+ * needed, and the arguments and the result are converted by `Handle::as` and
+ * the constructors of `Handle`.
+ */
+
+#ifndef CPYPP_CALLABLE_HPP
+#define CPYPP_CALLABLE_HPP
+
+#include <cstddef>
+#include <initializer_list>
+#include <new>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Traits giving the signatures of C++ callables.
+ *
+ * Callables with overloaded or templated call operators, like generic
+ * lambdas, have no single signature and are not supported.
+ */
+
+template <typename F>
+struct Callable_traits : Callable_traits<decltype(&F::operator())> {
+};
+
+template <typename R, typename... Args> struct Callable_traits<R (*)(Args...)> {
+    using Result = R;
+    using Arg_types = std::tuple<typename std::decay<Args>::type...>;
+    static constexpr std::size_t n_args = sizeof...(Args);
+};
+
+template <typename R, typename... Args>
+struct Callable_traits<R (&)(Args...)> : Callable_traits<R (*)(Args...)> {
+};
+
+template <typename R, typename... Args>
+struct Callable_traits<R(Args...)> : Callable_traits<R (*)(Args...)> {
+};
+
+template <typename C, typename R, typename... Args>
+struct Callable_traits<R (C::*)(Args...)> : Callable_traits<R (*)(Args...)> {
+};
+
+template <typename C, typename R, typename... Args>
+struct Callable_traits<R (C::*)(Args...) const>
+    : Callable_traits<R (*)(Args...)> {
+};
+
+/** Levels of the matches of Python arguments to C++ parameters.
+ *
+ * They only depend on the types of the arguments, so that the overloads
+ * chosen can be cached by the types.
+ */
+
+enum Arg_match : int { NO_MATCH = 0, CONVERTIBLE = 1, EXACT = 2 };
+
+/** View of the contents of Python bytes objects given as arguments.
+ *
+ * The contents are borrowed from the argument, which is only valid during the
+ * call.
+ */
+
+struct Bytes_view {
+    const char* data;
+    std::size_t size;
+};
+
+/** Conversion of the arguments of the callables from Python.
+ *
+ * Arguments taken as handles or raw pointers are given the objects borrowed
+ * from the caller, and booleans are given by the truth of the objects.
+ * Integers are read as `long` or `unsigned long` before being narrowed, with
+ * `OverflowError` raised for values out of the range of the parameters, while
+ * other types are read by `Handle::as`.  The `match` functions give how well
+ * the arguments match the parameters, for choosing among overloads.
+ */
+
+template <typename T, typename = void> struct Callable_arg {
+    static T get(PyObject* arg) { return Handle(arg, BORROW).as<T>(); }
+
+    static Arg_match match(PyObject*) noexcept { return CONVERTIBLE; }
+};
+
+template <typename T>
+struct Callable_arg<T,
+    typename std::enable_if<std::is_integral<T>::value
+        && !std::is_same<T, bool>::value>::type> {
+    using Read = typename std::conditional<std::is_signed<T>::value, long,
+        unsigned long>::type;
+
+    static T get(PyObject* arg)
+    {
+        Read value = Handle(arg, BORROW).as<Read>();
+        auto res = static_cast<T>(value);
+        if (static_cast<Read>(res) != value) {
+            PyErr_SetString(
+                PyExc_OverflowError, "int out of range of the parameter");
+            throw Exc_set{};
+        }
+        return res;
+    }
+
+    static Arg_match match(PyObject* arg) noexcept
+    {
+        if (PyLong_CheckExact(arg)) {
+            return EXACT;
+        }
+        return PyIndex_Check(arg) ? CONVERTIBLE : NO_MATCH;
+    }
+};
+
+template <> struct Callable_arg<double> {
+    static double get(PyObject* arg)
+    {
+        return Handle(arg, BORROW).as<double>();
+    }
+
+    static Arg_match match(PyObject* arg) noexcept
+    {
+        if (PyFloat_CheckExact(arg)) {
+            return EXACT;
+        }
+        PyNumberMethods* methods = Py_TYPE(arg)->tp_as_number;
+        bool if_number = methods != nullptr
+            && (methods->nb_float != nullptr || methods->nb_index != nullptr);
+        return if_number ? CONVERTIBLE : NO_MATCH;
+    }
+};
+
+template <> struct Callable_arg<bool> {
+    static bool get(PyObject* arg)
+    {
+        int res = PyObject_IsTrue(arg);
+        if (res < 0) {
+            throw Exc_set{};
+        }
+        return res != 0;
+    }
+
+    static Arg_match match(PyObject* arg) noexcept
+    {
+        return PyBool_Check(arg) ? EXACT : CONVERTIBLE;
+    }
+};
+
+template <> struct Callable_arg<std::string> {
+    static std::string get(PyObject* arg)
+    {
+        return Handle(arg, BORROW).as<std::string>();
+    }
+
+    static Arg_match match(PyObject* arg) noexcept
+    {
+        return PyUnicode_Check(arg) ? EXACT : NO_MATCH;
+    }
+};
+
+template <> struct Callable_arg<Bytes_view> {
+    static Bytes_view get(PyObject* arg)
+    {
+        char* data;
+        Py_ssize_t size;
+        if (PyBytes_AsStringAndSize(arg, &data, &size) < 0) {
+            throw Exc_set{};
+        }
+        return { data, static_cast<std::size_t>(size) };
+    }
+
+    static Arg_match match(PyObject* arg) noexcept
+    {
+        return PyBytes_Check(arg) ? EXACT : NO_MATCH;
+    }
+};
+
+template <> struct Callable_arg<Handle> {
+    static Handle get(PyObject* arg) { return { arg, BORROW }; }
+
+    static Arg_match match(PyObject*) noexcept { return CONVERTIBLE; }
+};
+
+template <> struct Callable_arg<PyObject*> {
+    static PyObject* get(PyObject* arg) noexcept { return arg; }
+
+    static Arg_match match(PyObject*) noexcept { return CONVERTIBLE; }
+};
+
+/** Conversion of the results of the callables into new references.
+ *
+ * Raw pointers returned are taken to be new references, `void` gives `None`,
+ * and booleans give the Python booleans.  Integers are converted as `long` or
+ * `unsigned long`, while other types are converted by the constructors of
+ * `Handle`.
+ */
+
+template <typename R, typename = void> struct Callable_result {
+    template <typename F> static PyObject* get(F&& action)
+    {
+        return Handle(action()).release();
+    }
+};
+
+template <typename R>
+struct Callable_result<R,
+    typename std::enable_if<std::is_integral<R>::value
+        && !std::is_same<R, bool>::value>::type> {
+    using Write = typename std::conditional<std::is_signed<R>::value, long,
+        unsigned long>::type;
+
+    template <typename F> static PyObject* get(F&& action)
+    {
+        return Handle(static_cast<Write>(action())).release();
+    }
+};
+
+template <> struct Callable_result<bool> {
+    template <typename F> static PyObject* get(F&& action)
+    {
+        return PyBool_FromLong(action());
+    }
+};
+
+template <> struct Callable_result<Handle> {
+    template <typename F> static PyObject* get(F&& action)
+    {
+        Handle res = action();
+        return res.get_new();
+    }
+};
+
+template <> struct Callable_result<PyObject*> {
+    template <typename F> static PyObject* get(F&& action)
+    {
+        return action();
+    }
+};
+
+template <> struct Callable_result<void> {
+    template <typename F> static PyObject* get(F&& action)
+    {
+        action();
+        Py_RETURN_NONE;
+    }
+};
+
+/** Calls a C++ callable with the given Python arguments.
+ *
+ * The number of the arguments is assumed to be correct.  The result is
+ * returned as a new reference.
+ */
+
+template <typename F, std::size_t... Is>
+PyObject* call_converted(
+    F& func, PyObject* const* args, std::index_sequence<Is...>)
+{
+    using Traits = Callable_traits<F>;
+    using Args = typename Traits::Arg_types;
+    return Callable_result<typename Traits::Result>::get(
+        [&]() -> decltype(auto) {
+            return func(
+                Callable_arg<typename std::tuple_element<Is, Args>::type>::get(
+                    args[Is])...);
+        });
+}
+
+template <typename F>
+PyObject* call_converted(F& func, PyObject* const* args)
+{
+    return call_converted(func, args,
+        std::make_index_sequence<Callable_traits<F>::n_args>{});
+}
+
+/** Header of the Python objects for C++ callables.
+ *
+ * The header is kept in a separate standard-layout structure, for the offset
+ * of the vectorcall pointer, which is only set after the C++ callables are
+ * constructed, with the memory zeroed by `tp_alloc` before.
+ */
+
+struct Callable_head {
+    PyObject_HEAD
+    vectorcallfunc vectorcall;
+};
+
+/** Python type for C++ callables of a given type.
+ *
+ * Each type of C++ callables gets its own static type, all named
+ * `cpypp.Callable`.  The callable is destructed with the object, which needs
+ * the callable to be safe to destruct with the GIL held.  Captured handles
+ * are not reported to the garbage collector, so cycles through them are
+ * never collected.
+ */
+
+template <typename F> class Callable {
+public:
+    using Traits = Callable_traits<F>;
+
+    /** Layout of the Python objects, with the callable stored inline.
+     */
+
+    struct Obj {
+        Callable_head head;
+        F func;
+    };
+
+    /** Gets the static type for the callables.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.Callable", sizeof(Obj));
+        tp.make_ready([](PyTypeObject* tp) {
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_VECTORCALL;
+            tp->tp_doc = "Python callable wrapping a C++ callable.";
+            tp->tp_dealloc = dealloc;
+            tp->tp_vectorcall_offset = offsetof(Callable_head, vectorcall);
+            tp->tp_call = PyVectorcall_Call;
+        });
+        return tp;
+    }
+
+    /** Creates a Python callable from the given C++ callable.
+     */
+
+    template <typename G> static Handle create(G&& func)
+    {
+        PyTypeObject* tp = type().tp();
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            throw Exc_set{};
+        }
+        Handle res(self);
+
+        Obj* obj = reinterpret_cast<Obj*>(self);
+        new (&obj->func) F(std::forward<G>(func));
+        obj->head.vectorcall = vectorcall;
+        return res;
+    }
+
+    /** Checks if an object is a callable of the current type.
+     */
+
+    static bool check(PyObject* obj) noexcept
+    {
+        return Py_TYPE(obj) == type().tp();
+    }
+
+    /** Gets the C++ callable in a Python callable of the current type.
+     */
+
+    static F& func(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self)->func;
+    }
+
+private:
+    static bool constructed(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self)->head.vectorcall != nullptr;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        if (constructed(self)) {
+            func(self).~F();
+        }
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* vectorcall(PyObject* self, PyObject* const* args,
+        std::size_t nargsf, PyObject* kwnames)
+    {
+        Py_ssize_t n_args = PyVectorcall_NARGS(nargsf);
+        auto n_expected = static_cast<Py_ssize_t>(Traits::n_args);
+        if (kwnames != nullptr && PyTuple_GET_SIZE(kwnames) > 0) {
+            PyErr_SetString(
+                PyExc_TypeError, "C++ callable takes no keyword arguments");
+            return nullptr;
+        }
+        if (n_args != n_expected) {
+            PyErr_Format(PyExc_TypeError,
+                "C++ callable takes %zd positional arguments but %zd were "
+                "given",
+                n_expected, n_args);
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() { return call_converted(func(self), args); }, nullptr);
+    }
+};
+
+/** Makes a Python callable from the given C++ callable.
+ */
+
+template <typename F> Handle make_callable(F&& func)
+{
+    using Func = typename std::decay<F>::type;
+    return Callable<Func>::create(std::forward<F>(func));
+}
+
+/** Gets the maximum of the given values, at compile time.
+ */
+
+constexpr std::size_t max_of(std::initializer_list<std::size_t> values)
+{
+    std::size_t res = 0;
+    for (std::size_t i : values) {
+        res = i > res ? i : res;
+    }
+    return res;
+}
+
+/** Python type for sets of overloaded C++ callables.
+ *
+ * Calls are dispatched to the overload matching the arguments best, by the
+ * sum of the levels of the matches of the arguments, with ties resolved in
+ * favour of the overloads given first.  Since the matches only depend on the
+ * exact types of the arguments, the overloads chosen are memoized for the
+ * tuples of the types in a tiny inline cache of the object, so that repeated
+ * calls with the same types skip the resolution entirely.  The types in the
+ * cache are kept alive by the object.
+ */
+
+template <typename... Fs> class Overloaded {
+public:
+    static constexpr std::size_t MAX_ARGS
+        = max_of({ Callable_traits<Fs>::n_args..., 1 });
+
+    static constexpr std::size_t CACHE_SIZE = 4;
+
+    /** Entries of the cache of the overloads chosen.
+     *
+     * Entries never filled have a negative number of arguments.
+     */
+
+    struct Cache_entry {
+        Py_ssize_t n_args;
+        PyTypeObject* types[MAX_ARGS];
+        std::size_t overload;
+    };
+
+    /** Layout of the Python objects, with the callables stored inline.
+     */
+
+    struct Obj {
+        Callable_head head;
+        std::tuple<Fs...> funcs;
+        Cache_entry cache[CACHE_SIZE];
+        std::size_t next_entry;
+        std::size_t n_resolved;
+    };
+
+    /** Gets the static type for the overload sets.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.Overloaded", sizeof(Obj));
+        tp.make_ready([](PyTypeObject* tp) {
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_VECTORCALL;
+            tp->tp_doc = "Python callable dispatching to C++ overloads.";
+            tp->tp_dealloc = dealloc;
+            tp->tp_vectorcall_offset = offsetof(Callable_head, vectorcall);
+            tp->tp_call = PyVectorcall_Call;
+        });
+        return tp;
+    }
+
+    /** Creates a Python callable from the given C++ callables.
+     */
+
+    template <typename... Gs> static Handle create(Gs&&... funcs)
+    {
+        PyTypeObject* tp = type().tp();
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            throw Exc_set{};
+        }
+        Handle res(self);
+
+        Obj* obj = reinterpret_cast<Obj*>(self);
+        new (&obj->funcs) std::tuple<Fs...>(std::forward<Gs>(funcs)...);
+        for (auto& i : obj->cache) {
+            i.n_args = -1;
+        }
+        obj->head.vectorcall = vectorcall;
+        return res;
+    }
+
+    /** Checks if an object is an overload set of the current type.
+     */
+
+    static bool check(PyObject* obj) noexcept
+    {
+        return Py_TYPE(obj) == type().tp();
+    }
+
+    /** Gets the number of times the overloads are resolved for calls.
+     *
+     * Calls served by the cache are not counted.
+     */
+
+    static std::size_t n_resolved(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self)->n_resolved;
+    }
+
+private:
+    static void dealloc(PyObject* self)
+    {
+        Obj* obj = reinterpret_cast<Obj*>(self);
+        if (obj->head.vectorcall != nullptr) {
+            obj->funcs.~tuple();
+            for (auto& i : obj->cache) {
+                clear(i);
+            }
+        }
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static void clear(Cache_entry& entry) noexcept
+    {
+        for (Py_ssize_t i = 0; i < entry.n_args; ++i) {
+            Py_DECREF(entry.types[i]);
+        }
+        entry.n_args = -1;
+    }
+
+    //
+    // Resolution of the overloads.
+    //
+
+    template <typename F, std::size_t... Is>
+    static int score(PyObject* const* args, Py_ssize_t n_args,
+        std::index_sequence<Is...>) noexcept
+    {
+        using Args = typename Callable_traits<F>::Arg_types;
+        if (n_args != static_cast<Py_ssize_t>(sizeof...(Is))) {
+            return -1;
+        }
+        // The trailing level keeps the array non-empty.
+        int levels[] = {
+            Callable_arg<typename std::tuple_element<Is, Args>::type>::match(
+                args[Is])...,
+            EXACT
+        };
+        int res = 0;
+        for (int i : levels) {
+            if (i == NO_MATCH) {
+                return -1;
+            }
+            res += i;
+        }
+        return res;
+    }
+
+    template <std::size_t I>
+    static int score(PyObject* const* args, Py_ssize_t n_args) noexcept
+    {
+        using F = typename std::tuple_element<I, std::tuple<Fs...>>::type;
+        return score<F>(args, n_args,
+            std::make_index_sequence<Callable_traits<F>::n_args>{});
+    }
+
+    template <std::size_t I>
+    static PyObject* call(Obj* obj, PyObject* const* args)
+    {
+        return call_converted(std::get<I>(obj->funcs), args);
+    }
+
+    using Score_fn = int (*)(PyObject* const*, Py_ssize_t);
+    using Call_fn = PyObject* (*)(Obj*, PyObject* const*);
+
+    template <std::size_t... Is>
+    static const Call_fn* calls(std::index_sequence<Is...>) noexcept
+    {
+        static const Call_fn res[] = { call<Is>... };
+        return res;
+    }
+
+    /** Resolves the overload for the arguments, or gives a negative value.
+     */
+
+    template <std::size_t... Is>
+    static int resolve(PyObject* const* args, Py_ssize_t n_args,
+        std::index_sequence<Is...>) noexcept
+    {
+        static const Score_fn scores[] = { score<Is>... };
+        int res = -1;
+        int best = -1;
+        for (std::size_t i = 0; i < sizeof...(Is); ++i) {
+            int curr = scores[i](args, n_args);
+            if (curr > best) {
+                best = curr;
+                res = static_cast<int>(i);
+            }
+        }
+        return res;
+    }
+
+    /** Looks up the cache for the overload for the types of the arguments.
+     */
+
+    static int lookup(Obj* obj, PyObject* const* args, Py_ssize_t n_args)
+    {
+        for (const auto& entry : obj->cache) {
+            if (entry.n_args != n_args) {
+                continue;
+            }
+            Py_ssize_t i = 0;
+            while (i < n_args && entry.types[i] == Py_TYPE(args[i])) {
+                ++i;
+            }
+            if (i == n_args) {
+                return static_cast<int>(entry.overload);
+            }
+        }
+        return -1;
+    }
+
+    static void memoize(Obj* obj, PyObject* const* args, Py_ssize_t n_args,
+        std::size_t overload) noexcept
+    {
+        Cache_entry& entry = obj->cache[obj->next_entry];
+        obj->next_entry = (obj->next_entry + 1) % CACHE_SIZE;
+        clear(entry);
+        for (Py_ssize_t i = 0; i < n_args; ++i) {
+            entry.types[i] = Py_TYPE(args[i]);
+            Py_INCREF(entry.types[i]);
+        }
+        entry.n_args = n_args;
+        entry.overload = overload;
+    }
+
+    static void no_match(PyObject* const* args, Py_ssize_t n_args)
+    {
+        std::string types{};
+        for (Py_ssize_t i = 0; i < n_args; ++i) {
+            types.append(i > 0 ? ", " : "").append(Py_TYPE(args[i])->tp_name);
+        }
+        PyErr_Format(PyExc_TypeError,
+            "no overload of the C++ callable matches the arguments (%s)",
+            types.c_str());
+    }
+
+    static PyObject* vectorcall(PyObject* self, PyObject* const* args,
+        std::size_t nargsf, PyObject* kwnames)
+    {
+        Obj* obj = reinterpret_cast<Obj*>(self);
+        Py_ssize_t n_args = PyVectorcall_NARGS(nargsf);
+        if (kwnames != nullptr && PyTuple_GET_SIZE(kwnames) > 0) {
+            PyErr_SetString(
+                PyExc_TypeError, "C++ callable takes no keyword arguments");
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                auto indices = std::index_sequence_for<Fs...>{};
+                int overload = lookup(obj, args, n_args);
+                if (overload < 0) {
+                    overload = resolve(args, n_args, indices);
+                    ++obj->n_resolved;
+                    if (overload < 0) {
+                        no_match(args, n_args);
+                        return nullptr;
+                    }
+                    memoize(obj, args, n_args,
+                        static_cast<std::size_t>(overload));
+                }
+                return calls(indices)[overload](obj, args);
+            },
+            nullptr);
+    }
+};
+
+/** Makes a Python callable from a set of overloaded C++ callables.
+ *
+ * Each callable needs to have a fixed signature, like for `make_callable`.
+ */
+
+template <typename... Fs> Handle make_overloaded(Fs&&... funcs)
+{
+    return Overloaded<typename std::decay<Fs>::type...>::create(
+        std::forward<Fs>(funcs)...);
+}
+
+// End of namespace cpypp
+}
+
+#endif
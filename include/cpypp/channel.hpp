@@ -0,0 +1,1101 @@
+/** @file channel.hpp
+ *
+ * Bounded channels between Python producers and native workers
+ *
+ * Handing work items from Python to native threads by `queue.Queue` takes the
+ * GIL and a lock for each item on both sides.  The channels here are bounded
+ * lock-free rings, where native threads can take the items without ever
+ * touching the GIL, and Python threads only release the GIL when they actually
+ * need to block on a full or empty channel.  Blocking is by futexes on the
+ * counts of events, so that no system call is made while the channel is
+ * neither full nor empty.
+ *
+ * The items can be Python objects, or 64-bit integers or floating-point
+ * numbers stored natively.  Object items popped without the GIL are given as
+ * `Deferred_ref`, whose references are released by the interpreter later.
+ */
+
+#ifndef CPYPP_CHANNEL_HPP
+#define CPYPP_CHANNEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/futex.hpp>
+
+namespace cpypp {
+
+//
+// Deferred release of references
+//
+
+/** The references waiting to be released with the GIL.
+ */
+
+struct Deferred_decrefs {
+    std::mutex mutex;
+    std::vector<PyObject*> refs;
+    std::atomic<bool> if_scheduled{ false };
+
+    /** Gets the references for the whole process.
+     */
+
+    static Deferred_decrefs& get()
+    {
+        static Deferred_decrefs decrefs{};
+        return decrefs;
+    }
+
+    /** Releases all the waiting references.
+     *
+     * It can only be called with the GIL held.
+     */
+
+    static int drain(void* = nullptr)
+    {
+        Deferred_decrefs& decrefs = get();
+        decrefs.if_scheduled.store(false);
+
+        std::vector<PyObject*> refs{};
+        {
+            std::lock_guard<std::mutex> guard(decrefs.mutex);
+            refs.swap(decrefs.refs);
+        }
+        for (auto i : refs) {
+            Py_DECREF(i);
+        }
+        return 0;
+    }
+};
+
+/** Releases a reference from any thread, with or without the GIL.
+ *
+ * The reference is released by the interpreter as a pending call, which is
+ * run by the main thread the next time it runs Python code.
+ */
+
+inline void defer_decref(PyObject* ref)
+{
+    Deferred_decrefs& decrefs = Deferred_decrefs::get();
+    {
+        std::lock_guard<std::mutex> guard(decrefs.mutex);
+        decrefs.refs.push_back(ref);
+    }
+    if (!decrefs.if_scheduled.exchange(true)) {
+        if (Py_AddPendingCall(Deferred_decrefs::drain, nullptr) < 0) {
+            // The queue of pending calls is full, to be retried next time.
+            decrefs.if_scheduled.store(false);
+        }
+    }
+}
+
+/** Owning references to Python objects usable without the GIL.
+ *
+ * Different from Handle, the reference count is never touched directly.  The
+ * reference is given to `defer_decref` on destruction, or can be released to
+ * a handle by `handle` with the GIL held.
+ */
+
+class Deferred_ref {
+public:
+    /** Constructs a reference by stealing the given one.
+     */
+
+    explicit Deferred_ref(PyObject* ref = nullptr) noexcept
+        : ref_{ ref }
+    {
+    }
+
+    Deferred_ref(Deferred_ref&& other) noexcept
+        : ref_{ other.ref_ }
+    {
+        other.ref_ = nullptr;
+    }
+
+    Deferred_ref& operator=(Deferred_ref&& other) noexcept
+    {
+        std::swap(ref_, other.ref_);
+        return *this;
+    }
+
+    ~Deferred_ref()
+    {
+        if (ref_ != nullptr) {
+            defer_decref(ref_);
+        }
+    }
+
+    /** Gets the pointer to the object.
+     */
+
+    PyObject* get() const noexcept { return ref_; }
+
+    /** If any object is referenced.
+     */
+
+    explicit operator bool() const noexcept { return ref_ != nullptr; }
+
+    /** Moves the reference into a handle, with the GIL held.
+     */
+
+    Handle handle() noexcept
+    {
+        PyObject* ref = ref_;
+        ref_ = nullptr;
+        return { ref, STEAL, true };
+    }
+
+private:
+    PyObject* ref_;
+};
+
+//
+// Lock-free rings
+//
+
+/** Bounded ring for multiple producers and consumers.
+ *
+ * This is the array-based queue of Dmitry Vyukov, where each cell has a
+ * sequence number telling if it is ready for the producer or the consumer of
+ * the current lap.  Producers and consumers only contend on their own index,
+ * which are kept on separate cache lines.  The capacity is rounded up to a
+ * power of two.
+ */
+
+template <typename T> class Mpmc_ring {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "Only trivially copyable items can be put in rings");
+
+public:
+    explicit Mpmc_ring(std::size_t capacity)
+    {
+        std::size_t n_cells = 2;
+        while (n_cells < capacity) {
+            n_cells *= 2;
+        }
+        cells_.reset(new Cell[n_cells]);
+        mask_ = n_cells - 1;
+        for (std::size_t i = 0; i < n_cells; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /** Gets the number of cells.
+     */
+
+    std::size_t capacity() const noexcept { return mask_ + 1; }
+
+    /** Gets the number of items, which may be stale with concurrent updates.
+     */
+
+    std::size_t size() const noexcept
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto tail = tail_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /** Pushes an item, with false returned when the ring is full.
+     */
+
+    bool try_push(const T& item) noexcept
+    {
+        Cell* cell;
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            auto seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq)
+                - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->item = item;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Pops an item, with false returned when the ring is empty.
+     */
+
+    bool try_pop(T& item) noexcept
+    {
+        Cell* cell;
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            auto seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq)
+                - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = cell->item;
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Pushes up to the given number of items, giving the number pushed.
+     *
+     * A run of cells is taken by a single update of the index, with the
+     * cells ready for the current lap counted from the index before.
+     */
+
+    std::size_t try_push_many(const T* items, std::size_t n_items) noexcept
+    {
+        if (n_items == 0) {
+            return 0;
+        }
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        std::size_t n_cells;
+        for (;;) {
+            n_cells = n_ready(pos, n_items, 0);
+            if (n_cells > 0) {
+                if (tail_.compare_exchange_weak(
+                        pos, pos + n_cells, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (is_lapped(pos, 0)) {
+                return 0;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        for (std::size_t i = 0; i < n_cells; ++i) {
+            Cell& cell = cells_[(pos + i) & mask_];
+            cell.item = items[i];
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return n_cells;
+    }
+
+    /** Pops up to the given number of items, giving the number popped.
+     */
+
+    std::size_t try_pop_many(T* items, std::size_t n_items) noexcept
+    {
+        if (n_items == 0) {
+            return 0;
+        }
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        std::size_t n_cells;
+        for (;;) {
+            n_cells = n_ready(pos, n_items, 1);
+            if (n_cells > 0) {
+                if (head_.compare_exchange_weak(
+                        pos, pos + n_cells, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (is_lapped(pos, 1)) {
+                return 0;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        for (std::size_t i = 0; i < n_cells; ++i) {
+            Cell& cell = cells_[(pos + i) & mask_];
+            items[i] = cell.item;
+            cell.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+        }
+        return n_cells;
+    }
+
+    /** Calls the given action on each item in the ring.
+     *
+     * The items cannot be pushed concurrently, while items popped
+     * concurrently may still be given.
+     */
+
+    template <typename F> void for_each(F&& action) const
+    {
+        std::size_t head = head_.load(std::memory_order_acquire);
+        std::size_t tail = tail_.load(std::memory_order_acquire);
+        for (std::size_t pos = head; pos != tail; ++pos) {
+            const Cell& cell = cells_[pos & mask_];
+            if (cell.seq.load(std::memory_order_acquire) == pos + 1) {
+                action(cell.item);
+            }
+        }
+    }
+
+private:
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        T item;
+    };
+
+    /** Counts the cells from the given index ready for the current lap.
+     *
+     * The cells are ready for producers with the offset zero, and for
+     * consumers with the offset one.
+     */
+
+    std::size_t n_ready(std::size_t pos, std::size_t max_cells,
+        std::size_t offset) const noexcept
+    {
+        std::size_t res = 0;
+        while (res < max_cells && res <= mask_) {
+            auto seq = cells_[(pos + res) & mask_].seq.load(
+                std::memory_order_acquire);
+            if (seq != pos + res + offset) {
+                break;
+            }
+            ++res;
+        }
+        return res;
+    }
+
+    /** Tests if the cell at the given index is still in the previous lap.
+     *
+     * It is for full rings with the offset zero and for empty rings with the
+     * offset one.  Otherwise the index is stale.
+     */
+
+    bool is_lapped(std::size_t pos, std::size_t offset) const noexcept
+    {
+        auto seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+        return static_cast<std::intptr_t>(seq)
+            - static_cast<std::intptr_t>(pos + offset)
+            < 0;
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+
+    // Padding instead of alignment, since the rings can be placed in Python
+    // objects without any alignment beyond the fundamental one.
+    char pad0_[CACHE_LINE];
+    std::atomic<std::size_t> head_{ 0 };
+    char pad1_[CACHE_LINE];
+    std::atomic<std::size_t> tail_{ 0 };
+    char pad2_[CACHE_LINE];
+};
+
+//
+// Channels
+//
+
+/** The kinds of items in channels.
+ */
+
+enum class Channel_kind { OBJECT, INT64, FLOAT64 };
+
+/** Python type of bounded channels.
+ *
+ * The Python type `Channel` is constructed as `Channel(capacity=1024,
+ * kind='object')`, with the kind being `'object'`, `'int64'` or `'float64'`.
+ * The methods are
+ *
+ * - `put(item)` and `put_many(iterable)` blocking while the channel is full,
+ *   with `ValueError` raised once the channel is closed,
+ *
+ * - `get()` blocking while the channel is empty, with `EOFError` raised once
+ *   the channel is closed and drained,
+ *
+ * - `get_many(max_items)` blocking for at least one item and getting up to the
+ *   given number of items as a list, which is empty once the channel is closed
+ *   and drained,
+ *
+ * - `close()` waking up all blocked threads.
+ *
+ * The channels are also iterators stopping when closed and drained.  The
+ * length gives the number of items in the channel, which can be stale.
+ *
+ * Native threads use the static methods `push` and `pop` here, which are to
+ * be called without the GIL.  They need to own a reference to the channel,
+ * for instance by a `Deferred_ref`, during their use of the channel.  The
+ * object items in channels are reported to the garbage collector, so that
+ * cycles through them are collected.
+ */
+
+class Channel {
+public:
+    /** The layout of the Python objects.
+     *
+     * The items are stored as 64-bit words, which are new references for
+     * object items.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Mpmc_ring<std::uint64_t> ring;
+        Event_count not_empty;
+        Event_count not_full;
+        std::atomic<bool> if_closed;
+        Channel_kind kind;
+    };
+
+    /** Gets the static type of the channels.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.Channel", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_length = length;
+
+            static PyMethodDef methods[] = {
+                { "put", (PyCFunction)py_put, METH_O,
+                    "Puts an item, blocking while the channel is full." },
+                { "put_many", (PyCFunction)py_put_many, METH_O,
+                    "Puts the items from an iterable." },
+                { "get", (PyCFunction)py_get, METH_NOARGS,
+                    "Gets an item, blocking while the channel is empty." },
+                { "get_many", (PyCFunction)py_get_many, METH_O,
+                    "Gets up to the given number of items." },
+                { "close", (PyCFunction)py_close, METH_NOARGS,
+                    "Closes the channel and wakes up all blocked threads." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+            tp->tp_doc = "Bounded channel for native workers.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_traverse = traverse;
+            tp->tp_clear = clear;
+            tp->tp_repr = repr;
+            tp->tp_iter = PyObject_SelfIter;
+            tp->tp_iternext = iternext;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new channel.
+     */
+
+    static Handle create(
+        std::size_t capacity, Channel_kind kind = Channel_kind::OBJECT)
+    {
+        static const char* names[] = { "object", "int64", "float64" };
+        return { PyObject_CallFunction(type().tp_obj(), "ns",
+            static_cast<Py_ssize_t>(capacity),
+            names[static_cast<int>(kind)]) };
+    }
+
+    /** Tests if the given object is a channel.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the kind of items in a channel.
+     */
+
+    static Channel_kind kind(PyObject* ch) noexcept { return obj(ch)->kind; }
+
+    /** Pops an item from a channel, blocking while it is empty.
+     *
+     * The item type must match the kind of the channel, with `Deferred_ref`
+     * for object items.  False is returned when the channel is closed and
+     * drained.
+     */
+
+    template <typename T> static bool pop(PyObject* ch, T& item)
+    {
+        std::uint64_t word;
+        auto res = retry(ch, obj(ch)->not_empty,
+            [&]() { return try_pop_word(ch, word); }, -1);
+        if (res != SUCCEEDED) {
+            return false;
+        }
+        item = from_word(word, static_cast<T*>(nullptr));
+        return true;
+    }
+
+    /** Pops an item from a channel if any, without blocking.
+     */
+
+    template <typename T> static bool try_pop(PyObject* ch, T& item)
+    {
+        std::uint64_t word;
+        if (!try_pop_word(ch, word)) {
+            return false;
+        }
+        item = from_word(word, static_cast<T*>(nullptr));
+        return true;
+    }
+
+    /** Pushes a native item into a channel, blocking while it is full.
+     *
+     * False is returned when the channel is closed.
+     */
+
+    template <typename T> static bool push(PyObject* ch, T item)
+    {
+        std::uint64_t word = to_word(item);
+        return retry(ch, obj(ch)->not_full,
+                   [&]() { return try_push_word(ch, word); }, -1)
+            == SUCCEEDED;
+    }
+
+    /** Closes a channel and wakes up all the blocked threads.
+     */
+
+    static void close(PyObject* ch) noexcept
+    {
+        obj(ch)->if_closed.store(true);
+        obj(ch)->not_empty.notify();
+        obj(ch)->not_full.notify();
+    }
+
+private:
+    /** The interval for checking signals while blocking with the GIL released.
+     */
+
+    static constexpr std::int64_t SIGNAL_INTERVAL_NS = 50000000;
+
+    /** The number of items converted and published together by `put_many`.
+     */
+
+    static constexpr std::size_t CHUNK_SIZE = 256;
+
+    enum Wait_res { SUCCEEDED, CLOSED, TIMED_OUT };
+
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    //
+    // Native items
+    //
+
+    static std::uint64_t to_word(std::int64_t item) noexcept
+    {
+        return static_cast<std::uint64_t>(item);
+    }
+
+    static std::uint64_t to_word(double item) noexcept
+    {
+        std::uint64_t res;
+        std::memcpy(&res, &item, sizeof(double));
+        return res;
+    }
+
+    static std::int64_t from_word(std::uint64_t word, std::int64_t*) noexcept
+    {
+        return static_cast<std::int64_t>(word);
+    }
+
+    static double from_word(std::uint64_t word, double*) noexcept
+    {
+        double res;
+        std::memcpy(&res, &word, sizeof(double));
+        return res;
+    }
+
+    static Deferred_ref from_word(std::uint64_t word, Deferred_ref*) noexcept
+    {
+        return Deferred_ref(reinterpret_cast<PyObject*>(word));
+    }
+
+    static bool try_push_word(PyObject* ch, std::uint64_t word) noexcept
+    {
+        if (obj(ch)->if_closed.load(std::memory_order_relaxed)
+            || !obj(ch)->ring.try_push(word)) {
+            return false;
+        }
+        obj(ch)->not_empty.notify();
+        return true;
+    }
+
+    static bool try_pop_word(PyObject* ch, std::uint64_t& word) noexcept
+    {
+        if (!obj(ch)->ring.try_pop(word)) {
+            return false;
+        }
+        obj(ch)->not_full.notify();
+        return true;
+    }
+
+    /** Pushes a run of words, with a single notification for all of them.
+     */
+
+    static std::size_t try_push_words(
+        PyObject* ch, const std::uint64_t* words, std::size_t n_words) noexcept
+    {
+        if (obj(ch)->if_closed.load(std::memory_order_relaxed)) {
+            return 0;
+        }
+        std::size_t res = obj(ch)->ring.try_push_many(words, n_words);
+        if (res > 0) {
+            obj(ch)->not_empty.notify();
+        }
+        return res;
+    }
+
+    /** Pops a run of words, with a single notification for all of them.
+     */
+
+    static std::size_t try_pop_words(
+        PyObject* ch, std::uint64_t* words, std::size_t n_words) noexcept
+    {
+        std::size_t res = obj(ch)->ring.try_pop_many(words, n_words);
+        if (res > 0) {
+            obj(ch)->not_full.notify();
+        }
+        return res;
+    }
+
+    /** Retries an attempt until it succeeds, blocking on the given event.
+     *
+     * The channel is found closed only when the attempt fails after closing.
+     * With a non-negative timeout, at most one wait is made.
+     */
+
+    template <typename F>
+    static Wait_res retry(PyObject* ch, Event_count& event, F&& attempt,
+        std::int64_t timeout_ns) noexcept
+    {
+        for (;;) {
+            if (attempt()) {
+                return SUCCEEDED;
+            }
+            auto key = event.prepare();
+            if (attempt()) {
+                event.cancel();
+                return SUCCEEDED;
+            }
+            if (obj(ch)->if_closed.load()) {
+                event.cancel();
+                return CLOSED;
+            }
+            event.wait(key, timeout_ns);
+            if (timeout_ns >= 0) {
+                return attempt() ? SUCCEEDED : TIMED_OUT;
+            }
+        }
+    }
+
+    /** Retries an attempt from Python, with the GIL released while blocking.
+     *
+     * False is returned when the channel is found closed.
+     */
+
+    template <typename F>
+    static bool py_retry(PyObject* ch, Event_count& event, F&& attempt)
+    {
+        if (attempt()) {
+            return true;
+        }
+        for (;;) {
+            Wait_res res;
+            Py_BEGIN_ALLOW_THREADS;
+            res = retry(ch, event, attempt, SIGNAL_INTERVAL_NS);
+            Py_END_ALLOW_THREADS;
+
+            if (res == SUCCEEDED) {
+                return true;
+            } else if (res == CLOSED) {
+                return false;
+            }
+            if (PyErr_CheckSignals() < 0) {
+                throw Exc_set{};
+            }
+        }
+    }
+
+    //
+    // Python items
+    //
+
+    /** Converts a Python object into a word, as a new reference for objects.
+     */
+
+    static std::uint64_t to_word(PyObject* ch, PyObject* item)
+    {
+        switch (kind(ch)) {
+        case Channel_kind::INT64: {
+            long long res = PyLong_AsLongLong(item);
+            if (res == -1) {
+                check_exc();
+            }
+            return to_word(static_cast<std::int64_t>(res));
+        }
+        case Channel_kind::FLOAT64: {
+            double res = PyFloat_AsDouble(item);
+            if (res == -1.0) {
+                check_exc();
+            }
+            return to_word(res);
+        }
+        default:
+            Py_INCREF(item);
+            return reinterpret_cast<std::uint64_t>(item);
+        }
+    }
+
+    /** Converts a word into a new reference, stealing the object items.
+     */
+
+    static PyObject* from_word(PyObject* ch, std::uint64_t word)
+    {
+        switch (kind(ch)) {
+        case Channel_kind::INT64:
+            return PyLong_FromLongLong(
+                from_word(word, static_cast<std::int64_t*>(nullptr)));
+        case Channel_kind::FLOAT64:
+            return PyFloat_FromDouble(
+                from_word(word, static_cast<double*>(nullptr)));
+        default:
+            return reinterpret_cast<PyObject*>(word);
+        }
+    }
+
+    /** Releases a word not put into the channel.
+     */
+
+    static void drop_word(PyObject* ch, std::uint64_t word) noexcept
+    {
+        if (kind(ch) == Channel_kind::OBJECT) {
+            Py_DECREF(reinterpret_cast<PyObject*>(word));
+        }
+    }
+
+    /** Puts all the words, which are cleared.
+     *
+     * The words not put are released on failures.
+     */
+
+    static void put_words(PyObject* ch, std::vector<std::uint64_t>& words)
+    {
+        std::size_t n_put = 0;
+        bool if_put = true;
+        try {
+            while (if_put && n_put < words.size()) {
+                if_put = py_retry(ch, obj(ch)->not_full, [&]() {
+                    std::size_t res = try_push_words(
+                        ch, words.data() + n_put, words.size() - n_put);
+                    n_put += res;
+                    return res > 0;
+                });
+            }
+        } catch (const Exc_set&) {
+            if_put = false;
+        }
+
+        for (std::size_t i = n_put; i < words.size(); ++i) {
+            drop_word(ch, words[i]);
+        }
+        words.clear();
+        if (!if_put) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_ValueError, "channel is closed");
+            }
+            throw Exc_set{};
+        }
+    }
+
+    static void put(PyObject* ch, PyObject* item)
+    {
+        std::uint64_t word = to_word(ch, item);
+        bool if_put = false;
+        try {
+            if_put = py_retry(ch, obj(ch)->not_full,
+                [&]() { return try_push_word(ch, word); });
+        } catch (...) {
+            drop_word(ch, word);
+            throw;
+        }
+
+        if (!if_put) {
+            drop_word(ch, word);
+            PyErr_SetString(PyExc_ValueError, "channel is closed");
+            throw Exc_set{};
+        }
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "capacity", "kind", nullptr };
+        Py_ssize_t capacity = 1024;
+        const char* kind_name = "object";
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ns:Channel",
+                const_cast<char**>(kwlist), &capacity, &kind_name)) {
+            return nullptr;
+        }
+
+        Channel_kind kind;
+        if (std::strcmp(kind_name, "object") == 0) {
+            kind = Channel_kind::OBJECT;
+        } else if (std::strcmp(kind_name, "int64") == 0) {
+            kind = Channel_kind::INT64;
+        } else if (std::strcmp(kind_name, "float64") == 0) {
+            kind = Channel_kind::FLOAT64;
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown kind %s", kind_name);
+            return nullptr;
+        }
+        if (capacity < 1) {
+            PyErr_SetString(PyExc_ValueError, "capacity must be positive");
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        auto created = catch_exc(
+            [&]() {
+                new (&obj(self)->ring) Mpmc_ring<std::uint64_t>(
+                    static_cast<std::size_t>(capacity));
+                return true;
+            },
+            false);
+        if (!created) {
+            // The type is deallocated directly for the ring not constructed.
+            PyObject_GC_Del(self);
+            return nullptr;
+        }
+        new (&obj(self)->not_empty) Event_count();
+        new (&obj(self)->not_full) Event_count();
+        new (&obj(self)->if_closed) std::atomic<bool>(false);
+        obj(self)->kind = kind;
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        PyObject_GC_UnTrack(self);
+        clear(self);
+        obj(self)->ring.~Mpmc_ring();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    /** Visits the object items, which are only pushed with the GIL held.
+     *
+     * The items popped concurrently by native threads are kept alive by
+     * their `Deferred_ref` until they are released by the interpreter.
+     */
+
+    static int traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        int res = 0;
+        if (kind(self) == Channel_kind::OBJECT) {
+            obj(self)->ring.for_each([&](std::uint64_t word) {
+                if (res == 0) {
+                    res = visit(reinterpret_cast<PyObject*>(word), arg);
+                }
+            });
+        }
+        return res;
+    }
+
+    static int clear(PyObject* self)
+    {
+        std::uint64_t word;
+        while (obj(self)->ring.try_pop(word)) {
+            drop_word(self, word);
+        }
+        obj(self)->not_full.notify();
+        return 0;
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        static const char* names[] = { "object", "int64", "float64" };
+        return PyUnicode_FromFormat("<%s of %s with %zu/%zu items%s>",
+            Py_TYPE(self)->tp_name, names[static_cast<int>(kind(self))],
+            obj(self)->ring.size(), obj(self)->ring.capacity(),
+            obj(self)->if_closed.load() ? ", closed" : "");
+    }
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(obj(self)->ring.size());
+    }
+
+    //
+    // Methods
+    //
+
+    static PyObject* py_put(PyObject* self, PyObject* item)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                put(self, item);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    /** Puts the items from an iterable, published in chunks.
+     *
+     * Each chunk takes runs of cells in the ring with one notification for
+     * each run.  The items before any failure of the iteration are still put.
+     */
+
+    static PyObject* py_put_many(PyObject* self, PyObject* items)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Handle iter(PyObject_GetIter(items));
+                std::vector<std::uint64_t> words{};
+                words.reserve(CHUNK_SIZE);
+                bool if_done = false;
+                while (!if_done) {
+                    try {
+                        while (words.size() < CHUNK_SIZE) {
+                            Handle item(PyIter_Next(iter), STEAL, true);
+                            if (!item) {
+                                check_exc();
+                                break;
+                            }
+                            words.push_back(to_word(self, item));
+                        }
+                    } catch (const Exc_set&) {
+                        Captured_exc exc = Captured_exc::capture();
+                        put_words(self, words);
+                        exc.rethrow();
+                    }
+                    if_done = words.size() < CHUNK_SIZE;
+                    put_words(self, words);
+                }
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    /** Gets an item as a new reference, or null when closed and drained.
+     */
+
+    static PyObject* get(PyObject* self)
+    {
+        std::uint64_t word;
+        if (!py_retry(self, obj(self)->not_empty,
+                [&]() { return try_pop_word(self, word); })) {
+            return nullptr;
+        }
+        return from_word(self, word);
+    }
+
+    static PyObject* py_get(PyObject* self, PyObject*)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                PyObject* res = get(self);
+                if (res == nullptr && !PyErr_Occurred()) {
+                    PyErr_SetString(PyExc_EOFError, "channel is closed");
+                }
+                return res;
+            },
+            nullptr);
+    }
+
+    static PyObject* iternext(PyObject* self)
+    {
+        return catch_exc([&]() { return get(self); }, nullptr);
+    }
+
+    static PyObject* py_get_many(PyObject* self, PyObject* arg)
+    {
+        Py_ssize_t max_items = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+        if (max_items == -1 && PyErr_Occurred()) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Handle res(PyList_New(0));
+                if (max_items < 1) {
+                    return res.release();
+                }
+
+                // The words are taken in runs of cells, with one
+                // notification for each run.
+                std::vector<std::uint64_t> words(std::min(
+                    static_cast<std::size_t>(max_items),
+                    obj(self)->ring.capacity()));
+                std::size_t n_words = 0;
+                if (!py_retry(self, obj(self)->not_empty, [&]() {
+                        n_words = try_pop_words(
+                            self, words.data(), words.size());
+                        return n_words > 0;
+                    })) {
+                    return res.release();
+                }
+                while (n_words < words.size()) {
+                    std::size_t n_popped = try_pop_words(
+                        self, words.data() + n_words, words.size() - n_words);
+                    if (n_popped == 0) {
+                        break;
+                    }
+                    n_words += n_popped;
+                }
+                words.resize(n_words);
+
+                // All the words are converted even on failures, for the
+                // object items to be released.
+                bool if_failed = false;
+                for (auto i : words) {
+                    Handle item(from_word(self, i), STEAL, true);
+                    if (!if_failed && (!item || PyList_Append(res, item) < 0)) {
+                        if_failed = true;
+                    }
+                }
+                if (if_failed) {
+                    throw Exc_set{};
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_close(PyObject* self, PyObject*)
+    {
+        close(self);
+        Py_RETURN_NONE;
+    }
+};
+
+template <typename T> constexpr std::size_t Mpmc_ring<T>::CACHE_LINE;
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,673 @@
+/** @file chrono.hpp
+ *
+ * Conversions between Python date and time objects and std::chrono
+ *
+ * Getting the fields of `datetime` objects one by one through attribute
+ * access costs a lookup and an integer object for each field.  The
+ * conversions here read the fields directly from the objects through the
+ * datetime C API, with the calendar arithmetic done natively.  Besides the
+ * conversions of single objects, whole sequences of datetimes can be
+ * converted to and from arrays of 64-bit nanoseconds since the Unix epoch,
+ * and ISO 8601 strings can be parsed into datetimes without going through
+ * any Python code.
+ *
+ * Time points are always in UTC.  Naive datetimes are taken to be in UTC,
+ * while aware datetimes are shifted by their offsets from UTC.
+ */
+
+#ifndef CPYPP_CHRONO_HPP
+#define CPYPP_CHRONO_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ratio>
+
+#include <Python.h>
+
+// The header defines a static pointer to the API for its macros in every
+// translation unit, which is not used here, since the API is kept by
+// `Datetime_api` instead.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+#include <datetime.h>
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include <cpypp.hpp>
+#include <cpypp/int_map.hpp>
+
+namespace cpypp {
+
+//
+// Calendar arithmetic
+//
+
+/** Days, in the same resolution as Python dates.
+ */
+
+using Days = std::chrono::duration<std::int32_t, std::ratio<86400>>;
+
+/** Time points of days since the Unix epoch.
+ */
+
+using Sys_days = std::chrono::time_point<std::chrono::system_clock, Days>;
+
+/** Time points of nanoseconds since the Unix epoch.
+ */
+
+using Sys_ns = std::chrono::time_point<std::chrono::system_clock,
+    std::chrono::nanoseconds>;
+
+/** Value for missing time points in arrays of nanoseconds.
+ *
+ * `None` is converted to and from it in the bulk conversions, the same as the
+ * `NaT` of numpy.
+ */
+
+constexpr std::int64_t nat_ns = std::numeric_limits<std::int64_t>::min();
+
+/** Divides integers with the quotient rounded toward negative infinity.
+ */
+
+inline std::int64_t floor_div(std::int64_t num, std::int64_t den) noexcept
+{
+    std::int64_t res = num / den;
+    return res * den > num ? res - 1 : res;
+}
+
+/** Date in the proleptic Gregorian calendar.
+ */
+
+struct Civil_date {
+    int year;
+    int month;
+    int day;
+
+    /** Gets the number of days since the Unix epoch.
+     */
+
+    std::int64_t to_days() const noexcept
+    {
+        std::int64_t y = month <= 2 ? year - 1 : year;
+        std::int64_t era = floor_div(y, 400);
+        std::int64_t yoe = y - era * 400;
+        std::int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5
+            + day - 1;
+        std::int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    /** Gets the date from the number of days since the Unix epoch.
+     */
+
+    static Civil_date from_days(std::int64_t days) noexcept
+    {
+        days += 719468;
+        std::int64_t era = floor_div(days, 146097);
+        std::int64_t doe = days - era * 146097;
+        std::int64_t yoe
+            = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        std::int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        std::int64_t mp = (5 * doy + 2) / 153;
+        int day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+        int month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+        int year = static_cast<int>(yoe + era * 400 + (month <= 2));
+        return { year, month, day };
+    }
+};
+
+//
+// The datetime C API
+//
+
+/** Access to the datetime C API and the cached time zones.
+ *
+ * The API is imported on first use, so the GIL needs to be held.  Only a
+ * single lifetime of the main interpreter is supported, and the time zones
+ * for the fixed offsets are cached for the whole of it.
+ */
+
+class Datetime_api {
+public:
+    /** Gets the API, imported on first use.
+     *
+     * Failed imports are not cached, so that the import is tried again on the
+     * next use.
+     */
+
+    static PyDateTime_CAPI& get()
+    {
+        static PyDateTime_CAPI* api = nullptr;
+        if (api == nullptr) {
+            api = static_cast<PyDateTime_CAPI*>(
+                PyCapsule_Import(PyDateTime_CAPSULE_NAME, 0));
+            if (api == nullptr) {
+                throw Exc_set{};
+            }
+        }
+        return *api;
+    }
+
+    /** Gets the UTC time zone, as a borrowed reference.
+     */
+
+    static PyObject* utc() { return get().TimeZone_UTC; }
+
+    /** Gets the time zone for a fixed offset from UTC, as a borrowed reference.
+     *
+     * The time zones are cached by the offsets, so that they are only created
+     * once.  UTC is given for the zero offset.
+     */
+
+    static PyObject* fixed_offset(int minutes)
+    {
+        if (minutes == 0) {
+            return utc();
+        }
+        // The time zones are leaked, to be valid after the finalization.
+        static Int_table<PyObject*> zones;
+        PyObject** found = zones.find(minutes);
+        if (found != nullptr) {
+            return *found;
+        }
+        Handle delta(
+            get().Delta_FromDelta(0, minutes * 60, 0, 1, get().DeltaType));
+        Handle zone(get().TimeZone_FromTimeZone(delta.get(), nullptr));
+        PyObject* res = zone.release();
+        *zones.emplace(minutes).first = res;
+        return res;
+    }
+
+    static bool check_datetime(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, get().DateTimeType);
+    }
+
+    static bool check_date(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, get().DateType);
+    }
+
+    static bool check_delta(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, get().DeltaType);
+    }
+
+    /** Checks if a time zone is known to have a fixed offset.
+     */
+
+    static bool is_fixed(PyObject* tz)
+    {
+        return Py_TYPE(tz) == Py_TYPE(utc());
+    }
+
+    /** Gets the time zone of a datetime, as a borrowed reference.
+     */
+
+    static PyObject* tzinfo(PyObject* obj) noexcept
+    {
+#if PY_VERSION_HEX >= 0x030A0000
+        return PyDateTime_DATE_GET_TZINFO(obj);
+#else
+        auto dt = reinterpret_cast<PyDateTime_DateTime*>(obj);
+        return dt->hastzinfo ? dt->tzinfo : Py_None;
+#endif
+    }
+};
+
+//
+// Conversions of single objects
+//
+
+/** Converts a Python timedelta into microseconds.
+ */
+
+inline std::chrono::microseconds as_duration(PyObject* obj)
+{
+    if (!Datetime_api::check_delta(obj)) {
+        PyErr_SetString(PyExc_TypeError, "timedelta expected");
+        throw Exc_set{};
+    }
+    // Larger deltas overflow 64-bit microseconds.
+    std::int64_t days = PyDateTime_DELTA_GET_DAYS(obj);
+    if (days > 106751991 || days < -106751991) {
+        PyErr_SetString(PyExc_OverflowError, "timedelta out of range");
+        throw Exc_set{};
+    }
+    return std::chrono::microseconds(days * 86400000000LL
+        + PyDateTime_DELTA_GET_SECONDS(obj) * 1000000LL
+        + PyDateTime_DELTA_GET_MICROSECONDS(obj));
+}
+
+/** Builds a Python timedelta from a duration.
+ *
+ * Durations finer than microseconds are rounded toward negative infinity.
+ */
+
+template <typename Rep, typename Period>
+Handle make_timedelta(std::chrono::duration<Rep, Period> dur)
+{
+    using std::chrono::microseconds;
+    auto us = std::chrono::duration_cast<microseconds>(dur);
+    if (us > dur) {
+        us -= microseconds(1);
+    }
+    std::int64_t days = floor_div(us.count(), 86400000000LL);
+    std::int64_t rem = us.count() - days * 86400000000LL;
+    if (days > 999999999 || days < -999999999) {
+        PyErr_SetString(
+            PyExc_OverflowError, "duration out of range of timedelta");
+        throw Exc_set{};
+    }
+    auto& api = Datetime_api::get();
+    return Handle(api.Delta_FromDelta(static_cast<int>(days),
+        static_cast<int>(rem / 1000000), static_cast<int>(rem % 1000000), 1,
+        api.DeltaType));
+}
+
+/** Converts a Python date into the days since the Unix epoch.
+ *
+ * For datetimes, the date part is taken, regardless of the time zone.
+ */
+
+inline Sys_days as_sys_days(PyObject* obj)
+{
+    if (!Datetime_api::check_date(obj)) {
+        PyErr_SetString(PyExc_TypeError, "date expected");
+        throw Exc_set{};
+    }
+    Civil_date date{ PyDateTime_GET_YEAR(obj), PyDateTime_GET_MONTH(obj),
+        PyDateTime_GET_DAY(obj) };
+    return Sys_days(Days(static_cast<std::int32_t>(date.to_days())));
+}
+
+/** Builds a Python date from the days since the Unix epoch.
+ */
+
+inline Handle make_date(Sys_days days)
+{
+    auto date = Civil_date::from_days(days.time_since_epoch().count());
+    auto& api = Datetime_api::get();
+    return Handle(
+        api.Date_FromDate(date.year, date.month, date.day, api.DateType));
+}
+
+/** Offset from UTC of the last time zone with a fixed offset met.
+ *
+ * The cache is only valid while the time zone in it is alive, which is
+ * usually for the conversion of a single sequence.
+ */
+
+struct Offset_cache {
+    PyObject* tz = nullptr;
+    std::int64_t offset_us = 0;
+};
+
+/** Gets the offset from UTC of a datetime, in microseconds.
+ */
+
+inline std::int64_t utc_offset_us(PyObject* obj, Offset_cache& cache)
+{
+    PyObject* tz = Datetime_api::tzinfo(obj);
+    if (tz == Py_None || tz == Datetime_api::utc()) {
+        return 0;
+    }
+    if (tz == cache.tz) {
+        return cache.offset_us;
+    }
+
+    Handle offset(PyObject_CallMethod(obj, "utcoffset", nullptr));
+    std::int64_t res
+        = offset.get() == Py_None ? 0 : as_duration(offset).count();
+    if (Datetime_api::is_fixed(tz)) {
+        cache.tz = tz;
+        cache.offset_us = res;
+    }
+    return res;
+}
+
+/** Converts a Python datetime into nanoseconds since the Unix epoch.
+ *
+ * `OverflowError` is raised for datetimes out of the range of 64-bit
+ * nanoseconds, roughly from 1678 to 2261.
+ */
+
+inline std::int64_t as_epoch_ns(PyObject* obj, Offset_cache& cache)
+{
+    if (!Datetime_api::check_datetime(obj)) {
+        PyErr_SetString(PyExc_TypeError, "datetime expected");
+        throw Exc_set{};
+    }
+    Civil_date date{ PyDateTime_GET_YEAR(obj), PyDateTime_GET_MONTH(obj),
+        PyDateTime_GET_DAY(obj) };
+    std::int64_t secs = date.to_days() * 86400
+        + PyDateTime_DATE_GET_HOUR(obj) * 3600
+        + PyDateTime_DATE_GET_MINUTE(obj) * 60
+        + PyDateTime_DATE_GET_SECOND(obj);
+    std::int64_t us = PyDateTime_DATE_GET_MICROSECOND(obj)
+        - utc_offset_us(obj, cache);
+    secs += floor_div(us, 1000000);
+    us -= floor_div(us, 1000000) * 1000000;
+
+    // The range keeps the missing value out of valid results.
+    if (secs < -9223372036LL || secs > 9223372035LL) {
+        PyErr_SetString(
+            PyExc_OverflowError, "datetime out of range of nanoseconds");
+        throw Exc_set{};
+    }
+    return secs * 1000000000LL + us * 1000;
+}
+
+/** Converts a Python datetime into a time point.
+ */
+
+inline Sys_ns as_sys_ns(PyObject* obj)
+{
+    Offset_cache cache;
+    return Sys_ns(std::chrono::nanoseconds(as_epoch_ns(obj, cache)));
+}
+
+/** Builds a Python datetime from microseconds since the Unix epoch.
+ *
+ * The datetime is in the given time zone, or naive in UTC for `None`.
+ */
+
+inline Handle make_datetime_us(
+    std::int64_t us, PyObject* tz, Offset_cache& cache)
+{
+    auto& api = Datetime_api::get();
+    bool if_fromutc = false;
+    if (tz != Py_None && tz != api.TimeZone_UTC) {
+        if (tz == cache.tz) {
+            us += cache.offset_us;
+        } else if (Datetime_api::is_fixed(tz)) {
+            Handle offset(PyObject_CallMethod(tz, "utcoffset", "O", Py_None));
+            cache.tz = tz;
+            cache.offset_us = as_duration(offset).count();
+            us += cache.offset_us;
+        } else {
+            if_fromutc = true;
+        }
+    }
+
+    std::int64_t days = floor_div(us, 86400000000LL);
+    std::int64_t rem = us - days * 86400000000LL;
+    auto date = Civil_date::from_days(days);
+    int secs = static_cast<int>(rem / 1000000);
+    Handle res(api.DateTime_FromDateAndTime(date.year, date.month, date.day,
+        secs / 3600, secs / 60 % 60, secs % 60,
+        static_cast<int>(rem % 1000000), tz, api.DateTimeType));
+
+    if (if_fromutc) {
+        return Handle(PyObject_CallMethod(tz, "fromutc", "O", res.get()));
+    }
+    return res;
+}
+
+/** Builds a Python datetime from a time point.
+ *
+ * Time points finer than microseconds are rounded toward negative infinity.
+ * By default the datetime is aware in UTC.
+ */
+
+template <typename Duration>
+Handle make_datetime(
+    std::chrono::time_point<std::chrono::system_clock, Duration> time,
+    PyObject* tz = Datetime_api::utc())
+{
+    using std::chrono::microseconds;
+    auto dur = time.time_since_epoch();
+    auto us = std::chrono::duration_cast<microseconds>(dur);
+    if (us > dur) {
+        us -= microseconds(1);
+    }
+    Offset_cache cache;
+    return make_datetime_us(us.count(), tz, cache);
+}
+
+//
+// Bulk conversions
+//
+
+/** Converts a sequence of datetimes into nanoseconds since the Unix epoch.
+ *
+ * The output needs to have the same size as the sequence.  `None` in the
+ * sequence gives `nat_ns`.
+ */
+
+inline void to_epoch_ns(PyObject* seq, std::int64_t* out, std::size_t size)
+{
+    Handle items(PySequence_Fast(seq, "sequence of datetimes expected"));
+    if (static_cast<std::size_t>(PySequence_Fast_GET_SIZE(items.get()))
+        != size) {
+        PyErr_SetString(
+            PyExc_ValueError, "output not of the same length as input");
+        throw Exc_set{};
+    }
+
+    PyObject** objs = PySequence_Fast_ITEMS(items.get());
+    Offset_cache cache;
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = objs[i] == Py_None ? nat_ns : as_epoch_ns(objs[i], cache);
+    }
+}
+
+/** Builds a list of datetimes from nanoseconds since the Unix epoch.
+ *
+ * The datetimes are in the given time zone, or naive in UTC for `None`.
+ * `nat_ns` gives `None`.
+ */
+
+inline Handle from_epoch_ns(const std::int64_t* ns, std::size_t size,
+    PyObject* tz = Datetime_api::utc())
+{
+    Handle res(PyList_New(static_cast<Py_ssize_t>(size)));
+    Offset_cache cache;
+    for (std::size_t i = 0; i < size; ++i) {
+        PyObject* item;
+        if (ns[i] == nat_ns) {
+            Py_INCREF(Py_None);
+            item = Py_None;
+        } else {
+            item = make_datetime_us(floor_div(ns[i], 1000), tz, cache)
+                       .release();
+        }
+        PyList_SET_ITEM(res.get(), static_cast<Py_ssize_t>(i), item);
+    }
+    return res;
+}
+
+//
+// Parsing
+//
+
+/** Parses an ISO 8601 string into a Python datetime.
+ *
+ * The string is a date of `YYYY-MM-DD`, optionally followed by `T` or a space
+ * and the time of `HH:MM[:SS[.fff...]]` with up to nine digits for the
+ * fraction, which is truncated to microseconds.  The offset from UTC can
+ * follow the time, as `Z`, `+HH`, `+HHMM` or `+HH:MM`.  The result is naive
+ * without any offset, and uses the cached time zones otherwise.
+ * `ValueError` is raised for invalid strings.
+ */
+
+inline Handle parse_iso_datetime(const char* str, std::size_t size)
+{
+    const char* curr = str;
+    const char* end = str + size;
+    auto invalid = [&]() {
+        PyErr_Format(PyExc_ValueError, "Invalid isoformat string: '%.*s'",
+            static_cast<int>(size), str);
+        throw Exc_set{};
+    };
+    auto digits = [&](int n) {
+        int res = 0;
+        for (int i = 0; i < n; ++i, ++curr) {
+            if (curr == end || *curr < '0' || *curr > '9') {
+                invalid();
+            }
+            res = res * 10 + (*curr - '0');
+        }
+        return res;
+    };
+    auto skip = [&](char c) {
+        if (curr != end && *curr == c) {
+            ++curr;
+            return true;
+        }
+        return false;
+    };
+
+    int year = digits(4);
+    if (!skip('-')) {
+        invalid();
+    }
+    int month = digits(2);
+    if (!skip('-')) {
+        invalid();
+    }
+    int day = digits(2);
+
+    int hour = 0;
+    int minute = 0;
+    int second = 0;
+    int us = 0;
+    PyObject* tz = Py_None;
+    if (curr != end) {
+        if (!skip('T') && !skip(' ')) {
+            invalid();
+        }
+        hour = digits(2);
+        if (!skip(':')) {
+            invalid();
+        }
+        minute = digits(2);
+        if (skip(':')) {
+            second = digits(2);
+            if (skip('.') || skip(',')) {
+                int n_digits = 0;
+                for (; curr != end && *curr >= '0' && *curr <= '9'; ++curr) {
+                    if (n_digits < 6) {
+                        us = us * 10 + (*curr - '0');
+                    }
+                    ++n_digits;
+                }
+                if (n_digits == 0 || n_digits > 9) {
+                    invalid();
+                }
+                for (; n_digits < 6; ++n_digits) {
+                    us *= 10;
+                }
+            }
+        }
+
+        if (skip('Z')) {
+            tz = Datetime_api::utc();
+        } else if (curr != end && (*curr == '+' || *curr == '-')) {
+            int sign = *curr++ == '-' ? -1 : 1;
+            int minutes = digits(2) * 60;
+            if (curr != end) {
+                skip(':');
+                minutes += digits(2);
+            }
+            if (minutes >= 24 * 60) {
+                invalid();
+            }
+            tz = Datetime_api::fixed_offset(sign * minutes);
+        }
+        if (curr != end) {
+            invalid();
+        }
+    }
+
+    auto& api = Datetime_api::get();
+    return Handle(api.DateTime_FromDateAndTime(
+        year, month, day, hour, minute, second, us, tz, api.DateTimeType));
+}
+
+/** Gets the module functions for the conversions of datetimes.
+ *
+ * `to_epoch_ns(datetimes, out)` writes into a writable buffer of 64-bit
+ * integers, `from_epoch_ns(ns, tz=UTC)` gives a list from such a buffer, and
+ * `parse_isoformat(str)` parses a string.
+ */
+
+inline PyMethodDef* chrono_methods()
+{
+    struct Funcs {
+        static PyObject* to_epoch_ns(PyObject*, PyObject* args)
+        {
+            PyObject* seq;
+            PyObject* out;
+            if (!PyArg_ParseTuple(args, "OO:to_epoch_ns", &seq, &out)) {
+                return nullptr;
+            }
+
+            return catch_exc(
+                [&]() -> PyObject* {
+                    Buffer out_buf(out,
+                        PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE);
+                    cpypp::to_epoch_ns(seq, out_buf.as_array<std::int64_t>(),
+                        static_cast<std::size_t>(out_buf.size()));
+                    Py_RETURN_NONE;
+                },
+                nullptr);
+        }
+
+        static PyObject* from_epoch_ns(PyObject*, PyObject* args)
+        {
+            PyObject* ns;
+            PyObject* tz = nullptr;
+            if (!PyArg_ParseTuple(args, "O|O:from_epoch_ns", &ns, &tz)) {
+                return nullptr;
+            }
+
+            return catch_exc(
+                [&]() -> PyObject* {
+                    Buffer ns_buf(ns);
+                    return cpypp::from_epoch_ns(ns_buf.as_array<std::int64_t>(),
+                        static_cast<std::size_t>(ns_buf.size()),
+                        tz != nullptr ? tz : Datetime_api::utc())
+                        .release();
+                },
+                nullptr);
+        }
+
+        static PyObject* parse_isoformat(PyObject*, PyObject* str)
+        {
+            return catch_exc(
+                [&]() -> PyObject* {
+                    Py_ssize_t size;
+                    const char* content = PyUnicode_AsUTF8AndSize(str, &size);
+                    if (content == nullptr) {
+                        throw Exc_set{};
+                    }
+                    return parse_iso_datetime(
+                        content, static_cast<std::size_t>(size))
+                        .release();
+                },
+                nullptr);
+        }
+    };
+
+    static PyMethodDef defs[] = {
+        { "to_epoch_ns", Funcs::to_epoch_ns, METH_VARARGS,
+            "Converts datetimes into nanoseconds since the epoch." },
+        { "from_epoch_ns", Funcs::from_epoch_ns, METH_VARARGS,
+            "Builds datetimes from nanoseconds since the epoch." },
+        { "parse_isoformat", Funcs::parse_isoformat, METH_O,
+            "Parses an ISO 8601 string into a datetime." },
+        { nullptr, nullptr, 0, nullptr }
+    };
+    return defs;
+}
+
+// End of namespace cpypp
+}
+
+#endif
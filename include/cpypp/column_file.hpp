@@ -0,0 +1,864 @@
+/** @file column_file.hpp
+ *
+ * Files of native columns read by memory mappings
+ *
+ * Columns passed between the stages of pipelines are better not pickled,
+ * since every read of a pickle rebuilds all of its objects.  The column files
+ * here hold columns of native numbers or packed strings in blocks aligned to
+ * 64 bytes, which are read in place from a memory mapping of the file.
+ * Opening a file only maps it and checks its directory of columns, so the
+ * cost is independent of the size of the data, and the pages of a column are
+ * only read from the disk when the column is used.
+ *
+ * A file starts with a header giving the number of columns and the offset of
+ * the directory, which is at the end of the file, so that the columns can be
+ * written one after another without holding them.  Each entry of the
+ * directory gives the name, the format and the blocks of a column.  Numbers
+ * are kept in their native formats of the struct module, and strings are kept
+ * as in `Packed_strs`, as 64-bit offsets from zero to the size of their
+ * concatenated UTF-8 data, with the format `s`.  Everything is in the native
+ * byte order.
+ */
+
+#ifndef CPYPP_COLUMN_FILE_HPP
+#define CPYPP_COLUMN_FILE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/mapping.hpp>
+#include <cpypp/str_column.hpp>
+
+namespace cpypp {
+
+/** Header at the start of the column files.
+ */
+
+struct Column_file_header {
+    char magic[8];
+    std::uint64_t n_columns;
+    std::uint64_t dir_offset;
+    std::uint64_t reserved;
+};
+
+/** Entry of a column in the directory of the column files.
+ *
+ * For numbers, the values are the items of the column.  For strings, the
+ * values are the offsets, and the data is the UTF-8 bytes of the strings.
+ */
+
+struct Column_entry {
+    char name[64];
+    char format[8];
+    std::uint64_t n_items;
+    std::uint64_t values_offset;
+    std::uint64_t values_nbytes;
+    std::uint64_t data_offset;
+    std::uint64_t data_nbytes;
+};
+
+/** Magic bytes at the start of the column files.
+ */
+
+constexpr char COLUMN_FILE_MAGIC[8]
+    = { 'C', 'P', 'Y', 'P', 'C', 'O', 'L', '1' };
+
+//
+// Writing
+//
+
+/** Writer of column files.
+ *
+ * The columns are written as they are added, and the file is only complete
+ * after `close`.  Files not closed, for instance on failures, are left
+ * without their headers, so that they are never opened as column files.
+ */
+
+class Column_writer {
+public:
+    explicit Column_writer(const char* path)
+        : path_{ path }
+    {
+        fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            throw Exc_set{};
+        }
+        Column_file_header header{};
+        try {
+            write_all(&header, sizeof(header));
+        } catch (Exc_set&) {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    Column_writer(const Column_writer&) = delete;
+    Column_writer& operator=(const Column_writer&) = delete;
+
+    ~Column_writer()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    /** Adds a column of native numbers of the given format.
+     *
+     * The format is the single character in the struct module for items of
+     * the given size.
+     */
+
+    void add(const char* name, const void* data, std::size_t n_items,
+        std::size_t itemsize, const char* format)
+    {
+        if (format == nullptr || std::strlen(format) != 1
+            || std::strchr("bBhHiIqQfd", format[0]) == nullptr) {
+            PyErr_SetString(PyExc_ValueError, "column format not supported");
+            throw Exc_set{};
+        }
+        Column_entry entry = new_entry(name, format, n_items);
+        entry.values_nbytes = n_items * itemsize;
+        entry.values_offset = write_block(data, entry.values_nbytes);
+        entries_.push_back(entry);
+    }
+
+    /** Adds a column of native numbers.
+     */
+
+    template <typename T>
+    void add(const char* name, const T* data, std::size_t n_items)
+    {
+        add(name, data, n_items, sizeof(T), native_format<T>());
+    }
+
+    /** Adds a column of strings.
+     */
+
+    void add(const char* name, const Packed_strs& strs)
+    {
+        Column_entry entry = new_entry(name, "s", strs.size());
+        const std::vector<std::int64_t>& offsets = strs.offsets();
+        entry.values_nbytes = offsets.size() * sizeof(std::int64_t);
+        entry.values_offset = write_block(offsets.data(), entry.values_nbytes);
+        entry.data_nbytes = strs.data().size();
+        entry.data_offset = write_block(strs.data().data(), entry.data_nbytes);
+        entries_.push_back(entry);
+    }
+
+    /** Writes the directory and the header, and closes the file.
+     */
+
+    void close()
+    {
+        std::uint64_t dir_offset = write_block(
+            entries_.data(), entries_.size() * sizeof(Column_entry));
+
+        Column_file_header header{};
+        std::memcpy(header.magic, COLUMN_FILE_MAGIC, sizeof(header.magic));
+        header.n_columns = entries_.size();
+        header.dir_offset = dir_offset;
+        int fd = fd_;
+        fd_ = -1;
+        bool if_written = pwrite(fd, &header, sizeof(header), 0)
+            == static_cast<ssize_t>(sizeof(header));
+        if (::close(fd) != 0 || !if_written) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path_.c_str());
+            throw Exc_set{};
+        }
+    }
+
+private:
+    static constexpr std::size_t ALIGNMENT = 64;
+
+    Column_entry new_entry(
+        const char* name, const char* format, std::size_t n_items)
+    {
+        if (std::strlen(name) >= sizeof(Column_entry::name)) {
+            PyErr_Format(PyExc_ValueError, "column name too long: %s", name);
+            throw Exc_set{};
+        }
+        Column_entry entry{};
+        std::strcpy(entry.name, name);
+        std::strcpy(entry.format, format);
+        entry.n_items = n_items;
+        return entry;
+    }
+
+    /** Writes a block of bytes aligned in the file, with its offset returned.
+     */
+
+    std::uint64_t write_block(const void* data, std::size_t size)
+    {
+        static const char padding[ALIGNMENT] = {};
+        std::size_t n_padding = (ALIGNMENT - pos_ % ALIGNMENT) % ALIGNMENT;
+        write_all(padding, n_padding);
+        std::uint64_t offset = pos_;
+        write_all(data, size);
+        return offset;
+    }
+
+    void write_all(const void* data, std::size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+        std::size_t n_written = 0;
+        while (n_written < size) {
+            ssize_t res = write(fd_, bytes + n_written, size - n_written);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res < 0) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, path_.c_str());
+                throw Exc_set{};
+            }
+            n_written += static_cast<std::size_t>(res);
+        }
+        pos_ += size;
+    }
+
+    std::string path_;
+    int fd_ = -1;
+    std::uint64_t pos_ = 0;
+    std::vector<Column_entry> entries_;
+};
+
+//
+// Reading
+//
+
+/** Reader of a column file mapped into memory.
+ *
+ * The header and the directory are checked on construction, and so are the
+ * ends of the offsets of the strings, but not the offsets in between, which
+ * are only checked when the strings are read.
+ */
+
+class Column_reader {
+public:
+    explicit Column_reader(const char* path)
+        : region_{ Mapped_region::map_file(path) }
+    {
+        std::size_t size = region_.size();
+        const Column_file_header* header = nullptr;
+        if (size >= sizeof(Column_file_header)) {
+            header = static_cast<const Column_file_header*>(region_.data());
+        }
+        if (header == nullptr
+            || std::memcmp(header->magic, COLUMN_FILE_MAGIC,
+                   sizeof(header->magic))
+                != 0
+            || header->dir_offset % 8 != 0 || header->dir_offset > size
+            || header->n_columns
+                > (size - header->dir_offset) / sizeof(Column_entry)) {
+            PyErr_Format(PyExc_ValueError, "%s is not a column file", path);
+            throw Exc_set{};
+        }
+
+        n_columns_ = static_cast<std::size_t>(header->n_columns);
+        entries_ = reinterpret_cast<const Column_entry*>(
+            base() + header->dir_offset);
+        for (std::size_t i = 0; i < n_columns_; ++i) {
+            if (!check_entry(entries_[i])) {
+                PyErr_Format(PyExc_ValueError, "corrupt column %zu in %s", i,
+                    path);
+                throw Exc_set{};
+            }
+        }
+    }
+
+    /** Gets the number of columns.
+     */
+
+    std::size_t size() const noexcept { return n_columns_; }
+
+    /** Gets the entry of a column.
+     */
+
+    const Column_entry& entry(std::size_t idx) const noexcept
+    {
+        return entries_[idx];
+    }
+
+    /** Finds the entry of the column of the given name.
+     *
+     * Null is returned when there is no such column.
+     */
+
+    const Column_entry* find(const char* name) const noexcept
+    {
+        for (std::size_t i = 0; i < n_columns_; ++i) {
+            if (std::strcmp(entries_[i].name, name) == 0) {
+                return entries_ + i;
+            }
+        }
+        return nullptr;
+    }
+
+    /** Gets the start of the mapped file.
+     */
+
+    const char* base() const noexcept
+    {
+        return static_cast<const char*>(region_.data());
+    }
+
+    /** Gets the number of bytes of the mapped file.
+     */
+
+    std::size_t nbytes() const noexcept { return region_.size(); }
+
+    /** Gets the values of a column of native numbers.
+     *
+     * A Python `TypeError` is set and `Exc_set` thrown when the column does
+     * not hold items of the given type.
+     */
+
+    template <typename T> const T* values(const Column_entry& entry) const
+    {
+        if (std::strcmp(entry.format, native_format<T>()) != 0) {
+            PyErr_Format(PyExc_TypeError,
+                "column %s of format '%s' does not hold the native type",
+                entry.name, entry.format);
+            throw Exc_set{};
+        }
+        return reinterpret_cast<const T*>(base() + entry.values_offset);
+    }
+
+    /** Gets a string in a column of strings as its bytes and size.
+     */
+
+    std::pair<const char*, std::size_t> str(
+        const Column_entry& entry, std::size_t idx) const
+    {
+        auto offsets = reinterpret_cast<const std::int64_t*>(
+            base() + entry.values_offset);
+        std::int64_t begin = offsets[idx];
+        std::int64_t end = offsets[idx + 1];
+        if (begin < 0 || end < begin
+            || static_cast<std::uint64_t>(end) > entry.data_nbytes) {
+            PyErr_Format(
+                PyExc_ValueError, "corrupt offsets in column %s", entry.name);
+            throw Exc_set{};
+        }
+        return { base() + entry.data_offset + begin,
+            static_cast<std::size_t>(end - begin) };
+    }
+
+private:
+    /** Tests if a block is inside the file and aligned.
+     */
+
+    bool check_block(std::uint64_t offset, std::uint64_t nbytes) const noexcept
+    {
+        return offset % 8 == 0 && offset <= region_.size()
+            && nbytes <= region_.size() - offset;
+    }
+
+    bool check_entry(const Column_entry& entry) const noexcept
+    {
+        if (std::memchr(entry.name, '\0', sizeof(entry.name)) == nullptr
+            || std::memchr(entry.format, '\0', sizeof(entry.format))
+                == nullptr
+            || !check_block(entry.values_offset, entry.values_nbytes)) {
+            return false;
+        }
+
+        if (std::strcmp(entry.format, "s") != 0) {
+            std::size_t itemsize = format_size(entry.format);
+            return itemsize > 0 && entry.n_items <= entry.values_nbytes
+                && entry.values_nbytes == entry.n_items * itemsize;
+        }
+
+        if (entry.n_items >= entry.values_nbytes
+            || entry.values_nbytes != (entry.n_items + 1) * sizeof(std::int64_t)
+            || !check_block(entry.data_offset, entry.data_nbytes)) {
+            return false;
+        }
+        auto offsets = reinterpret_cast<const std::int64_t*>(
+            base() + entry.values_offset);
+        return offsets[0] == 0
+            && static_cast<std::uint64_t>(offsets[entry.n_items])
+            == entry.data_nbytes;
+    }
+
+    /** Gets the item size of a supported format, or zero for others.
+     */
+
+    static std::size_t format_size(const char* format) noexcept
+    {
+        if (format[0] == '\0' || format[1] != '\0') {
+            return 0;
+        }
+        switch (format[0]) {
+        case 'b':
+        case 'B':
+            return 1;
+        case 'h':
+        case 'H':
+            return 2;
+        case 'i':
+        case 'I':
+        case 'f':
+            return 4;
+        case 'q':
+        case 'Q':
+        case 'd':
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    Mapped_region region_;
+    const Column_entry* entries_ = nullptr;
+    std::size_t n_columns_ = 0;
+};
+
+//
+// Python interface
+//
+
+/** Python type for the lazy sequences of strings in mapped memory.
+ *
+ * The strings are only decoded when they are accessed, and slices give
+ * lists.  The views keep their owners of the memory alive.
+ */
+
+class Str_view {
+public:
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        PyObject* owner;
+        const Column_reader* file;
+        const Column_entry* entry;
+    };
+
+    /** Gets the static type of the views.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.StrView", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_length = length;
+            seq_methods.sq_item = item;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Sequence of strings decoded when accessed.";
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a view of a column of strings in a file owned by an object.
+     */
+
+    static Handle create(
+        PyObject* owner, const Column_reader& file, const Column_entry& entry)
+    {
+        Handle res(type().tp()->tp_alloc(type().tp(), 0));
+        Obj* self = obj(res);
+        Py_INCREF(owner);
+        self->owner = owner;
+        self->file = &file;
+        self->entry = &entry;
+        return res;
+    }
+
+    /** Tests if the given object is a view of strings.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        Py_DECREF(obj(self)->owner);
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object of column %s with %zd strings>",
+            Py_TYPE(self)->tp_name, obj(self)->entry->name, length(self));
+    }
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(obj(self)->entry->n_items);
+    }
+
+    static PyObject* item(PyObject* self, Py_ssize_t i)
+    {
+        if (i < 0 || i >= length(self)) {
+            PyErr_SetString(PyExc_IndexError, "column index out of range");
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                auto bytes = obj(self)->file->str(
+                    *obj(self)->entry, static_cast<std::size_t>(i));
+                return PyUnicode_DecodeUTF8(bytes.first,
+                    static_cast<Py_ssize_t>(bytes.second), nullptr);
+            },
+            nullptr);
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        if (!PySlice_Check(key)) {
+            Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+            if (i == -1 && PyErr_Occurred()) {
+                return nullptr;
+            }
+            return item(self, i < 0 ? i + length(self) : i);
+        }
+
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(key, &start, &stop, &step) < 0) {
+            return nullptr;
+        }
+        Py_ssize_t n = PySlice_AdjustIndices(length(self), &start, &stop, step);
+
+        return catch_exc(
+            [&]() {
+                Handle res(PyList_New(n));
+                for (Py_ssize_t i = 0, j = start; i < n; ++i, j += step) {
+                    PyObject* str = item(self, j);
+                    if (str == nullptr) {
+                        throw Exc_set{};
+                    }
+                    PyList_SET_ITEM(res.get(), i, str);
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+};
+
+/** Python type for the column files opened.
+ *
+ * `ColumnFile(path)` maps the file, and the columns are got by their names,
+ * with numbers as read-only memory views of their formats, and strings as
+ * `StrView` objects, neither of which copies the data.  The names of the
+ * columns are given by `names()`.  The whole file is also exported read-only
+ * by the buffer protocol.
+ */
+
+class Column_file {
+public:
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Column_reader file;
+    };
+
+    /** Gets the static type of the column files.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.ColumnFile", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PyBufferProcs buffer_procs{};
+            buffer_procs.bf_getbuffer = get_buffer;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+
+            static PyMethodDef methods[] = {
+                { "names", (PyCFunction)py_names, METH_NOARGS,
+                    "Gets the names of the columns." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "File of native columns mapped into memory.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_as_buffer = &buffer_procs;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Tests if the given object is a column file.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the reader inside a Python column file.
+     */
+
+    static const Column_reader& file(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->file;
+    }
+
+private:
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "path", nullptr };
+        PyObject* path;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&:ColumnFile",
+                const_cast<char**>(kwlist), PyUnicode_FSConverter, &path)) {
+            return nullptr;
+        }
+        Handle path_bytes(path);
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        auto opened = catch_exc(
+            [&]() {
+                new (&reinterpret_cast<Obj*>(self)->file)
+                    Column_reader(PyBytes_AS_STRING(path));
+                return true;
+            },
+            false);
+        if (!opened) {
+            // The file is only unmapped by the deallocation once it is mapped.
+            tp->tp_free(self);
+            return nullptr;
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        reinterpret_cast<Obj*>(self)->file.~Column_reader();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object with %zu columns>",
+            Py_TYPE(self)->tp_name, file(self).size());
+    }
+
+    static int get_buffer(PyObject* self, Py_buffer* view, int flags)
+    {
+        const Column_reader& curr = file(self);
+        return PyBuffer_FillInfo(view, self, const_cast<char*>(curr.base()),
+            static_cast<Py_ssize_t>(curr.nbytes()), 1, flags);
+    }
+
+    //
+    // Mapping protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(file(self).size());
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                const char* name = PyUnicode_AsUTF8(key);
+                if (name == nullptr) {
+                    throw Exc_set{};
+                }
+                const Column_entry* entry = file(self).find(name);
+                if (entry == nullptr) {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    throw Exc_set{};
+                }
+                if (std::strcmp(entry->format, "s") == 0) {
+                    return Str_view::create(self, file(self), *entry).release();
+                }
+
+                auto begin = static_cast<Py_ssize_t>(entry->values_offset);
+                auto size = static_cast<Py_ssize_t>(entry->values_nbytes);
+                Handle whole(PyMemoryView_FromObject(self));
+                Handle bytes(PySequence_GetSlice(whole, begin, begin + size));
+                return PyObject_CallMethod(bytes, "cast", "s", entry->format);
+            },
+            nullptr);
+    }
+
+    static PyObject* py_names(PyObject* self, PyObject*)
+    {
+        return catch_exc(
+            [&]() {
+                const Column_reader& curr = file(self);
+                Handle res(PyList_New(static_cast<Py_ssize_t>(curr.size())));
+                for (std::size_t i = 0; i < curr.size(); ++i) {
+                    PyList_SET_ITEM(res.get(), static_cast<Py_ssize_t>(i),
+                        PyUnicode_FromString(curr.entry(i).name));
+                }
+                check_exc();
+                return res.release();
+            },
+            nullptr);
+    }
+};
+
+/** Writes a column from a Python object.
+ *
+ * String columns and sequences of strings are written as strings, buffers
+ * in their formats, and other sequences as 64-bit integers, or as doubles
+ * when any of their items is a float.
+ */
+
+inline void write_column(
+    Column_writer& writer, const char* name, PyObject* values)
+{
+    if (Str_column::check(values)) {
+        writer.add(name, Str_column::strs(values));
+        return;
+    }
+
+    if (PyObject_CheckBuffer(values)) {
+        Buffer buf(values);
+        const Py_buffer& view = buf.view();
+        const char* fmt = view.format == nullptr ? "B" : view.format;
+        if (*fmt == '@') {
+            ++fmt;
+        }
+        bool if_valid = fmt[0] != '\0' && fmt[1] == '\0';
+        bool if_float = if_valid && std::strchr("fd", fmt[0]) != nullptr;
+        bool if_signed = if_valid && std::strchr("bhilqn", fmt[0]) != nullptr;
+        bool if_unsigned
+            = if_valid && std::strchr("BHILQN?", fmt[0]) != nullptr;
+        const char* format = if_float || if_signed || if_unsigned
+            ? native_format(if_float, if_float || if_signed,
+                static_cast<std::size_t>(view.itemsize))
+            : nullptr;
+        writer.add(name, view.buf, static_cast<std::size_t>(buf.size()),
+            static_cast<std::size_t>(view.itemsize), format);
+        return;
+    }
+
+    Handle items(PySequence_Fast(values, "sequence expected"));
+    Py_ssize_t n_items = PySequence_Fast_GET_SIZE(items.get());
+    PyObject** objs = PySequence_Fast_ITEMS(items.get());
+    if (n_items > 0 && PyUnicode_Check(objs[0])) {
+        Packed_strs strs;
+        for (Py_ssize_t i = 0; i < n_items; ++i) {
+            Py_ssize_t size;
+            const char* data = PyUnicode_AsUTF8AndSize(objs[i], &size);
+            if (data == nullptr) {
+                throw Exc_set{};
+            }
+            strs.push_back(data, static_cast<std::size_t>(size));
+        }
+        writer.add(name, strs);
+        return;
+    }
+
+    bool if_float = false;
+    for (Py_ssize_t i = 0; i < n_items && !if_float; ++i) {
+        if_float = PyFloat_Check(objs[i]);
+    }
+    if (if_float) {
+        auto nums = Handle(items.get(), BORROW).as<std::vector<double>>();
+        writer.add(name, nums.data(), nums.size());
+    } else {
+        auto nums = Handle(items.get(), BORROW).as<std::vector<std::int64_t>>();
+        writer.add(name, nums.data(), nums.size());
+    }
+}
+
+/** Gets the module functions for the column files.
+ *
+ * `write_columns(path, columns)` writes a file of the columns in a mapping
+ * from their names, by `write_column`.
+ */
+
+inline PyMethodDef* column_file_methods()
+{
+    struct Funcs {
+        static PyObject* write_columns(PyObject*, PyObject* args)
+        {
+            PyObject* path;
+            PyObject* columns;
+            if (!PyArg_ParseTuple(args, "O&O:write_columns",
+                    PyUnicode_FSConverter, &path, &columns)) {
+                return nullptr;
+            }
+            Handle path_bytes(path);
+
+            return catch_exc(
+                [&]() -> PyObject* {
+                    Handle items(PyMapping_Items(columns));
+                    Column_writer writer(PyBytes_AS_STRING(path));
+                    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(items.get());
+                         ++i) {
+                        PyObject* item = PyList_GET_ITEM(items.get(), i);
+                        const char* name
+                            = PyUnicode_AsUTF8(PyTuple_GET_ITEM(item, 0));
+                        if (name == nullptr) {
+                            throw Exc_set{};
+                        }
+                        write_column(writer, name, PyTuple_GET_ITEM(item, 1));
+                    }
+                    writer.close();
+                    Py_RETURN_NONE;
+                },
+                nullptr);
+        }
+    };
+
+    static PyMethodDef defs[]
+        = { { "write_columns", (PyCFunction)Funcs::write_columns, METH_VARARGS,
+                "Writes a file of columns." },
+              { nullptr, nullptr, 0, nullptr } };
+    return defs;
+}
+
+// End of namespace cpypp
+}
+
+#endif
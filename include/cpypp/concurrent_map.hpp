@@ -0,0 +1,758 @@
+/** @file concurrent_map.hpp
+ *
+ * Hash maps safe for concurrent updates from many threads
+ *
+ * A dictionary shared by many threads, as for counters or caches, serializes
+ * all its updates.  The maps here are split into independently locked shards,
+ * selected by the hash of the keys, so that threads updating different keys
+ * rarely contend for the same lock.  Each shard takes whole cache lines of its
+ * own, so that the locks of neighbouring shards do not share cache lines
+ * either.
+ *
+ * Values can be native 64-bit counters or Python objects.  The counters can be
+ * updated by native threads without any interaction with the interpreter,
+ * while the Python type `Concurrent_map` gives the same table to Python code
+ * with the updates atomic for each key.  No Python code is ever run with a
+ * shard locked, so that shards are never held across a switch of the GIL.
+ */
+
+#ifndef CPYPP_CONCURRENT_MAP_HPP
+#define CPYPP_CONCURRENT_MAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Conversion of the keys of concurrent maps from and to Python objects.
+ *
+ * The hash here selects the shard by its high bits.  The static types for the
+ * maps are also named here.
+ */
+
+template <typename K> struct Concurrent_key;
+
+template <> struct Concurrent_key<std::int64_t> {
+    static const char* name() noexcept { return "cpypp.IntConcurrentMap"; }
+
+    static std::uint64_t hash(std::int64_t key) noexcept
+    {
+        // The finalizer of splitmix64, as for the integer tables.
+        std::uint64_t x = static_cast<std::uint64_t>(key);
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static std::int64_t from_py(PyObject* obj)
+    {
+        long long res = PyLong_AsLongLong(obj);
+        if (res == -1) {
+            check_exc();
+        }
+        return res;
+    }
+
+    static Handle to_py(std::int64_t key)
+    {
+        return { PyLong_FromLongLong(key) };
+    }
+};
+
+template <> struct Concurrent_key<std::string> {
+    static const char* name() noexcept { return "cpypp.StrConcurrentMap"; }
+
+    static std::uint64_t hash(const std::string& key) noexcept
+    {
+        return Concurrent_key<std::int64_t>::hash(
+            static_cast<std::int64_t>(std::hash<std::string>()(key)));
+    }
+
+    static std::string from_py(PyObject* obj)
+    {
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize(obj, &size);
+        if (data == nullptr) {
+            throw Exc_set{};
+        }
+        return { data, static_cast<std::size_t>(size) };
+    }
+
+    static Handle to_py(const std::string& key)
+    {
+        return { PyUnicode_FromStringAndSize(
+            key.data(), static_cast<Py_ssize_t>(key.size())) };
+    }
+};
+
+/** Values in concurrent tables.
+ *
+ * The value is the Python object when the handle is not empty, or the native
+ * counter otherwise.
+ */
+
+struct Concurrent_value {
+    Handle obj;
+    std::int64_t count;
+};
+
+/** Lock-striped hash table.
+ *
+ * Operations on single keys are atomic.  Operations involving the native
+ * counters only can be called from any thread, while object values can only
+ * be copied or released with the GIL held, or with an attached thread state in
+ * free-threaded builds.  Object values replaced in the arguments or removed
+ * from the table are always released after the shard is unlocked, in case
+ * their finalizers come back to the table.
+ */
+
+template <typename K> class Concurrent_table {
+public:
+    using Key = K;
+    using Value = Concurrent_value;
+
+    /** The size of the cache lines to keep the shards apart.
+     */
+
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    /** Constructs an empty table.
+     *
+     * The number of shards is rounded up to a power of two.
+     */
+
+    explicit Concurrent_table(std::size_t n_shards = 64)
+    {
+        while ((std::size_t(1) << shard_bits_) < n_shards) {
+            ++shard_bits_;
+        }
+        n_shards_ = std::size_t(1) << shard_bits_;
+
+        shards_.reset(new Shard[n_shards_]);
+    }
+
+    Concurrent_table(const Concurrent_table&) = delete;
+    Concurrent_table& operator=(const Concurrent_table&) = delete;
+
+    /** Gets the number of shards.
+     */
+
+    std::size_t n_shards() const noexcept { return n_shards_; }
+
+    /** Gets the number of entries.
+     *
+     * With concurrent updates, the result can be stale by the time it is
+     * returned.
+     */
+
+    std::size_t size() const noexcept
+    {
+        std::size_t res = 0;
+        for (std::size_t i = 0; i < n_shards_; ++i) {
+            res += shards_[i].size.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+
+    /** Adds to the counter for a key.
+     *
+     * Absent keys start from zero.  False is returned and nothing is changed
+     * when the key holds an object, otherwise the new count is set.
+     */
+
+    bool increment(const K& key, std::int64_t delta, std::int64_t& res)
+    {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        auto pos = shard.entries.find(key);
+        if (pos == shard.entries.end()) {
+            pos = shard.entries.emplace(key, Value{ {}, 0 }).first;
+            shard.size.fetch_add(1, std::memory_order_relaxed);
+        } else if (pos->second.obj) {
+            return false;
+        }
+        res = pos->second.count += delta;
+        return true;
+    }
+
+    /** Gets a copy of the value for a key.
+     *
+     * False is returned when the key is absent.
+     */
+
+    bool find(const K& key, Value& res) const
+    {
+        Value found{};
+        {
+            Shard& shard = shard_of(key);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto pos = shard.entries.find(key);
+            if (pos == shard.entries.end()) {
+                return false;
+            }
+            found = pos->second;
+        }
+        std::swap(res, found);
+        return true;
+    }
+
+    /** Gets the value for a key, inserting the given one when it is absent.
+     *
+     * The current value is copied to the argument.  True is returned when the
+     * given value is inserted.
+     */
+
+    bool setdefault(const K& key, Value& value)
+    {
+        Value found{};
+        {
+            Shard& shard = shard_of(key);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto res = shard.entries.emplace(key, value);
+            if (res.second) {
+                shard.size.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            found = res.first->second;
+        }
+        std::swap(value, found);
+        return false;
+    }
+
+    /** Sets the value for a key.
+     *
+     * The previous value is moved into the argument, with true returned when
+     * the key was present.
+     */
+
+    bool set(const K& key, Value& value)
+    {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        auto res = shard.entries.emplace(key, Value{});
+        if (res.second) {
+            shard.size.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::swap(res.first->second, value);
+        return !res.second;
+    }
+
+    /** Removes a key with its value moved into the argument.
+     *
+     * False is returned when the key is absent.
+     */
+
+    bool take(const K& key, Value& res)
+    {
+        Value found{};
+        {
+            Shard& shard = shard_of(key);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto pos = shard.entries.find(key);
+            if (pos == shard.entries.end()) {
+                return false;
+            }
+            std::swap(found, pos->second);
+            shard.entries.erase(pos);
+            shard.size.fetch_sub(1, std::memory_order_relaxed);
+        }
+        std::swap(res, found);
+        return true;
+    }
+
+    /** Removes all the entries.
+     */
+
+    void clear()
+    {
+        for (std::size_t i = 0; i < n_shards_; ++i) {
+            Entries removed{};
+            Shard& shard = shards_[i];
+            {
+                std::lock_guard<std::mutex> guard(shard.mutex);
+                removed.swap(shard.entries);
+                shard.size.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** Calls the action on all the entries.
+     *
+     * The shards are visited one after another, with the action called with
+     * the shard locked.  So the action must not run Python code or touch the
+     * table.  Updates concurrent to the visit may or may not be seen.
+     */
+
+    template <typename F> void for_each(F&& action) const
+    {
+        for (std::size_t i = 0; i < n_shards_; ++i) {
+            Shard& shard = shards_[i];
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            for (const auto& j : shard.entries) {
+                action(j.first, j.second);
+            }
+        }
+    }
+
+private:
+    struct Hash {
+        std::size_t operator()(const K& key) const noexcept
+        {
+            return static_cast<std::size_t>(Concurrent_key<K>::hash(key));
+        }
+    };
+
+    using Entries = std::unordered_map<K, Value, Hash>;
+
+    struct alignas(CACHE_LINE) Shard {
+        std::mutex mutex;
+        std::atomic<std::size_t> size{ 0 };
+        Entries entries;
+    };
+
+    Shard& shard_of(const K& key) const noexcept
+    {
+        if (shard_bits_ == 0) {
+            return shards_[0];
+        }
+        // The high bits are used, since the low bits select the buckets.
+        return shards_[Concurrent_key<K>::hash(key) >> (64 - shard_bits_)];
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    std::size_t n_shards_ = 1;
+    unsigned shard_bits_ = 0;
+};
+
+template <typename K> constexpr std::size_t Concurrent_table<K>::CACHE_LINE;
+
+/** Python mapping types backed by concurrent tables.
+ *
+ * The key type can be `std::int64_t` or `std::string`, giving the Python types
+ * `IntConcurrentMap` and `StrConcurrentMap` keyed by integers and strings
+ * respectively, with the number of shards given by the optional `shards`
+ * argument.  Integers fitting in 64 bits are stored as native counters, and
+ * all other values as objects.  Besides the mapping protocol, the types have
+ *
+ * - `get(key, default=None)` and `pop(key[, default])` as for dictionaries,
+ *
+ * - `setdefault(key, default=None)` atomically inserting the default for
+ *   absent keys, and returning the current value,
+ *
+ * - `increment(key, delta=1)` atomically adding to the counter for the key,
+ *   starting from zero, with the new count returned,
+ *
+ * - `keys()`, `values()`, `items()` and `clear()`, where the first three give
+ *   lists as snapshots of the entries.
+ *
+ * Iteration goes over a snapshot of the keys as well.
+ */
+
+template <typename K> class Concurrent_map {
+public:
+    using Table = Concurrent_table<K>;
+    using Conv = Concurrent_key<K>;
+
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Table table;
+    };
+
+    /** Gets the static type of the maps.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp(Conv::name(), sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_contains = contains;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+            map_methods.mp_ass_subscript = ass_subscript;
+
+            static PyMethodDef methods[] = {
+                { "get", (PyCFunction)py_get, METH_VARARGS,
+                    "Gets the value for a key, or the default." },
+                { "setdefault", (PyCFunction)py_setdefault, METH_VARARGS,
+                    "Gets the value for a key, inserting the default." },
+                { "increment", (PyCFunction)py_increment, METH_VARARGS,
+                    "Adds to the counter for a key." },
+                { "pop", (PyCFunction)py_pop, METH_VARARGS,
+                    "Removes a key and returns its value." },
+                { "keys", (PyCFunction)py_keys, METH_NOARGS,
+                    "Gets a list of the keys." },
+                { "values", (PyCFunction)py_values, METH_NOARGS,
+                    "Gets a list of the values." },
+                { "items", (PyCFunction)py_items, METH_NOARGS,
+                    "Gets a list of the key-value pairs." },
+                { "clear", (PyCFunction)py_clear, METH_NOARGS,
+                    "Removes all the entries." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+            tp->tp_doc = "Hash map with shards locked independently.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_traverse = traverse;
+            tp->tp_clear = clear;
+            tp->tp_repr = repr;
+            tp->tp_iter = iter;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new empty map.
+     */
+
+    static Handle create()
+    {
+        return { PyObject_CallObject(type().tp_obj(), nullptr) };
+    }
+
+    /** Tests if the given object is a map of this kind.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the native table inside a map.
+     *
+     * The given object must be a map of this kind.  The table can be used
+     * without the GIL for the native counters, as long as a reference to the
+     * map is kept.
+     */
+
+    static Table& table(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->table;
+    }
+
+private:
+    static Concurrent_value from_py(PyObject* obj)
+    {
+        if (PyLong_CheckExact(obj)) {
+            int overflow;
+            long long count = PyLong_AsLongLongAndOverflow(obj, &overflow);
+            if (overflow == 0) {
+                return { {}, count };
+            }
+        }
+        return { { obj, NEW }, 0 };
+    }
+
+    static Handle to_py(const Concurrent_value& value)
+    {
+        if (value.obj) {
+            return value.obj;
+        }
+        return { PyLong_FromLongLong(value.count) };
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "shards", nullptr };
+        Py_ssize_t n_shards = 64;
+        if (!PyArg_ParseTupleAndKeywords(
+                args, kwds, "|n", const_cast<char**>(kwlist), &n_shards)) {
+            return nullptr;
+        }
+        if (n_shards < 1) {
+            PyErr_SetString(PyExc_ValueError, "at least one shard is needed");
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        auto created = catch_exc(
+            [&]() {
+                new (&table(self)) Table(static_cast<std::size_t>(n_shards));
+                return true;
+            },
+            false);
+        if (!created) {
+            // The type is deallocated directly for the table not constructed.
+            PyObject_GC_Del(self);
+            return nullptr;
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        PyObject_GC_UnTrack(self);
+        table(self).~Table();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static int traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        int res = 0;
+        table(self).for_each([&](const K&, const Concurrent_value& value) {
+            if (res == 0 && value.obj) {
+                res = visit(value.obj.get(), arg);
+            }
+        });
+        return res;
+    }
+
+    static int clear(PyObject* self)
+    {
+        table(self).clear();
+        return 0;
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat(
+            "<%s object with %zu entries in %zu shards>",
+            Py_TYPE(self)->tp_name, table(self).size(),
+            table(self).n_shards());
+    }
+
+    //
+    // Mapping protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(table(self).size());
+    }
+
+    static int contains(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() {
+                Concurrent_value value{};
+                return table(self).find(Conv::from_py(key), value) ? 1 : 0;
+            },
+            -1);
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Concurrent_value value{};
+                if (!table(self).find(Conv::from_py(key), value)) {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    return nullptr;
+                }
+                return get_new(to_py(value));
+            },
+            nullptr);
+    }
+
+    static int ass_subscript(PyObject* self, PyObject* key, PyObject* value)
+    {
+        return catch_exc(
+            [&]() {
+                auto k = Conv::from_py(key);
+                Concurrent_value prev{};
+                if (value == nullptr) {
+                    if (!table(self).take(k, prev)) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return -1;
+                    }
+                    return 0;
+                }
+                prev = from_py(value);
+                table(self).set(k, prev);
+                return 0;
+            },
+            -1);
+    }
+
+    //
+    // Atomic methods
+    //
+
+    static PyObject* py_get(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* default_ = Py_None;
+        if (!PyArg_ParseTuple(args, "O|O:get", &key, &default_)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Concurrent_value value{};
+                if (!table(self).find(Conv::from_py(key), value)) {
+                    Py_INCREF(default_);
+                    return default_;
+                }
+                return get_new(to_py(value));
+            },
+            nullptr);
+    }
+
+    static PyObject* py_setdefault(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* default_ = Py_None;
+        if (!PyArg_ParseTuple(args, "O|O:setdefault", &key, &default_)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                auto k = Conv::from_py(key);
+                Concurrent_value value = from_py(default_);
+                table(self).setdefault(k, value);
+                return get_new(to_py(value));
+            },
+            nullptr);
+    }
+
+    static PyObject* py_increment(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        long long delta = 1;
+        if (!PyArg_ParseTuple(args, "O|L:increment", &key, &delta)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                std::int64_t res;
+                if (!table(self).increment(Conv::from_py(key), delta, res)) {
+                    PyErr_SetString(
+                        PyExc_TypeError, "value is not a native counter");
+                    return nullptr;
+                }
+                return PyLong_FromLongLong(res);
+            },
+            nullptr);
+    }
+
+    static PyObject* py_pop(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* default_ = nullptr;
+        if (!PyArg_ParseTuple(args, "O|O:pop", &key, &default_)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Concurrent_value value{};
+                if (!table(self).take(Conv::from_py(key), value)) {
+                    if (default_ == nullptr) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return nullptr;
+                    }
+                    Py_INCREF(default_);
+                    return default_;
+                }
+                return get_new(to_py(value));
+            },
+            nullptr);
+    }
+
+    //
+    // Snapshots
+    //
+
+    /** Makes a list from a snapshot of the entries.
+     *
+     * The entries are copied out of the table before any Python object is
+     * created for the keys or the values.
+     */
+
+    template <typename F> static PyObject* snapshot(PyObject* self, F&& conv)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                std::vector<std::pair<K, Concurrent_value>> entries{};
+                entries.reserve(table(self).size());
+                table(self).for_each(
+                    [&](const K& key, const Concurrent_value& value) {
+                        entries.emplace_back(key, value);
+                    });
+
+                Handle res(PyList_New(0));
+                for (const auto& i : entries) {
+                    if (PyList_Append(res, conv(i.first, i.second)) < 0) {
+                        return nullptr;
+                    }
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_keys(PyObject* self, PyObject*)
+    {
+        return snapshot(self, [](const K& key, const Concurrent_value&) {
+            return Conv::to_py(key);
+        });
+    }
+
+    static PyObject* py_values(PyObject* self, PyObject*)
+    {
+        return snapshot(self, [](const K&, const Concurrent_value& value) {
+            return to_py(value);
+        });
+    }
+
+    static PyObject* py_items(PyObject* self, PyObject*)
+    {
+        return snapshot(self, [](const K& key, const Concurrent_value& value) {
+            return Handle(PyTuple_Pack(2, Conv::to_py(key).get(),
+                to_py(value).get()));
+        });
+    }
+
+    static PyObject* py_clear(PyObject* self, PyObject*)
+    {
+        table(self).clear();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* iter(PyObject* self)
+    {
+        Handle keys(py_keys(self, nullptr));
+        return PyObject_GetIter(keys);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
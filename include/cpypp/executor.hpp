@@ -0,0 +1,395 @@
+/** @file executor.hpp
+ *
+ * Batched calls into Python from many native threads
+ *
+ * When many native threads call Python callbacks each taking the GIL by
+ * `PyGILState_Ensure`, the GIL is handed over for every single call, which
+ * quickly dominates the cost of the calls.  The executor here lets the native
+ * threads submit the calls as jobs to a lock-free queue instead, to be run in
+ * batches by a single thread holding the GIL, with the results given back by
+ * futures.  The GIL is then taken once for each batch rather than each call.
+ */
+
+#ifndef CPYPP_EXECUTOR_HPP
+#define CPYPP_EXECUTOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/futex.hpp>
+
+namespace cpypp {
+
+/** C++ exception for Python exceptions raised by calls from other threads.
+ *
+ * The message gives the name of the Python exception type and its string
+ * form.  The Python exception itself is not kept, since it can only be
+ * touched with the GIL held.
+ */
+
+class Call_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+
+    /** Makes an error from the current Python exception, which is cleared.
+     */
+
+    static Call_error fetch()
+    {
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        PyErr_NormalizeException(&type, &value, &traceback);
+        Handle type_h(type, STEAL, true);
+        Handle value_h(value, STEAL, true);
+        Handle traceback_h(traceback, STEAL, true);
+
+        std::string msg = type != nullptr
+            ? reinterpret_cast<PyTypeObject*>(type)->tp_name
+            : "unknown error";
+        PyObject* str = value != nullptr ? PyObject_Str(value) : nullptr;
+        if (str != nullptr) {
+            const char* content = PyUnicode_AsUTF8(str);
+            if (content != nullptr && *content != '\0') {
+                msg.append(": ").append(content);
+            }
+            Py_DECREF(str);
+        }
+        PyErr_Clear();
+        return Call_error(msg);
+    }
+};
+
+/** Executor running calls from native threads in batches.
+ *
+ * Jobs can be submitted from any thread, with or without the GIL.  They are
+ * run either by the thread started by `start`, which takes the GIL for each
+ * batch of up to the given number of jobs, or by `run_pending` called by
+ * threads already holding the GIL, but not both.  The executor must be stopped
+ * before the interpreter is finalized.
+ */
+
+class Batch_executor {
+public:
+    explicit Batch_executor(std::size_t max_batch = 64)
+        : max_batch_{ max_batch > 0 ? max_batch : 1 }
+    {
+    }
+
+    Batch_executor(const Batch_executor&) = delete;
+    Batch_executor& operator=(const Batch_executor&) = delete;
+
+    /** Stops the executor with all the submitted jobs run.
+     *
+     * Jobs that can no longer be run, for executors never started, have their
+     * futures broken.  They are destroyed with the GIL held while the
+     * interpreter is alive.
+     */
+
+    ~Batch_executor()
+    {
+        stop();
+        if (!has_jobs()) {
+            return;
+        }
+        if (Py_IsInitialized()) {
+            Gil_acquire gil{};
+            drop_pending();
+        } else {
+            drop_pending();
+        }
+    }
+
+    /** Submits a call of the given callable with the given arguments.
+     *
+     * The callable is only borrowed, so it needs to be kept alive until the
+     * call is made.  The arguments are stored natively and converted into
+     * Python objects by `Handle::call` when the call is made, so they cannot
+     * be Python objects themselves, whose reference counts could not be
+     * touched by threads without the GIL.  The result is read by `Handle::as`
+     * into the given type, unless it is `void`.  Python exceptions from the
+     * call are set on the future as `Call_error`.
+     */
+
+    template <typename R, typename... Args>
+    std::future<R> submit(const Handle& callable, Args&&... args)
+    {
+        static_assert(
+            !Has_python_arg<typename std::decay<Args>::type...>::value,
+            "Python objects cannot be submitted as arguments");
+        auto job = new Call_job<R, typename std::decay<Args>::type...>(
+            callable.get(), std::forward<Args>(args)...);
+        auto res = job->promise.get_future();
+        push(job);
+        return res;
+    }
+
+    /** Starts the thread running the jobs.
+     */
+
+    void start()
+    {
+        if (!thread_.joinable()) {
+            if_stopping_.store(false);
+            thread_ = std::thread([this]() { serve(); });
+        }
+    }
+
+    /** Stops the thread running the jobs after all submitted jobs are run.
+     *
+     * The GIL is released while waiting for the thread, if it is held.
+     */
+
+    void stop()
+    {
+        if (!thread_.joinable()) {
+            return;
+        }
+        if_stopping_.store(true);
+        has_jobs_.notify();
+
+        if (holds_gil()) {
+            Gil_release released{};
+            thread_.join();
+        } else {
+            thread_.join();
+        }
+    }
+
+    /** Runs up to the given number of pending jobs with the GIL held.
+     *
+     * The number of jobs run is returned, which is zero when another thread
+     * is running the jobs.
+     */
+
+    std::size_t run_pending(std::size_t max_jobs)
+    {
+        if (if_running_.exchange(true, std::memory_order_acquire)) {
+            return 0;
+        }
+
+        std::size_t n_run = 0;
+        while (n_run < max_jobs) {
+            Job* job = take_ready();
+            if (job == nullptr) {
+                break;
+            }
+            job->run();
+            delete job;
+            ++n_run;
+        }
+
+        if (n_run > 0) {
+            n_batches_.fetch_add(1, std::memory_order_relaxed);
+            n_jobs_.fetch_add(n_run, std::memory_order_relaxed);
+        }
+        if_running_.store(false, std::memory_order_release);
+        return n_run;
+    }
+
+    /** Gets the number of non-empty batches run.
+     */
+
+    std::size_t n_batches() const noexcept { return n_batches_.load(); }
+
+    /** Gets the number of jobs run.
+     */
+
+    std::size_t n_jobs() const noexcept { return n_jobs_.load(); }
+
+private:
+    /** Jobs in the intrusive queue.
+     */
+
+    struct Job {
+        Job* next = nullptr;
+
+        virtual ~Job() = default;
+
+        /** Runs the job with the GIL held, without throwing.
+         */
+
+        virtual void run() noexcept = 0;
+    };
+
+    /** Tests if any of the given types are Python objects.
+     */
+
+    template <typename... Args> struct Has_python_arg : std::false_type {
+    };
+
+    template <typename Arg, typename... Args>
+    struct Has_python_arg<Arg, Args...>
+        : std::integral_constant<bool,
+              std::is_convertible<Arg, PyObject*>::value
+                  || std::is_base_of<Handle, Arg>::value
+                  || Has_python_arg<Args...>::value> {
+    };
+
+    template <typename R> struct Job_result {
+        static void set(std::promise<R>& promise, const Handle& res)
+        {
+            promise.set_value(res.as<R>());
+        }
+    };
+
+    template <typename R, typename... Args> struct Call_job : Job {
+        template <typename... Given>
+        Call_job(PyObject* callable, Given&&... args)
+            : callable{ callable, BORROW }
+            , args{ std::forward<Given>(args)... }
+        {
+        }
+
+        void run() noexcept override
+        {
+            try {
+                Handle res = call(std::index_sequence_for<Args...>{});
+                Job_result<R>::set(promise, res);
+            } catch (const Exc_set&) {
+                promise.set_exception(
+                    std::make_exception_ptr(Call_error::fetch()));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        template <std::size_t... Is> Handle call(std::index_sequence<Is...>)
+        {
+            return callable.call(std::get<Is>(args)...);
+        }
+
+        Handle callable;
+        std::tuple<Args...> args;
+        std::promise<R> promise;
+    };
+
+    /** Pushes a job onto the stack of submitted jobs.
+     */
+
+    void push(Job* job) noexcept
+    {
+        job->next = submitted_.load(std::memory_order_relaxed);
+        while (!submitted_.compare_exchange_weak(job->next, job,
+            std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        has_jobs_.notify();
+    }
+
+    /** Takes the next job in the order of submission.
+     *
+     * The submitted jobs are only moved into the ready list, in reversed
+     * order, when the ready list is empty.  So this can only be called by the
+     * thread running the jobs.
+     */
+
+    Job* take_ready() noexcept
+    {
+        if (ready_ == nullptr) {
+            Job* submitted
+                = submitted_.exchange(nullptr, std::memory_order_acquire);
+            while (submitted != nullptr) {
+                Job* next = submitted->next;
+                submitted->next = ready_;
+                ready_ = submitted;
+                submitted = next;
+            }
+        }
+
+        Job* res = ready_;
+        if (res != nullptr) {
+            ready_ = res->next;
+        }
+        return res;
+    }
+
+    /** Destroys the jobs never run, with their futures broken.
+     */
+
+    void drop_pending() noexcept
+    {
+        for (Job* job = take_ready(); job != nullptr; job = take_ready()) {
+            delete job;
+        }
+    }
+
+    bool has_jobs() const noexcept
+    {
+        return ready_ != nullptr
+            || submitted_.load(std::memory_order_acquire) != nullptr;
+    }
+
+    /** Runs the jobs in batches until stopped.
+     *
+     * The thread keeps a thread state of the main interpreter for its whole
+     * life, bound in `Thread_binding`, so that each batch only takes the GIL,
+     * and the thread-local Python state is kept between the batches.
+     */
+
+    void serve()
+    {
+        Thread_binding& binding = Thread_binding::current();
+        binding.tstate = PyThreadState_New(PyInterpreterState_Main());
+
+        for (;;) {
+            if (!has_jobs()) {
+                auto key = has_jobs_.prepare();
+                if (has_jobs()) {
+                    has_jobs_.cancel();
+                } else if (if_stopping_.load()) {
+                    has_jobs_.cancel();
+                    break;
+                } else {
+                    has_jobs_.wait(key);
+                    continue;
+                }
+            }
+
+            Gil_acquire gil{};
+            run_pending(max_batch_);
+        }
+
+        if (binding.tstate != nullptr) {
+            PyEval_RestoreThread(binding.tstate);
+            PyThreadState_Clear(binding.tstate);
+            PyThreadState_DeleteCurrent();
+            binding.tstate = nullptr;
+        }
+    }
+
+    std::size_t max_batch_;
+
+    std::atomic<Job*> submitted_{ nullptr };
+    Job* ready_ = nullptr;
+    Event_count has_jobs_;
+
+    std::thread thread_;
+    std::atomic<bool> if_stopping_{ false };
+    std::atomic<bool> if_running_{ false };
+
+    std::atomic<std::size_t> n_batches_{ 0 };
+    std::atomic<std::size_t> n_jobs_{ 0 };
+};
+
+template <> struct Batch_executor::Job_result<void> {
+    static void set(std::promise<void>& promise, const Handle&)
+    {
+        promise.set_value();
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,635 @@
+/** @file footprint.hpp
+ *
+ * Deep memory footprints of graphs of Python objects
+ *
+ * `sys.getsizeof` only gives the size of a single object, and walking the
+ * graphs of objects in Python code is far too slow for large heaps.  The
+ * walker here follows the references reported by `tp_traverse` natively, with
+ * each object counted once by its identity, and sums the sizes of the objects
+ * rounded up to the blocks actually taken from the allocators.  The sizes are
+ * grouped by the types of the objects and by the prefixes of the paths from
+ * the root where the objects are first reached.
+ */
+
+#ifndef CPYPP_FOOTPRINT_HPP
+#define CPYPP_FOOTPRINT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/int_map.hpp>
+
+namespace cpypp {
+
+/** Options for walking the graphs of objects.
+ */
+
+struct Footprint_options {
+    /** Number of steps from the root kept in the paths grouping the sizes.
+     */
+
+    std::size_t path_depth = 2;
+
+    /** If functions, methods, code objects and frames are walked into.
+     *
+     * They are not by default, since functions refer to their globals, which
+     * usually reach most of the heap.  Types and modules are never walked
+     * into, unless they are the root.
+     */
+
+    bool if_follow_callables = false;
+
+    /** Maximum number of objects walked, with zero for no limit.
+     */
+
+    std::size_t max_objects = 0;
+};
+
+/** Number of objects and bytes for a group in the footprints.
+ */
+
+struct Footprint_group {
+    std::string name;
+    std::size_t n_objects = 0;
+    std::size_t n_bytes = 0;
+};
+
+/** Report of the deep memory footprint of a graph of objects.
+ *
+ * The groups by types and by paths are sorted by the bytes in decreasing
+ * order.  The paths are written like Python expressions from the root `$`,
+ * with `[*]` for any item of sequences and sets and `.*` for references from
+ * other objects, like the attributes of instances without a dictionary.
+ */
+
+struct Footprint {
+    std::size_t n_objects = 0;
+    std::size_t n_bytes = 0;
+    bool if_truncated = false;
+    std::vector<Footprint_group> by_type;
+    std::vector<Footprint_group> by_path;
+
+    /** Makes the report for Python.
+     *
+     * The report is a `cpypp.Footprint` struct sequence, with the groups as
+     * dictionaries from the names to pairs of the numbers of objects and
+     * bytes.
+     */
+
+    Handle to_py() const
+    {
+        Struct_sequence res(type());
+        res.setitem(0, Handle(PyLong_FromSize_t(n_objects)));
+        res.setitem(1, Handle(PyLong_FromSize_t(n_bytes)));
+        res.setitem(2, groups_to_py(by_type));
+        res.setitem(3, groups_to_py(by_path));
+        res.setitem(4, Handle(PyBool_FromLong(if_truncated)));
+        return std::move(res);
+    }
+
+    /** Gets the static type of the reports for Python.
+     */
+
+    static Static_type& type()
+    {
+        static PyStructSequence_Field fields[]
+            = { { "n_objects", "Number of objects reached." },
+                  { "n_bytes", "Number of bytes allocated for the objects." },
+                  { "by_type", "Objects and bytes for each type." },
+                  { "by_path", "Objects and bytes for each path prefix." },
+                  { "truncated", "If the walk stopped at the object limit." },
+                  { nullptr, nullptr } };
+        static PyStructSequence_Desc desc = { "cpypp.Footprint",
+            "Deep memory footprint of a graph of objects.", fields, 5 };
+        static Static_type tp{};
+        tp.make_ready(desc);
+        return tp;
+    }
+
+    /** Gets the Python functions computing footprints.
+     *
+     * The only function is `footprint(obj, path_depth=2)`, giving the report
+     * for Python.  It can be added to modules by `PyModule_AddFunctions`.
+     */
+
+    static PyMethodDef* methods();
+
+private:
+    static Handle groups_to_py(const std::vector<Footprint_group>& groups)
+    {
+        Handle res(PyDict_New());
+        for (const auto& i : groups) {
+            Handle value(Py_BuildValue("(nn)",
+                static_cast<Py_ssize_t>(i.n_objects),
+                static_cast<Py_ssize_t>(i.n_bytes)));
+            if (PyDict_SetItemString(res, i.name.c_str(), value) < 0) {
+                throw Exc_set{};
+            }
+        }
+        return res;
+    }
+};
+
+/** Walker of the graphs of objects for their footprints.
+ *
+ * The GIL needs to be held for the entire walk.  The objects waiting to be
+ * walked, and the ones referred to by the object being expanded, are kept
+ * alive by the walker, in case any `__sizeof__` implemented in Python changes
+ * the graph.
+ */
+
+class Footprint_walker {
+public:
+    explicit Footprint_walker(const Footprint_options& options = {})
+        : options_(options)
+    {
+        prefixes_.push_back({ 0, "$", {} });
+    }
+
+    /** Walks the graph from the root, with the report returned.
+     */
+
+    Footprint walk(PyObject* root)
+    {
+        add(root, 0, 0, false, true);
+
+        while (!stack_.empty()) {
+            Pending pending = stack_.back();
+            stack_.pop_back();
+            Handle obj(pending.obj, STEAL);
+            expand(pending);
+        }
+
+        return report();
+    }
+
+    /** Gets the size of the block the allocators give for the given size.
+     *
+     * Small blocks are served by pymalloc in classes rounded to sixteen
+     * bytes, while larger ones go to the system allocator, where each chunk
+     * of glibc takes a header word and is also aligned to sixteen bytes.
+     */
+
+    static std::size_t allocated(std::size_t size) noexcept
+    {
+        if (size == 0) {
+            return 0;
+        }
+        if (size <= SMALL_REQUEST_THRESHOLD) {
+            return (size + 15) & ~std::size_t(15);
+        }
+        return std::max<std::size_t>(
+            32, (size + sizeof(void*) + 15) & ~std::size_t(15));
+    }
+
+    /** Gets the size by `__sizeof__` of common built-in objects natively.
+     *
+     * The common built-in types all have their own `__sizeof__`, which would
+     * cost a call of a Python method for each of them.  False is returned
+     * for the other objects.
+     */
+
+    static bool builtin_size(PyObject* obj, std::size_t& size) noexcept
+    {
+        PyTypeObject* tp = Py_TYPE(obj);
+        std::size_t basic = static_cast<std::size_t>(tp->tp_basicsize);
+
+        // Integers always have a digit allocated, and booleans the layout of
+        // integers.
+        if (tp == &PyLong_Type || tp == &PyBool_Type) {
+#if PY_VERSION_HEX >= 0x030C0000
+            // The tag keeps the sign and flags below the count of digits.
+            Py_ssize_t n_digits = static_cast<Py_ssize_t>(
+                reinterpret_cast<PyLongObject*>(obj)->long_value.lv_tag >> 3);
+#else
+            Py_ssize_t n_digits = Py_SIZE(obj) < 0 ? -Py_SIZE(obj)
+                                                    : Py_SIZE(obj);
+#endif
+            size = static_cast<std::size_t>(PyLong_Type.tp_basicsize)
+                + static_cast<std::size_t>(PyLong_Type.tp_itemsize)
+                    * static_cast<std::size_t>(
+                        std::max<Py_ssize_t>(n_digits, 1));
+            return true;
+        }
+
+        if (tp == &PyUnicode_Type) {
+            if (!PyUnicode_IS_COMPACT(obj)) {
+                return false;
+            }
+#if PY_VERSION_HEX < 0x030C0000
+            if (reinterpret_cast<PyASCIIObject*>(obj)->wstr != nullptr) {
+                return false;
+            }
+#endif
+            std::size_t len
+                = static_cast<std::size_t>(PyUnicode_GET_LENGTH(obj)) + 1;
+            if (PyUnicode_IS_COMPACT_ASCII(obj)) {
+                size = sizeof(PyASCIIObject) + len;
+                return true;
+            }
+            auto compact = reinterpret_cast<PyCompactUnicodeObject*>(obj);
+            size = sizeof(PyCompactUnicodeObject) + len * PyUnicode_KIND(obj);
+            if (compact->utf8 != nullptr) {
+                size += static_cast<std::size_t>(compact->utf8_length) + 1;
+            }
+            return true;
+        }
+
+        if (tp == &PyList_Type) {
+            size = basic
+                + static_cast<std::size_t>(
+                      reinterpret_cast<PyListObject*>(obj)->allocated)
+                    * sizeof(PyObject*);
+            return true;
+        }
+
+        if (tp == &PySet_Type || tp == &PyFrozenSet_Type) {
+            auto set = reinterpret_cast<PySetObject*>(obj);
+            size = basic;
+            if (set->table != set->smalltable) {
+                size += static_cast<std::size_t>(set->mask + 1)
+                    * sizeof(setentry);
+            }
+            return true;
+        }
+
+#if PY_VERSION_HEX < 0x030D0000
+        if (tp == &PyDict_Type) {
+            size = static_cast<std::size_t>(
+                _PyDict_SizeOf(reinterpret_cast<PyDictObject*>(obj)));
+            return true;
+        }
+#endif
+
+        if (tp == &PyBytes_Type) {
+            size = basic
+                + static_cast<std::size_t>(tp->tp_itemsize)
+                    * static_cast<std::size_t>(Py_SIZE(obj));
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static constexpr std::size_t SMALL_REQUEST_THRESHOLD = 512;
+
+    /** Objects waiting to be walked, with a strong reference.
+     */
+
+    struct Pending {
+        PyObject* obj;
+        std::uint32_t prefix;
+        std::uint32_t depth;
+        bool if_attrs;
+    };
+
+    struct Prefix {
+        std::uint32_t parent;
+        std::string label;
+        Footprint_group group;
+    };
+
+    /** Information cached for the types reached.
+     */
+
+    struct Type_info {
+        PyTypeObject* tp;
+        bool if_plain_sizeof;
+        bool if_opaque;
+        Footprint_group group;
+    };
+
+    /** Counts an object reached for the first time, to be walked later.
+     *
+     * Instance dictionaries are marked to have their keys written as
+     * attributes in the paths.
+     */
+
+    void add(PyObject* obj, std::uint32_t prefix, std::uint32_t depth,
+        bool if_attrs, bool if_root = false)
+    {
+        if (!seen_.emplace(reinterpret_cast<std::intptr_t>(obj)).second) {
+            return;
+        }
+        Type_info& info = type_info(Py_TYPE(obj));
+        if (info.if_opaque && !if_root) {
+            return;
+        }
+
+        std::size_t n_bytes = size_of(obj, info);
+        ++n_objects_;
+        n_bytes_ += n_bytes;
+        ++info.group.n_objects;
+        info.group.n_bytes += n_bytes;
+        Footprint_group& group = prefixes_[prefix].group;
+        ++group.n_objects;
+        group.n_bytes += n_bytes;
+
+        if (Py_TYPE(obj)->tp_traverse != nullptr) {
+            Py_INCREF(obj);
+            stack_.push_back({ obj, prefix, depth, if_attrs });
+        }
+    }
+
+    /** Adds the objects referred to by an object being walked.
+     */
+
+    void expand(const Pending& pending)
+    {
+        PyObject* obj = pending.obj;
+        std::uint32_t depth = pending.depth + 1;
+        bool if_labelled = depth <= options_.path_depth;
+
+        // The references are taken before any of them is added, since
+        // adding them can run Python code changing the object.
+        if (PyDict_Check(obj)) {
+            children_.clear();
+            Py_ssize_t pos = 0;
+            PyObject *key, *value;
+            while (PyDict_Next(obj, &pos, &key, &value)) {
+                children_.emplace_back(key, NEW);
+                children_.emplace_back(value, NEW);
+            }
+            for (std::size_t i = 0; i < children_.size() && !is_full();
+                 i += 2) {
+                PyObject* key = children_[i].get();
+                add(key, pending.prefix, depth, false);
+                std::uint32_t prefix = pending.prefix;
+                if (if_labelled) {
+                    prefix = child(prefix, key_label(key, pending.if_attrs));
+                }
+                add(children_[i + 1].get(), prefix, depth, false);
+            }
+            // Subclasses can have other references to be traversed.
+            if (PyDict_CheckExact(obj)) {
+                return;
+            }
+        }
+
+        std::uint32_t prefix = pending.prefix;
+        bool if_items = PyList_Check(obj) || PyTuple_Check(obj)
+            || PyAnySet_Check(obj);
+        if (if_labelled && !PyDict_Check(obj)) {
+            prefix = child(prefix, if_items ? "[*]" : ".*");
+        }
+
+        children_.clear();
+        Py_TYPE(obj)->tp_traverse(obj, collect, &children_);
+        for (const Handle& i : children_) {
+            if (is_full()) {
+                break;
+            }
+            // Dictionaries directly referred to by instances hold attributes.
+            bool if_attrs
+                = !if_items && !PyDict_Check(obj) && PyDict_Check(i.get());
+            add(i.get(), if_attrs ? pending.prefix : prefix, depth, if_attrs);
+        }
+    }
+
+    bool is_full() noexcept
+    {
+        if (options_.max_objects > 0 && n_objects_ >= options_.max_objects) {
+            if_truncated_ = true;
+            return true;
+        }
+        return false;
+    }
+
+    static int collect(PyObject* obj, void* arg)
+    {
+        if (obj != nullptr) {
+            static_cast<std::vector<Handle>*>(arg)->emplace_back(obj, NEW);
+        }
+        return 0;
+    }
+
+    /** Gets the label of a key in the paths.
+     */
+
+    static std::string key_label(PyObject* key, bool if_attrs)
+    {
+        constexpr Py_ssize_t max_len = 40;
+        if (!PyUnicode_Check(key)) {
+            return "[*]";
+        }
+        Py_ssize_t len = 0;
+        const char* content = PyUnicode_AsUTF8AndSize(key, &len);
+        if (content == nullptr) {
+            PyErr_Clear();
+            return "[*]";
+        }
+        std::string name(content, std::min(len, max_len));
+        if (len > max_len) {
+            name.append("...");
+        }
+        return if_attrs ? "." + name : "['" + name + "']";
+    }
+
+    /** Gets the index of the child of a path prefix with the given label.
+     */
+
+    std::uint32_t child(std::uint32_t parent, std::string label)
+    {
+        auto res = children_of_.emplace(
+            std::make_pair(parent, std::move(label)), 0);
+        if (res.second) {
+            res.first->second = static_cast<std::uint32_t>(prefixes_.size());
+            prefixes_.push_back({ parent, res.first->first.second, {} });
+        }
+        return res.first->second;
+    }
+
+    Type_info& type_info(PyTypeObject* tp)
+    {
+        auto res = types_.emplace(reinterpret_cast<std::intptr_t>(tp));
+        if (!res.second) {
+            return infos_[*res.first];
+        }
+
+        static PyObject* sizeof_name = PyUnicode_InternFromString("__sizeof__");
+        static PyObject* plain_sizeof
+            = _PyType_Lookup(&PyBaseObject_Type, sizeof_name);
+        bool if_opaque = PyType_IsSubtype(tp, &PyType_Type)
+            || PyType_IsSubtype(tp, &PyModule_Type);
+        if (!options_.if_follow_callables) {
+            if_opaque = if_opaque || tp == &PyFunction_Type
+                || tp == &PyCFunction_Type || tp == &PyCMethod_Type
+                || tp == &PyMethod_Type || tp == &PyCode_Type
+                || tp == &PyFrame_Type;
+        }
+
+        *res.first = infos_.size();
+        infos_.push_back({ tp, _PyType_Lookup(tp, sizeof_name) == plain_sizeof,
+            if_opaque, {} });
+        return infos_.back();
+    }
+
+    /** Gets the number of bytes allocated for an object.
+     *
+     * The size is the one by `__sizeof__` with the headers before the object
+     * added, like `sys.getsizeof`.  For types with their own `__sizeof__` but
+     * without items stored in the object, the part beyond the basic size is
+     * taken to be a separate buffer for the rounding, like for lists,
+     * dictionaries and sets.
+     */
+
+    static std::size_t size_of(PyObject* obj, const Type_info& info)
+    {
+        PyTypeObject* tp = info.tp;
+        std::size_t basic = static_cast<std::size_t>(tp->tp_basicsize);
+        std::size_t size = basic;
+        if (info.if_plain_sizeof) {
+            Py_ssize_t n_items = Py_SIZE(obj);
+            size += static_cast<std::size_t>(tp->tp_itemsize)
+                * static_cast<std::size_t>(n_items < 0 ? -n_items : n_items);
+        } else if (!builtin_size(obj, size)) {
+            PyObject* res = PyObject_CallMethod(obj, "__sizeof__", nullptr);
+            Py_ssize_t value = res != nullptr ? PyLong_AsSsize_t(res) : -1;
+            Py_XDECREF(res);
+            if (value < 0) {
+                PyErr_Clear();
+            } else {
+                size = static_cast<std::size_t>(value);
+            }
+        }
+
+        // The header for the garbage collector, and the pointers of the
+        // managed dictionary before the object.
+        std::size_t header = 0;
+        if (PyObject_IS_GC(obj)) {
+            header += 2 * sizeof(void*);
+        }
+#ifdef Py_TPFLAGS_MANAGED_DICT
+        if (PyType_HasFeature(tp, Py_TPFLAGS_MANAGED_DICT)) {
+            header += 2 * sizeof(void*);
+        }
+#endif
+
+        bool if_inline = info.if_plain_sizeof || tp->tp_itemsize > 0
+            || PyUnicode_Check(obj) || size <= basic;
+        if (if_inline) {
+            return allocated(header + size);
+        }
+        return allocated(header + basic) + allocated(size - basic);
+    }
+
+    /** Makes the report, with the groups sorted.
+     */
+
+    Footprint report() const
+    {
+        Footprint res{};
+        res.n_objects = n_objects_;
+        res.n_bytes = n_bytes_;
+        res.if_truncated = if_truncated_;
+
+        std::map<std::string, Footprint_group> by_type{};
+        for (const auto& i : infos_) {
+            if (i.group.n_objects > 0) {
+                Footprint_group& group = by_type[i.tp->tp_name];
+                group.n_objects += i.group.n_objects;
+                group.n_bytes += i.group.n_bytes;
+            }
+        }
+        for (auto& i : by_type) {
+            i.second.name = i.first;
+            res.by_type.push_back(std::move(i.second));
+        }
+
+        for (std::uint32_t i = 0; i < prefixes_.size(); ++i) {
+            if (prefixes_[i].group.n_objects == 0) {
+                continue;
+            }
+            std::string path{};
+            for (std::uint32_t j = i; j != 0; j = prefixes_[j].parent) {
+                path.insert(0, prefixes_[j].label);
+            }
+            path.insert(0, prefixes_[0].label);
+            res.by_path.push_back(prefixes_[i].group);
+            res.by_path.back().name = std::move(path);
+        }
+
+        auto by_bytes = [](const Footprint_group& a, const Footprint_group& b) {
+            return a.n_bytes > b.n_bytes;
+        };
+        std::sort(res.by_type.begin(), res.by_type.end(), by_bytes);
+        std::sort(res.by_path.begin(), res.by_path.end(), by_bytes);
+        return res;
+    }
+
+    Footprint_options options_;
+
+    Int_table<char> seen_;
+    std::vector<Pending> stack_;
+    std::vector<Handle> children_;
+
+    Int_table<std::size_t> types_;
+    std::vector<Type_info> infos_;
+
+    std::vector<Prefix> prefixes_;
+    std::map<std::pair<std::uint32_t, std::string>, std::uint32_t>
+        children_of_;
+
+    std::size_t n_objects_ = 0;
+    std::size_t n_bytes_ = 0;
+    bool if_truncated_ = false;
+};
+
+/** Computes the deep memory footprint of the graph from the given object.
+ */
+
+inline Footprint footprint(
+    const Handle& root, const Footprint_options& options = {})
+{
+    Footprint_walker walker(options);
+    return walker.walk(root.get());
+}
+
+inline PyMethodDef* Footprint::methods()
+{
+    struct Funcs {
+        static PyObject* footprint(
+            PyObject*, PyObject* args, PyObject* kwargs)
+        {
+            static const char* kwlist[] = { "obj", "path_depth", nullptr };
+            PyObject* obj;
+            Py_ssize_t path_depth = 2;
+            if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n:footprint",
+                    const_cast<char**>(kwlist), &obj, &path_depth)) {
+                return nullptr;
+            }
+
+            return catch_exc(
+                [&]() {
+                    Footprint_options options{};
+                    options.path_depth
+                        = static_cast<std::size_t>(std::max<Py_ssize_t>(
+                            path_depth, 0));
+                    return cpypp::footprint({ obj, BORROW }, options)
+                        .to_py()
+                        .release();
+                },
+                nullptr);
+        }
+    };
+
+    static PyMethodDef defs[]
+        = { { "footprint", (PyCFunction)(void (*)())Funcs::footprint,
+                METH_VARARGS | METH_KEYWORDS,
+                "Computes the deep memory footprint of an object." },
+              { nullptr, nullptr, 0, nullptr } };
+    return defs;
+}
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,318 @@
+/** @file fork_share.hpp
+ *
+ * Sharing of data with forked worker processes
+ *
+ * Data loaded in a parent process is shared with forked children by the
+ * copy-on-write pages of the operating system, but only until the pages are
+ * written.  Any reference to a Python object in the children, even only for
+ * reading it, writes its reference count, and the collector writes the
+ * headers of all the objects it tracks, so the pages of the whole data end up
+ * copied into each worker.
+ *
+ * Bulk data to be shared is better kept out of Python objects altogether.
+ * The frozen buffers here keep their contents in read-only pages mapped
+ * separately from the objects, which can only be read through the buffer
+ * protocol.  The packed strings of `Str_column`, without its cache, and the
+ * keys and native values of the maps in `int_map.hpp` and `btree_map.hpp` are
+ * likewise never reference counted.  For the Python objects remaining,
+ * `prepare_fork` moves them out of the sight of the collector.
+ */
+
+#ifndef CPYPP_FORK_SHARE_HPP
+#define CPYPP_FORK_SHARE_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Python buffers with contents in read-only pages of their own.
+ *
+ * The contents are copied into a private anonymous mapping when the buffer is
+ * created, after which the mapping is made read-only, so that its pages are
+ * never written in any process.  Only the small object header is reference
+ * counted.  From Python, `FrozenBuffer(obj)` copies the contents of any
+ * contiguous buffer, with its format kept, and the buffers can be read by
+ * `memoryview` and anything taking the buffer protocol.
+ */
+
+class Frozen_buffer {
+public:
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        void* data;
+        std::size_t map_size;
+        Py_ssize_t nbytes;
+        Py_ssize_t itemsize;
+        Py_ssize_t n_items;
+        char format[16];
+    };
+
+    /** Gets the static type of the frozen buffers.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.FrozenBuffer", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PyBufferProcs buffer_procs{};
+            buffer_procs.bf_getbuffer = get_buffer;
+
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_length = length;
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Read-only buffer in pages never written.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_as_buffer = &buffer_procs;
+            tp->tp_as_sequence = &seq_methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a frozen buffer with a copy of the given items.
+     *
+     * The format is in the syntax of the struct module, for items of the
+     * given size.
+     */
+
+    static Handle create(const void* data, std::size_t n_items,
+        std::size_t itemsize, const char* format = "B")
+    {
+        if (format == nullptr || std::strlen(format) >= sizeof(Obj::format)) {
+            PyErr_SetString(PyExc_ValueError, "format not supported");
+            throw Exc_set{};
+        }
+
+        Handle res(type().tp()->tp_alloc(type().tp(), 0));
+        Obj* self = obj(res);
+        self->data = nullptr;
+        self->map_size = 0;
+        self->nbytes = static_cast<Py_ssize_t>(n_items * itemsize);
+        self->itemsize = static_cast<Py_ssize_t>(itemsize);
+        self->n_items = static_cast<Py_ssize_t>(n_items);
+        std::strcpy(self->format, format);
+        freeze(self, data);
+        return res;
+    }
+
+    /** Creates a frozen buffer with a copy of the given native values.
+     */
+
+    template <typename T>
+    static Handle create(const T* data, std::size_t n_items)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Arithmetic type expected");
+        return create(data, n_items, sizeof(T), native_format<T>());
+    }
+
+    /** Tests if the given object is a frozen buffer.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the contents of a frozen buffer.
+     */
+
+    static const void* data(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->data;
+    }
+
+    /** Gets the number of bytes in a frozen buffer.
+     */
+
+    static std::size_t nbytes(PyObject* obj) noexcept
+    {
+        return static_cast<std::size_t>(reinterpret_cast<Obj*>(obj)->nbytes);
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    /** Copies the contents into a new read-only mapping.
+     */
+
+    static void freeze(Obj* self, const void* data)
+    {
+        if (self->nbytes == 0) {
+            return;
+        }
+
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t size = static_cast<std::size_t>(self->nbytes);
+        std::size_t map_size = (size + page - 1) / page * page;
+        void* mapped = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            throw Exc_set{};
+        }
+        self->data = mapped;
+        self->map_size = map_size;
+
+        std::memcpy(mapped, data, size);
+        if (mprotect(mapped, map_size, PROT_READ) != 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            throw Exc_set{};
+        }
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject*, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "obj", nullptr };
+        PyObject* src;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O:FrozenBuffer",
+                const_cast<char**>(kwlist), &src)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                Buffer buf(src);
+                const Py_buffer& view = buf.view();
+                return create(view.buf, static_cast<std::size_t>(buf.size()),
+                    static_cast<std::size_t>(view.itemsize),
+                    view.format == nullptr ? "B" : view.format)
+                    .release();
+            },
+            nullptr);
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        if (obj(self)->data != nullptr) {
+            munmap(obj(self)->data, obj(self)->map_size);
+        }
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object of %zd items of format '%s'>",
+            Py_TYPE(self)->tp_name, obj(self)->n_items, obj(self)->format);
+    }
+
+    static Py_ssize_t length(PyObject* self) { return obj(self)->n_items; }
+
+    //
+    // Buffer protocol
+    //
+
+    static int get_buffer(PyObject* self, Py_buffer* view, int flags)
+    {
+        if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+            PyErr_SetString(PyExc_BufferError, "frozen buffer is read-only");
+            view->obj = nullptr;
+            return -1;
+        }
+
+        static char empty[1] = { 0 };
+        Obj* buf = obj(self);
+        view->buf = buf->data != nullptr ? buf->data : empty;
+        view->obj = self;
+        Py_INCREF(self);
+        view->len = buf->nbytes;
+        view->readonly = 1;
+        view->itemsize = buf->itemsize;
+        view->format
+            = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? buf->format : nullptr;
+        view->ndim = 1;
+        view->shape = (flags & PyBUF_ND) == PyBUF_ND ? &buf->n_items : nullptr;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES
+            ? &buf->itemsize
+            : nullptr;
+        view->suboffsets = nullptr;
+        view->internal = nullptr;
+        return 0;
+    }
+};
+
+/** Prepares the Python objects of the process to be shared by forked workers.
+ *
+ * The garbage is optionally collected first, and then all the objects
+ * tracked by the collector are moved to its permanent generation by
+ * `gc.freeze`, so that the collections in the children never write to their
+ * headers.  This is to be called right before forking, with the workers
+ * calling `gc.unfreeze` if the shared objects are ever to be collected.
+ *
+ * The reference counts of the shared objects are still written whenever they
+ * are used, which is why bulk data is better kept in the native structures.
+ * Objects can only be made immortal by the public API of CPython for the
+ * objects it creates itself.
+ */
+
+inline void prepare_fork(bool if_collect = true)
+{
+    Handle gc(PyImport_ImportModule("gc"));
+    if (if_collect) {
+        Handle collected(PyObject_CallMethod(gc, "collect", nullptr));
+    }
+    Handle frozen(PyObject_CallMethod(gc, "freeze", nullptr));
+}
+
+/** Gets the module functions for the sharing with forked workers.
+ *
+ * `prepare_fork(collect=True)` calls `prepare_fork`.
+ */
+
+inline PyMethodDef* fork_share_methods()
+{
+    struct Funcs {
+        static PyObject* prepare_fork(
+            PyObject*, PyObject* args, PyObject* kwargs)
+        {
+            static const char* kwlist[] = { "collect", nullptr };
+            int if_collect = 1;
+            if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:prepare_fork",
+                    const_cast<char**>(kwlist), &if_collect)) {
+                return nullptr;
+            }
+
+            return catch_exc(
+                [&]() -> PyObject* {
+                    cpypp::prepare_fork(if_collect != 0);
+                    Py_RETURN_NONE;
+                },
+                nullptr);
+        }
+    };
+
+    static PyMethodDef defs[]
+        = { { "prepare_fork", (PyCFunction)(void (*)())Funcs::prepare_fork,
+                METH_VARARGS | METH_KEYWORDS,
+                "Prepares the objects to be shared with forked workers." },
+              { nullptr, nullptr, 0, nullptr } };
+    return defs;
+}
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,159 @@
+/** @file futex.hpp
+ *
+ * Blocking on atomic words without any lock
+ *
+ * On Linux, threads wait directly on 32-bit atomic words by the futex system
+ * call, so that no mutex or condition variable is needed for lock-free data
+ * structures to block when they are empty or full.  Other systems fall back
+ * to sleeping in short intervals.
+ *
+ * `Event_count` builds on the futexes to let threads wait for a condition
+ * checked outside of any lock, with the notifying side only making system
+ * calls when some thread is actually waiting.
+ *
+ * Words in memory shared between processes need the shared futexes, which
+ * are slower to look up by the kernel than the private ones for a single
+ * process.
+ */
+
+#ifndef CPYPP_FUTEX_HPP
+#define CPYPP_FUTEX_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace cpypp {
+
+/** Waits until the word no longer holds the expected value.
+ *
+ * The wait can also end spuriously or after the given timeout in nanoseconds,
+ * with a negative timeout meaning no limit.  So the callers need to check
+ * their condition again after it returns.  Words shared between processes
+ * need to be waited on as shared.
+ */
+
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+    std::int64_t timeout_ns = -1, bool if_shared = false) noexcept
+{
+#ifdef __linux__
+    timespec timeout{};
+    timespec* timeout_ptr = nullptr;
+    if (timeout_ns >= 0) {
+        timeout.tv_sec = static_cast<time_t>(timeout_ns / 1000000000);
+        timeout.tv_nsec = static_cast<long>(timeout_ns % 1000000000);
+        timeout_ptr = &timeout;
+    }
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+        if_shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected, timeout_ptr,
+        nullptr, 0);
+#else
+    (void)if_shared;
+    if (word.load(std::memory_order_acquire) == expected) {
+        auto interval = std::chrono::microseconds(50);
+        if (timeout_ns >= 0 && timeout_ns < 50000) {
+            interval = std::chrono::microseconds(timeout_ns / 1000);
+        }
+        std::this_thread::sleep_for(interval);
+    }
+#endif
+}
+
+/** Wakes up to the given number of threads waiting on the word.
+ */
+
+inline void futex_wake(
+    std::atomic<std::uint32_t>& word, int n, bool if_shared = false) noexcept
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+        if_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)n;
+    (void)if_shared;
+#endif
+}
+
+/** Counter of events for threads waiting on a condition.
+ *
+ * A waiting thread calls `prepare` before checking its condition for the last
+ * time, and then either `wait` with the key from `prepare` when the condition
+ * does not hold, or `cancel` when it does.  The notifying thread makes the
+ * condition hold before calling `notify`, which only touches the futex when
+ * some thread has prepared for waiting.  No notification can be lost between
+ * the check of the condition and the wait.
+ *
+ * Counts placed in memory shared between processes need to be constructed as
+ * shared, for the waits and notifications across the processes.
+ */
+
+class Event_count {
+public:
+    explicit Event_count(bool if_shared = false) noexcept
+        : if_shared_{ if_shared }
+    {
+    }
+
+    /** Registers the current thread as waiting and gets the key for `wait`.
+     */
+
+    std::uint32_t prepare() noexcept
+    {
+        n_waiters_.fetch_add(1, std::memory_order_seq_cst);
+        return epoch_.load(std::memory_order_seq_cst);
+    }
+
+    /** Unregisters the current thread after the condition is found to hold.
+     */
+
+    void cancel() noexcept
+    {
+        n_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /** Waits for a notification after the given key is taken.
+     *
+     * The wait can end spuriously or after the given timeout as for
+     * `futex_wait`.  The thread is unregistered when this returns.
+     */
+
+    void wait(std::uint32_t key, std::int64_t timeout_ns = -1) noexcept
+    {
+        futex_wait(epoch_, key, timeout_ns, if_shared_);
+        n_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /** Wakes all the threads waiting on the events.
+     */
+
+    void notify() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_waiters_.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        futex_wake(epoch_, WAKE_ALL, if_shared_);
+    }
+
+private:
+    static constexpr int WAKE_ALL = 0x7fffffff;
+
+    std::atomic<std::uint32_t> epoch_{ 0 };
+    std::atomic<std::uint32_t> n_waiters_{ 0 };
+    bool if_shared_;
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,485 @@
+/** @file gil_monitor.hpp
+ *
+ * Monitoring the contention on the GIL
+ *
+ * The monitor here observes the GIL taken and released by the cpypp guards,
+ * `Gil_acquire` and `Gil_release`, recording for each thread the time spent
+ * waiting for the GIL and holding it into histograms with logarithmic
+ * buckets, along with the number of times the GIL is handed over to the
+ * thread from other threads.  A sampler thread also counts how often each
+ * thread is found holding the GIL, which shows the threads hogging it even
+ * when they never give it up.
+ *
+ * Only the GIL taken by the guards is observed.  The GIL taken or released
+ * directly by the CPython API, including the interpreter handing it over
+ * between Python threads, is not seen.
+ */
+
+#ifndef CPYPP_GIL_MONITOR_HPP
+#define CPYPP_GIL_MONITOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Histogram with buckets for powers of two.
+ *
+ * Bucket zero counts the zero values, and bucket `i` the values in `[2^(i -
+ * 1), 2^i)`.  Negative values are counted as zero.  Each histogram is to be
+ * written by a single thread, while it can be read by any thread.
+ */
+
+class Log2_histogram {
+public:
+    static constexpr std::size_t N_BUCKETS = 64;
+
+    /** Records a value.
+     */
+
+    void record(std::int64_t value) noexcept
+    {
+        std::uint64_t unsigned_value
+            = value > 0 ? static_cast<std::uint64_t>(value) : 0;
+        std::size_t idx = 0;
+        while (unsigned_value != 0 && idx < N_BUCKETS - 1) {
+            unsigned_value >>= 1;
+            ++idx;
+        }
+
+        add(buckets_[idx], 1);
+        add(count_, 1);
+        add(sum_, static_cast<std::uint64_t>(std::max<std::int64_t>(value, 0)));
+        if (value > static_cast<std::int64_t>(max_.load(RELAXED))) {
+            max_.store(static_cast<std::uint64_t>(value), RELAXED);
+        }
+    }
+
+    std::uint64_t count() const noexcept { return count_.load(RELAXED); }
+
+    std::uint64_t sum() const noexcept { return sum_.load(RELAXED); }
+
+    std::uint64_t max() const noexcept { return max_.load(RELAXED); }
+
+    std::uint64_t bucket(std::size_t idx) const noexcept
+    {
+        return buckets_[idx].load(RELAXED);
+    }
+
+    /** Gets the upper bound of the bucket holding the given quantile.
+     *
+     * The bound is capped by the maximum value recorded.  Zero is given for
+     * empty histograms.
+     */
+
+    std::uint64_t quantile(double q) const noexcept
+    {
+        std::uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        auto target
+            = static_cast<std::uint64_t>(q * static_cast<double>(total));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < N_BUCKETS; ++i) {
+            seen += bucket(i);
+            if (seen > target || seen == total) {
+                std::uint64_t bound = i == 0 ? 0 : (std::uint64_t(1) << i) - 1;
+                return std::min(bound, max());
+            }
+        }
+        return max();
+    }
+
+    /** Clears all the recorded values.
+     */
+
+    void reset() noexcept
+    {
+        for (auto& i : buckets_) {
+            i.store(0, RELAXED);
+        }
+        count_.store(0, RELAXED);
+        sum_.store(0, RELAXED);
+        max_.store(0, RELAXED);
+    }
+
+private:
+    static constexpr std::memory_order RELAXED = std::memory_order_relaxed;
+
+    /** Adds to a counter written only by the current thread.
+     */
+
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t value)
+    {
+        counter.store(counter.load(RELAXED) + value, RELAXED);
+    }
+
+    std::atomic<std::uint64_t> buckets_[N_BUCKETS] = {};
+    std::atomic<std::uint64_t> count_{ 0 };
+    std::atomic<std::uint64_t> sum_{ 0 };
+    std::atomic<std::uint64_t> max_{ 0 };
+};
+
+/** Statistics of the GIL for a thread.
+ */
+
+struct Gil_thread_stats {
+    /** The identifier of the thread, as given by `threading.get_ident`.
+     */
+
+    unsigned long ident = 0;
+
+    Log2_histogram wait;
+    Log2_histogram hold;
+
+    /** Number of times the GIL is taken from another thread.
+     */
+
+    std::atomic<std::uint64_t> n_handoffs{ 0 };
+
+    /** Number of samples with the thread found holding the GIL.
+     */
+
+    std::atomic<std::uint64_t> n_samples_held{ 0 };
+
+    std::atomic<bool> if_holding{ false };
+};
+
+/** Monitor of the GIL taken and released by the guards.
+ *
+ * The monitor is started by `start`, which installs it as the `Gil_observer`
+ * and starts the sampler thread, and stopped by `stop`.  It must not be
+ * destructed while any guard could still be reporting to it, so that it is
+ * best to be kept alive until the end of the process once started.
+ */
+
+class Gil_monitor : public Gil_observer {
+public:
+    /** Constructs a monitor sampling at the given interval.
+     */
+
+    explicit Gil_monitor(
+        std::chrono::nanoseconds interval = std::chrono::milliseconds(1))
+        : interval_{ interval }
+        , id_{ next_id().fetch_add(1) + 1 }
+    {
+    }
+
+    ~Gil_monitor() override { stop(); }
+
+    /** Installs the monitor and starts sampling.
+     */
+
+    void start()
+    {
+        std::lock_guard<std::mutex> guard(sampler_mutex_);
+        if (sampler_.joinable()) {
+            return;
+        }
+        if_stopping_ = false;
+        install(this);
+        sampler_ = std::thread([this]() { sample(); });
+    }
+
+    /** Uninstalls the monitor and stops sampling.
+     *
+     * Statistics already recorded are kept.
+     */
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(sampler_mutex_);
+            if (!sampler_.joinable()) {
+                return;
+            }
+            if_stopping_ = true;
+            Gil_observer* expected = this;
+            if (installed() == expected) {
+                install(nullptr);
+            }
+        }
+        stopping_.notify_all();
+        sampler_.join();
+    }
+
+    void acquired(std::int64_t wait_ns) noexcept override
+    {
+        Gil_thread_stats* stats = local();
+        if (stats == nullptr) {
+            return;
+        }
+        stats->wait.record(wait_ns);
+        Gil_thread_stats* prev = last_holder_.exchange(stats);
+        if (prev != nullptr && prev != stats) {
+            stats->n_handoffs.store(
+                stats->n_handoffs.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+        }
+        stats->if_holding.store(true, std::memory_order_relaxed);
+    }
+
+    void released(std::int64_t hold_ns) noexcept override
+    {
+        Gil_thread_stats* stats = local();
+        if (stats == nullptr) {
+            return;
+        }
+        stats->if_holding.store(false, std::memory_order_relaxed);
+        stats->hold.record(hold_ns);
+    }
+
+    /** Gets the total number of samples taken.
+     */
+
+    std::uint64_t n_samples() const noexcept { return n_samples_.load(); }
+
+    /** Calls the action for the statistics of each thread seen.
+     */
+
+    template <typename F> void for_each(F&& action) const
+    {
+        std::lock_guard<std::mutex> guard(threads_mutex_);
+        for (const auto& i : threads_) {
+            action(static_cast<const Gil_thread_stats&>(*i));
+        }
+    }
+
+    /** Clears all the statistics recorded.
+     *
+     * Statistics being recorded concurrently might be partly kept.
+     */
+
+    void reset() noexcept
+    {
+        std::lock_guard<std::mutex> guard(threads_mutex_);
+        for (const auto& i : threads_) {
+            i->wait.reset();
+            i->hold.reset();
+            i->n_handoffs.store(0);
+            i->n_samples_held.store(0);
+        }
+        n_samples_.store(0);
+    }
+
+    /** Makes the report of the statistics for Python.
+     *
+     * The report is a `cpypp.GilReport` struct sequence with the total number
+     * of samples, and a tuple of `cpypp.GilThreadStats` struct sequences for
+     * the threads.  The histograms are given as tuples of the counts in the
+     * buckets, with the trailing empty buckets dropped.
+     *
+     * The statistics of the threads are only listed under the lock, with the
+     * Python objects made after it is released, since making them can run
+     * Python code and switch to threads registering themselves.  They are
+     * never removed, so that they stay valid.
+     */
+
+    Handle report() const
+    {
+        std::vector<const Gil_thread_stats*> all_stats{};
+        for_each([&](const Gil_thread_stats& stats) {
+            all_stats.push_back(&stats);
+        });
+
+        Struct_sequence res(report_type());
+        res.setitem(0, Handle(PyLong_FromUnsignedLongLong(n_samples())));
+
+        Handle threads(PyList_New(0));
+        for (const Gil_thread_stats* i : all_stats) {
+            const Gil_thread_stats& stats = *i;
+            Struct_sequence entry(thread_type());
+            Py_ssize_t idx = 0;
+            auto set_int = [&](unsigned long long value) {
+                entry.setitem(
+                    idx++, Handle(PyLong_FromUnsignedLongLong(value)));
+            };
+            set_int(stats.ident);
+            set_int(stats.wait.count());
+            set_int(stats.n_handoffs.load());
+            set_int(stats.n_samples_held.load());
+            for (const auto* hist : { &stats.wait, &stats.hold }) {
+                set_int(hist->sum());
+                set_int(hist->max());
+                set_int(hist->quantile(0.5));
+                set_int(hist->quantile(0.99));
+                entry.setitem(idx++, buckets(*hist));
+            }
+            if (PyList_Append(threads, entry) < 0) {
+                throw Exc_set{};
+            }
+        }
+        res.setitem(1, Handle(PyList_AsTuple(threads)));
+        return std::move(res);
+    }
+
+    /** Makes a Python function giving the report of the monitor.
+     *
+     * The function holds a borrowed pointer to the monitor, so it must not be
+     * called after the monitor is destructed.
+     */
+
+    Handle report_function()
+    {
+        static PyMethodDef def = { "gil_report", (PyCFunction)py_report,
+            METH_NOARGS, "Gets the report of the GIL monitor." };
+        Handle self(PyCapsule_New(this, CAPSULE_NAME, nullptr));
+        return { PyCFunction_New(&def, self) };
+    }
+
+    /** Gets the static type of the reports.
+     */
+
+    static Static_type& report_type()
+    {
+        static PyStructSequence_Field fields[]
+            = { { "n_samples", "Total number of samples taken." },
+                  { "threads", "Statistics of the threads." },
+                  { nullptr, nullptr } };
+        static PyStructSequence_Desc desc = { "cpypp.GilReport",
+            "Report of the GIL monitor.", fields, 2 };
+        static Static_type tp{};
+        tp.make_ready(desc);
+        return tp;
+    }
+
+    /** Gets the static type of the statistics of threads in the reports.
+     */
+
+    static Static_type& thread_type()
+    {
+        static PyStructSequence_Field fields[] = {
+            { "ident", "Identifier of the thread." },
+            { "n_acquired", "Number of times the GIL is taken." },
+            { "n_handoffs", "Number of times the GIL is taken from others." },
+            { "n_samples_held", "Number of samples holding the GIL." },
+            { "wait_total_ns", "Total time waiting for the GIL." },
+            { "wait_max_ns", "Maximum time waiting for the GIL." },
+            { "wait_p50_ns", "Bound of the median time waiting." },
+            { "wait_p99_ns", "Bound of the 99th percentile time waiting." },
+            { "wait_hist", "Histogram of the times waiting." },
+            { "hold_total_ns", "Total time holding the GIL." },
+            { "hold_max_ns", "Maximum time holding the GIL." },
+            { "hold_p50_ns", "Bound of the median time holding." },
+            { "hold_p99_ns", "Bound of the 99th percentile time holding." },
+            { "hold_hist", "Histogram of the times holding." },
+            { nullptr, nullptr }
+        };
+        static PyStructSequence_Desc desc = { "cpypp.GilThreadStats",
+            "Statistics of the GIL for a thread.", fields, 14 };
+        static Static_type tp{};
+        tp.make_ready(desc);
+        return tp;
+    }
+
+private:
+    static constexpr const char* CAPSULE_NAME = "cpypp.Gil_monitor";
+
+    static std::atomic<std::uint64_t>& next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> id{ 0 };
+        return id;
+    }
+
+    /** Gets the statistics of the current thread, registered on first use.
+     *
+     * The statistics are cached for the thread, with the monitor identified
+     * by its unique identifier rather than its address, which could be
+     * reused by later monitors.
+     */
+
+    Gil_thread_stats* local() noexcept
+    {
+        struct Cached {
+            std::uint64_t id = 0;
+            Gil_thread_stats* stats = nullptr;
+        };
+        static thread_local Cached cached{};
+        if (cached.id == id_) {
+            return cached.stats;
+        }
+
+        try {
+            std::unique_ptr<Gil_thread_stats> stats(new Gil_thread_stats{});
+            stats->ident = PyThread_get_thread_ident();
+            std::lock_guard<std::mutex> guard(threads_mutex_);
+            threads_.push_back(std::move(stats));
+            cached = { id_, threads_.back().get() };
+            return cached.stats;
+        } catch (...) {
+            return nullptr;
+        }
+    }
+
+    void sample()
+    {
+        std::unique_lock<std::mutex> lock(sampler_mutex_);
+        while (!if_stopping_) {
+            stopping_.wait_for(lock, interval_);
+            std::lock_guard<std::mutex> guard(threads_mutex_);
+            for (const auto& i : threads_) {
+                if (i->if_holding.load(std::memory_order_relaxed)) {
+                    ++i->n_samples_held;
+                }
+            }
+            ++n_samples_;
+        }
+    }
+
+    static Handle buckets(const Log2_histogram& hist)
+    {
+        std::size_t size = Log2_histogram::N_BUCKETS;
+        while (size > 0 && hist.bucket(size - 1) == 0) {
+            --size;
+        }
+        Tuple res(static_cast<Py_ssize_t>(size));
+        for (std::size_t i = 0; i < size; ++i) {
+            res.setitem(static_cast<Py_ssize_t>(i),
+                Handle(PyLong_FromUnsignedLongLong(hist.bucket(i))));
+        }
+        return std::move(res);
+    }
+
+    static PyObject* py_report(PyObject* self, PyObject*)
+    {
+        auto monitor = static_cast<Gil_monitor*>(
+            PyCapsule_GetPointer(self, CAPSULE_NAME));
+        if (monitor == nullptr) {
+            return nullptr;
+        }
+        return catch_exc(
+            [&]() { return monitor->report().release(); }, nullptr);
+    }
+
+    std::chrono::nanoseconds interval_;
+    std::uint64_t id_;
+
+    mutable std::mutex threads_mutex_;
+    std::vector<std::unique_ptr<Gil_thread_stats>> threads_;
+    std::atomic<Gil_thread_stats*> last_holder_{ nullptr };
+
+    std::mutex sampler_mutex_;
+    std::condition_variable stopping_;
+    std::thread sampler_;
+    bool if_stopping_ = false;
+    std::atomic<std::uint64_t> n_samples_{ 0 };
+};
+
+// End of namespace cpypp
+}
+
+#endif
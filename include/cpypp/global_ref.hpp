@@ -0,0 +1,260 @@
+/** @file global_ref.hpp
+ *
+ * Cached references to the globals of modules
+ *
+ * Looking up things like `decimal.Decimal` by importing the module and
+ * getting the attribute on every use costs a lookup in `sys.modules` and in
+ * the dictionary of the module, while caching the results in static handles
+ * goes stale when the modules are reloaded or the attributes are reassigned.
+ * The references here are resolved lazily and cached, with the cache
+ * invalidated by changes to the dictionaries of the modules or to
+ * `sys.modules`.  From Python 3.12, the changes are seen by dictionary
+ * watchers, which count the changes to each entry watched, so that checking
+ * the cache on the hot path is a comparison of at most two counters, and
+ * changes to other entries never invalidate it.  Before that, the versions of
+ * the whole dictionaries are compared instead.
+ */
+
+#ifndef CPYPP_GLOBAL_REF_HPP
+#define CPYPP_GLOBAL_REF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Reference to a module, or to a global attribute of it, cached lazily.
+ *
+ * The GIL needs to be held for all uses, and only the main interpreter is
+ * supported.  The cache is invalidated by changes to the attribute in the
+ * dictionary of the module, including its reassignment and the reloading of
+ * the module, and to the module in `sys.modules`, like its replacement.
+ * Before Python 3.12, changes to any other entries of the dictionaries also
+ * invalidate it.  Only the attribute directly in the module is watched, so
+ * for attributes of attributes, only the outermost one is to be cached.
+ * Objects other than modules in `sys.modules` are never cached.
+ *
+ * Global references are usually static objects.  Their references are leaked
+ * when they are destructed after the interpreter is finalized.
+ */
+
+class Global_ref {
+public:
+    /** Constructs a reference to an attribute of a module.
+     *
+     * Without any attribute, the reference is to the module itself.  Both
+     * strings are only borrowed, so they usually need to be literals.
+     */
+
+    explicit Global_ref(const char* module, const char* attr = nullptr) noexcept
+        : module_{ module }
+        , attr_{ attr }
+    {
+    }
+
+    Global_ref(const Global_ref&) = delete;
+    Global_ref& operator=(const Global_ref&) = delete;
+
+    ~Global_ref()
+    {
+        if (!Py_IsInitialized()) {
+            value_.release();
+            dict_.release();
+        }
+    }
+
+    /** Gets the referenced object, resolved again if needed.
+     *
+     * `Exc_set` is thrown when the module cannot be imported or the attribute
+     * is not found.
+     */
+
+    const Handle& get()
+    {
+        if (!is_fresh()) {
+            resolve();
+        }
+        return value_;
+    }
+
+    /** Calls the referenced object.
+     */
+
+    template <typename... Args> Handle call(Args&&... args)
+    {
+        return get().call(std::forward<Args>(args)...);
+    }
+
+    /** Drops the cached object, to be resolved again on the next use.
+     */
+
+    void invalidate() noexcept
+    {
+        value_ = Handle();
+        dict_ = Handle();
+    }
+
+    /** Gets the number of times the reference has been resolved.
+     */
+
+    std::size_t n_resolved() const noexcept { return n_resolved_; }
+
+private:
+    /** Tests if the cached object is still valid.
+     */
+
+    bool is_fresh() const noexcept
+    {
+        if (!dict_) {
+            return false;
+        }
+#if PY_VERSION_HEX >= 0x030C0000
+        return *module_version_ == module_stamp_
+            && (attr_version_ == nullptr || *attr_version_ == attr_stamp_);
+#else
+        return version(dict_.get()) == dict_version_
+            && version(PyImport_GetModuleDict()) == modules_version_;
+#endif
+    }
+
+    void resolve()
+    {
+        invalidate();
+        ++n_resolved_;
+
+        Handle module(PyImport_ImportModule(module_));
+        Handle value = attr_ != nullptr ? module.getattr(attr_) : module;
+
+        value_ = std::move(value);
+        if (!PyModule_Check(module.get())) {
+            return;
+        }
+
+        PyObject* dict = PyModule_GetDict(module.get());
+        PyObject* modules = PyImport_GetModuleDict();
+#if PY_VERSION_HEX >= 0x030C0000
+        module_version_ = watch(modules, module_);
+        module_stamp_ = *module_version_;
+        if (attr_ != nullptr) {
+            attr_version_ = watch(dict, attr_);
+            attr_stamp_ = *attr_version_;
+        }
+#else
+        dict_version_ = version(dict);
+        modules_version_ = version(modules);
+#endif
+        dict_ = Handle(dict, NEW);
+    }
+
+#if PY_VERSION_HEX >= 0x030C0000
+    /** Entry of a dictionary watched, with the number of changes to it.
+     */
+
+    struct Watched {
+        PyObject* dict;
+        PyObject* key;
+        std::uint64_t version;
+    };
+
+    /** Gets all the entries watched, which are never removed.
+     *
+     * The entries are in a deque for their counters to stay in place.
+     */
+
+    static std::deque<Watched>& watched() noexcept
+    {
+        static std::deque<Watched> entries{};
+        return entries;
+    }
+
+    /** Watches an entry of a dictionary, with its counter of changes given.
+     */
+
+    static const std::uint64_t* watch(PyObject* dict, const char* key)
+    {
+        if (PyDict_Watch(watcher_id(), dict) < 0) {
+            throw Exc_set{};
+        }
+        Handle key_obj(PyUnicode_InternFromString(key));
+        for (auto& i : watched()) {
+            if (i.dict == dict && PyUnicode_Compare(i.key, key_obj) == 0) {
+                return &i.version;
+            }
+        }
+        watched().push_back({ dict, key_obj.release(), 0 });
+        return &watched().back().version;
+    }
+
+    /** Counts a change to the watched dictionaries.
+     *
+     * Events without keys, like the clearing of the dictionaries, change all
+     * of their entries.
+     */
+
+    static int on_change(
+        PyDict_WatchEvent, PyObject* dict, PyObject* key, PyObject*)
+    {
+        for (auto& i : watched()) {
+            if (i.dict != dict) {
+                continue;
+            }
+            bool if_changed = key == nullptr || key == i.key
+                || (PyUnicode_Check(key)
+                    && PyUnicode_Compare(key, i.key) == 0);
+            if (if_changed) {
+                ++i.version;
+            }
+        }
+        return 0;
+    }
+
+    /** Gets the watcher of the dictionaries, added on first use.
+     *
+     * Adding the watcher is tried again on the next use after a failure.
+     */
+
+    static int watcher_id()
+    {
+        static int id = -1;
+        if (id < 0) {
+            id = PyDict_AddWatcher(on_change);
+            if (id < 0) {
+                throw Exc_set{};
+            }
+        }
+        return id;
+    }
+#else
+    static std::uint64_t version(PyObject* dict) noexcept
+    {
+        return reinterpret_cast<PyDictObject*>(dict)->ma_version_tag;
+    }
+#endif
+
+    const char* module_;
+    const char* attr_;
+
+    Handle value_;
+    Handle dict_;
+#if PY_VERSION_HEX >= 0x030C0000
+    const std::uint64_t* module_version_ = nullptr;
+    std::uint64_t module_stamp_ = 0;
+    const std::uint64_t* attr_version_ = nullptr;
+    std::uint64_t attr_stamp_ = 0;
+#else
+    std::uint64_t dict_version_ = 0;
+    std::uint64_t modules_version_ = 0;
+#endif
+    std::size_t n_resolved_ = 0;
+};
+
+// End of namespace cpypp
+}
+
+#endif
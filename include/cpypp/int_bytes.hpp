@@ -0,0 +1,332 @@
+/** @file int_bytes.hpp
+ *
+ * Conversions between Python integers and native integers of any width
+ *
+ * Integers wider than 64 bits, like 128-bit identifiers and hashes, cannot be
+ * converted by `Handle::as`, and formatting them as strings to be parsed is
+ * slow.  The conversions here go through the bytes of the integers directly,
+ * using the native bytes API of Python 3.13 and the equivalent private
+ * functions of earlier versions.  Besides the 128-bit integers of the
+ * compilers, integers can be given as arrays of 64-bit limbs or as spans of
+ * bytes, and sequences of integers can be converted to and from columns of
+ * fixed-width bytes.
+ *
+ * Bytes are always in little-endian order, and limbs go from the least
+ * significant one, regardless of the byte order of the platform.
+ */
+
+#ifndef CPYPP_INT_BYTES_HPP
+#define CPYPP_INT_BYTES_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+//
+// Spans of bytes
+//
+
+/** Builds a Python integer from its little-endian bytes.
+ */
+
+inline Handle int_from_bytes(
+    const unsigned char* data, std::size_t size, bool if_signed)
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    auto n_bytes = static_cast<Py_ssize_t>(size);
+    int flags = Py_ASNATIVEBYTES_LITTLE_ENDIAN;
+    return Handle(if_signed
+            ? PyLong_FromNativeBytes(data, n_bytes, flags)
+            : PyLong_FromUnsignedNativeBytes(data, n_bytes, flags));
+#else
+    return Handle(_PyLong_FromByteArray(data, size, 1, if_signed));
+#endif
+}
+
+/** Writes a Python integer into its little-endian bytes.
+ *
+ * `OverflowError` is raised when the integer does not fit.  Negative integers
+ * are rejected for unsigned bytes, by `ValueError` from Python 3.13.  Objects
+ * other than integers are converted by `__index__`.
+ */
+
+inline void int_to_bytes(
+    PyObject* obj, unsigned char* data, std::size_t size, bool if_signed)
+{
+    Handle index;
+    if (!PyLong_Check(obj)) {
+        index = Handle(PyNumber_Index(obj));
+        obj = index.get();
+    }
+
+#if PY_VERSION_HEX >= 0x030D0000
+    int flags = Py_ASNATIVEBYTES_LITTLE_ENDIAN
+        | (if_signed ? 0
+                     : Py_ASNATIVEBYTES_UNSIGNED_BUFFER
+                         | Py_ASNATIVEBYTES_REJECT_NEGATIVE);
+    Py_ssize_t n_bytes = PyLong_AsNativeBytes(
+        obj, data, static_cast<Py_ssize_t>(size), flags);
+    if (n_bytes < 0) {
+        throw Exc_set{};
+    }
+    if (static_cast<std::size_t>(n_bytes) > size) {
+        PyErr_SetString(PyExc_OverflowError, "int too big to convert");
+        throw Exc_set{};
+    }
+#else
+    if (_PyLong_AsByteArray(reinterpret_cast<PyLongObject*>(obj), data, size,
+            1, if_signed)
+        < 0) {
+        throw Exc_set{};
+    }
+#endif
+}
+
+//
+// Arrays of limbs
+//
+
+/** Builds a Python integer from unsigned 64-bit limbs.
+ */
+
+template <std::size_t N>
+Handle make_int(const std::array<std::uint64_t, N>& limbs)
+{
+    unsigned char bytes[N * 8];
+    for (std::size_t i = 0; i < N * 8; ++i) {
+        bytes[i] = static_cast<unsigned char>(limbs[i / 8] >> (i % 8 * 8));
+    }
+    return int_from_bytes(bytes, N * 8, false);
+}
+
+/** Reads a Python integer into unsigned 64-bit limbs.
+ */
+
+template <std::size_t N> std::array<std::uint64_t, N> as_limbs(PyObject* obj)
+{
+    unsigned char bytes[N * 8];
+    int_to_bytes(obj, bytes, N * 8, false);
+    std::array<std::uint64_t, N> res{};
+    for (std::size_t i = 0; i < N * 8; ++i) {
+        res[i / 8] |= static_cast<std::uint64_t>(bytes[i]) << (i % 8 * 8);
+    }
+    return res;
+}
+
+//
+// 128-bit integers
+//
+
+#ifdef __SIZEOF_INT128__
+
+__extension__ typedef __int128 Int128;
+__extension__ typedef unsigned __int128 Uint128;
+
+/** Builds a Python integer from a 128-bit integer.
+ *
+ * Values fitting in 64 bits take the faster path of the plain conversions.
+ */
+
+inline Handle make_int(Uint128 v)
+{
+    if ((v >> 64) == 0) {
+        return Handle(
+            PyLong_FromUnsignedLongLong(static_cast<unsigned long long>(v)));
+    }
+    unsigned char bytes[16];
+    for (std::size_t i = 0; i < 16; ++i) {
+        bytes[i] = static_cast<unsigned char>(v >> (i * 8));
+    }
+    return int_from_bytes(bytes, 16, false);
+}
+
+inline Handle make_int(Int128 v)
+{
+    if (v >= INT64_MIN && v <= INT64_MAX) {
+        return Handle(PyLong_FromLongLong(static_cast<long long>(v)));
+    }
+    unsigned char bytes[16];
+    for (std::size_t i = 0; i < 16; ++i) {
+        auto bits = static_cast<Uint128>(v) >> (i * 8);
+        bytes[i] = static_cast<unsigned char>(bits);
+    }
+    return int_from_bytes(bytes, 16, true);
+}
+
+/** Reads a Python integer into an unsigned 128-bit integer.
+ */
+
+inline Uint128 as_uint128(PyObject* obj)
+{
+    unsigned char bytes[16];
+    int_to_bytes(obj, bytes, 16, false);
+    Uint128 res = 0;
+    for (std::size_t i = 16; i > 0; --i) {
+        res = res << 8 | bytes[i - 1];
+    }
+    return res;
+}
+
+/** Reads a Python integer into a signed 128-bit integer.
+ */
+
+inline Int128 as_int128(PyObject* obj)
+{
+    unsigned char bytes[16];
+    int_to_bytes(obj, bytes, 16, true);
+    Uint128 res = 0;
+    for (std::size_t i = 16; i > 0; --i) {
+        res = res << 8 | bytes[i - 1];
+    }
+    return static_cast<Int128>(res);
+}
+
+#endif
+
+//
+// Columns of fixed-width integers
+//
+
+/** Writes a sequence of Python integers into fixed-width bytes.
+ *
+ * Each integer takes `width` bytes of the output, which needs to have room
+ * for all the integers in the sequence.
+ */
+
+inline void ints_to_bytes(PyObject* seq, unsigned char* out, std::size_t width,
+    std::size_t size, bool if_signed)
+{
+    Handle items(PySequence_Fast(seq, "sequence of ints expected"));
+    if (static_cast<std::size_t>(PySequence_Fast_GET_SIZE(items.get()))
+        != size) {
+        PyErr_SetString(
+            PyExc_ValueError, "output not of the same length as input");
+        throw Exc_set{};
+    }
+
+    PyObject** objs = PySequence_Fast_ITEMS(items.get());
+    for (std::size_t i = 0; i < size; ++i) {
+        int_to_bytes(objs[i], out + i * width, width, if_signed);
+    }
+}
+
+/** Builds a list of Python integers from fixed-width bytes.
+ */
+
+inline Handle ints_from_bytes(const unsigned char* data, std::size_t width,
+    std::size_t size, bool if_signed)
+{
+    Handle res(PyList_New(static_cast<Py_ssize_t>(size)));
+    for (std::size_t i = 0; i < size; ++i) {
+        PyList_SET_ITEM(res.get(), static_cast<Py_ssize_t>(i),
+            int_from_bytes(data + i * width, width, if_signed).release());
+    }
+    return res;
+}
+
+/** Gets the module functions for the columns of fixed-width integers.
+ *
+ * `pack_ints(ints, width, signed=False)` gives the bytes for a sequence of
+ * integers, while `unpack_ints(buffer, width, signed=False)` gives the list of
+ * integers back from any contiguous buffer.
+ */
+
+inline PyMethodDef* int_bytes_methods()
+{
+    struct Funcs {
+        static PyObject* pack_ints(
+            PyObject*, PyObject* args, PyObject* kwargs)
+        {
+            static const char* kwlist[]
+                = { "ints", "width", "signed", nullptr };
+            PyObject* seq;
+            Py_ssize_t width;
+            int if_signed = 0;
+            if (!PyArg_ParseTupleAndKeywords(args, kwargs, "On|p:pack_ints",
+                    const_cast<char**>(kwlist), &seq, &width, &if_signed)) {
+                return nullptr;
+            }
+
+            return catch_exc(
+                [&]() -> PyObject* {
+                    if (width <= 0) {
+                        PyErr_SetString(
+                            PyExc_ValueError, "width needs to be positive");
+                        throw Exc_set{};
+                    }
+                    Py_ssize_t size = PyObject_Length(seq);
+                    if (size < 0) {
+                        throw Exc_set{};
+                    }
+                    if (size > 0 && width > PY_SSIZE_T_MAX / size) {
+                        PyErr_SetString(
+                            PyExc_OverflowError, "packed ints too large");
+                        throw Exc_set{};
+                    }
+                    Handle res(
+                        PyBytes_FromStringAndSize(nullptr, width * size));
+                    ints_to_bytes(seq,
+                        reinterpret_cast<unsigned char*>(
+                            PyBytes_AS_STRING(res.get())),
+                        static_cast<std::size_t>(width),
+                        static_cast<std::size_t>(size), if_signed != 0);
+                    return res.release();
+                },
+                nullptr);
+        }
+
+        static PyObject* unpack_ints(
+            PyObject*, PyObject* args, PyObject* kwargs)
+        {
+            static const char* kwlist[]
+                = { "buffer", "width", "signed", nullptr };
+            Py_buffer view;
+            Py_ssize_t width;
+            int if_signed = 0;
+            if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*n|p:unpack_ints",
+                    const_cast<char**>(kwlist), &view, &width, &if_signed)) {
+                return nullptr;
+            }
+
+            PyObject* res = catch_exc(
+                [&]() -> PyObject* {
+                    if (width <= 0 || view.len % width != 0) {
+                        PyErr_SetString(PyExc_ValueError,
+                            "buffer not a whole number of the width");
+                        throw Exc_set{};
+                    }
+                    return ints_from_bytes(
+                        static_cast<const unsigned char*>(view.buf),
+                        static_cast<std::size_t>(width),
+                        static_cast<std::size_t>(view.len / width),
+                        if_signed != 0)
+                        .release();
+                },
+                nullptr);
+            PyBuffer_Release(&view);
+            return res;
+        }
+    };
+
+    static PyMethodDef defs[] = {
+        { "pack_ints", (PyCFunction)(void (*)())Funcs::pack_ints,
+            METH_VARARGS | METH_KEYWORDS,
+            "Packs integers into bytes of a fixed width each." },
+        { "unpack_ints", (PyCFunction)(void (*)())Funcs::unpack_ints,
+            METH_VARARGS | METH_KEYWORDS,
+            "Unpacks integers from bytes of a fixed width each." },
+        { nullptr, nullptr, 0, nullptr }
+    };
+    return defs;
+}
+
+// End of namespace cpypp
+}
+
+#endif
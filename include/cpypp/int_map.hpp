@@ -0,0 +1,985 @@
+/** @file int_map.hpp
+ *
+ * Compact hash maps from native 64-bit integers to native values
+ *
+ * Python dictionaries keyed by integers need a boxed Python integer for each
+ * key and value in addition to the hash table entry itself.  The maps here
+ * store the keys and values natively in a flat open-addressing table, which
+ * takes about twenty bytes per entry for integer or floating-point values.
+ *
+ * The table itself is available to C++ code as `Int_table`, while `Int_map`
+ * exposes it to Python as static types implementing the mapping protocol, with
+ * additional bulk methods working on buffers.
+ */
+
+#ifndef CPYPP_INT_MAP_HPP
+#define CPYPP_INT_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Flat open-addressing hash table from 64-bit integers to native values.
+ *
+ * The keys, the values and the one-byte control words for the slots are
+ * stored in three separate arrays, so that no padding is wasted for any value
+ * type.  Collisions are resolved by linear probing, with the keys scrambled by
+ * the finalizer of splitmix64 so that the sequential ids common in practice do
+ * not form long runs.  The table is kept at most seven-eighths full.
+ *
+ * Pointers to values are invalidated by any insertion into the table.
+ */
+
+template <typename V> class Int_table {
+public:
+    using Key = std::int64_t;
+
+    /** Constructs an empty table without any slot allocated.
+     */
+
+    Int_table() noexcept = default;
+
+    /** Constructs a table by taking over the entries of another one.
+     *
+     * The other table is left empty.
+     */
+
+    Int_table(Int_table&& other) noexcept { swap(other); }
+
+    /** Exchanges the entries with another table.
+     */
+
+    Int_table& operator=(Int_table&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(Int_table& other) noexcept
+    {
+        std::swap(keys_, other.keys_);
+        std::swap(values_, other.values_);
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(cap_, other.cap_);
+        std::swap(size_, other.size_);
+        std::swap(n_deleted_, other.n_deleted_);
+    }
+
+    /** Gets the number of entries in the table.
+     */
+
+    std::size_t size() const noexcept { return size_; }
+
+    /** Gets the number of slots in the table.
+     */
+
+    std::size_t capacity() const noexcept { return cap_; }
+
+    /** Gets the number of bytes taken by the slots of the table.
+     */
+
+    std::size_t memory_usage() const noexcept
+    {
+        return cap_ * (sizeof(Key) + sizeof(V) + sizeof(std::uint8_t));
+    }
+
+    /** Finds the value for a key.
+     *
+     * A null pointer is returned when the key is not present.
+     */
+
+    V* find(Key key) noexcept
+    {
+        std::size_t slot = locate(key);
+        return slot < cap_ ? &values_[slot] : nullptr;
+    }
+
+    const V* find(Key key) const noexcept
+    {
+        return const_cast<Int_table*>(this)->find(key);
+    }
+
+    /** Finds the value for a key, inserting a default one when absent.
+     *
+     * The pointer to the value is returned along with if it is newly
+     * inserted.
+     */
+
+    std::pair<V*, bool> emplace(Key key)
+    {
+        std::size_t slot = locate(key);
+        if (slot < cap_) {
+            return { &values_[slot], false };
+        }
+
+        if ((size_ + n_deleted_ + 1) * 8 > cap_ * 7) {
+            // Tables mostly filled by tombstones are only cleaned up.
+            rehash(n_deleted_ > size_ ? size_ + 1 : 2 * size_ + 1);
+        }
+
+        // After the rehash, any tombstone on the way can be reused.
+        std::size_t mask = cap_ - 1;
+        slot = hash(key) & mask;
+        while (ctrl_[slot] == FULL) {
+            slot = (slot + 1) & mask;
+        }
+        if (ctrl_[slot] == DELETED) {
+            --n_deleted_;
+        }
+        ctrl_[slot] = FULL;
+        keys_[slot] = key;
+        values_[slot] = V{};
+        ++size_;
+        return { &values_[slot], true };
+    }
+
+    /** Removes a key with its value moved out.
+     *
+     * False is returned when the key is not present.
+     */
+
+    bool take(Key key, V& out) noexcept
+    {
+        std::size_t slot = locate(key);
+        if (slot >= cap_) {
+            return false;
+        }
+
+        out = std::move(values_[slot]);
+        values_[slot] = V{};
+        ctrl_[slot] = DELETED;
+        --size_;
+        ++n_deleted_;
+        return true;
+    }
+
+    /** Removes a key, returning if it was present.
+     */
+
+    bool erase(Key key) noexcept
+    {
+        V removed;
+        return take(key, removed);
+    }
+
+    /** Removes all the entries while keeping the slots.
+     */
+
+    void clear() noexcept
+    {
+        for (std::size_t i = 0; i < cap_; ++i) {
+            if (ctrl_[i] == FULL) {
+                values_[i] = V{};
+            }
+            ctrl_[i] = EMPTY;
+        }
+        size_ = 0;
+        n_deleted_ = 0;
+    }
+
+    /** Makes room for the given number of entries without rehashing.
+     */
+
+    void reserve(std::size_t n)
+    {
+        if (n * 8 > cap_ * 7) {
+            rehash(n);
+        }
+    }
+
+    //
+    // Iteration over the slots
+    //
+    // The entries are visited by the indices of their slots, from `next(0)`
+    // until the capacity is reached.
+    //
+
+    /** Gets the first slot holding an entry from the given one.
+     */
+
+    std::size_t next(std::size_t slot) const noexcept
+    {
+        while (slot < cap_ && ctrl_[slot] != FULL) {
+            ++slot;
+        }
+        return slot;
+    }
+
+    Key key_at(std::size_t slot) const noexcept { return keys_[slot]; }
+
+    V& value_at(std::size_t slot) noexcept { return values_[slot]; }
+
+private:
+    enum : std::uint8_t { EMPTY = 0, FULL = 1, DELETED = 2 };
+
+    static std::uint64_t hash(Key key) noexcept
+    {
+        std::uint64_t x = static_cast<std::uint64_t>(key);
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    /** Gets the slot of a key, or the capacity when it is absent.
+     */
+
+    std::size_t locate(Key key) const noexcept
+    {
+        if (size_ == 0) {
+            return cap_;
+        }
+
+        std::size_t mask = cap_ - 1;
+        for (std::size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            if (ctrl_[slot] == EMPTY) {
+                return cap_;
+            } else if (ctrl_[slot] == FULL && keys_[slot] == key) {
+                return slot;
+            }
+        }
+    }
+
+    /** Moves all entries into a new table large enough for the given size.
+     */
+
+    void rehash(std::size_t n)
+    {
+        std::size_t new_cap = 16;
+        while (n * 8 > new_cap * 7) {
+            new_cap *= 2;
+        }
+
+        std::unique_ptr<Key[]> keys(new Key[new_cap]);
+        std::unique_ptr<V[]> values(new V[new_cap]);
+        std::unique_ptr<std::uint8_t[]> ctrl(new std::uint8_t[new_cap]());
+
+        std::size_t mask = new_cap - 1;
+        for (std::size_t i = 0; i < cap_; ++i) {
+            if (ctrl_[i] != FULL) {
+                continue;
+            }
+            std::size_t slot = hash(keys_[i]) & mask;
+            while (ctrl[slot] == FULL) {
+                slot = (slot + 1) & mask;
+            }
+            ctrl[slot] = FULL;
+            keys[slot] = keys_[i];
+            values[slot] = std::move(values_[i]);
+        }
+
+        keys_ = std::move(keys);
+        values_ = std::move(values);
+        ctrl_ = std::move(ctrl);
+        cap_ = new_cap;
+        n_deleted_ = 0;
+    }
+
+    std::unique_ptr<Key[]> keys_;
+    std::unique_ptr<V[]> values_;
+    std::unique_ptr<std::uint8_t[]> ctrl_;
+
+    std::size_t cap_ = 0;
+    std::size_t size_ = 0;
+    std::size_t n_deleted_ = 0;
+};
+
+/** Conversion of the values of integer maps from and to Python objects.
+ *
+ * The static types for the maps are also named here.
+ */
+
+template <typename V> struct Int_map_value;
+
+template <> struct Int_map_value<std::int64_t> {
+    static const char* name() noexcept { return "cpypp.IntIntMap"; }
+
+    static std::int64_t from_py(PyObject* obj)
+    {
+        long long res = PyLong_AsLongLong(obj);
+        if (res == -1) {
+            check_exc();
+        }
+        return res;
+    }
+
+    static Handle to_py(std::int64_t v) { return { PyLong_FromLongLong(v) }; }
+};
+
+template <> struct Int_map_value<double> {
+    static const char* name() noexcept { return "cpypp.IntFloatMap"; }
+
+    static double from_py(PyObject* obj)
+    {
+        double res = PyFloat_AsDouble(obj);
+        if (res == -1.0) {
+            check_exc();
+        }
+        return res;
+    }
+
+    static Handle to_py(double v) { return { PyFloat_FromDouble(v) }; }
+};
+
+template <> struct Int_map_value<Handle> {
+    static const char* name() noexcept { return "cpypp.IntObjectMap"; }
+
+    static Handle from_py(PyObject* obj) { return { obj, NEW }; }
+
+    static Handle to_py(const Handle& v) { return v; }
+};
+
+/** Python mapping types backed by integer tables.
+ *
+ * The value type can be `std::int64_t`, `double` or `Handle`, giving the
+ * Python types `IntIntMap`, `IntFloatMap` and `IntObjectMap` respectively.
+ * Besides the usual mapping protocol and the dictionary methods `get`, `pop`,
+ * `keys`, `values`, `items` and `clear`, the types have
+ *
+ * - `update(keys, values)` inserting the keys from an int64 buffer with values
+ *   from a buffer of the native value type, or from an iterable for object
+ *   values.  A single mapping argument is also accepted.
+ *
+ * - `lookup_many(keys, out, default=0)` writing the values for the keys in an
+ *   int64 buffer into a writable buffer of the native value type, with the
+ *   number of keys found returned.  For object values, the signature is
+ *   `lookup_many(keys, default=None)` and a list is returned.
+ *
+ * - `reserve(n)` making room for the given number of entries.
+ *
+ * `sys.getsizeof` gives the memory taken by the table.  The static types are
+ * made ready lazily by the `type` method, which can only be called with the
+ * GIL held.
+ */
+
+template <typename V> class Int_map {
+public:
+    using Table = Int_table<V>;
+    using Conv = Int_map_value<V>;
+
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Table table;
+
+        /** Version of the key set, bumped on insertion and removal.
+         */
+
+        std::size_t version;
+    };
+
+    /** Gets the static type of the maps.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp(Conv::name(), sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_contains = contains;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+            map_methods.mp_ass_subscript = ass_subscript;
+
+            static PyMethodDef methods[] = {
+                { "get", (PyCFunction)py_get, METH_VARARGS,
+                    "Gets the value for a key, or the default." },
+                { "pop", (PyCFunction)py_pop, METH_VARARGS,
+                    "Removes a key and returns its value." },
+                { "keys", (PyCFunction)py_keys, METH_NOARGS,
+                    "Iterates over the keys." },
+                { "values", (PyCFunction)py_values, METH_NOARGS,
+                    "Iterates over the values." },
+                { "items", (PyCFunction)py_items, METH_NOARGS,
+                    "Iterates over the key-value pairs." },
+                { "clear", (PyCFunction)py_clear, METH_NOARGS,
+                    "Removes all the entries." },
+                { "reserve", (PyCFunction)py_reserve, METH_O,
+                    "Makes room for the given number of entries." },
+                { "update", (PyCFunction)py_update, METH_VARARGS,
+                    "Inserts keys from a buffer with values, or a mapping." },
+                { "lookup_many", (PyCFunction)(void (*)(void))py_lookup_many,
+                    METH_VARARGS | METH_KEYWORDS,
+                    "Looks up the keys from a buffer." },
+                { "__sizeof__", (PyCFunction)py_sizeof, METH_NOARGS,
+                    "Gets the size of the map in bytes." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            if (if_gc) {
+                tp->tp_flags |= Py_TPFLAGS_HAVE_GC;
+                tp->tp_traverse = traverse;
+                tp->tp_clear = clear;
+            }
+            tp->tp_doc = "Hash map from 64-bit integers to native values.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_iter = iter;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new empty map.
+     */
+
+    static Handle create()
+    {
+        return { PyObject_CallObject(type().tp_obj(), nullptr) };
+    }
+
+    /** Tests if the given object is a map of this kind.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the native table inside a map.
+     *
+     * The given object must be a map of this kind.
+     */
+
+    static Table& table(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->table;
+    }
+
+private:
+    /** If the values can hold references to Python objects.
+     */
+
+    static constexpr bool if_gc = std::is_same<V, Handle>::value;
+
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    static std::int64_t to_key(PyObject* key)
+    {
+        return Int_map_value<std::int64_t>::from_py(key);
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "capacity", nullptr };
+        Py_ssize_t capacity = 0;
+        if (!PyArg_ParseTupleAndKeywords(
+                args, kwds, "|n", const_cast<char**>(kwlist), &capacity)) {
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        new (&obj(self)->table) Table();
+        obj(self)->version = 0;
+
+        if (capacity > 0) {
+            auto reserved = catch_exc(
+                [&]() {
+                    table(self).reserve(static_cast<std::size_t>(capacity));
+                    return true;
+                },
+                false);
+            if (!reserved) {
+                Py_DECREF(self);
+                return nullptr;
+            }
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        if (if_gc) {
+            PyObject_GC_UnTrack(self);
+        }
+        table(self).~Table();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static int traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        Table& t = table(self);
+        for (std::size_t i = t.next(0); i < t.capacity(); i = t.next(i + 1)) {
+            Py_VISIT(value_obj(t.value_at(i)));
+        }
+        return 0;
+    }
+
+    static int clear(PyObject* self)
+    {
+        // The values are released only after the map is already empty, in
+        // case their finalizers come back to the map.
+        Table removed;
+        removed.swap(table(self));
+        ++obj(self)->version;
+        return 0;
+    }
+
+    static PyObject* value_obj(const Handle& v) noexcept { return v.get(); }
+
+    template <typename T> static PyObject* value_obj(const T&) noexcept
+    {
+        return nullptr;
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object with %zu entries>",
+            Py_TYPE(self)->tp_name, table(self).size());
+    }
+
+    //
+    // Mapping protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(table(self).size());
+    }
+
+    static int contains(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() { return table(self).find(to_key(key)) != nullptr ? 1 : 0; },
+            -1);
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                const V* v = table(self).find(to_key(key));
+                if (v == nullptr) {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    return nullptr;
+                }
+                return get_new(Conv::to_py(*v));
+            },
+            nullptr);
+    }
+
+    static int ass_subscript(PyObject* self, PyObject* key, PyObject* value)
+    {
+        return catch_exc(
+            [&]() {
+                auto k = to_key(key);
+                if (value == nullptr) {
+                    if (!table(self).erase(k)) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return -1;
+                    }
+                    ++obj(self)->version;
+                    return 0;
+                }
+                set(self, k, Conv::from_py(value));
+                return 0;
+            },
+            -1);
+    }
+
+    /** Sets the value for a key, with the version bumped for new keys.
+     */
+
+    static void set(PyObject* self, std::int64_t key, V value)
+    {
+        auto res = table(self).emplace(key);
+        *res.first = std::move(value);
+        if (res.second) {
+            ++obj(self)->version;
+        }
+    }
+
+    //
+    // Dictionary methods
+    //
+
+    static PyObject* py_get(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* dflt = Py_None;
+        if (!PyArg_ParseTuple(args, "O|O:get", &key, &dflt)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                const V* v = table(self).find(to_key(key));
+                if (v == nullptr) {
+                    Py_INCREF(dflt);
+                    return dflt;
+                }
+                return get_new(Conv::to_py(*v));
+            },
+            nullptr);
+    }
+
+    static PyObject* py_pop(PyObject* self, PyObject* args)
+    {
+        PyObject* key;
+        PyObject* dflt = nullptr;
+        if (!PyArg_ParseTuple(args, "O|O:pop", &key, &dflt)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                V v{};
+                if (!table(self).take(to_key(key), v)) {
+                    if (dflt == nullptr) {
+                        PyErr_SetObject(PyExc_KeyError, key);
+                        return nullptr;
+                    }
+                    Py_INCREF(dflt);
+                    return dflt;
+                }
+                ++obj(self)->version;
+                return get_new(Conv::to_py(v));
+            },
+            nullptr);
+    }
+
+    static PyObject* py_clear(PyObject* self, PyObject*)
+    {
+        clear(self);
+        Py_RETURN_NONE;
+    }
+
+    /** Makes room in the table, with the version bumped if it is rehashed.
+     *
+     * The iterators keep the indices of slots, which are moved by rehashing.
+     */
+
+    static void reserve(PyObject* self, std::size_t n)
+    {
+        Table& t = table(self);
+        std::size_t capacity = t.capacity();
+        t.reserve(n);
+        if (t.capacity() != capacity) {
+            ++obj(self)->version;
+        }
+    }
+
+    static PyObject* py_reserve(PyObject* self, PyObject* arg)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Py_ssize_t n = PyLong_AsSsize_t(arg);
+                if (n < 0) {
+                    check_exc();
+                    PyErr_SetString(PyExc_ValueError, "negative size");
+                    return nullptr;
+                }
+                reserve(self, static_cast<std::size_t>(n));
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_sizeof(PyObject* self, PyObject*)
+    {
+        return PyLong_FromSize_t(sizeof(Obj) + table(self).memory_usage());
+    }
+
+    //
+    // Bulk operations
+    //
+
+    static PyObject* py_update(PyObject* self, PyObject* args)
+    {
+        PyObject* keys;
+        PyObject* values = nullptr;
+        if (!PyArg_ParseTuple(args, "O|O:update", &keys, &values)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                if (values == nullptr) {
+                    update_mapping(self, keys);
+                } else {
+                    update_bulk(self, keys, values);
+                }
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static void update_mapping(PyObject* self, PyObject* mapping)
+    {
+        Handle items(PyMapping_Items(mapping));
+        for (const auto& i : items) {
+            Handle key(PySequence_GetItem(i, 0));
+            Handle value(PySequence_GetItem(i, 1));
+            set(self, to_key(key), Conv::from_py(value));
+        }
+    }
+
+    static void update_bulk(PyObject* self, PyObject* keys, PyObject* values)
+    {
+        Buffer key_buf(keys);
+        const std::int64_t* key_arr = key_buf.as_array<std::int64_t>();
+        std::size_t n = static_cast<std::size_t>(key_buf.size());
+
+        reserve(self, table(self).size() + n);
+        write_values(self, key_arr, n, values);
+    }
+
+    template <typename T = V>
+    static typename std::enable_if<!std::is_same<T, Handle>::value>::type
+    write_values(PyObject* self, const std::int64_t* keys, std::size_t n,
+        PyObject* values)
+    {
+        Buffer value_buf(values);
+        const V* value_arr = value_buf.as_array<V>();
+        if (static_cast<std::size_t>(value_buf.size()) != n) {
+            PyErr_SetString(
+                PyExc_ValueError, "keys and values of different lengths");
+            throw Exc_set{};
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            set(self, keys[i], value_arr[i]);
+        }
+    }
+
+    template <typename T = V>
+    static typename std::enable_if<std::is_same<T, Handle>::value>::type
+    write_values(PyObject* self, const std::int64_t* keys, std::size_t n,
+        PyObject* values)
+    {
+        Handle seq(PySequence_Fast(values, "values should be iterable"));
+        auto n_values = PySequence_Fast_GET_SIZE(seq.get());
+        if (static_cast<std::size_t>(n_values) != n) {
+            PyErr_SetString(
+                PyExc_ValueError, "keys and values of different lengths");
+            throw Exc_set{};
+        }
+
+        PyObject** items = PySequence_Fast_ITEMS(seq.get());
+        for (std::size_t i = 0; i < n; ++i) {
+            set(self, keys[i], Handle(items[i], NEW));
+        }
+    }
+
+    static PyObject* py_lookup_many(
+        PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        return catch_exc(
+            [&]() { return lookup_many(self, args, kwds); }, nullptr);
+    }
+
+    template <typename T = V>
+    static typename std::enable_if<!std::is_same<T, Handle>::value,
+        PyObject*>::type
+    lookup_many(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "keys", "out", "default", nullptr };
+        PyObject* keys;
+        PyObject* out;
+        PyObject* dflt = nullptr;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O:lookup_many",
+                const_cast<char**>(kwlist), &keys, &out, &dflt)) {
+            return nullptr;
+        }
+
+        V dflt_v = dflt == nullptr ? V{} : Conv::from_py(dflt);
+        Buffer key_buf(keys);
+        const std::int64_t* key_arr = key_buf.as_array<std::int64_t>();
+        Buffer out_buf(out, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE);
+        V* out_arr = out_buf.as_array<V>();
+        if (out_buf.size() != key_buf.size()) {
+            PyErr_SetString(
+                PyExc_ValueError, "keys and output of different lengths");
+            return nullptr;
+        }
+
+        const Table& t = table(self);
+        std::size_t n_found = 0;
+        for (Py_ssize_t i = 0; i < key_buf.size(); ++i) {
+            const V* v = t.find(key_arr[i]);
+            if (v != nullptr) {
+                out_arr[i] = *v;
+                ++n_found;
+            } else {
+                out_arr[i] = dflt_v;
+            }
+        }
+        return PyLong_FromSize_t(n_found);
+    }
+
+    template <typename T = V>
+    static typename std::enable_if<std::is_same<T, Handle>::value,
+        PyObject*>::type
+    lookup_many(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "keys", "default", nullptr };
+        PyObject* keys;
+        PyObject* dflt = Py_None;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:lookup_many",
+                const_cast<char**>(kwlist), &keys, &dflt)) {
+            return nullptr;
+        }
+
+        Buffer key_buf(keys);
+        const std::int64_t* key_arr = key_buf.as_array<std::int64_t>();
+        Handle res(PyList_New(key_buf.size()));
+
+        const Table& t = table(self);
+        for (Py_ssize_t i = 0; i < key_buf.size(); ++i) {
+            const Handle* v = t.find(key_arr[i]);
+            PyObject* item = v != nullptr ? v->get() : dflt;
+            Py_INCREF(item);
+            PyList_SET_ITEM(res.get(), i, item);
+        }
+        return res.release();
+    }
+
+    //
+    // Iteration
+    //
+
+    enum Iter_kind { KEYS, VALUES, ITEMS };
+
+    /** The layout of the iterators over the maps.
+     */
+
+    struct Iter_obj {
+        PyObject_HEAD
+
+        PyObject* map;
+        std::size_t slot;
+        std::size_t version;
+        Iter_kind kind;
+    };
+
+    static Static_type& iter_type()
+    {
+        static Static_type tp("cpypp.IntMapIterator", sizeof(Iter_obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            tp->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+            tp->tp_dealloc = iter_dealloc;
+            tp->tp_traverse = iter_traverse;
+            tp->tp_iter = PyObject_SelfIter;
+            tp->tp_iternext = iter_next;
+        });
+
+        return tp;
+    }
+
+    static PyObject* make_iter(PyObject* self, Iter_kind kind)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                auto it = PyObject_GC_New(Iter_obj, iter_type().tp());
+                if (it == nullptr) {
+                    return nullptr;
+                }
+                Py_INCREF(self);
+                it->map = self;
+                it->slot = 0;
+                it->version = obj(self)->version;
+                it->kind = kind;
+                PyObject_GC_Track(it);
+                return reinterpret_cast<PyObject*>(it);
+            },
+            nullptr);
+    }
+
+    static PyObject* iter(PyObject* self) { return make_iter(self, KEYS); }
+
+    static PyObject* py_keys(PyObject* self, PyObject*)
+    {
+        return make_iter(self, KEYS);
+    }
+
+    static PyObject* py_values(PyObject* self, PyObject*)
+    {
+        return make_iter(self, VALUES);
+    }
+
+    static PyObject* py_items(PyObject* self, PyObject*)
+    {
+        return make_iter(self, ITEMS);
+    }
+
+    static void iter_dealloc(PyObject* self)
+    {
+        PyObject_GC_UnTrack(self);
+        Py_DECREF(reinterpret_cast<Iter_obj*>(self)->map);
+        PyObject_GC_Del(self);
+    }
+
+    static int iter_traverse(PyObject* self, visitproc visit, void* arg)
+    {
+        Py_VISIT(reinterpret_cast<Iter_obj*>(self)->map);
+        return 0;
+    }
+
+    static PyObject* iter_next(PyObject* self)
+    {
+        auto it = reinterpret_cast<Iter_obj*>(self);
+        if (obj(it->map)->version != it->version) {
+            PyErr_SetString(
+                PyExc_RuntimeError, "map changed size during iteration");
+            return nullptr;
+        }
+
+        Table& t = table(it->map);
+        it->slot = t.next(it->slot);
+        if (it->slot >= t.capacity()) {
+            return nullptr;
+        }
+        std::size_t slot = it->slot++;
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                switch (it->kind) {
+                case KEYS:
+                    return PyLong_FromLongLong(t.key_at(slot));
+                case VALUES:
+                    return get_new(Conv::to_py(t.value_at(slot)));
+                default: {
+                    Handle key(PyLong_FromLongLong(t.key_at(slot)));
+                    Handle value = Conv::to_py(t.value_at(slot));
+                    return PyTuple_Pack(2, key.get(), value.get());
+                }
+                }
+            },
+            nullptr);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
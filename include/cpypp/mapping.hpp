@@ -0,0 +1,207 @@
+/** @file mapping.hpp
+ *
+ * Memory mappings of files and shared memory objects
+ *
+ * The regions here own their mappings, which are unmapped when the regions
+ * are destructed.  They are the basis of the facilities sharing memory
+ * between processes or reading large files without copying them, and they
+ * report failures as Python `OSError` with the names involved.
+ */
+
+#ifndef CPYPP_MAPPING_HPP
+#define CPYPP_MAPPING_HPP
+
+#include <cstddef>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Region of memory mapped from a file descriptor.
+ *
+ * The region is only moved, never copied.  An empty region does not own any
+ * mapping.
+ */
+
+class Mapped_region {
+public:
+    Mapped_region() noexcept = default;
+
+    Mapped_region(Mapped_region&& other) noexcept
+        : data_{ other.data_ }
+        , size_{ other.size_ }
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    Mapped_region& operator=(Mapped_region&& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    Mapped_region(const Mapped_region&) = delete;
+    Mapped_region& operator=(const Mapped_region&) = delete;
+
+    ~Mapped_region()
+    {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    /** Maps the given number of bytes of a file descriptor.
+     *
+     * The mapping is shared with other mappings of the same file, and only
+     * writable when requested.  The descriptor can be closed afterward.  The
+     * name is only for the error messages.
+     */
+
+    static Mapped_region map_fd(int fd, std::size_t size, bool if_writable,
+        const char* name, std::size_t offset = 0)
+    {
+        Mapped_region res;
+        if (size == 0) {
+            return res;
+        }
+        int prot = PROT_READ | (if_writable ? PROT_WRITE : 0);
+        void* data = mmap(nullptr, size, prot, MAP_SHARED, fd,
+            static_cast<off_t>(offset));
+        if (data == MAP_FAILED) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            throw Exc_set{};
+        }
+        res.data_ = data;
+        res.size_ = size;
+        return res;
+    }
+
+    /** Maps the whole of a file.
+     *
+     * The file is only read unless it is mapped writable.
+     */
+
+    static Mapped_region map_file(const char* path, bool if_writable = false)
+    {
+        int fd = open(path, if_writable ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            throw Exc_set{};
+        }
+        Fd_guard guard{ fd };
+        return map_fd(fd, file_size(fd, path), if_writable, path);
+    }
+
+    /** Maps a POSIX shared memory object, created with the given size.
+     *
+     * Without a size, the existing object is opened with its own size.  New
+     * objects are never opened in place of existing ones, and their contents
+     * start as zeros.
+     */
+
+    static Mapped_region open_shm(const char* name, std::size_t size = 0)
+    {
+        int flags = size > 0 ? O_RDWR | O_CREAT | O_EXCL : O_RDWR;
+        int fd = shm_open(name, flags, 0600);
+        if (fd < 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            throw Exc_set{};
+        }
+        Fd_guard guard{ fd };
+
+        if (size > 0) {
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+                shm_unlink(name);
+                throw Exc_set{};
+            }
+        } else {
+            size = file_size(fd, name);
+        }
+        return map_fd(fd, size, true, name);
+    }
+
+    /** Removes the name of a POSIX shared memory object.
+     *
+     * The memory is freed when the last mapping of it is unmapped.
+     */
+
+    static void unlink_shm(const char* name)
+    {
+        if (shm_unlink(name) != 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            throw Exc_set{};
+        }
+    }
+
+    /** Advises the kernel on the use of a part of the region.
+     *
+     * The advice is any of the `MADV_*` constants of `madvise`, for the
+     * given bytes, or to the end of the region without a length.  The start
+     * is rounded down to a page.
+     */
+
+    void advise(int advice, std::size_t offset = 0, std::size_t length = 0)
+    {
+        if (data_ == nullptr || offset >= size_) {
+            return;
+        }
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t begin = offset / page * page;
+        std::size_t end
+            = length == 0 || offset + length > size_ ? size_ : offset + length;
+        if (madvise(static_cast<char*>(data_) + begin, end - begin, advice)
+            != 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            throw Exc_set{};
+        }
+    }
+
+    /** Gets the start of the region.
+     */
+
+    void* data() const noexcept { return data_; }
+
+    /** Gets the number of bytes in the region.
+     */
+
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    /** Guard closing a file descriptor.
+     */
+
+    struct Fd_guard {
+        int fd;
+
+        ~Fd_guard() { close(fd); }
+    };
+
+    static std::size_t file_size(int fd, const char* name)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            throw Exc_set{};
+        }
+        return static_cast<std::size_t>(st.st_size);
+    }
+
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// End of namespace cpypp
+}
+
+#endif
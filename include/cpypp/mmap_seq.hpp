@@ -0,0 +1,704 @@
+/** @file mmap_seq.hpp
+ *
+ * Sequences of records in memory-mapped files
+ *
+ * Datasets larger than the memory cannot be held in lists.  The sequences
+ * here keep their records in files mapped into memory, so that only the pages
+ * actually read are brought into the page cache, and the kernel can drop them
+ * again under memory pressure.  Items are only made into Python objects when
+ * they are accessed.
+ *
+ * Records either all have the same size, with the data file holding only the
+ * records, or they have their own sizes.  Records of their own sizes are
+ * prefixed by their sizes in the data file, with the offsets of the records
+ * in a separate index file, named by the data file with `.idx` appended, for
+ * the random access.  The sizes and offsets are 64-bit integers in the native
+ * byte order.
+ */
+
+#ifndef CPYPP_MMAP_SEQ_HPP
+#define CPYPP_MMAP_SEQ_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/mapping.hpp>
+
+namespace cpypp {
+
+/** File of records with random access through memory mappings.
+ *
+ * Appended records are buffered and written to the end of the files with
+ * `write`, and the mappings are only extended when records beyond them are
+ * read, so the pointers to the records are only valid until the next read or
+ * append.  Files opened for writing are created when they do not exist yet.
+ *
+ * The access pattern for the page cache and the readahead of the data is
+ * advised by `advise`, which is kept across the remappings.
+ */
+
+class Record_file {
+public:
+    Record_file(
+        const char* path, std::size_t record_size = 0, bool if_writable = true)
+        : path_{ path }
+        , record_size_{ record_size }
+        , if_writable_{ if_writable }
+    {
+        int flags = if_writable ? O_RDWR | O_CREAT | O_APPEND : O_RDONLY;
+        data_fd_.open(path_, flags);
+        data_size_ = file_size(data_fd_.fd, path_);
+
+        if (record_size_ > 0) {
+            if (data_size_ % record_size_ != 0) {
+                PyErr_Format(PyExc_ValueError,
+                    "size of %s not a multiple of the record size",
+                    path_.c_str());
+                throw Exc_set{};
+            }
+            n_items_ = data_size_ / record_size_;
+        } else {
+            index_path_ = path_ + ".idx";
+            index_fd_.open(index_path_, flags);
+            std::size_t index_size = file_size(index_fd_.fd, index_path_);
+            if (index_size % sizeof(std::uint64_t) != 0) {
+                PyErr_Format(PyExc_ValueError, "truncated index in %s",
+                    index_path_.c_str());
+                throw Exc_set{};
+            }
+            index_size_ = index_size;
+            n_items_ = index_size / sizeof(std::uint64_t);
+        }
+        n_written_ = n_items_;
+    }
+
+    Record_file(const Record_file&) = delete;
+    Record_file& operator=(const Record_file&) = delete;
+
+    /** Writes the records appended before closing the files.
+     *
+     * Failures are reported as unraisable Python exceptions.
+     */
+
+    ~Record_file()
+    {
+        try {
+            flush();
+        } catch (Exc_set&) {
+            PyErr_WriteUnraisable(nullptr);
+        }
+    }
+
+    /** Gets the number of records, including the ones not written yet.
+     */
+
+    std::size_t size() const noexcept { return n_items_; }
+
+    /** Gets the size of all the records, or zero for records of any sizes.
+     */
+
+    std::size_t record_size() const noexcept { return record_size_; }
+
+    /** Gets the data and the size of a record.
+     */
+
+    std::pair<const char*, std::size_t> item(std::size_t idx)
+    {
+        if (idx >= n_written_) {
+            flush();
+        }
+
+        if (record_size_ > 0) {
+            std::size_t begin = idx * record_size_;
+            map_data(begin + record_size_);
+            return { static_cast<const char*>(data_map_.data()) + begin,
+                record_size_ };
+        }
+
+        std::uint64_t begin = record_offset(idx);
+        std::uint64_t size;
+        if (begin + sizeof(size) > data_size_) {
+            corrupt();
+        }
+        map_data(begin + sizeof(size));
+        const char* base = static_cast<const char*>(data_map_.data());
+        std::memcpy(&size, base + begin, sizeof(size));
+        begin += sizeof(size);
+        if (size > data_size_ - begin) {
+            corrupt();
+        }
+        map_data(begin + size);
+        return { static_cast<const char*>(data_map_.data()) + begin,
+            static_cast<std::size_t>(size) };
+    }
+
+    /** Appends a record.
+     *
+     * The record is buffered, and written when enough records are buffered,
+     * or when the records are read or flushed.
+     */
+
+    void append(const void* data, std::size_t size)
+    {
+        if (!if_writable_) {
+            PyErr_SetString(PyExc_ValueError, "record file not writable");
+            throw Exc_set{};
+        }
+
+        if (record_size_ > 0) {
+            if (size != record_size_) {
+                PyErr_Format(PyExc_ValueError,
+                    "record of %zu bytes given for records of %zu bytes", size,
+                    record_size_);
+                throw Exc_set{};
+            }
+        } else {
+            std::uint64_t offset = data_size_ + pending_data_.size();
+            std::uint64_t size_word = size;
+            pending_index_.append(
+                reinterpret_cast<const char*>(&offset), sizeof(offset));
+            pending_data_.append(
+                reinterpret_cast<const char*>(&size_word), sizeof(size_word));
+        }
+        pending_data_.append(static_cast<const char*>(data), size);
+        ++n_items_;
+
+        if (pending_data_.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    /** Writes all the records appended to the files.
+     *
+     * The data is written before the index, so that the index never refers
+     * to records not in the data.
+     */
+
+    void flush()
+    {
+        if (n_written_ == n_items_) {
+            return;
+        }
+        write_all(data_fd_.fd, pending_data_, path_);
+        data_size_ += pending_data_.size();
+        pending_data_.clear();
+        if (record_size_ == 0) {
+            write_all(index_fd_.fd, pending_index_, index_path_);
+            index_size_ += pending_index_.size();
+            pending_index_.clear();
+        }
+        n_written_ = n_items_;
+    }
+
+    /** Advises the kernel on the pattern of the access to the data.
+     *
+     * The advice is any of `MADV_NORMAL`, `MADV_RANDOM` and
+     * `MADV_SEQUENTIAL`, which is given to both the mapping and the page cache
+     * of the data file.  Sequential access doubles the readahead, while random
+     * access turns it off.
+     */
+
+    void advise(int advice)
+    {
+        int file_advice = advice == MADV_RANDOM ? POSIX_FADV_RANDOM
+            : advice == MADV_SEQUENTIAL        ? POSIX_FADV_SEQUENTIAL
+                                               : POSIX_FADV_NORMAL;
+        int err = posix_fadvise(data_fd_.fd, 0, 0, file_advice);
+        if (err != 0) {
+            errno = err;
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path_.c_str());
+            throw Exc_set{};
+        }
+        advice_ = advice;
+        data_map_.advise(advice_);
+    }
+
+    /** Starts reading the data of the given records into the page cache.
+     */
+
+    void prefetch(std::size_t begin, std::size_t end)
+    {
+        flush();
+        if (begin >= end || end > n_items_) {
+            return;
+        }
+        std::size_t begin_byte = record_offset(begin);
+        std::size_t end_byte
+            = end == n_items_ ? data_size_ : record_offset(end);
+        map_data(data_size_);
+        data_map_.advise(MADV_WILLNEED, begin_byte, end_byte - begin_byte);
+    }
+
+    /** Drops the pages of the data from the mapping and the page cache.
+     *
+     * Only pages already written back to the disk can be dropped from the
+     * page cache.
+     */
+
+    void evict()
+    {
+        flush();
+        data_map_.advise(MADV_DONTNEED);
+        posix_fadvise(data_fd_.fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+private:
+    /** Records buffered before they are written.
+     */
+
+    static constexpr std::size_t FLUSH_SIZE = 1 << 20;
+
+    /** File descriptor closed on destruction.
+     */
+
+    struct Fd {
+        int fd = -1;
+
+        void open(const std::string& path, int flags)
+        {
+            fd = ::open(path.c_str(), flags, 0644);
+            if (fd < 0) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, path.c_str());
+                throw Exc_set{};
+            }
+        }
+
+        ~Fd()
+        {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    };
+
+    static std::size_t file_size(int fd, const std::string& path)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path.c_str());
+            throw Exc_set{};
+        }
+        return static_cast<std::size_t>(st.st_size);
+    }
+
+    static void write_all(
+        int fd, const std::string& data, const std::string& path)
+    {
+        std::size_t n_written = 0;
+        while (n_written < data.size()) {
+            ssize_t res
+                = write(fd, data.data() + n_written, data.size() - n_written);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res < 0) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, path.c_str());
+                throw Exc_set{};
+            }
+            n_written += static_cast<std::size_t>(res);
+        }
+    }
+
+    [[noreturn]] void corrupt()
+    {
+        PyErr_Format(PyExc_ValueError, "corrupt record in %s", path_.c_str());
+        throw Exc_set{};
+    }
+
+    /** Makes sure that the mapping of the data covers the given bytes.
+     *
+     * The whole data written is mapped when it is not covered.
+     */
+
+    void map_data(std::size_t size)
+    {
+        if (data_map_.size() >= size) {
+            return;
+        }
+        data_map_ = Mapped_region::map_fd(
+            data_fd_.fd, data_size_, false, path_.c_str());
+        if (advice_ != MADV_NORMAL) {
+            data_map_.advise(advice_);
+        }
+    }
+
+    /** Gets the offset of a written record in the data.
+     */
+
+    std::uint64_t record_offset(std::size_t idx)
+    {
+        if (record_size_ > 0) {
+            return idx * record_size_;
+        }
+
+        std::size_t end = (idx + 1) * sizeof(std::uint64_t);
+        if (index_map_.size() < end) {
+            if (index_size_ < end) {
+                index_size_ = file_size(index_fd_.fd, index_path_);
+            }
+            index_map_ = Mapped_region::map_fd(
+                index_fd_.fd, index_size_, false, index_path_.c_str());
+        }
+        std::uint64_t res;
+        std::memcpy(&res,
+            static_cast<const char*>(index_map_.data())
+                + idx * sizeof(std::uint64_t),
+            sizeof(res));
+        return res;
+    }
+
+    std::string path_;
+    std::string index_path_;
+    std::size_t record_size_;
+    bool if_writable_;
+    int advice_ = MADV_NORMAL;
+
+    Fd data_fd_;
+    Fd index_fd_;
+    std::size_t data_size_ = 0;
+    std::size_t index_size_ = 0;
+    Mapped_region data_map_;
+    Mapped_region index_map_;
+
+    std::size_t n_items_ = 0;
+    std::size_t n_written_ = 0;
+    std::string pending_data_;
+    std::string pending_index_;
+};
+
+/** Python type for the sequences of records in files.
+ *
+ * `MmapSeq(path, record_size=0, writable=True, access='normal')` opens the
+ * records in the given file, with the access being `'normal'`, `'random'` or
+ * `'sequential'`.  The records are read by indices or slices as `bytes`, with
+ * slices giving lists.  The other methods are
+ *
+ * - `append(record)` and `extend(records)` for bytes-like records,
+ *
+ * - `flush()` writing the records appended,
+ *
+ * - `advise(access)` changing the access pattern advised,
+ *
+ * - `prefetch(start=0, stop=None)` starting the reading of the records,
+ *
+ * - `evict()` dropping the pages of the data from memory.
+ */
+
+class Mmap_seq {
+public:
+    /** The layout of the Python objects.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Record_file file;
+    };
+
+    /** Gets the static type of the sequences.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.MmapSeq", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_length = length;
+            seq_methods.sq_item = item;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+
+            static PyMethodDef methods[] = {
+                { "append", (PyCFunction)py_append, METH_O,
+                    "Appends a record." },
+                { "extend", (PyCFunction)py_extend, METH_O,
+                    "Appends the records from an iterable." },
+                { "flush", (PyCFunction)py_flush, METH_NOARGS,
+                    "Writes the records appended." },
+                { "advise", (PyCFunction)py_advise, METH_O,
+                    "Advises the pattern of the access." },
+                { "prefetch", (PyCFunction)py_prefetch, METH_VARARGS,
+                    "Starts reading records into memory." },
+                { "evict", (PyCFunction)py_evict, METH_NOARGS,
+                    "Drops the records from memory." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Sequence of records in a memory-mapped file.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Tests if the given object is a sequence of records.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the file of the records of a sequence.
+     */
+
+    static Record_file& file(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->file;
+    }
+
+private:
+    /** Parses the name of an access pattern into its advice.
+     */
+
+    static int parse_access(const char* access)
+    {
+        if (std::strcmp(access, "normal") == 0) {
+            return MADV_NORMAL;
+        } else if (std::strcmp(access, "random") == 0) {
+            return MADV_RANDOM;
+        } else if (std::strcmp(access, "sequential") == 0) {
+            return MADV_SEQUENTIAL;
+        }
+        PyErr_Format(PyExc_ValueError, "unknown access pattern %s", access);
+        throw Exc_set{};
+    }
+
+    static void append(PyObject* self, PyObject* record)
+    {
+        Buffer buf(record, PyBUF_C_CONTIGUOUS);
+        file(self).append(buf.data(), static_cast<std::size_t>(buf.nbytes()));
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[]
+            = { "path", "record_size", "writable", "access", nullptr };
+        PyObject* path;
+        Py_ssize_t record_size = 0;
+        int if_writable = 1;
+        const char* access = "normal";
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|nps:MmapSeq",
+                const_cast<char**>(kwlist), PyUnicode_FSConverter, &path,
+                &record_size, &if_writable, &access)) {
+            return nullptr;
+        }
+        Handle path_bytes(path);
+        if (record_size < 0) {
+            PyErr_SetString(PyExc_ValueError, "negative record size");
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        bool if_opened = false;
+        auto created = catch_exc(
+            [&]() {
+                int advice = parse_access(access);
+                new (&file(self)) Record_file(PyBytes_AS_STRING(path),
+                    static_cast<std::size_t>(record_size), if_writable != 0);
+                if_opened = true;
+                if (advice != MADV_NORMAL) {
+                    file(self).advise(advice);
+                }
+                return true;
+            },
+            false);
+        if (!created) {
+            // The file is only closed by the deallocation once it is opened.
+            if (if_opened) {
+                Py_DECREF(self);
+            } else {
+                tp->tp_free(self);
+            }
+            return nullptr;
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        file(self).~Record_file();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s object with %zu records>",
+            Py_TYPE(self)->tp_name, file(self).size());
+    }
+
+    //
+    // Sequence protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(file(self).size());
+    }
+
+    static PyObject* item(PyObject* self, Py_ssize_t i)
+    {
+        if (i < 0 || i >= length(self)) {
+            PyErr_SetString(PyExc_IndexError, "record index out of range");
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                auto record = file(self).item(static_cast<std::size_t>(i));
+                return PyBytes_FromStringAndSize(
+                    record.first, static_cast<Py_ssize_t>(record.second));
+            },
+            nullptr);
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        if (!PySlice_Check(key)) {
+            Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+            if (i == -1 && PyErr_Occurred()) {
+                return nullptr;
+            }
+            return item(self, i < 0 ? i + length(self) : i);
+        }
+
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(key, &start, &stop, &step) < 0) {
+            return nullptr;
+        }
+        Py_ssize_t n = PySlice_AdjustIndices(length(self), &start, &stop, step);
+
+        return catch_exc(
+            [&]() {
+                Handle res(PyList_New(n));
+                for (Py_ssize_t i = 0, j = start; i < n; ++i, j += step) {
+                    PyObject* record = item(self, j);
+                    if (record == nullptr) {
+                        throw Exc_set{};
+                    }
+                    PyList_SET_ITEM(res.get(), i, record);
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+
+    //
+    // Methods
+    //
+
+    static PyObject* py_append(PyObject* self, PyObject* record)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                append(self, record);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_extend(PyObject* self, PyObject* records)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Handle iter(PyObject_GetIter(records));
+                while (PyObject* record = PyIter_Next(iter)) {
+                    Handle record_handle(record);
+                    append(self, record);
+                }
+                check_exc();
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_flush(PyObject* self, PyObject*)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                file(self).flush();
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_advise(PyObject* self, PyObject* access)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                const char* name = PyUnicode_AsUTF8(access);
+                if (name == nullptr) {
+                    throw Exc_set{};
+                }
+                file(self).advise(parse_access(name));
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_prefetch(PyObject* self, PyObject* args)
+    {
+        Py_ssize_t start = 0;
+        PyObject* stop = Py_None;
+        if (!PyArg_ParseTuple(args, "|nO:prefetch", &start, &stop)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Py_ssize_t stop_idx = length(self);
+                if (stop != Py_None) {
+                    stop_idx = PyNumber_AsSsize_t(stop, PyExc_IndexError);
+                    check_exc();
+                }
+                PySlice_AdjustIndices(length(self), &start, &stop_idx, 1);
+                file(self).prefetch(static_cast<std::size_t>(start),
+                    static_cast<std::size_t>(stop_idx));
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_evict(PyObject* self, PyObject*)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                file(self).evict();
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
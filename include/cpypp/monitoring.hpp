@@ -0,0 +1,221 @@
+/** @file monitoring.hpp
+ *
+ * Visibility of native code to the profilers of Python
+ *
+ * Profilers like `cProfile` only see the Python functions and the builtin
+ * functions called from Python code.  The native functions behind other
+ * kinds of callables, like the slots of types, are opaque to them, and the
+ * Python callbacks called from native code are attributed to whatever Python
+ * frame happens to be below.  The sites here are code objects standing for
+ * places in native code, which can be entered and left by scopes so that the
+ * profilers see them like Python functions, with the calls made inside
+ * attributed to them.
+ *
+ * From Python 3.13, the scopes fire the `PY_START`, `PY_RETURN` and
+ * `PY_UNWIND` events of `sys.monitoring` by its C API.  Before that, they call
+ * the profile functions set by `sys.setprofile`, which is what `cProfile`
+ * uses before Python 3.12.  In both cases, scopes cost a few loads and
+ * branches when no tool is registered.
+ */
+
+#ifndef CPYPP_MONITORING_HPP
+#define CPYPP_MONITORING_HPP
+
+#include <cstdint>
+#include <utility>
+
+#include <Python.h>
+#include <frameobject.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Site in native code, seen by profilers like a Python function.
+ *
+ * The code object for the site is created on first use, with the GIL held,
+ * and kept until the end of the process.  So sites are best defined as
+ * static variables, with the file name, name and line number shown by the
+ * profilers, like
+ *
+ *     static Native_site site(__FILE__, "encode", __LINE__);
+ *
+ * Sites are for the main interpreter, since code objects cannot be shared
+ * among interpreters with their own GILs.
+ */
+
+class Native_site {
+public:
+    Native_site(const char* file, const char* name, int line) noexcept
+        : file_{ file }
+        , name_{ name }
+        , line_{ line }
+    {
+    }
+
+    Native_site(const Native_site&) = delete;
+    Native_site& operator=(const Native_site&) = delete;
+
+    /** Gets the code object of the site, created if needed.
+     */
+
+    PyCodeObject* code()
+    {
+        if (code_ == nullptr) {
+            code_ = PyCode_NewEmpty(file_, name_, line_);
+            if (code_ == nullptr) {
+                throw Exc_set();
+            }
+        }
+        return code_;
+    }
+
+    const char* name() const noexcept { return name_; }
+
+private:
+    friend class Native_scope;
+
+    const char* file_;
+    const char* name_;
+    int line_;
+
+    PyCodeObject* code_ = nullptr;
+    PyObject* globals_ = nullptr;
+#if PY_VERSION_HEX >= 0x030D0000
+    // The states are only filled when the version is out of date, so they
+    // are kept with the version, as `PyMonitoring_EnterScope` requires.
+    PyMonitoringState states_[3] = {};
+    std::uint64_t version_ = 0;
+#endif
+};
+
+/** Scope of native code reported to the profilers as a site.
+ *
+ * The site is entered when the scope is constructed, with the GIL held, and
+ * left when it is destructed.  It is left by an exception when a Python
+ * exception is set at that time, otherwise it returns `None`.  Errors from
+ * the profilers when entering are thrown as `Exc_set`, while errors when
+ * leaving are reported as unraisable, with any exception already set kept.
+ */
+
+class Native_scope {
+public:
+    explicit Native_scope(Native_site& site)
+        : site_{ site }
+    {
+#if PY_VERSION_HEX >= 0x030D0000
+        static const std::uint8_t events[] = { PY_MONITORING_EVENT_PY_START,
+            PY_MONITORING_EVENT_PY_RETURN, PY_MONITORING_EVENT_PY_UNWIND };
+        PyMonitoringState* states = site.states_;
+        if (PyMonitoring_EnterScope(states, &site.version_, events, 3) < 0) {
+            throw Exc_set();
+        }
+        if_entered_ = true;
+        if (states[0].active) {
+            PyObject* code = reinterpret_cast<PyObject*>(site.code());
+            if (PyMonitoring_FirePyStartEvent(&states[0], code, 0) < 0) {
+                PyMonitoring_ExitScope();
+                throw Exc_set();
+            }
+        }
+#else
+        PyThreadState* tstate = PyThreadState_Get();
+        if (tstate->c_profilefunc == nullptr || tstate->tracing) {
+            return;
+        }
+
+        if (site.globals_ == nullptr) {
+            site.globals_ = PyDict_New();
+            if (site.globals_ == nullptr) {
+                throw Exc_set();
+            }
+        }
+        frame_ = PyFrame_New(tstate, site.code(), site.globals_, nullptr);
+        if (frame_ == nullptr) {
+            throw Exc_set();
+        }
+        if (profile(tstate, PyTrace_CALL, Py_None) < 0) {
+            Py_CLEAR(frame_);
+            throw Exc_set();
+        }
+#endif
+    }
+
+    Native_scope(const Native_scope&) = delete;
+    Native_scope& operator=(const Native_scope&) = delete;
+
+    ~Native_scope()
+    {
+#if PY_VERSION_HEX >= 0x030D0000
+        if (!if_entered_) {
+            return;
+        }
+        PyObject* code = reinterpret_cast<PyObject*>(site_.code_);
+        PyMonitoringState* states = site_.states_;
+        if (code != nullptr) {
+            int status = PyErr_Occurred() != nullptr
+                ? PyMonitoring_FirePyUnwindEvent(&states[2], code, 0)
+                : PyMonitoring_FirePyReturnEvent(&states[1], code, 0, Py_None);
+            if (status < 0) {
+                PyErr_WriteUnraisable(code);
+            }
+        }
+        PyMonitoring_ExitScope();
+#else
+        if (frame_ == nullptr) {
+            return;
+        }
+        PyThreadState* tstate = PyThreadState_Get();
+        if (tstate->c_profilefunc != nullptr) {
+            PyObject* exc = PyErr_Occurred();
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            if (profile(tstate, PyTrace_RETURN, exc ? nullptr : Py_None) < 0) {
+                PyErr_WriteUnraisable(reinterpret_cast<PyObject*>(frame_));
+            }
+            PyErr_Restore(type, value, traceback);
+        }
+        Py_DECREF(frame_);
+#endif
+    }
+
+private:
+#if PY_VERSION_HEX < 0x030D0000
+    /** Calls the profile function with the frame of the site.
+     */
+
+    int profile(PyThreadState* tstate, int what, PyObject* arg) noexcept
+    {
+        PyThreadState_EnterTracing(tstate);
+        int status
+            = tstate->c_profilefunc(tstate->c_profileobj, frame_, what, arg);
+        PyThreadState_LeaveTracing(tstate);
+        return status;
+    }
+#endif
+
+    Native_site& site_;
+#if PY_VERSION_HEX >= 0x030D0000
+    bool if_entered_ = false;
+#else
+    PyFrameObject* frame_ = nullptr;
+#endif
+};
+
+/** Calls a Python callable from a native site.
+ *
+ * The call is made inside a scope of the site, so that profilers attribute
+ * the time spent in the callable to the native site calling it.
+ */
+
+template <typename... Args>
+Handle call_from(Native_site& site, const Handle& callable, Args&&... args)
+{
+    Native_scope scope(site);
+    return callable.call(std::forward<Args>(args)...);
+}
+
+// End of namespace cpypp
+}
+
+#endif
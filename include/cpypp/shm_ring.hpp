@@ -0,0 +1,597 @@
+/** @file shm_ring.hpp
+ *
+ * Rings of records in shared memory between processes
+ *
+ * Passing batches of results between processes by `multiprocessing` pickles
+ * the data and copies it through a pipe, and copies it again when it is
+ * unpickled.  The rings here are in POSIX shared memory, where the producer
+ * copies each record once into the ring, and the consumer gets memory views
+ * directly onto the shared records.  Waiting on empty or full rings is by
+ * futexes in the shared memory, so only a single host is supported, and no
+ * system call is made while the ring is neither empty nor full.
+ *
+ * Each ring has a single producer and a single consumer at any time.  The
+ * records are published and consumed in batches, with the positions in the
+ * shared memory only updated once for each batch.
+ */
+
+#ifndef CPYPP_SHM_RING_HPP
+#define CPYPP_SHM_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/futex.hpp>
+#include <cpypp/mapping.hpp>
+
+namespace cpypp {
+
+/** Layout of the start of the shared memory of the rings.
+ *
+ * The positions are the total numbers of bytes written and released, which
+ * are taken modulo the capacity for the offsets in the data.  The data
+ * follows the header, with each record starting with a 64-bit word of its
+ * size and padded to eight bytes.  Records never wrap around the end of the
+ * data, where a marker tells the consumer to continue from the start.
+ */
+
+struct Shm_ring_header {
+    std::atomic<std::uint64_t> magic;
+    std::uint64_t capacity;
+
+    alignas(64) std::atomic<std::uint64_t> head;
+    Event_count readable;
+
+    alignas(64) std::atomic<std::uint64_t> tail;
+    Event_count writable;
+};
+
+/** Ring of records in a POSIX shared memory object.
+ *
+ * The producer reserves room for records by `try_reserve`, writes them, and
+ * makes all of them visible to the consumer by `publish`.  The consumer takes
+ * the records by `try_next`, which stay valid until they are given back to
+ * the producer by `release`.
+ */
+
+class Shm_ring_buffer {
+public:
+    /** Creates a new ring with at least the given bytes for the records.
+     *
+     * The capacity is rounded up to a power of two of at least a page.
+     */
+
+    static Shm_ring_buffer create(const char* name, std::size_t capacity)
+    {
+        std::size_t rounded = 4096;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+
+        Shm_ring_buffer res(
+            Mapped_region::open_shm(name, data_offset() + rounded));
+        auto header = res.header_;
+        header->capacity = rounded;
+        new (&header->head) std::atomic<std::uint64_t>(0);
+        new (&header->readable) Event_count(true);
+        new (&header->tail) std::atomic<std::uint64_t>(0);
+        new (&header->writable) Event_count(true);
+        header->magic.store(MAGIC, std::memory_order_release);
+        res.init();
+        return res;
+    }
+
+    /** Opens an existing ring.
+     */
+
+    static Shm_ring_buffer open(const char* name)
+    {
+        Shm_ring_buffer res(Mapped_region::open_shm(name));
+        if (res.region_.size() < data_offset()
+            || res.header_->magic.load(std::memory_order_acquire) != MAGIC
+            || res.region_.size()
+                != data_offset() + res.header_->capacity) {
+            PyErr_Format(PyExc_ValueError, "%s is not a ring", name);
+            throw Exc_set{};
+        }
+        res.init();
+        return res;
+    }
+
+    /** Gets the number of bytes for the records.
+     */
+
+    std::size_t capacity() const noexcept { return mask_ + 1; }
+
+    /** Gets the largest size of a single record.
+     *
+     * Records are limited to half the ring, so that a record not fitting
+     * before the end of the data always fits at its start once the ring is
+     * drained.
+     */
+
+    std::size_t max_record() const noexcept { return capacity() / 2 - 8; }
+
+    /** Gets the data of the records, for the offsets of records in it.
+     */
+
+    unsigned char* data() const noexcept { return data_; }
+
+    //
+    // Producer side
+    //
+
+    /** Reserves room for a record of the given size.
+     *
+     * The record is to be written to the returned memory, and it is only seen
+     * by the consumer after `publish`.  Null is returned when the ring has not
+     * enough free room.
+     */
+
+    unsigned char* try_reserve(std::size_t size) noexcept
+    {
+        std::uint64_t total = 8 + (size + 7) / 8 * 8;
+        std::uint64_t offset = reserved_ & mask_;
+        std::uint64_t skip = offset + total > capacity() ? capacity() - offset
+                                                         : 0;
+        std::uint64_t tail = header_->tail.load(std::memory_order_acquire);
+        if (size > max_record()
+            || reserved_ + skip + total - tail > capacity()) {
+            return nullptr;
+        }
+
+        if (skip > 0) {
+            write_word(offset, WRAP);
+            reserved_ += skip;
+            offset = 0;
+        }
+        write_word(offset, size);
+        reserved_ += total;
+        return data_ + offset + 8;
+    }
+
+    /** Makes all the reserved records visible to the consumer.
+     */
+
+    void publish() noexcept
+    {
+        header_->head.store(reserved_, std::memory_order_release);
+        header_->readable.notify();
+    }
+
+    //
+    // Consumer side
+    //
+
+    /** Takes the next record published.
+     *
+     * False is returned when all published records are taken.
+     */
+
+    bool try_next(const unsigned char*& data, std::size_t& size) noexcept
+    {
+        std::uint64_t head = header_->head.load(std::memory_order_acquire);
+        while (read_ != head) {
+            std::uint64_t offset = read_ & mask_;
+            std::uint64_t word;
+            std::memcpy(&word, data_ + offset, sizeof(word));
+            if (word == WRAP) {
+                read_ += capacity() - offset;
+                continue;
+            }
+            data = data_ + offset + 8;
+            size = static_cast<std::size_t>(word);
+            read_ += 8 + (word + 7) / 8 * 8;
+            return true;
+        }
+        return false;
+    }
+
+    /** Gives the room of all the records taken back to the producer.
+     */
+
+    void release() noexcept
+    {
+        header_->tail.store(read_, std::memory_order_release);
+        header_->writable.notify();
+    }
+
+    /** Gets the counts of events to wait on for the records and the room.
+     */
+
+    Event_count& readable() noexcept { return header_->readable; }
+
+    Event_count& writable() noexcept { return header_->writable; }
+
+private:
+    static constexpr std::uint64_t MAGIC = 0x676e69726d687363ULL;
+
+    static constexpr std::uint64_t WRAP = ~static_cast<std::uint64_t>(0);
+
+    static std::size_t data_offset() noexcept
+    {
+        return (sizeof(Shm_ring_header) + 63) / 64 * 64;
+    }
+
+    explicit Shm_ring_buffer(Mapped_region region) noexcept
+        : region_{ std::move(region) }
+        , header_{ static_cast<Shm_ring_header*>(region_.data()) }
+    {
+    }
+
+    void init() noexcept
+    {
+        data_ = static_cast<unsigned char*>(region_.data()) + data_offset();
+        mask_ = header_->capacity - 1;
+        reserved_ = header_->head.load(std::memory_order_acquire);
+        read_ = header_->tail.load(std::memory_order_acquire);
+    }
+
+    void write_word(std::uint64_t offset, std::uint64_t word) noexcept
+    {
+        std::memcpy(data_ + offset, &word, sizeof(word));
+    }
+
+    Mapped_region region_;
+    Shm_ring_header* header_;
+    unsigned char* data_ = nullptr;
+    std::uint64_t mask_ = 0;
+
+    /** Position after the records reserved by the producer here.
+     */
+
+    std::uint64_t reserved_ = 0;
+
+    /** Position after the records taken by the consumer here.
+     */
+
+    std::uint64_t read_ = 0;
+};
+
+/** Python type for the rings in shared memory.
+ *
+ * `ShmRing(name, capacity=0)` creates a new ring with a positive capacity,
+ * or opens an existing one otherwise.  The methods are
+ *
+ * - `publish(records, timeout=None)` copying the contents of a sequence of
+ *   bytes-like objects into the ring, blocking while the ring is full, with
+ *   the number of records published returned, or given as the `n_published`
+ *   attribute of the exception when any record fails, like by `ValueError`
+ *   for records larger than the ring, after the records before it are
+ *   published,
+ *
+ * - `consume(max_records=64, timeout=None)` giving a list of read-only
+ *   memory views onto the next records, blocking until there is any,
+ *
+ * - `release()` giving the records consumed back to the producer, after
+ *   which their memory views must no longer be used,
+ *
+ * - `unlink(name)` as a static method removing the name of a ring.
+ *
+ * The timeouts are in seconds, with the number of records done so far given
+ * when they expire.  The GIL is released while blocking.
+ */
+
+class Shm_ring {
+public:
+    struct Obj {
+        PyObject_HEAD
+
+        Shm_ring_buffer ring;
+    };
+
+    /** Gets the static type of the rings.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.ShmRing", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PyBufferProcs buffer_procs{};
+            buffer_procs.bf_getbuffer = get_buffer;
+
+            static PyMethodDef methods[] = {
+                { "publish", (PyCFunction)(void (*)())py_publish,
+                    METH_VARARGS | METH_KEYWORDS,
+                    "Publishes a batch of records." },
+                { "consume", (PyCFunction)(void (*)())py_consume,
+                    METH_VARARGS | METH_KEYWORDS,
+                    "Consumes a batch of records as memory views." },
+                { "release", (PyCFunction)py_release, METH_NOARGS,
+                    "Releases the records consumed." },
+                { "unlink", (PyCFunction)py_unlink, METH_O | METH_STATIC,
+                    "Removes the name of a ring." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Ring of records in shared memory.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_as_buffer = &buffer_procs;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Tests if the given object is a ring.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the ring inside a Python ring object.
+     */
+
+    static Shm_ring_buffer& ring(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->ring;
+    }
+
+private:
+    static constexpr std::int64_t SIGNAL_INTERVAL_NS = 50000000;
+
+    /** Parses a timeout in seconds into nanoseconds, negative for none.
+     */
+
+    static std::int64_t timeout_ns(PyObject* timeout)
+    {
+        if (timeout == nullptr || timeout == Py_None) {
+            return -1;
+        }
+        double secs = PyFloat_AsDouble(timeout);
+        if (secs == -1.0) {
+            check_exc();
+        }
+        return std::max<std::int64_t>(
+            static_cast<std::int64_t>(secs * 1e9), 0);
+    }
+
+    /** Retries an attempt until it succeeds or the timeout expires.
+     *
+     * The GIL is released while blocking on the event, so the attempt must
+     * not touch any Python object.
+     */
+
+    template <typename F>
+    static bool retry(Event_count& event, F&& attempt, std::int64_t timeout)
+    {
+        if (attempt()) {
+            return true;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (;;) {
+            std::int64_t wait_ns = SIGNAL_INTERVAL_NS;
+            if (timeout >= 0) {
+                std::int64_t elapsed
+                    = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                          .count();
+                if (elapsed >= timeout) {
+                    return false;
+                }
+                wait_ns = std::min(wait_ns, timeout - elapsed);
+            }
+
+            bool if_done;
+            Py_BEGIN_ALLOW_THREADS;
+            auto key = event.prepare();
+            if_done = attempt();
+            if (if_done) {
+                event.cancel();
+            } else {
+                event.wait(key, wait_ns);
+            }
+            Py_END_ALLOW_THREADS;
+
+            if (if_done || attempt()) {
+                return true;
+            }
+            if (PyErr_CheckSignals() < 0) {
+                throw Exc_set{};
+            }
+        }
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "name", "capacity", nullptr };
+        const char* name;
+        Py_ssize_t capacity = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|n:ShmRing",
+                const_cast<char**>(kwlist), &name, &capacity)) {
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        auto created = catch_exc(
+            [&]() {
+                new (&ring(self)) Shm_ring_buffer(capacity > 0
+                        ? Shm_ring_buffer::create(
+                            name, static_cast<std::size_t>(capacity))
+                        : Shm_ring_buffer::open(name));
+                return true;
+            },
+            false);
+        if (!created) {
+            // The type is deallocated directly for the ring not constructed.
+            tp->tp_free(self);
+            return nullptr;
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        ring(self).~Shm_ring_buffer();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static int get_buffer(PyObject* self, Py_buffer* view, int flags)
+    {
+        Shm_ring_buffer& curr = ring(self);
+        return PyBuffer_FillInfo(view, self, curr.data(),
+            static_cast<Py_ssize_t>(curr.capacity()), 1, flags);
+    }
+
+    //
+    // Methods
+    //
+
+    /** Writes a record, with false returned when the timeout expires.
+     *
+     * The records written before are published while waiting for room.
+     */
+
+    static bool publish_one(
+        Shm_ring_buffer& curr, PyObject* record, std::int64_t limit)
+    {
+        Buffer buf(record, PyBUF_C_CONTIGUOUS);
+        auto size = static_cast<std::size_t>(buf.nbytes());
+        if (size > curr.max_record()) {
+            PyErr_SetString(PyExc_ValueError, "record larger than the ring");
+            throw Exc_set{};
+        }
+
+        unsigned char* dest = curr.try_reserve(size);
+        if (dest == nullptr) {
+            curr.publish();
+            bool if_reserved = retry(curr.writable(),
+                [&]() {
+                    dest = curr.try_reserve(size);
+                    return dest != nullptr;
+                },
+                limit);
+            if (!if_reserved) {
+                return false;
+            }
+        }
+        std::memcpy(dest, buf.data(), size);
+        return true;
+    }
+
+    static PyObject* py_publish(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "records", "timeout", nullptr };
+        PyObject* records;
+        PyObject* timeout = nullptr;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:publish",
+                const_cast<char**>(kwlist), &records, &timeout)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                std::int64_t limit = timeout_ns(timeout);
+                Handle items(PySequence_Fast(records, "sequence expected"));
+                Py_ssize_t n_items = PySequence_Fast_GET_SIZE(items.get());
+                PyObject** objs = PySequence_Fast_ITEMS(items.get());
+                Shm_ring_buffer& curr = ring(self);
+
+                Py_ssize_t n_published = 0;
+                try {
+                    for (; n_published < n_items; ++n_published) {
+                        if (!publish_one(curr, objs[n_published], limit)) {
+                            break;
+                        }
+                    }
+                } catch (const Exc_set&) {
+                    curr.publish();
+                    Captured_exc exc = Captured_exc::capture();
+                    Handle count(PyLong_FromSsize_t(n_published));
+                    if (PyObject_SetAttrString(exc.get(), "n_published", count)
+                        < 0) {
+                        PyErr_Clear();
+                    }
+                    exc.rethrow();
+                }
+
+                curr.publish();
+                return PyLong_FromSsize_t(n_published);
+            },
+            nullptr);
+    }
+
+    static PyObject* py_consume(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "max_records", "timeout", nullptr };
+        Py_ssize_t max_records = 64;
+        PyObject* timeout = nullptr;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nO:consume",
+                const_cast<char**>(kwlist), &max_records, &timeout)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Shm_ring_buffer& curr = ring(self);
+                Handle res(PyList_New(0));
+                const unsigned char* data;
+                std::size_t size;
+                bool if_any = max_records > 0
+                    && retry(curr.readable(),
+                        [&]() { return curr.try_next(data, size); },
+                        timeout_ns(timeout));
+                if (!if_any) {
+                    return res.release();
+                }
+
+                Handle whole(PyMemoryView_FromObject(self));
+                do {
+                    auto begin = static_cast<Py_ssize_t>(data - curr.data());
+                    Handle record(PySequence_GetSlice(
+                        whole, begin, begin + static_cast<Py_ssize_t>(size)));
+                    if (PyList_Append(res, record) < 0) {
+                        throw Exc_set{};
+                    }
+                } while (PyList_GET_SIZE(res.get()) < max_records
+                    && curr.try_next(data, size));
+                return res.release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_release(PyObject* self, PyObject*)
+    {
+        ring(self).release();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_unlink(PyObject*, PyObject* name)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                const char* name_str = PyUnicode_AsUTF8(name);
+                if (name_str == nullptr) {
+                    throw Exc_set{};
+                }
+                Mapped_region::unlink_shm(name_str);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,674 @@
+/** @file str_column.hpp
+ *
+ * Compact columns of strings with lazy creation of Python strings
+ *
+ * Each Python string object takes about fifty bytes of overhead besides its
+ * content, plus the pointer in the list holding it.  The columns here store
+ * the UTF-8 encoding of all the strings in a single contiguous buffer, with
+ * an array of offsets delimiting the items, so that only eight bytes of
+ * overhead are needed for each string.  Python string objects are only created
+ * when the items are accessed, while comparisons and hashing work directly on
+ * the packed bytes.
+ *
+ * The packed storage itself is available to C++ code as `Packed_strs`, while
+ * `Str_column` exposes it to Python as a static sequence type.
+ */
+
+#ifndef CPYPP_STR_COLUMN_HPP
+#define CPYPP_STR_COLUMN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Strings packed into a single buffer.
+ *
+ * The bytes of item `i` are in `[offsets[i], offsets[i + 1])` of the data
+ * buffer.  The strings are normally UTF-8 encoded, although the bytes are
+ * never interpreted here.
+ */
+
+class Packed_strs {
+public:
+    Packed_strs()
+        : offsets_(1, 0)
+    {
+    }
+
+    /** Gets the number of strings.
+     */
+
+    std::size_t size() const noexcept { return offsets_.size() - 1; }
+
+    /** Gets a string as its bytes and number of bytes.
+     */
+
+    std::pair<const char*, std::size_t> item(std::size_t i) const noexcept
+    {
+        return { data_.data() + offsets_[i],
+            static_cast<std::size_t>(offsets_[i + 1] - offsets_[i]) };
+    }
+
+    /** Appends a string.
+     */
+
+    void push_back(const char* str, std::size_t size)
+    {
+        data_.insert(data_.end(), str, str + size);
+        offsets_.push_back(static_cast<std::int64_t>(data_.size()));
+    }
+
+    /** Makes room for the given numbers of strings and bytes.
+     */
+
+    void reserve(std::size_t n_strs, std::size_t n_bytes)
+    {
+        offsets_.reserve(n_strs + 1);
+        data_.reserve(n_bytes);
+    }
+
+    /** Tests if a string equals the given bytes.
+     */
+
+    bool equals(std::size_t i, const char* str, std::size_t size) const
+        noexcept
+    {
+        auto curr = item(i);
+        return curr.second == size
+            && std::memcmp(curr.first, str, size) == 0;
+    }
+
+    /** Gets the 64-bit FNV-1a hash of a string.
+     *
+     * Different from the hash of Python strings, the result is the same across
+     * processes, which makes it suitable for partitioning data.
+     */
+
+    std::uint64_t hash(std::size_t i) const noexcept
+    {
+        auto curr = item(i);
+        std::uint64_t res = 0xcbf29ce484222325ULL;
+        for (std::size_t j = 0; j < curr.second; ++j) {
+            res ^= static_cast<unsigned char>(curr.first[j]);
+            res *= 0x100000001b3ULL;
+        }
+        return res;
+    }
+
+    /** Gets the bytes of all strings.
+     */
+
+    const std::vector<char>& data() const noexcept { return data_; }
+
+    /** Gets the offsets delimiting the strings.
+     */
+
+    const std::vector<std::int64_t>& offsets() const noexcept
+    {
+        return offsets_;
+    }
+
+    /** Replaces the contents by the given buffer and offsets.
+     *
+     * The offsets must be non-decreasing, starting from zero and ending at the
+     * size of the data.  False is returned and nothing is changed otherwise.
+     */
+
+    bool assign(const char* data, std::size_t n_bytes,
+        const std::int64_t* offsets, std::size_t n_offsets)
+    {
+        if (n_offsets == 0 || offsets[0] != 0
+            || offsets[n_offsets - 1] != static_cast<std::int64_t>(n_bytes)) {
+            return false;
+        }
+        for (std::size_t i = 1; i < n_offsets; ++i) {
+            if (offsets[i] < offsets[i - 1]) {
+                return false;
+            }
+        }
+
+        data_.assign(data, data + n_bytes);
+        offsets_.assign(offsets, offsets + n_offsets);
+        return true;
+    }
+
+    /** Gets the number of bytes taken by the storage.
+     */
+
+    std::size_t memory_usage() const noexcept
+    {
+        return data_.capacity() + offsets_.capacity() * sizeof(std::int64_t);
+    }
+
+private:
+    std::vector<char> data_;
+    std::vector<std::int64_t> offsets_;
+};
+
+/** Python sequence type of packed strings.
+ *
+ * The Python type `StrColumn` can be constructed from an iterable of strings,
+ * with the keyword argument `cache` giving if the string objects created on
+ * item access are to be kept for later accesses.  Without the cache, each
+ * access creates a new string object.  It implements the sequence protocol
+ * with slicing, and the methods
+ *
+ * - `append(s)`, `extend(iterable)`, `count(s)` and `index(s)` as for lists,
+ *
+ * - `from_buffers(data, offsets, cache=False)` as a class method, building a
+ *   column from a bytes-like object of the UTF-8 data and a buffer of int64
+ *   offsets with one more item than the strings,
+ *
+ * - `equal(s, out)` writing into a writable buffer of bytes if each string
+ *   equals the given one, with the number of equal strings returned,
+ *
+ * - `hashes(out)` writing the stable 64-bit hashes of `Packed_strs::hash`
+ *   into a writable buffer of 64-bit integers.
+ *
+ * Columns compare equal to other columns with the same strings.  Invalid
+ * UTF-8 data from `from_buffers` is only detected when the items are accessed.
+ */
+
+class Str_column {
+public:
+    /** The layout of the Python objects.
+     *
+     * The cache holds new references or null pointers for the items not yet
+     * accessed.  It is empty when caching is disabled.
+     */
+
+    struct Obj {
+        PyObject_HEAD
+
+        Packed_strs strs;
+        std::vector<PyObject*> cache;
+        bool if_cache;
+    };
+
+    /** Gets the static type of the columns.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.StrColumn", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PySequenceMethods seq_methods{};
+            seq_methods.sq_length = length;
+            seq_methods.sq_item = item;
+            seq_methods.sq_contains = contains;
+
+            static PyMappingMethods map_methods{};
+            map_methods.mp_length = length;
+            map_methods.mp_subscript = subscript;
+
+            static PyMethodDef methods[] = {
+                { "append", (PyCFunction)py_append, METH_O,
+                    "Appends a string." },
+                { "extend", (PyCFunction)py_extend, METH_O,
+                    "Appends the strings from an iterable." },
+                { "count", (PyCFunction)py_count, METH_O,
+                    "Counts the occurrences of a string." },
+                { "index", (PyCFunction)py_index, METH_O,
+                    "Gets the first index of a string." },
+                { "equal", (PyCFunction)py_equal, METH_VARARGS,
+                    "Writes if each string equals the given one." },
+                { "hashes", (PyCFunction)py_hashes, METH_O,
+                    "Writes the stable hashes of the strings." },
+                { "from_buffers", (PyCFunction)(void (*)(void))py_from_buffers,
+                    METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+                    "Builds a column from UTF-8 data and offsets." },
+                { "__sizeof__", (PyCFunction)py_sizeof, METH_NOARGS,
+                    "Gets the size of the column in bytes." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Column of strings packed in a single buffer.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_richcompare = richcompare;
+            tp->tp_as_sequence = &seq_methods;
+            tp->tp_as_mapping = &map_methods;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new empty column.
+     */
+
+    static Handle create(bool if_cache = false)
+    {
+        Handle res(PyObject_CallObject(type().tp_obj(), nullptr));
+        set_cache(res, if_cache);
+        return res;
+    }
+
+    /** Tests if the given object is a column.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the packed strings inside a column.
+     *
+     * The given object must be a column.  Strings appended through the packed
+     * storage need to be followed by `sync`.
+     */
+
+    static Packed_strs& strs(PyObject* obj) noexcept
+    {
+        return reinterpret_cast<Obj*>(obj)->strs;
+    }
+
+    /** Updates the cache of a column after changes to its strings.
+     */
+
+    static void sync(PyObject* obj)
+    {
+        Obj* self = reinterpret_cast<Obj*>(obj);
+        if (self->if_cache) {
+            self->cache.resize(self->strs.size(), nullptr);
+        }
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    static void set_cache(PyObject* self, bool if_cache)
+    {
+        obj(self)->if_cache = if_cache;
+        sync(self);
+    }
+
+    /** Gets the UTF-8 encoding of a Python string.
+     */
+
+    static std::pair<const char*, std::size_t> utf8(PyObject* str)
+    {
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize(str, &size);
+        if (data == nullptr) {
+            throw Exc_set{};
+        }
+        return { data, static_cast<std::size_t>(size) };
+    }
+
+    static void append(PyObject* self, PyObject* str)
+    {
+        auto bytes = utf8(str);
+        strs(self).push_back(bytes.first, bytes.second);
+        sync(self);
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "iterable", "cache", nullptr };
+        PyObject* iterable = nullptr;
+        int if_cache = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Op:StrColumn",
+                const_cast<char**>(kwlist), &iterable, &if_cache)) {
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        Handle res(self);
+        new (&obj(self)->strs) Packed_strs();
+        new (&obj(self)->cache) std::vector<PyObject*>();
+
+        return catch_exc(
+            [&]() {
+                set_cache(self, if_cache != 0);
+                if (iterable != nullptr) {
+                    extend(self, iterable);
+                }
+                return res.release();
+            },
+            nullptr);
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        for (auto i : obj(self)->cache) {
+            Py_XDECREF(i);
+        }
+        obj(self)->cache.~vector();
+        strs(self).~Packed_strs();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat(
+            "<%s object with %zu strings>", Py_TYPE(self)->tp_name,
+            strs(self).size());
+    }
+
+    static PyObject* py_sizeof(PyObject* self, PyObject*)
+    {
+        return PyLong_FromSize_t(sizeof(Obj) + strs(self).memory_usage()
+            + obj(self)->cache.capacity() * sizeof(PyObject*));
+    }
+
+    static PyObject* py_from_buffers(
+        PyObject* cls, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "data", "offsets", "cache", nullptr };
+        PyObject* data;
+        PyObject* offsets;
+        int if_cache = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|p:from_buffers",
+                const_cast<char**>(kwlist), &data, &offsets, &if_cache)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                Buffer data_buf(data, PyBUF_SIMPLE);
+                Buffer offsets_buf(offsets);
+                auto offsets_arr = offsets_buf.as_array<std::int64_t>();
+
+                Handle res(PyObject_CallObject(cls, nullptr));
+                bool if_valid = strs(res).assign(
+                    static_cast<const char*>(data_buf.data()),
+                    static_cast<std::size_t>(data_buf.nbytes()), offsets_arr,
+                    static_cast<std::size_t>(offsets_buf.size()));
+                if (!if_valid) {
+                    PyErr_SetString(PyExc_ValueError,
+                        "offsets not increasing from zero to the data size");
+                    return nullptr;
+                }
+                set_cache(res, if_cache != 0);
+                return res.release();
+            },
+            nullptr);
+    }
+
+    //
+    // Sequence protocol
+    //
+
+    static Py_ssize_t length(PyObject* self)
+    {
+        return static_cast<Py_ssize_t>(strs(self).size());
+    }
+
+    static PyObject* item(PyObject* self, Py_ssize_t i)
+    {
+        if (i < 0 || i >= length(self)) {
+            PyErr_SetString(PyExc_IndexError, "column index out of range");
+            return nullptr;
+        }
+
+        std::vector<PyObject*>& cache = obj(self)->cache;
+        if (obj(self)->if_cache && cache[i] != nullptr) {
+            Py_INCREF(cache[i]);
+            return cache[i];
+        }
+
+        auto bytes = strs(self).item(static_cast<std::size_t>(i));
+        PyObject* res = PyUnicode_DecodeUTF8(
+            bytes.first, static_cast<Py_ssize_t>(bytes.second), nullptr);
+        if (res != nullptr && obj(self)->if_cache) {
+            Py_INCREF(res);
+            cache[i] = res;
+        }
+        return res;
+    }
+
+    static PyObject* subscript(PyObject* self, PyObject* key)
+    {
+        if (!PySlice_Check(key)) {
+            Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+            if (i == -1 && PyErr_Occurred()) {
+                return nullptr;
+            }
+            return item(self, i < 0 ? i + length(self) : i);
+        }
+
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(key, &start, &stop, &step) < 0) {
+            return nullptr;
+        }
+        Py_ssize_t n = PySlice_AdjustIndices(length(self), &start, &stop, step);
+
+        return catch_exc(
+            [&]() {
+                Handle res = create(obj(self)->if_cache);
+                Packed_strs& src = strs(self);
+                Packed_strs& dest = strs(res);
+                for (Py_ssize_t i = 0, j = start; i < n; ++i, j += step) {
+                    auto bytes = src.item(static_cast<std::size_t>(j));
+                    dest.push_back(bytes.first, bytes.second);
+                }
+                sync(res);
+                return res.release();
+            },
+            nullptr);
+    }
+
+    /** Gets the index of the first string equal to the given object.
+     *
+     * Negative one is returned when it is not found, including when the given
+     * object is not a string.
+     */
+
+    static Py_ssize_t find(PyObject* self, PyObject* str)
+    {
+        if (!PyUnicode_Check(str)) {
+            return -1;
+        }
+        auto bytes = utf8(str);
+        const Packed_strs& packed = strs(self);
+        for (std::size_t i = 0; i < packed.size(); ++i) {
+            if (packed.equals(i, bytes.first, bytes.second)) {
+                return static_cast<Py_ssize_t>(i);
+            }
+        }
+        return -1;
+    }
+
+    static int contains(PyObject* self, PyObject* str)
+    {
+        return catch_exc([&]() { return find(self, str) >= 0 ? 1 : 0; }, -1);
+    }
+
+    static PyObject* richcompare(PyObject* self, PyObject* other, int op)
+    {
+        if (!check(other) || (op != Py_EQ && op != Py_NE)) {
+            Py_RETURN_NOTIMPLEMENTED;
+        }
+
+        const Packed_strs& lhs = strs(self);
+        const Packed_strs& rhs = strs(other);
+        bool if_eq = lhs.offsets() == rhs.offsets() && lhs.data() == rhs.data();
+        return PyBool_FromLong((op == Py_EQ) == if_eq);
+    }
+
+    //
+    // List-like methods
+    //
+
+    static PyObject* py_append(PyObject* self, PyObject* str)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                append(self, str);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    /** Appends the strings from an iterable.
+     *
+     * Other columns are copied natively, with the column itself taken as it
+     * is before the extension, like for lists.
+     */
+
+    static void extend(PyObject* self, PyObject* iterable)
+    {
+        if (check(iterable)) {
+            Packed_strs snapshot{};
+            if (iterable == self) {
+                snapshot = strs(self);
+            }
+            const Packed_strs& src
+                = iterable == self ? snapshot : strs(iterable);
+            Packed_strs& packed = strs(self);
+            packed.reserve(packed.size() + src.size(),
+                packed.data().size() + src.data().size());
+            for (std::size_t i = 0; i < src.size(); ++i) {
+                auto str = src.item(i);
+                packed.push_back(str.first, str.second);
+            }
+            sync(self);
+            return;
+        }
+
+        Py_ssize_t hint = PyObject_LengthHint(iterable, 0);
+        if (hint < 0) {
+            throw Exc_set{};
+        }
+        Packed_strs& packed = strs(self);
+        packed.reserve(packed.size() + hint, packed.data().size());
+
+        for (const auto& i : Handle(iterable, BORROW)) {
+            append(self, i);
+        }
+    }
+
+    static PyObject* py_extend(PyObject* self, PyObject* iterable)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                extend(self, iterable);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_count(PyObject* self, PyObject* str)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                std::size_t res = 0;
+                if (PyUnicode_Check(str)) {
+                    auto bytes = utf8(str);
+                    const Packed_strs& packed = strs(self);
+                    for (std::size_t i = 0; i < packed.size(); ++i) {
+                        res += packed.equals(i, bytes.first, bytes.second);
+                    }
+                }
+                return PyLong_FromSize_t(res);
+            },
+            nullptr);
+    }
+
+    static PyObject* py_index(PyObject* self, PyObject* str)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Py_ssize_t res = find(self, str);
+                if (res < 0) {
+                    PyErr_SetString(PyExc_ValueError, "string not in column");
+                    return nullptr;
+                }
+                return PyLong_FromSsize_t(res);
+            },
+            nullptr);
+    }
+
+    //
+    // Bulk operations
+    //
+
+    /** Gets a writable output buffer with an item for each string.
+     */
+
+    template <typename T> static T* out_array(PyObject* self, Buffer& out)
+    {
+        T* res = out.as_array<T>();
+        if (static_cast<std::size_t>(out.size()) != strs(self).size()) {
+            PyErr_SetString(
+                PyExc_ValueError, "output not of the same length as column");
+            throw Exc_set{};
+        }
+        return res;
+    }
+
+    static PyObject* py_equal(PyObject* self, PyObject* args)
+    {
+        PyObject* str;
+        PyObject* out;
+        if (!PyArg_ParseTuple(args, "UO:equal", &str, &out)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                auto bytes = utf8(str);
+                Buffer out_buf(
+                    out, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE);
+                auto out_arr = out_array<std::uint8_t>(self, out_buf);
+
+                const Packed_strs& packed = strs(self);
+                std::size_t res = 0;
+                for (std::size_t i = 0; i < packed.size(); ++i) {
+                    bool if_eq = packed.equals(i, bytes.first, bytes.second);
+                    out_arr[i] = if_eq;
+                    res += if_eq;
+                }
+                return PyLong_FromSize_t(res);
+            },
+            nullptr);
+    }
+
+    static PyObject* py_hashes(PyObject* self, PyObject* out)
+    {
+        return catch_exc(
+            [&]() -> PyObject* {
+                Buffer out_buf(
+                    out, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE);
+                // Both signed and unsigned 64-bit outputs are accepted.
+                std::uint64_t* out_arr
+                    = out_buf.holds<std::int64_t>()
+                    ? reinterpret_cast<std::uint64_t*>(
+                          out_array<std::int64_t>(self, out_buf))
+                    : out_array<std::uint64_t>(self, out_buf);
+
+                const Packed_strs& packed = strs(self);
+                for (std::size_t i = 0; i < packed.size(); ++i) {
+                    out_arr[i] = packed.hash(i);
+                }
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,913 @@
+/** @file subinterp_pool.hpp
+ *
+ * Pools of sub-interpreters for running Python code on multiple cores
+ *
+ * CPU-bound Python code cannot run in parallel in threads of a single
+ * interpreter, while spreading it over processes costs pickling and memory.
+ * The pools here start sub-interpreters each living on its own native thread,
+ * which run functions named by their modules.  From Python 3.12, each
+ * sub-interpreter has its own GIL so that they truly run in parallel.  Before
+ * 3.12, the sub-interpreters share the GIL with the main interpreter, which
+ * keeps them isolated without any speedup.
+ *
+ * No objects are ever shared among the interpreters.  The arguments and
+ * results cross the boundaries of the interpreters encoded by `marshal`, so
+ * they are limited to the builtin types supported there, like numbers,
+ * strings, bytes, and containers of them.
+ */
+
+#ifndef CPYPP_SUBINTERP_POOL_HPP
+#define CPYPP_SUBINTERP_POOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <Python.h>
+#include <marshal.h>
+
+#include <cpypp.hpp>
+#include <cpypp/executor.hpp>
+
+namespace cpypp {
+
+/** C++ exception for Python exceptions raised in sub-interpreters.
+ *
+ * The name of the Python exception type is kept besides the message, so that
+ * builtin exceptions can be raised again with the same type in the calling
+ * interpreter.
+ */
+
+class Interp_error : public Call_error {
+public:
+    Interp_error(std::string type_name, const std::string& msg)
+        : Call_error{ msg }
+        , type_name_{ std::move(type_name) }
+    {
+    }
+
+    /** Makes an error from the current Python exception, which is cleared.
+     */
+
+    static Interp_error fetch()
+    {
+        PyObject* type = PyErr_Occurred();
+        std::string type_name = type != nullptr && PyType_Check(type)
+            ? reinterpret_cast<PyTypeObject*>(type)->tp_name
+            : "";
+        return Interp_error(std::move(type_name), Call_error::fetch().what());
+    }
+
+    /** Gets the name of the Python exception type.
+     */
+
+    const std::string& type_name() const noexcept { return type_name_; }
+
+    /** Sets the error as the current Python exception.
+     *
+     * Builtin exceptions are raised with the same type, and others as
+     * `RuntimeError` with the type name in the message.
+     */
+
+    void restore() const
+    {
+        PyObject* type = type_name_.empty()
+            ? nullptr
+            : PyDict_GetItemString(PyEval_GetBuiltins(), type_name_.c_str());
+        if (type == nullptr || !PyExceptionClass_Check(type)) {
+            PyErr_SetString(PyExc_RuntimeError, what());
+            return;
+        }
+
+        std::string msg = what();
+        std::string prefix = type_name_ + ": ";
+        if (msg.compare(0, prefix.size(), prefix) == 0) {
+            msg.erase(0, prefix.size());
+        } else if (msg == type_name_) {
+            msg.clear();
+        }
+        PyErr_SetString(type, msg.c_str());
+    }
+
+private:
+    std::string type_name_;
+};
+
+/** Future for the encoded result of a call in a sub-interpreter.
+ *
+ * The result can be taken any number of times, each time decoded into a new
+ * object in the calling interpreter.
+ */
+
+class Interp_future {
+public:
+    Interp_future() = default;
+
+    explicit Interp_future(std::shared_future<std::string> res)
+        : res_{ std::move(res) }
+    {
+    }
+
+    /** Tests if the result is ready.
+     */
+
+    bool done() const
+    {
+        return res_.wait_for(std::chrono::seconds(0))
+            == std::future_status::ready;
+    }
+
+    /** Gets the result, blocking with the GIL released until it is ready.
+     *
+     * Python exceptions from the call are raised again in the calling
+     * interpreter by `Interp_error::restore`.
+     */
+
+    Handle get() const
+    {
+        while (!done()) {
+            {
+                Gil_release released{};
+                res_.wait_for(std::chrono::milliseconds(50));
+            }
+            if (PyErr_CheckSignals() < 0) {
+                throw Exc_set{};
+            }
+        }
+
+        try {
+            const std::string& encoded = res_.get();
+            return { PyMarshal_ReadObjectFromString(encoded.data(),
+                static_cast<Py_ssize_t>(encoded.size())) };
+        } catch (const Interp_error& exc) {
+            exc.restore();
+            throw Exc_set{};
+        }
+    }
+
+private:
+    std::shared_future<std::string> res_;
+};
+
+/** Pool of sub-interpreters running named functions.
+ *
+ * The functions are named as `module:name`, or `module.name` with the last
+ * dot separating the name.  The modules are imported in each sub-interpreter
+ * when the functions are first called there.  Functions defined by the
+ * initialization code given to the pool, which is run in the `__main__`
+ * module of each sub-interpreter, are named like `__main__:name`.
+ *
+ * The pool needs to be constructed with the GIL of the main interpreter
+ * held.  It is shut down when it is destructed, or at the exit of the main
+ * interpreter.
+ */
+
+class Interp_pool {
+public:
+    /** Starts the given number of sub-interpreters.
+     *
+     * With pinning, each thread of the sub-interpreters is bound to a CPU, on
+     * systems supporting it.  Python exceptions are raised when any of the
+     * sub-interpreters fails to start.
+     */
+
+    explicit Interp_pool(
+        std::size_t n_interps, std::string init = "", bool if_pin = false)
+        : main_interp_{ PyInterpreterState_Get() }
+        , init_{ std::move(init) }
+    {
+        register_atexit();
+        with_registry(
+            [this](Registry& registry) { registry.pools.push_back(this); });
+
+        n_interps = std::max<std::size_t>(n_interps, 1);
+        std::vector<std::future<std::string>> errors{};
+        for (std::size_t i = 0; i < n_interps; ++i) {
+            std::promise<std::string> started{};
+            errors.push_back(started.get_future());
+            threads_.emplace_back(
+                &Interp_pool::work, this, i, if_pin, std::move(started));
+        }
+
+        std::string error{};
+        {
+            Gil_release released{};
+            for (auto& i : errors) {
+                std::string curr = i.get();
+                if (error.empty()) {
+                    error = std::move(curr);
+                }
+            }
+        }
+        if (!error.empty()) {
+            shutdown();
+            unregister();
+            PyErr_SetString(PyExc_RuntimeError, error.c_str());
+            throw Exc_set{};
+        }
+    }
+
+    Interp_pool(const Interp_pool&) = delete;
+    Interp_pool& operator=(const Interp_pool&) = delete;
+
+    ~Interp_pool()
+    {
+        shutdown();
+        unregister();
+    }
+
+    /** Gets the number of sub-interpreters.
+     */
+
+    std::size_t size() const noexcept { return threads_.size(); }
+
+    /** Submits a call of the named function with the given tuple of arguments.
+     *
+     * The arguments are encoded with the GIL held, and Python exceptions are
+     * raised when they cannot be encoded or the pool is already shut down.
+     */
+
+    Interp_future submit(const std::string& func, const Handle& args)
+    {
+        if (!PyTuple_Check(args.get())) {
+            PyErr_SetString(PyExc_TypeError, "arguments must be a tuple");
+            throw Exc_set{};
+        }
+
+        Task task{ func, encode(args), {} };
+        Interp_future res(task.res.get_future().share());
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (if_stopping_) {
+                PyErr_SetString(PyExc_RuntimeError, "pool is shut down");
+                throw Exc_set{};
+            }
+            tasks_.push_back(std::move(task));
+        }
+        has_tasks_.notify_one();
+        return res;
+    }
+
+    /** Calls the named function on each of the items, giving a list of results.
+     */
+
+    Handle map(const std::string& func, const Handle& items)
+    {
+        std::vector<Interp_future> futures{};
+        for (const auto& i : items) {
+            futures.push_back(submit(func, Handle("(O)", i.get())));
+        }
+
+        Handle res(PyList_New(0));
+        for (const auto& i : futures) {
+            Handle item = i.get();
+            if (PyList_Append(res, item) < 0) {
+                throw Exc_set{};
+            }
+        }
+        return res;
+    }
+
+    /** Shuts down the pool after all submitted calls are finished.
+     *
+     * The GIL is released while waiting, if it is held.  Nothing is done for
+     * pools already shut down.
+     */
+
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (if_stopping_) {
+                return;
+            }
+            if_stopping_ = true;
+        }
+        has_tasks_.notify_all();
+
+        if (holds_gil()) {
+            Gil_release released{};
+            join();
+        } else {
+            join();
+        }
+    }
+
+private:
+    /** Calls submitted to the pool.
+     */
+
+    struct Task {
+        std::string func;
+        std::string args;
+        std::promise<std::string> res;
+    };
+
+    /** All pools alive, with the interpreters where `atexit` is registered.
+     */
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Interp_pool*> pools;
+        std::vector<PyInterpreterState*> interps;
+    };
+
+    /** Runs an action with the registry locked and the GIL released.
+     */
+
+    template <typename F> static void with_registry(F&& action)
+    {
+        static Registry registry{};
+        auto locked = [&]() {
+            std::lock_guard<std::mutex> guard(registry.mutex);
+            action(registry);
+        };
+
+        if (holds_gil()) {
+            Gil_release released{};
+            locked();
+        } else {
+            locked();
+        }
+    }
+
+    void unregister()
+    {
+        with_registry([this](Registry& registry) {
+            auto& pools = registry.pools;
+            pools.erase(
+                std::remove(pools.begin(), pools.end(), this), pools.end());
+        });
+    }
+
+    /** Encodes an object in the current interpreter.
+     */
+
+    static std::string encode(PyObject* obj)
+    {
+        Handle encoded(PyMarshal_WriteObjectToString(obj, Py_MARSHAL_VERSION));
+        char* data;
+        Py_ssize_t size;
+        if (PyBytes_AsStringAndSize(encoded, &data, &size) < 0) {
+            throw Exc_set{};
+        }
+        return { data, static_cast<std::size_t>(size) };
+    }
+
+    void join()
+    {
+        for (auto& i : threads_) {
+            if (i.joinable()) {
+                i.join();
+            }
+        }
+    }
+
+    //
+    // Sub-interpreters
+    //
+
+    /** Creates a new sub-interpreter, made current with its GIL held.
+     *
+     * Null is returned on failure, with the current thread state unchanged.
+     */
+
+    static PyThreadState* new_interp() noexcept
+    {
+#if PY_VERSION_HEX >= 0x030C0000
+        PyInterpreterConfig config{};
+        config.use_main_obmalloc = 0;
+        config.allow_fork = 0;
+        config.allow_exec = 0;
+        config.allow_threads = 1;
+        config.allow_daemon_threads = 0;
+        config.check_multi_interp_extensions = 1;
+        config.gil = PyInterpreterConfig_OWN_GIL;
+
+        PyThreadState* tstate = nullptr;
+        PyStatus status = Py_NewInterpreterFromConfig(&tstate, &config);
+        return PyStatus_Exception(status) ? nullptr : tstate;
+#else
+        return Py_NewInterpreter();
+#endif
+    }
+
+    /** Ends a sub-interpreter, with the thread state of the main interpreter.
+     *
+     * The thread state of the sub-interpreter needs to be current.  The given
+     * thread state of the main interpreter is made current afterwards, with
+     * the GIL of the main interpreter held.
+     */
+
+    static void end_interp(PyThreadState* tstate, PyThreadState* main) noexcept
+    {
+        Py_EndInterpreter(tstate);
+        PyThreadState_Swap(main);
+    }
+
+    /** Starts the sub-interpreter of the current thread.
+     *
+     * Null is returned on failure, with the error message given.
+     */
+
+    PyThreadState* start(std::string& error) noexcept
+    {
+        PyThreadState* main = PyThreadState_New(main_interp_);
+        PyEval_RestoreThread(main);
+
+        PyThreadState* tstate = new_interp();
+        if (tstate == nullptr) {
+            error = "failed to create sub-interpreter";
+        } else if (!init_.empty()) {
+            PyObject* globals
+                = PyModule_GetDict(PyImport_AddModule("__main__"));
+            PyObject* res = PyRun_String(
+                init_.c_str(), Py_file_input, globals, globals);
+            if (res == nullptr) {
+                error = Call_error::fetch().what();
+            }
+            Py_XDECREF(res);
+        }
+
+        if (tstate != nullptr && !error.empty()) {
+            end_interp(tstate, main);
+            tstate = nullptr;
+        } else if (tstate != nullptr) {
+            PyEval_SaveThread();
+            PyEval_RestoreThread(main);
+        }
+        PyThreadState_Clear(main);
+        PyThreadState_DeleteCurrent();
+        return tstate;
+    }
+
+    /** Pins the current thread to a CPU chosen by the given index.
+     */
+
+    static void pin(std::size_t idx) noexcept
+    {
+#ifdef __linux__
+        unsigned n_cpus = std::thread::hardware_concurrency();
+        if (n_cpus == 0) {
+            return;
+        }
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(static_cast<int>(idx % n_cpus), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+        (void)idx;
+#endif
+    }
+
+    /** Runs the calls in the sub-interpreter of a thread.
+     *
+     * The promise is given the error message from starting the
+     * sub-interpreter, which is empty on success.
+     */
+
+    void work(std::size_t idx, bool if_pin, std::promise<std::string> started)
+    {
+        if (if_pin) {
+            pin(idx);
+        }
+        std::string error{};
+        PyThreadState* tstate = start(error);
+        started.set_value(error);
+        if (tstate == nullptr) {
+            return;
+        }
+
+        Thread_binding& binding = Thread_binding::current();
+        binding.tstate = tstate;
+        std::unordered_map<std::string, Handle> funcs{};
+
+        for (;;) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                has_tasks_.wait(
+                    lock, [this]() { return if_stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    break;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+
+            Gil_acquire acquired{};
+            run(task, funcs);
+        }
+
+        PyThreadState* main = PyThreadState_New(main_interp_);
+        PyEval_RestoreThread(tstate);
+        funcs.clear();
+        binding.tstate = nullptr;
+        end_interp(tstate, main);
+        PyThreadState_Clear(main);
+        PyThreadState_DeleteCurrent();
+    }
+
+    /** Runs a call with the GIL of the sub-interpreter held.
+     */
+
+    static void run(
+        Task& task, std::unordered_map<std::string, Handle>& funcs) noexcept
+    {
+        try {
+            Handle args(PyMarshal_ReadObjectFromString(task.args.data(),
+                static_cast<Py_ssize_t>(task.args.size())));
+            Handle res(PyObject_Call(resolve(task.func, funcs), args, nullptr));
+            task.res.set_value(encode(res));
+        } catch (const Exc_set&) {
+            task.res.set_exception(
+                std::make_exception_ptr(Interp_error::fetch()));
+        } catch (...) {
+            task.res.set_exception(std::current_exception());
+        }
+    }
+
+    /** Resolves a named function in the current interpreter, with caching.
+     */
+
+    static PyObject* resolve(
+        const std::string& func, std::unordered_map<std::string, Handle>& funcs)
+    {
+        auto found = funcs.find(func);
+        if (found != funcs.end()) {
+            return found->second;
+        }
+
+        auto sep = func.find(':');
+        if (sep == std::string::npos) {
+            sep = func.rfind('.');
+        }
+        if (sep == std::string::npos || sep == 0 || sep + 1 == func.size()) {
+            PyErr_Format(
+                PyExc_ValueError, "invalid function name %s", func.c_str());
+            throw Exc_set{};
+        }
+
+        Handle res(PyImport_ImportModule(func.substr(0, sep).c_str()));
+        std::string path = func.substr(sep + 1);
+        for (std::size_t begin = 0; begin <= path.size();) {
+            auto end = std::min(path.find('.', begin), path.size());
+            res = res.getattr(path.substr(begin, end - begin).c_str());
+            begin = end + 1;
+        }
+        return funcs.emplace(func, std::move(res)).first->second;
+    }
+
+    //
+    // Shutdown at exit
+    //
+
+    /** Registers the shutdown of the pools at the exit of the interpreter.
+     */
+
+    void register_atexit()
+    {
+        bool if_registered = false;
+        with_registry([&](Registry& registry) {
+            auto& interps = registry.interps;
+            if_registered
+                = std::find(interps.begin(), interps.end(), main_interp_)
+                != interps.end();
+            if (!if_registered) {
+                interps.push_back(main_interp_);
+            }
+        });
+        if (if_registered) {
+            return;
+        }
+
+        static PyMethodDef def = { "_shutdown_interp_pools",
+            (PyCFunction)shutdown_all, METH_NOARGS,
+            "Shuts down the sub-interpreter pools of the interpreter." };
+        Handle atexit(PyImport_ImportModule("atexit"));
+        Handle callback(PyCFunction_New(&def, nullptr));
+        atexit.getattr("register").call(callback);
+    }
+
+    static PyObject* shutdown_all(PyObject*, PyObject*)
+    {
+        PyInterpreterState* interp = PyInterpreterState_Get();
+        with_registry([&](Registry& registry) {
+            for (auto i : registry.pools) {
+                if (i->main_interp_ == interp) {
+                    i->shutdown();
+                }
+            }
+            auto& interps = registry.interps;
+            interps.erase(std::remove(interps.begin(), interps.end(), interp),
+                interps.end());
+        });
+        Py_RETURN_NONE;
+    }
+
+    PyInterpreterState* main_interp_;
+    std::string init_;
+
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    std::deque<Task> tasks_;
+    bool if_stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
+
+/** Python type for the futures of calls in sub-interpreters.
+ */
+
+class Subinterp_future {
+public:
+    struct Obj {
+        PyObject_HEAD
+
+        Interp_future fut;
+    };
+
+    /** Gets the static type of the futures.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.SubinterpFuture", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PyMethodDef methods[] = {
+                { "result", (PyCFunction)py_result, METH_NOARGS,
+                    "Gets the result, blocking until it is ready." },
+                { "done", (PyCFunction)py_done, METH_NOARGS,
+                    "Tests if the result is ready." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Future for a call in a sub-interpreter.";
+            tp->tp_dealloc = dealloc;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a Python future for the given future.
+     */
+
+    static Handle create(Interp_future fut)
+    {
+        PyTypeObject* tp = type().tp();
+        Handle res(tp->tp_alloc(tp, 0));
+        new (&obj(res)->fut) Interp_future(std::move(fut));
+        return res;
+    }
+
+    /** Tests if the given object is a future of sub-interpreters.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the native future.
+     */
+
+    static const Interp_future& fut(PyObject* self) noexcept
+    {
+        return obj(self)->fut;
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        obj(self)->fut.~Interp_future();
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* py_result(PyObject* self, PyObject*)
+    {
+        return catch_exc(
+            [&]() { return obj(self)->fut.get().release(); }, nullptr);
+    }
+
+    static PyObject* py_done(PyObject* self, PyObject*)
+    {
+        return PyBool_FromLong(obj(self)->fut.done());
+    }
+};
+
+/** Python type for the pools of sub-interpreters.
+ *
+ * The pools are constructed as `SubinterpPool(n_interps, init='',
+ * pin=False)`, with `submit(func, *args)` giving a future and `map(func,
+ * items)` a list of results.  They can also be used as context managers
+ * shutting them down at exit.
+ */
+
+class Subinterp_pool {
+public:
+    struct Obj {
+        PyObject_HEAD
+
+        Interp_pool* pool;
+    };
+
+    /** Gets the static type of the pools.
+     */
+
+    static Static_type& type()
+    {
+        static Static_type tp("cpypp.SubinterpPool", sizeof(Obj));
+
+        tp.make_ready([](PyTypeObject* tp) {
+            static PyMethodDef methods[] = {
+                { "submit", (PyCFunction)py_submit, METH_VARARGS,
+                    "Submits a call of the named function." },
+                { "map", (PyCFunction)py_map, METH_VARARGS,
+                    "Calls the named function on each of the items." },
+                { "shutdown", (PyCFunction)py_shutdown, METH_NOARGS,
+                    "Shuts down the pool after all calls are finished." },
+                { "__enter__", (PyCFunction)py_enter, METH_NOARGS,
+                    "Enters the pool as a context." },
+                { "__exit__", (PyCFunction)py_exit, METH_VARARGS,
+                    "Shuts down the pool at the exit of the context." },
+                { nullptr, nullptr, 0, nullptr } };
+
+            tp->tp_flags = Py_TPFLAGS_DEFAULT;
+            tp->tp_doc = "Pool of sub-interpreters running named functions.";
+            tp->tp_new = tp_new;
+            tp->tp_dealloc = dealloc;
+            tp->tp_repr = repr;
+            tp->tp_methods = methods;
+        });
+
+        return tp;
+    }
+
+    /** Creates a new pool.
+     */
+
+    static Handle create(
+        std::size_t n_interps, const char* init = "", bool if_pin = false)
+    {
+        return { PyObject_CallFunction(type().tp_obj(), "nsi",
+            static_cast<Py_ssize_t>(n_interps), init,
+            static_cast<int>(if_pin)) };
+    }
+
+    /** Tests if the given object is a pool of sub-interpreters.
+     */
+
+    static bool check(PyObject* obj)
+    {
+        return PyObject_TypeCheck(obj, type().tp());
+    }
+
+    /** Gets the native pool.
+     */
+
+    static Interp_pool& pool(PyObject* self) noexcept
+    {
+        return *obj(self)->pool;
+    }
+
+private:
+    static Obj* obj(PyObject* self) noexcept
+    {
+        return reinterpret_cast<Obj*>(self);
+    }
+
+    //
+    // Life cycle
+    //
+
+    static PyObject* tp_new(PyTypeObject* tp, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = { "n_interps", "init", "pin", nullptr };
+        Py_ssize_t n_interps;
+        const char* init = "";
+        int if_pin = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|sp:SubinterpPool",
+                const_cast<char**>(kwlist), &n_interps, &init, &if_pin)) {
+            return nullptr;
+        }
+        if (n_interps < 1) {
+            PyErr_SetString(
+                PyExc_ValueError, "number of interpreters must be positive");
+            return nullptr;
+        }
+
+        PyObject* self = tp->tp_alloc(tp, 0);
+        if (self == nullptr) {
+            return nullptr;
+        }
+        obj(self)->pool = catch_exc(
+            [&]() {
+                return new Interp_pool(
+                    static_cast<std::size_t>(n_interps), init, if_pin != 0);
+            },
+            nullptr);
+        if (obj(self)->pool == nullptr) {
+            Py_DECREF(self);
+            return nullptr;
+        }
+        return self;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        delete obj(self)->pool;
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* repr(PyObject* self)
+    {
+        return PyUnicode_FromFormat("<%s with %zu sub-interpreters>",
+            Py_TYPE(self)->tp_name, pool(self).size());
+    }
+
+    //
+    // Methods
+    //
+
+    static PyObject* py_submit(PyObject* self, PyObject* args)
+    {
+        Py_ssize_t n_args = PyTuple_GET_SIZE(args);
+        if (n_args < 1) {
+            PyErr_SetString(PyExc_TypeError, "function name is not given");
+            return nullptr;
+        }
+        const char* func = PyUnicode_AsUTF8(PyTuple_GET_ITEM(args, 0));
+        if (func == nullptr) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                Handle call_args(PyTuple_GetSlice(args, 1, n_args));
+                return Subinterp_future::create(
+                    pool(self).submit(func, call_args))
+                    .release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_map(PyObject* self, PyObject* args)
+    {
+        const char* func;
+        PyObject* items;
+        if (!PyArg_ParseTuple(args, "sO:map", &func, &items)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() {
+                return pool(self).map(func, Handle(items, BORROW)).release();
+            },
+            nullptr);
+    }
+
+    static PyObject* py_shutdown(PyObject* self, PyObject*)
+    {
+        pool(self).shutdown();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_enter(PyObject* self, PyObject*)
+    {
+        Py_INCREF(self);
+        return self;
+    }
+
+    static PyObject* py_exit(PyObject* self, PyObject*)
+    {
+        pool(self).shutdown();
+        Py_RETURN_FALSE;
+    }
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,573 @@
+/** @file trace.hpp
+ *
+ * Timelines of the spans at the boundaries of native code and Python
+ *
+ * The recorder here is a `Span_tracer` logging the beginnings and ends of the
+ * calls, conversions and waits for the GIL at the cpypp boundaries, along with
+ * scopes defined by users, into ring buffers for each thread.  The events can
+ * be dumped in the JSON format of Chrome traces, for viewers like Perfetto or
+ * `chrome://tracing`, on demand or at the exit of the process.
+ *
+ * Recording can be switched on and off at runtime, from C++ or from Python
+ * through the functions in `Span_recorder::methods`, which can be added to
+ * any extension module.
+ */
+
+#ifndef CPYPP_TRACE_HPP
+#define CPYPP_TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Events of the beginnings and ends of spans.
+ *
+ * The names are copied into the events, truncated when needed, so that the
+ * events never refer to any Python object.
+ */
+
+struct Trace_event {
+    static constexpr std::size_t NAME_SIZE = 46;
+
+    std::int64_t ts_ns;
+    char phase;
+    Span_kind kind;
+    char name[NAME_SIZE];
+};
+
+/** Ring buffer of the events of a thread.
+ *
+ * The buffer is written only by its thread, and the oldest events are
+ * overwritten when it is full.  Reading it while it is being written gives
+ * the events written so far, possibly with the latest one torn.
+ */
+
+class Trace_buffer {
+public:
+    Trace_buffer(unsigned long ident, std::size_t capacity)
+        : ident_{ ident }
+        , events_(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    /** Appends an event, with the name cut at the given length.
+     */
+
+    void push(char phase, Span_kind kind, const char* name,
+        std::size_t len) noexcept
+    {
+        std::uint64_t pos = n_pushed_.load(std::memory_order_relaxed);
+        Trace_event& event = events_[pos % events_.size()];
+        event.ts_ns = Gil_observer::now();
+        event.phase = phase;
+        event.kind = kind;
+        len = std::min(len, Trace_event::NAME_SIZE - 1);
+        std::memcpy(event.name, name, len);
+        event.name[len] = '\0';
+        n_pushed_.store(pos + 1, std::memory_order_release);
+    }
+
+    /** Calls the action on each of the events kept, from the oldest.
+     */
+
+    template <typename F> void for_each(F&& action) const
+    {
+        std::uint64_t n_pushed = n_pushed_.load(std::memory_order_acquire);
+        std::uint64_t begin = n_pushed > events_.size()
+            ? n_pushed - events_.size()
+            : 0;
+        for (std::uint64_t i = begin; i < n_pushed; ++i) {
+            action(events_[i % events_.size()]);
+        }
+    }
+
+    /** Drops all the events.
+     *
+     * This is only safe when the thread of the buffer is not writing.
+     */
+
+    void clear() noexcept { n_pushed_.store(0, std::memory_order_release); }
+
+    unsigned long ident() const noexcept { return ident_; }
+
+private:
+    unsigned long ident_;
+    std::vector<Trace_event> events_;
+    std::atomic<std::uint64_t> n_pushed_{ 0 };
+};
+
+/** Recorder of the spans into ring buffers for each thread.
+ *
+ * The recorder for the process is given by `global`, which lives until the
+ * end of the process so that it is always safe to install.
+ */
+
+class Span_recorder : public Span_tracer {
+public:
+    explicit Span_recorder(std::size_t capacity = 65536)
+        : capacity_{ capacity }
+    {
+    }
+
+    /** Gets the recorder for the process.
+     */
+
+    static Span_recorder& global()
+    {
+        static Span_recorder* recorder = new Span_recorder();
+        return *recorder;
+    }
+
+    /** Starts recording, by installing the recorder as the span tracer.
+     */
+
+    void enable() noexcept
+    {
+        if_enabled_.store(true);
+        install(this);
+    }
+
+    /** Stops recording, with the recorded events kept.
+     */
+
+    void disable() noexcept
+    {
+        if_enabled_.store(false);
+        if (installed() == this) {
+            install(nullptr);
+        }
+    }
+
+    bool enabled() const noexcept { return if_enabled_.load(); }
+
+    void begin(Span_kind kind, PyObject* obj) noexcept override
+    {
+        Trace_buffer* buffer = local();
+        if (buffer == nullptr) {
+            return;
+        }
+        char name[Trace_event::NAME_SIZE];
+        std::size_t len = name_of(kind, obj, name);
+        buffer->push('B', kind, name, len);
+    }
+
+    void end(Span_kind kind) noexcept override
+    {
+        Trace_buffer* buffer = local();
+        if (buffer != nullptr) {
+            buffer->push('E', kind, "", 0);
+        }
+    }
+
+    /** Begins a scope defined by users, with the given name.
+     */
+
+    void begin_scope(const char* name) noexcept
+    {
+        Trace_buffer* buffer = enabled() ? local() : nullptr;
+        if (buffer != nullptr) {
+            buffer->push('B', Span_kind::SCOPE, name, std::strlen(name));
+        }
+    }
+
+    /** Ends the innermost scope defined by users.
+     */
+
+    void end_scope() noexcept
+    {
+        Trace_buffer* buffer = enabled() ? local() : nullptr;
+        if (buffer != nullptr) {
+            buffer->push('E', Span_kind::SCOPE, "", 0);
+        }
+    }
+
+    /** Drops all the recorded events.
+     *
+     * This is only safe while no thread is recording.
+     */
+
+    void clear() noexcept
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (const auto& i : buffers_) {
+            i->clear();
+        }
+    }
+
+    /** Dumps the recorded events as a Chrome trace in JSON.
+     */
+
+    std::string dump() const
+    {
+        std::string res = "{\"traceEvents\":[";
+        bool if_first = true;
+        auto sep = [&]() {
+            if (!if_first) {
+                res.push_back(',');
+            }
+            if_first = false;
+        };
+        long pid = static_cast<long>(getpid());
+        char buf[128];
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (std::size_t tid = 0; tid < buffers_.size(); ++tid) {
+            const Trace_buffer& buffer = *buffers_[tid];
+            sep();
+            std::snprintf(buf, sizeof(buf),
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+                "\"tid\":%zu,\"args\":{\"name\":\"thread %lu\"}}",
+                pid, tid, buffer.ident());
+            res.append(buf);
+
+            buffer.for_each([&](const Trace_event& event) {
+                sep();
+                res.append("{\"name\":\"");
+                append_escaped(res, event.name);
+                std::snprintf(buf, sizeof(buf),
+                    "\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,"
+                    "\"pid\":%ld,\"tid\":%zu}",
+                    category(event.kind), event.phase,
+                    static_cast<long long>(event.ts_ns / 1000),
+                    static_cast<long long>(event.ts_ns % 1000), pid, tid);
+                res.append(buf);
+            });
+        }
+        res.append("],\"displayTimeUnit\":\"ns\"}");
+        return res;
+    }
+
+    /** Dumps the recorded events into the file of the given path.
+     *
+     * False is returned when the file cannot be written.
+     */
+
+    bool dump(const char* path) const
+    {
+        std::string content = dump();
+        std::FILE* file = std::fopen(path, "w");
+        if (file == nullptr) {
+            return false;
+        }
+        bool if_written
+            = std::fwrite(content.data(), 1, content.size(), file)
+            == content.size();
+        return std::fclose(file) == 0 && if_written;
+    }
+
+    /** Dumps the events of the global recorder at the exit of the process.
+     *
+     * Only the last path given is used.
+     */
+
+    static void dump_at_exit(const char* path)
+    {
+        static std::string exit_path{};
+        static bool if_registered = false;
+        static std::mutex mutex{};
+
+        std::lock_guard<std::mutex> guard(mutex);
+        exit_path = path;
+        if (!if_registered) {
+            if_registered = true;
+            std::atexit([]() {
+                std::lock_guard<std::mutex> guard(mutex);
+                global().disable();
+                global().dump(exit_path.c_str());
+            });
+        }
+    }
+
+    /** Gets the Python functions controlling the global recorder.
+     *
+     * The functions are `trace_enable()`, `trace_disable()`,
+     * `trace_enabled()`, `trace_clear()`, `trace_dump(path=None)` giving the
+     * JSON when no path is given, `trace_dump_at_exit(path)`,
+     * `trace_begin(name)` and `trace_end()`.  They can be added to modules by
+     * `PyModule_AddFunctions`.
+     */
+
+    static PyMethodDef* methods()
+    {
+        static PyMethodDef defs[] = {
+            { "trace_enable", (PyCFunction)py_enable, METH_NOARGS,
+                "Starts recording the spans." },
+            { "trace_disable", (PyCFunction)py_disable, METH_NOARGS,
+                "Stops recording the spans." },
+            { "trace_enabled", (PyCFunction)py_enabled, METH_NOARGS,
+                "Tests if the spans are being recorded." },
+            { "trace_clear", (PyCFunction)py_clear, METH_NOARGS,
+                "Drops all the recorded spans." },
+            { "trace_dump", (PyCFunction)py_dump, METH_VARARGS,
+                "Dumps the spans as a Chrome trace, into a file if given." },
+            { "trace_dump_at_exit", (PyCFunction)py_dump_at_exit, METH_O,
+                "Dumps the spans into the file at the exit of the process." },
+            { "trace_begin", (PyCFunction)py_begin, METH_O,
+                "Begins a scope with the given name." },
+            { "trace_end", (PyCFunction)py_end, METH_NOARGS,
+                "Ends the innermost scope." },
+            { nullptr, nullptr, 0, nullptr }
+        };
+        return defs;
+    }
+
+private:
+    /** Gets the buffer of the current thread, registered on first use.
+     *
+     * The buffers are cached for each thread by the recorders, which are
+     * identified by unique identifiers rather than their addresses.  The last
+     * buffer used is checked first.
+     */
+
+    Trace_buffer* local() noexcept
+    {
+        struct Cached {
+            std::uint64_t id = 0;
+            Trace_buffer* buffer = nullptr;
+        };
+        static thread_local Cached last{};
+        static thread_local std::vector<Cached> cached{};
+        if (last.id == id_) {
+            return last.buffer;
+        }
+        for (const auto& i : cached) {
+            if (i.id == id_) {
+                last = i;
+                return last.buffer;
+            }
+        }
+
+        try {
+            cached.reserve(cached.size() + 1);
+            std::unique_ptr<Trace_buffer> buffer(
+                new Trace_buffer(PyThread_get_thread_ident(), capacity_));
+            std::lock_guard<std::mutex> guard(mutex_);
+            buffers_.push_back(std::move(buffer));
+            last = { id_, buffers_.back().get() };
+            cached.push_back(last);
+            return last.buffer;
+        } catch (...) {
+            return nullptr;
+        }
+    }
+
+    /** Writes the name of a span, with its length returned.
+     *
+     * Only names readily available in ASCII are used, so that no Python API
+     * that could fail or allocate is called.
+     */
+
+    static std::size_t name_of(
+        Span_kind kind, PyObject* obj, char (&name)[Trace_event::NAME_SIZE])
+    {
+        const char* prefix = kind == Span_kind::CONVERT ? "as " : "";
+        const char* base = "";
+        std::size_t base_len = 0;
+
+        if (kind == Span_kind::GIL_WAIT) {
+            base = "gil wait";
+        } else if (obj == nullptr) {
+            base = "?";
+        } else if (kind == Span_kind::CALL && PyFunction_Check(obj)) {
+            PyObject* qualname
+                = reinterpret_cast<PyFunctionObject*>(obj)->func_qualname;
+            if (qualname != nullptr && PyUnicode_Check(qualname)
+                && PyUnicode_IS_ASCII(qualname)) {
+                base = static_cast<const char*>(PyUnicode_DATA(qualname));
+                base_len = static_cast<std::size_t>(
+                    PyUnicode_GET_LENGTH(qualname));
+            } else {
+                base = "function";
+            }
+        } else if (kind == Span_kind::CALL && PyCFunction_Check(obj)) {
+            base = reinterpret_cast<PyCFunctionObject*>(obj)->m_ml->ml_name;
+        } else if (kind == Span_kind::CALL && PyType_Check(obj)) {
+            base = reinterpret_cast<PyTypeObject*>(obj)->tp_name;
+        } else {
+            base = Py_TYPE(obj)->tp_name;
+        }
+        if (base_len == 0) {
+            base_len = std::strlen(base);
+        }
+
+        std::size_t prefix_len = std::strlen(prefix);
+        std::size_t len = std::min(
+            prefix_len + base_len, Trace_event::NAME_SIZE - 1);
+        std::memcpy(name, prefix, prefix_len);
+        std::memcpy(name + prefix_len, base, len - prefix_len);
+        name[len] = '\0';
+        return len;
+    }
+
+    static const char* category(Span_kind kind) noexcept
+    {
+        switch (kind) {
+        case Span_kind::CALL:
+            return "call";
+        case Span_kind::CONVERT:
+            return "convert";
+        case Span_kind::GIL_WAIT:
+            return "gil";
+        default:
+            return "scope";
+        }
+    }
+
+    static void append_escaped(std::string& out, const char* str)
+    {
+        for (; *str != '\0'; ++str) {
+            auto c = static_cast<unsigned char>(*str);
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(static_cast<char>(c));
+            } else if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out.append(buf);
+            } else {
+                out.push_back(static_cast<char>(c));
+            }
+        }
+    }
+
+    static std::uint64_t next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> id{ 0 };
+        return ++id;
+    }
+
+    //
+    // Python functions
+    //
+
+    static PyObject* py_enable(PyObject*, PyObject*)
+    {
+        global().enable();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_disable(PyObject*, PyObject*)
+    {
+        global().disable();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_enabled(PyObject*, PyObject*)
+    {
+        return PyBool_FromLong(global().enabled());
+    }
+
+    static PyObject* py_clear(PyObject*, PyObject*)
+    {
+        global().clear();
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_dump(PyObject*, PyObject* args)
+    {
+        const char* path = nullptr;
+        if (!PyArg_ParseTuple(args, "|z:trace_dump", &path)) {
+            return nullptr;
+        }
+
+        return catch_exc(
+            [&]() -> PyObject* {
+                if (path == nullptr) {
+                    std::string content = global().dump();
+                    return PyUnicode_FromStringAndSize(content.data(),
+                        static_cast<Py_ssize_t>(content.size()));
+                }
+                if (!global().dump(path)) {
+                    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+                    return nullptr;
+                }
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_dump_at_exit(PyObject*, PyObject* path)
+    {
+        const char* content = PyUnicode_AsUTF8(path);
+        if (content == nullptr) {
+            return nullptr;
+        }
+        return catch_exc(
+            [&]() -> PyObject* {
+                dump_at_exit(content);
+                Py_RETURN_NONE;
+            },
+            nullptr);
+    }
+
+    static PyObject* py_begin(PyObject*, PyObject* name)
+    {
+        const char* content = PyUnicode_AsUTF8(name);
+        if (content == nullptr) {
+            return nullptr;
+        }
+        global().begin_scope(content);
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* py_end(PyObject*, PyObject*)
+    {
+        global().end_scope();
+        Py_RETURN_NONE;
+    }
+
+    std::size_t capacity_;
+    std::uint64_t id_ = next_id();
+    std::atomic<bool> if_enabled_{ false };
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Trace_buffer>> buffers_;
+};
+
+/** Scope defined by users, recorded by the global recorder when enabled.
+ */
+
+class Trace_span {
+public:
+    explicit Trace_span(const char* name) noexcept
+        : if_recording_{ Span_recorder::global().enabled() }
+    {
+        if (if_recording_) {
+            Span_recorder::global().begin_scope(name);
+        }
+    }
+
+    Trace_span(const Trace_span&) = delete;
+    Trace_span& operator=(const Trace_span&) = delete;
+
+    ~Trace_span()
+    {
+        if (if_recording_) {
+            Span_recorder::global().end_scope();
+        }
+    }
+
+private:
+    bool if_recording_;
+};
+
+// End of namespace cpypp
+}
+
+#endif
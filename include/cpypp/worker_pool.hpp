@@ -0,0 +1,418 @@
+/** @file worker_pool.hpp
+ *
+ * Pools of native threads with persistent thread states
+ *
+ * `PyGILState_Ensure` on a thread without any thread state creates a new one,
+ * which is destroyed again by the matching `PyGILState_Release`.  For native
+ * threads taking the GIL over and over again, like the workers of thread
+ * pools, most of the cost of taking the GIL is then spent on the thread
+ * states.  The workers of the pool here create their thread states once, for
+ * a given interpreter or sub-interpreter, and bind them to their threads by
+ * `Thread_binding`, so that all `Gil_acquire` guards in the tasks reuse them.
+ */
+
+#ifndef CPYPP_WORKER_POOL_HPP
+#define CPYPP_WORKER_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+namespace cpypp {
+
+/** Pool of native worker threads with persistent thread states.
+ *
+ * The tasks are run without the GIL, which can be taken by `Gil_acquire`
+ * guards using the thread state of the worker.  The pool is shut down when it
+ * is destructed, or at the exit of the interpreter of the workers by an
+ * `atexit` callback registered when the pool is constructed in that
+ * interpreter.  Pools for other interpreters need to be shut down before their
+ * interpreters are finalized.
+ */
+
+class Worker_pool {
+public:
+    /** Starts the given number of workers for the given interpreter.
+     *
+     * The interpreter defaults to the current one, which needs the GIL to be
+     * held.
+     */
+
+    explicit Worker_pool(
+        std::size_t n_workers, PyInterpreterState* interp = nullptr)
+        : interp_{ interp != nullptr ? interp : PyInterpreterState_Get() }
+    {
+        if (holds_gil() && PyInterpreterState_Get() == interp_) {
+            register_atexit();
+        }
+        with_registry([this](Registry& registry) {
+            registry.pools.push_back(this);
+        });
+
+        for (std::size_t i = 0; i < std::max<std::size_t>(n_workers, 1); ++i) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    Worker_pool(const Worker_pool&) = delete;
+    Worker_pool& operator=(const Worker_pool&) = delete;
+
+    ~Worker_pool()
+    {
+        shutdown();
+        with_registry([this](Registry& registry) {
+            auto& pools = registry.pools;
+            pools.erase(
+                std::remove(pools.begin(), pools.end(), this), pools.end());
+        });
+    }
+
+    /** Gets the number of workers.
+     */
+
+    std::size_t size() const noexcept { return workers_.size(); }
+
+    /** Gets the interpreter of the thread states of the workers.
+     */
+
+    PyInterpreterState* interp() const noexcept { return interp_; }
+
+    /** Submits a task, with its result given by a future.
+     *
+     * Python exceptions signalled by `Exc_set` from the task are captured
+     * into `Captured_exc` for the future, since they would otherwise be left
+     * in the thread state of the worker.  `std::runtime_error` is thrown when
+     * the pool is already shut down.
+     */
+
+    template <typename F>
+    auto submit(F&& task) -> std::future<decltype(task())>
+    {
+        using R = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<R()>>(
+            [task = std::forward<F>(task)]() mutable -> R {
+                try {
+                    return task();
+                } catch (const Exc_set&) {
+                    throw Captured_exc::capture();
+                }
+            });
+        auto res = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (if_stopping_) {
+                throw std::runtime_error("worker pool is shut down");
+            }
+            tasks_.emplace_back([packaged]() { (*packaged)(); });
+        }
+        has_tasks_.notify_one();
+        return res;
+    }
+
+    /** Shuts down the pool after all submitted tasks are finished.
+     *
+     * The GIL is released while waiting for the workers, if it is held.
+     * Nothing is done for pools already shut down.
+     */
+
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (if_stopping_) {
+                return;
+            }
+            if_stopping_ = true;
+        }
+        has_tasks_.notify_all();
+
+        if (holds_gil()) {
+            Gil_release released{};
+            join();
+        } else {
+            join();
+        }
+    }
+
+private:
+    /** All pools alive, with the interpreters where `atexit` is registered.
+     */
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Worker_pool*> pools;
+        std::vector<PyInterpreterState*> interps;
+    };
+
+    /** Runs an action with the registry locked.
+     *
+     * The GIL is released while the registry is locked, since shutting down
+     * pools with the registry locked needs the GIL for the workers.
+     */
+
+    template <typename F> static void with_registry(F&& action)
+    {
+        static Registry registry{};
+        auto locked = [&]() {
+            std::lock_guard<std::mutex> guard(registry.mutex);
+            action(registry);
+        };
+
+        if (holds_gil()) {
+            Gil_release released{};
+            locked();
+        } else {
+            locked();
+        }
+    }
+
+    void join()
+    {
+        for (auto& i : workers_) {
+            if (i.joinable()) {
+                i.join();
+            }
+        }
+    }
+
+    /** Runs the tasks with the thread state of the worker.
+     */
+
+    void work()
+    {
+        Thread_binding& binding = Thread_binding::current();
+        binding.tstate = PyThreadState_New(interp_);
+
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                has_tasks_.wait(
+                    lock, [this]() { return if_stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    break;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+
+        if (binding.tstate != nullptr) {
+            PyEval_RestoreThread(binding.tstate);
+            PyThreadState_Clear(binding.tstate);
+            PyThreadState_DeleteCurrent();
+            binding.tstate = nullptr;
+        }
+    }
+
+    /** Registers the shutdown of the pools at the exit of the interpreter.
+     *
+     * It is done at most once for each interpreter, with the GIL held.
+     */
+
+    void register_atexit()
+    {
+        bool if_registered = false;
+        with_registry([&](Registry& registry) {
+            auto& interps = registry.interps;
+            if_registered = std::find(interps.begin(), interps.end(), interp_)
+                != interps.end();
+            if (!if_registered) {
+                interps.push_back(interp_);
+            }
+        });
+        if (if_registered) {
+            return;
+        }
+
+        static PyMethodDef def = { "_shutdown_worker_pools",
+            (PyCFunction)shutdown_all, METH_NOARGS,
+            "Shuts down the worker pools of the interpreter." };
+        Handle atexit(PyImport_ImportModule("atexit"));
+        Handle callback(PyCFunction_New(&def, nullptr));
+        atexit.getattr("register").call(callback);
+    }
+
+    static PyObject* shutdown_all(PyObject*, PyObject*)
+    {
+        PyInterpreterState* interp = PyInterpreterState_Get();
+        with_registry([&](Registry& registry) {
+            for (auto i : registry.pools) {
+                if (i->interp_ == interp) {
+                    i->shutdown();
+                }
+            }
+            auto& interps = registry.interps;
+            interps.erase(std::remove(interps.begin(), interps.end(), interp),
+                interps.end());
+        });
+        Py_RETURN_NONE;
+    }
+
+    PyInterpreterState* interp_;
+
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    std::deque<std::function<void()>> tasks_;
+    bool if_stopping_ = false;
+
+    std::vector<std::thread> workers_;
+};
+
+/** Group of tasks on a worker pool failing fast.
+ *
+ * The first failure of the tasks in a group, either a C++ exception or a
+ * Python exception signalled by `Exc_set`, cancels the group.  Tasks not
+ * started yet are then skipped, and running tasks can stop early by polling
+ * `cancelled`.  The failure is thrown again by `wait` on the joining thread,
+ * where captured Python exceptions are set again as the current exception
+ * before `Exc_set` is thrown, if the GIL is held.
+ */
+
+class Task_group {
+public:
+    explicit Task_group(Worker_pool& pool)
+        : pool_{ pool }
+    {
+    }
+
+    Task_group(const Task_group&) = delete;
+    Task_group& operator=(const Task_group&) = delete;
+
+    /** Waits for the tasks, with any failure ignored.
+     */
+
+    ~Task_group() { join(); }
+
+    /** Runs a task in the group.
+     */
+
+    template <typename F> void run(F&& task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            ++n_pending_;
+        }
+        try {
+            pool_.submit([this, task = std::forward<F>(task)]() mutable {
+                if (!cancelled()) {
+                    try {
+                        task();
+                    } catch (const Exc_set&) {
+                        fail(std::make_exception_ptr(Captured_exc::capture()));
+                    } catch (...) {
+                        fail(std::current_exception());
+                    }
+                }
+                finish();
+            });
+        } catch (...) {
+            finish();
+            throw;
+        }
+    }
+
+    /** Tests if the group is cancelled.
+     */
+
+    bool cancelled() const noexcept
+    {
+        return if_cancelled_.load(std::memory_order_relaxed);
+    }
+
+    /** Cancels the tasks not started yet.
+     */
+
+    void cancel() noexcept { if_cancelled_.store(true); }
+
+    /** Waits for all the tasks and throws the first failure.
+     *
+     * The GIL is released while waiting, if it is held.  The group can be
+     * used again afterwards.
+     */
+
+    void wait()
+    {
+        join();
+
+        std::exception_ptr failure{};
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            std::swap(failure, failure_);
+        }
+        if_cancelled_.store(false);
+        if (failure == nullptr) {
+            return;
+        }
+
+        try {
+            std::rethrow_exception(failure);
+        } catch (const Captured_exc& exc) {
+            if (holds_gil()) {
+                exc.rethrow();
+            }
+            throw;
+        }
+    }
+
+private:
+    void fail(std::exception_ptr failure)
+    {
+        cancel();
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (failure_ == nullptr) {
+            failure_ = std::move(failure);
+        }
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (--n_pending_ == 0) {
+            finished_.notify_all();
+        }
+    }
+
+    void join()
+    {
+        auto wait_pending = [this]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            finished_.wait(lock, [this]() { return n_pending_ == 0; });
+        };
+
+        if (holds_gil()) {
+            Gil_release released{};
+            wait_pending();
+        } else {
+            wait_pending();
+        }
+    }
+
+    Worker_pool& pool_;
+
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    std::size_t n_pending_ = 0;
+    std::exception_ptr failure_;
+    std::atomic<bool> if_cancelled_{ false };
+};
+
+// End of namespace cpypp
+}
+
+#endif
@@ -0,0 +1,58 @@
+/** Tests for the memory resources for conversions.
+ */
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/arena.hpp>
+
+using namespace cpypp;
+
+using Pmr_strs = std::pmr::vector<std::pmr::string>;
+
+TEST_CASE("Conversions take storage from memory resources", "[as_in]")
+{
+    Counting_resource counting{};
+    Handle strs(Py_BuildValue("[sss]", "a long string beyond any small buffer",
+        "another long string beyond any small buffer", "x"));
+
+    auto res = as_in<Pmr_strs>(strs, &counting);
+    REQUIRE(res.size() == 3);
+    CHECK(res[1] == "another long string beyond any small buffer");
+    CHECK(res[2] == "x");
+    // The vector itself and the two long strings.
+    CHECK(counting.n_allocs() == 3);
+    CHECK(res[0].get_allocator().resource() == &counting);
+}
+
+TEST_CASE("Request arenas release the memory at once", "[Request_arena]")
+{
+    Counting_resource upstream{};
+    Handle strs(Py_BuildValue("[sss]", "a long string beyond any small buffer",
+        "another long string beyond any small buffer", "x"));
+    Handle nested(Py_BuildValue("[[ii][i]]", 1, 2, 3));
+
+    Request_arena<> arena(&upstream);
+    for (int i = 0; i < 100; ++i) {
+        auto res = arena.as<Pmr_strs>(strs);
+        CHECK(res[0] == "a long string beyond any small buffer");
+        auto nums
+            = arena.as<std::pmr::vector<std::pmr::vector<long>>>(nested);
+        CHECK(nums[1][0] == 3);
+        arena.release();
+    }
+    // Every request fits in the inline buffer.
+    CHECK(upstream.n_allocs() == 0);
+
+    // Larger requests take more buffers from upstream.
+    Request_arena<64> small(&upstream);
+    auto res = small.as<Pmr_strs>(strs);
+    CHECK(res.size() == 3);
+    CHECK(upstream.n_allocs() > 0);
+}
@@ -0,0 +1,156 @@
+/** Tests for the ordered maps with native keys.
+ */
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/btree_map.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("B-trees keep entries in order", "[Btree]")
+{
+    // Small nodes for deep trees even with a few entries.
+    using Tree = Btree<std::int64_t, long, 32>;
+    Tree tree{};
+    std::map<std::int64_t, long> ref{};
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<std::int64_t> dist(-500, 500);
+    for (int i = 0; i < 2000; ++i) {
+        auto key = dist(gen);
+        *tree.emplace(key).first = i;
+        ref[key] = i;
+    }
+
+    auto check_ref = [&]() {
+        REQUIRE(tree.size() == ref.size());
+        auto pos = tree.begin();
+        for (const auto& i : ref) {
+            REQUIRE(pos.valid());
+            CHECK(pos.key() == i.first);
+            CHECK(pos.value() == i.second);
+            pos.advance();
+        }
+        CHECK_FALSE(pos.valid());
+    };
+
+    SECTION("after insertion")
+    {
+        check_ref();
+        CHECK(*tree.find(ref.begin()->first) == ref.begin()->second);
+    }
+
+    SECTION("after removal")
+    {
+        for (int i = 0; i < 3000; ++i) {
+            auto key = dist(gen);
+            long removed;
+            CHECK(tree.take(key, removed) == (ref.erase(key) == 1));
+        }
+        check_ref();
+
+        for (auto i = ref.begin(); i != ref.end(); i = ref.erase(i)) {
+            CHECK(tree.take(i->first, i->second));
+        }
+        CHECK(tree.size() == 0);
+        CHECK(tree.memory_usage() == 0);
+    }
+
+    SECTION("gives bounds")
+    {
+        for (std::int64_t i = -510; i <= 510; i += 7) {
+            auto lower = tree.lower_bound(i);
+            auto ref_lower = ref.lower_bound(i);
+            CHECK(lower.valid() == (ref_lower != ref.end()));
+            if (lower.valid()) {
+                CHECK(lower.key() == ref_lower->first);
+            }
+
+            auto upper = tree.upper_bound(i);
+            auto ref_upper = ref.upper_bound(i);
+            CHECK(upper.valid() == (ref_upper != ref.end()));
+            if (upper.valid()) {
+                CHECK(upper.key() == ref_upper->first);
+            }
+        }
+    }
+
+    SECTION("can be bulk loaded")
+    {
+        std::vector<std::int64_t> keys{};
+        std::vector<long> values{};
+        for (const auto& i : ref) {
+            keys.push_back(i.first);
+            values.push_back(i.second);
+        }
+        tree.load_sorted(keys.data(), values.data(), keys.size());
+        check_ref();
+    }
+}
+
+TEST_CASE("B-tree maps give ordered ranges", "[Btree_map]")
+{
+    Handle map = Btree_map<std::int64_t>::create();
+    for (long i = 20; i > 0; --i) {
+        REQUIRE(PyObject_SetItem(map, Handle(i * 10), Handle(i)) == 0);
+    }
+    CHECK(PyMapping_Length(map) == 20);
+    CHECK(Handle(PyObject_GetItem(map, Handle(70l))).as<long>() == 7);
+
+    SECTION("iterates in order")
+    {
+        long expected = 10;
+        for (const auto& i : map) {
+            CHECK(i.as<long>() == expected);
+            expected += 10;
+        }
+    }
+
+    SECTION("iterates lazily over ranges")
+    {
+        Handle inclusive("(OO)", Py_True, Py_False);
+        Handle range(PyObject_CallMethod(
+            map, "irange", "llO", 35l, 70l, inclusive.get()));
+        Handle keys(PySequence_List(range));
+        CHECK(keys == Handle("[iii]", 40, 50, 60));
+
+        Handle items(
+            PyObject_CallMethod(map, "irange_items", "Ol", Py_None, 20l));
+        CHECK(Handle(PySequence_List(items))
+            == Handle("[(ii)(ii)]", 10, 1, 20, 2));
+    }
+
+    SECTION("invalidates iterators on changes")
+    {
+        Handle keys(PyObject_CallMethod(map, "keys", nullptr));
+        REQUIRE(PyObject_DelItem(map, Handle(10l)) == 0);
+        CHECK(PyIter_Next(keys) == nullptr);
+        CHECK(PyErr_ExceptionMatches(PyExc_RuntimeError));
+        PyErr_Clear();
+    }
+}
+
+TEST_CASE("B-tree maps support bytes keys and bulk loading", "[Btree_map]")
+{
+    Handle map = Btree_map<std::string>::create();
+    Handle res(PyObject_CallMethod(map, "load_sorted", "OO",
+        Handle("[yyy]", "a", "b", "c").get(),
+        Handle("[iii]", 1, 2, 3).get()));
+    CHECK(PyMapping_Length(map) == 3);
+    CHECK(Handle(PyObject_GetItem(map, Handle("y", "b"))).as<long>() == 2);
+
+    CHECK(PyObject_CallMethod(map, "load_sorted", "OO",
+              Handle("[yy]", "b", "a").get(), Handle("[ii]", 1, 2).get())
+        == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
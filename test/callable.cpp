@@ -0,0 +1,170 @@
+/** Tests for the Python callables wrapping C++ callables.
+ */
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/callable.hpp>
+
+using namespace cpypp;
+
+static long twice(long x) { return 2 * x; }
+
+TEST_CASE("C++ callables can be called from Python", "[make_callable]")
+{
+    long offset = 10;
+    Handle add = make_callable([offset](long x, double y) {
+        return static_cast<double>(x + offset) + y;
+    });
+    CHECK(PyCallable_Check(add));
+    CHECK(PyVectorcall_Function(add) != nullptr);
+    CHECK(add.call(1l, 0.5).as<double>() == 11.5);
+
+    Handle from_ptr = make_callable(&twice);
+    CHECK(from_ptr.call(21l).as<long>() == 42);
+
+    Handle concat = make_callable(
+        [](const std::string& a, Handle b) { return a + b.as<std::string>(); });
+    CHECK(concat.call("ab", "cd").as<std::string>() == "abcd");
+
+    int n_calls = 0;
+    Handle handler = make_callable([&n_calls](bool flag, int n) {
+        n_calls += flag ? n : 0;
+    });
+    CHECK(handler.call(Py_True, 3l).get() == Py_None);
+    CHECK(n_calls == 3);
+
+    // Used as the key for sorting by Python code.
+    Handle list(Py_BuildValue("[iii]", 3, -5, 1));
+    Handle neg = make_callable([](long x) { return -x; });
+    Handle kwargs(Py_BuildValue("{sO}", "key", neg.get()));
+    Handle args(PyTuple_New(0));
+    Handle sort(PyObject_GetAttrString(list, "sort"));
+    Handle res(PyObject_Call(sort, args, kwargs));
+    Handle expected(Py_BuildValue("[iii]", 3, 1, -5));
+    CHECK(list == expected);
+}
+
+TEST_CASE("Errors of C++ callables are translated", "[make_callable]")
+{
+    Handle func = make_callable([](long x) -> long {
+        if (x < 0) {
+            PyErr_SetString(PyExc_ValueError, "negative");
+            throw Exc_set{};
+        }
+        if (x == 0) {
+            throw std::runtime_error("zero");
+        }
+        return x;
+    });
+
+    CHECK(PyObject_CallFunction(func, "(i)", -1) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+
+    CHECK(PyObject_CallFunction(func, "(i)", 0) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_RuntimeError));
+    PyErr_Clear();
+
+    // Integers out of the range of the parameters.
+    Handle narrow = make_callable([](int x, unsigned char y) {
+        return static_cast<long>(x) + y;
+    });
+    CHECK(narrow.call(-7l, 255l).as<long>() == 248);
+    CHECK(PyObject_CallFunction(narrow, "(li)", 1l << 40, 0) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+    CHECK(PyObject_CallFunction(narrow, "(ii)", 0, 256) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+    CHECK(PyObject_CallFunction(narrow, "(ii)", 0, -1) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+
+    // Wrong arguments.
+    CHECK(PyObject_CallFunction(func, "(ii)", 1, 2) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+    CHECK(PyObject_CallFunction(func, "(s)", "x") == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Captures of C++ callables are destructed", "[make_callable]")
+{
+    auto flag = std::make_shared<int>(0);
+    {
+        auto get = [flag]() { return static_cast<long>(*flag); };
+        Handle func = make_callable(get);
+        CHECK(flag.use_count() == 3);
+        CHECK(Callable<decltype(get)>::check(func));
+        CHECK(func.call().as<long>() == 0);
+    }
+    CHECK(flag.use_count() == 1);
+}
+
+TEST_CASE("Overloads are dispatched by the argument types", "[make_overloaded]")
+{
+    Handle describe = make_overloaded(
+        [](long x) { return "int " + std::to_string(x); },
+        [](double x) { return "float " + std::to_string(x); },
+        [](const std::string& x) { return "str " + x; },
+        [](Bytes_view x) { return "bytes " + std::string(x.data, x.size); },
+        [](long x, long y) { return "pair " + std::to_string(x + y); });
+
+    auto call = [&](Handle args) {
+        Handle res(PyObject_Call(describe, args, nullptr));
+        return res.as<std::string>();
+    };
+    CHECK(call(Handle("(i)", 1)) == "int 1");
+    CHECK(call(Handle("(d)", 0.5)) == "float 0.500000");
+    CHECK(call(Handle("(s)", "a")) == "str a");
+    CHECK(call(Handle("(y)", "b")) == "bytes b");
+    CHECK(call(Handle("(ii)", 1, 2)) == "pair 3");
+
+    // Booleans are integers convertible to both numeric overloads.
+    CHECK(call(Handle("(O)", Py_True)) == "int 1");
+
+    Handle none_args("(O)", Py_None);
+    CHECK(PyObject_Call(describe, none_args, nullptr) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Overloads chosen are cached by the types", "[make_overloaded]")
+{
+    long n_ints = 0;
+    double total = 0;
+    auto on_int = [&](long x) { n_ints += x; };
+    auto on_float = [&](double x) { total += x; };
+    Handle func = make_overloaded(on_int, on_float);
+    using Funcs = Overloaded<decltype(on_int), decltype(on_float)>;
+    REQUIRE(Funcs::check(func));
+
+    for (long i = 0; i < 10; ++i) {
+        func.call(i);
+        func.call(0.5);
+    }
+    CHECK(n_ints == 45);
+    CHECK(total == 5.0);
+    CHECK(Funcs::n_resolved(func) == 2);
+
+    // More types than the entries of the cache, with the eviction.
+    Handle types(PyRun_String("(True, 1, 1.0, __import__('fractions')"
+                              ".Fraction(1, 2), __import__('decimal')"
+                              ".Decimal(1))",
+        Py_eval_input, PyEval_GetBuiltins(), nullptr));
+    for (int i = 0; i < 2; ++i) {
+        for (Py_ssize_t j = 0; j < PyTuple_GET_SIZE(types.get()); ++j) {
+            func.call(PyTuple_GET_ITEM(types.get(), j));
+        }
+    }
+    CHECK(Funcs::n_resolved(func) > 2);
+    CHECK(n_ints == 45 + 2 * 2);
+}
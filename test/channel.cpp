@@ -0,0 +1,209 @@
+/** Tests for the bounded channels.
+ */
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/channel.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Rings pass items between threads", "[Mpmc_ring]")
+{
+    Mpmc_ring<std::int64_t> ring(5);
+    CHECK(ring.capacity() == 8);
+
+    const std::int64_t n_items = 10000;
+    const int n_threads = 2;
+    std::vector<std::int64_t> sums(n_threads, 0);
+
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            for (std::int64_t j = 1; j <= n_items; ++j) {
+                while (!ring.try_push(j)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&, i]() {
+            for (std::int64_t j = 0; j < n_items; ++j) {
+                std::int64_t item;
+                while (!ring.try_pop(item)) {
+                    std::this_thread::yield();
+                }
+                sums[i] += item;
+            }
+        });
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+
+    CHECK(sums[0] + sums[1] == n_threads * n_items * (n_items + 1) / 2);
+    CHECK(ring.size() == 0);
+}
+
+TEST_CASE("Rings pass runs of items between threads", "[Mpmc_ring]")
+{
+    Mpmc_ring<std::int64_t> ring(16);
+    std::int64_t items[5];
+    CHECK(ring.try_pop_many(items, 5) == 0);
+    for (std::int64_t i = 0; i < 5; ++i) {
+        items[i] = i;
+    }
+    CHECK(ring.try_push_many(items, 5) == 5);
+    CHECK(ring.try_push_many(items, 0) == 0);
+    CHECK(ring.size() == 5);
+
+    const std::int64_t n_runs = 2000;
+    std::int64_t sum = 0;
+    std::thread producer([&]() {
+        std::int64_t run[5] = { 1, 2, 3, 4, 5 };
+        for (std::int64_t i = 0; i < n_runs; ++i) {
+            std::size_t n_pushed = 0;
+            while (n_pushed < 5) {
+                n_pushed += ring.try_push_many(run + n_pushed, 5 - n_pushed);
+            }
+        }
+    });
+    std::thread consumer([&]() {
+        std::int64_t popped[7];
+        std::int64_t n_popped = 0;
+        while (n_popped < 5 * n_runs + 5) {
+            std::size_t n = ring.try_pop_many(popped, 7);
+            for (std::size_t i = 0; i < n; ++i) {
+                sum += popped[i];
+            }
+            n_popped += static_cast<std::int64_t>(n);
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    CHECK(sum == 10 + 15 * n_runs);
+    CHECK(ring.size() == 0);
+}
+
+TEST_CASE("Channels feed native workers from Python", "[Channel]")
+{
+    SECTION("with native items")
+    {
+        Handle ch = Channel::create(4, Channel_kind::INT64);
+        std::int64_t sum = 0;
+        std::thread worker([&]() {
+            std::int64_t item;
+            while (Channel::pop(ch, item)) {
+                sum += item;
+            }
+        });
+
+        // The channel gets full, with the GIL released while blocking.
+        Handle items(PyObject_CallFunction(
+            reinterpret_cast<PyObject*>(&PyRange_Type), "i", 100));
+        Handle res(PyObject_CallMethod(ch, "put_many", "(O)", items.get()));
+        res = Handle(PyObject_CallMethod(ch, "close", nullptr));
+        Py_BEGIN_ALLOW_THREADS;
+        worker.join();
+        Py_END_ALLOW_THREADS;
+
+        CHECK(sum == 4950);
+    }
+
+    SECTION("with object items")
+    {
+        Handle ch = Channel::create(16);
+        Handle obj("[i]", 1);
+        Handle res(PyObject_CallMethod(
+            ch, "put_many", "(O)", Handle("(OO)", obj.get(), obj.get()).get()));
+        auto n_refs = Py_REFCNT(obj.get());
+
+        std::vector<Deferred_ref> popped{};
+        std::thread worker([&]() {
+            Deferred_ref item{};
+            while (Channel::try_pop(ch, item)) {
+                popped.push_back(std::move(item));
+            }
+        });
+        worker.join();
+
+        REQUIRE(popped.size() == 2);
+        CHECK(popped[0].get() == obj.get());
+        Handle taken = popped[0].handle();
+        CHECK(taken == obj);
+
+        // The reference of the other item is only released with the GIL.
+        popped.clear();
+        CHECK(Py_REFCNT(obj.get()) == n_refs);
+        Deferred_decrefs::drain();
+        CHECK(Py_REFCNT(obj.get()) == n_refs - 1);
+    }
+}
+
+TEST_CASE("Channels can be used as Python queues", "[Channel]")
+{
+    Handle ch(PyObject_CallFunction(
+        Channel::type().tp_obj(), "is", 8, "float64"));
+    Handle res(PyObject_CallMethod(ch, "put", "d", 1.5));
+    res = Handle(PyObject_CallMethod(
+        ch, "put_many", "(O)", Handle("[ddd]", 2.5, 3.5, 4.5).get()));
+    CHECK(PySequence_Length(ch) == 4);
+    CHECK(PyFloat_AsDouble(Handle(PyObject_CallMethod(ch, "get", nullptr)))
+        == 1.5);
+    CHECK(Handle(PyObject_CallMethod(ch, "get_many", "i", 2))
+        == Handle("[dd]", 2.5, 3.5));
+
+    // Items before a failure of the iteration are still put.
+    CHECK(PyObject_CallMethod(ch, "put_many", "(O)",
+              Handle("[dsd]", 5.5, "x", 6.5).get())
+        == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+    CHECK(PySequence_Length(ch) == 2);
+    CHECK(PyFloat_AsDouble(Handle(PyObject_CallMethod(ch, "get", nullptr)))
+        == 4.5);
+    CHECK(PyFloat_AsDouble(Handle(PyObject_CallMethod(ch, "get", nullptr)))
+        == 5.5);
+    res = Handle(PyObject_CallMethod(ch, "put", "d", 4.5));
+
+    res = Handle(PyObject_CallMethod(ch, "close", nullptr));
+    CHECK(PyObject_CallMethod(ch, "put", "d", 1.0) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+
+    CHECK(Handle(PySequence_List(ch)) == Handle("[d]", 4.5));
+    CHECK(Handle(PyObject_CallMethod(ch, "get_many", "i", 2))
+        == Handle("[]"));
+    CHECK(PyObject_CallMethod(ch, "get", nullptr) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_EOFError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Cycles through channels are collected", "[Channel]")
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "Channel", Channel::type().tp_obj());
+    Handle res(PyRun_String(R"(
+import gc
+import weakref
+
+class Node:
+    pass
+
+node = Node()
+node.ch = Channel(4)
+node.ch.put(node)
+ref = weakref.ref(node)
+del node
+gc.collect()
+assert ref() is None
+)",
+        Py_file_input, globals, globals));
+}
@@ -0,0 +1,178 @@
+/** Tests for the conversions between datetimes and std::chrono.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/chrono.hpp>
+
+using namespace cpypp;
+
+namespace {
+
+Handle eval(const char* code)
+{
+    Handle globals(PyDict_New());
+    if (PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        < 0) {
+        throw Exc_set{};
+    }
+    Handle res(PyRun_String("import datetime as dt\n", Py_file_input,
+        globals, globals));
+    return Handle(PyRun_String(code, Py_eval_input, globals, globals));
+}
+}
+
+TEST_CASE("Calendar arithmetic follows the Gregorian calendar", "[Civil_date]")
+{
+    CHECK(Civil_date{ 1970, 1, 1 }.to_days() == 0);
+    CHECK(Civil_date{ 2000, 3, 1 }.to_days() == 11017);
+    CHECK(Civil_date{ 1969, 12, 31 }.to_days() == -1);
+    CHECK(Civil_date{ 1, 1, 1 }.to_days() == -719162);
+
+    for (std::int64_t days = -800000; days < 3000000; days += 997) {
+        auto date = Civil_date::from_days(days);
+        CHECK(date.to_days() == days);
+    }
+    auto leap = Civil_date::from_days(Civil_date{ 2024, 2, 29 }.to_days());
+    CHECK(leap.year == 2024);
+    CHECK(leap.month == 2);
+    CHECK(leap.day == 29);
+}
+
+TEST_CASE("Single objects are converted", "[chrono]")
+{
+    using namespace std::chrono;
+
+    Handle dt = eval("dt.datetime(2021, 3, 4, 5, 6, 7, 891011, "
+                     "tzinfo=dt.timezone(dt.timedelta(hours=-2)))");
+    Sys_ns time = as_sys_ns(dt);
+    Handle expected = eval("int(dt.datetime(2021, 3, 4, 7, 6, 7, "
+                           "tzinfo=dt.timezone.utc).timestamp())");
+    CHECK(duration_cast<seconds>(time.time_since_epoch()).count()
+        == expected.as<long>());
+    CHECK(time.time_since_epoch().count() % 1000000000 == 891011000);
+
+    Handle back = make_datetime(time);
+    CHECK(back == dt);
+    CHECK(Datetime_api::tzinfo(back) == Datetime_api::utc());
+    Handle naive = make_datetime(time, Py_None);
+    CHECK(naive == eval("dt.datetime(2021, 3, 4, 7, 6, 7, 891011)"));
+
+    // Before the epoch, with the rounding of nanoseconds.
+    Handle early = make_datetime(Sys_ns(nanoseconds(-1500)), Py_None);
+    CHECK(early == eval("dt.datetime(1969, 12, 31, 23, 59, 59, 999998)"));
+
+    Handle date = eval("dt.date(1999, 12, 31)");
+    Sys_days days = as_sys_days(date);
+    CHECK(days.time_since_epoch().count() == 10956);
+    CHECK(make_date(days) == date);
+
+    Handle delta = eval("dt.timedelta(days=-3, seconds=5, microseconds=7)");
+    microseconds us = as_duration(delta);
+    CHECK(us.count() == -3 * 86400000000LL + 5000007);
+    CHECK(make_timedelta(us) == delta);
+    CHECK(make_timedelta(hours(30)) == eval("dt.timedelta(hours=30)"));
+
+    CHECK_THROWS_AS(as_sys_ns(date), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+
+    CHECK_THROWS_AS(as_sys_ns(eval("dt.datetime(3000, 1, 1)")), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Sequences of datetimes are converted in bulk", "[chrono]")
+{
+    Handle datetimes = eval(
+        "[dt.datetime(2020, 1, 1), None, "
+        "dt.datetime(2020, 1, 1, 1, tzinfo=dt.timezone(dt.timedelta(hours=1))),"
+        " dt.datetime(1900, 6, 30, 12, tzinfo=dt.timezone.utc)]");
+    std::vector<std::int64_t> ns(4);
+    to_epoch_ns(datetimes, ns.data(), ns.size());
+    CHECK(ns[0] == 1577836800000000000LL);
+    CHECK(ns[1] == nat_ns);
+    CHECK(ns[2] == ns[0]);
+    CHECK(ns[3] == -2193393600000000000LL);
+
+    Handle back = from_epoch_ns(ns.data(), ns.size());
+    CHECK(back == eval("[dt.datetime(2020, 1, 1, tzinfo=dt.timezone.utc), "
+                       "None, dt.datetime(2020, 1, 1, tzinfo=dt.timezone.utc),"
+                       " dt.datetime(1900, 6, 30, 12, "
+                       "tzinfo=dt.timezone.utc)]"));
+
+    // Local times in time zones with fixed offsets.
+    Handle tz = eval("dt.timezone(dt.timedelta(hours=5, minutes=30))");
+    Handle local = from_epoch_ns(ns.data(), 1, tz);
+    Handle item(PyList_GetItem(local, 0), NEW);
+    CHECK(Handle(PyObject_GetAttrString(item, "hour")).as<long>() == 5);
+    CHECK(Datetime_api::tzinfo(item) == tz.get());
+
+    std::vector<std::int64_t> short_out(2);
+    CHECK_THROWS_AS(
+        to_epoch_ns(datetimes, short_out.data(), short_out.size()), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
+
+TEST_CASE("ISO 8601 strings are parsed into datetimes", "[chrono]")
+{
+    auto parse = [](const std::string& str) {
+        return parse_iso_datetime(str.data(), str.size());
+    };
+
+    CHECK(parse("2021-03-04") == eval("dt.datetime(2021, 3, 4)"));
+    CHECK(parse("2021-03-04T05:06")
+        == eval("dt.datetime(2021, 3, 4, 5, 6)"));
+    CHECK(parse("2021-03-04 05:06:07.123456789")
+        == eval("dt.datetime(2021, 3, 4, 5, 6, 7, 123456)"));
+    CHECK(parse("2021-03-04T05:06:07.5")
+        == eval("dt.datetime(2021, 3, 4, 5, 6, 7, 500000)"));
+
+    Handle utc = parse("2021-03-04T05:06:07Z");
+    CHECK(Datetime_api::tzinfo(utc) == Datetime_api::utc());
+    Handle offset = parse("2021-03-04T05:06:07+05:30");
+    CHECK(offset
+        == eval("dt.datetime(2021, 3, 4, 5, 6, 7, "
+                "tzinfo=dt.timezone(dt.timedelta(hours=5, minutes=30)))"));
+    CHECK(parse("2021-03-04T05:06:07-0800")
+        == eval("dt.datetime(2021, 3, 4, 13, 6, 7, tzinfo=dt.timezone.utc)"));
+
+    // The time zones for the same offset are shared.
+    Handle again = parse("1999-01-01T00:00+05:30");
+    CHECK(Datetime_api::tzinfo(again) == Datetime_api::tzinfo(offset));
+
+    for (const char* i : { "2021-3-04", "2021-03-04T", "2021-03-04T05",
+             "2021-03-04T05:06:07.", "2021-03-04T05:06+25:00",
+             "2021-03-04T05:06:07Zx", "2021-02-30" }) {
+        CHECK_THROWS_AS(parse(i), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+    }
+}
+
+TEST_CASE("Datetime conversions are exposed to Python", "[chrono_methods]")
+{
+    Handle module(PyModule_New("cpypp_chrono_test"));
+    REQUIRE(PyModule_AddFunctions(module, chrono_methods()) == 0);
+
+    Handle datetimes = eval("[dt.datetime(2020, 1, 1), None]");
+    Handle out = eval("__import__('array').array('q', [0, 0])");
+    Handle res(PyObject_CallMethod(
+        module, "to_epoch_ns", "OO", datetimes.get(), out.get()));
+    Handle back(PyObject_CallMethod(module, "from_epoch_ns", "OO", out.get(),
+        Py_None));
+    CHECK(back == datetimes);
+
+    Handle parsed(PyObject_CallMethod(
+        module, "parse_isoformat", "s", "2020-01-01T00:00:00Z"));
+    CHECK(parsed == eval("dt.datetime(2020, 1, 1, tzinfo=dt.timezone.utc)"));
+}
@@ -0,0 +1,158 @@
+/** Tests for the files of native columns.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/column_file.hpp>
+
+using namespace cpypp;
+
+/** Path of a file removed at the end of the tests.
+ */
+
+struct Temp_path {
+    std::string path;
+
+    Temp_path()
+    {
+        char templ[] = "/tmp/cpypp-test-XXXXXX";
+        int fd = mkstemp(templ);
+        REQUIRE(fd >= 0);
+        close(fd);
+        path = templ;
+    }
+
+    ~Temp_path() { std::remove(path.c_str()); }
+};
+
+TEST_CASE("Native columns are written and mapped", "[Column_reader]")
+{
+    Temp_path tmp;
+    std::vector<std::int64_t> ids{ 3, -1, 4, 1, 5, 9 };
+    std::vector<float> weights{ 0.5f, 1.5f };
+    Packed_strs names;
+    names.push_back("alpha", 5);
+    names.push_back("", 0);
+    names.push_back("\xce\xb2", 2);
+
+    {
+        Column_writer writer(tmp.path.c_str());
+        writer.add("ids", ids.data(), ids.size());
+        writer.add("names", names);
+        writer.add("weights", weights.data(), weights.size());
+        writer.add<double>("empty", nullptr, 0);
+        writer.close();
+    }
+
+    Column_reader file(tmp.path.c_str());
+    REQUIRE(file.size() == 4);
+    CHECK(file.find("missing") == nullptr);
+
+    const Column_entry* entry = file.find("ids");
+    REQUIRE(entry != nullptr);
+    CHECK(entry->n_items == 6);
+    CHECK(entry->values_offset % 64 == 0);
+    const std::int64_t* values = file.values<std::int64_t>(*entry);
+    CHECK(std::vector<std::int64_t>(values, values + 6) == ids);
+    CHECK_THROWS_AS(file.values<std::int32_t>(*entry), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+
+    entry = file.find("names");
+    REQUIRE(entry != nullptr);
+    CHECK(std::string(entry->format) == "s");
+    auto str = file.str(*entry, 0);
+    CHECK(std::string(str.first, str.second) == "alpha");
+    CHECK(file.str(*entry, 1).second == 0);
+    CHECK(file.str(*entry, 2).second == 2);
+
+    entry = file.find("weights");
+    REQUIRE(entry != nullptr);
+    CHECK(file.values<float>(*entry)[1] == 1.5f);
+    CHECK(file.find("empty")->n_items == 0);
+}
+
+TEST_CASE("Incomplete column files are not opened", "[Column_reader]")
+{
+    Temp_path tmp;
+    {
+        Column_writer writer(tmp.path.c_str());
+        std::int32_t value = 42;
+        writer.add("value", &value, 1);
+        CHECK_THROWS_AS(writer.add("value", &value, 1, 4, "l"), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+    }
+
+    CHECK_THROWS_AS(Column_reader(tmp.path.c_str()), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Column files are used from Python", "[Column_file]")
+{
+    Temp_path tmp;
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(
+        globals, "ColumnFile", Column_file::type().tp_obj());
+    PyDict_SetItemString(globals, "StrColumn", Str_column::type().tp_obj());
+    PyDict_SetItemString(
+        globals, "path", Handle(PyUnicode_FromString(tmp.path.c_str())));
+    Handle funcs(PyModule_New("funcs"));
+    REQUIRE(PyModule_AddFunctions(funcs, column_file_methods()) == 0);
+    PyDict_SetItemString(globals, "funcs", funcs);
+
+    Handle res(PyRun_String(R"(
+import array
+
+funcs.write_columns(path, {
+    'ints': [1, -2, 3],
+    'floats': [1, 2.5],
+    'strs': ['a', 'bc', 'déf'],
+    'column': StrColumn(['x', 'y']),
+    'shorts': array.array('h', [7, 8]),
+    'flags': memoryview(b'\x01\x00').cast('?'),
+})
+
+columns = ColumnFile(path)
+assert len(columns) == 6
+assert columns.names()[:2] == ['ints', 'floats']
+assert columns['ints'].format == 'q' and columns['ints'].tolist() == [1, -2, 3]
+assert columns['ints'].readonly
+assert columns['floats'].tolist() == [1.0, 2.5]
+assert columns['shorts'].format == 'h' and list(columns['shorts']) == [7, 8]
+assert columns['flags'].format == 'B'
+
+strs = columns['strs']
+assert len(strs) == 3 and strs[2] == 'déf' and strs[-1] == strs[2]
+assert strs[::2] == ['a', 'déf']
+assert list(columns['column']) == ['x', 'y']
+
+try:
+    columns['missing']
+    assert False
+except KeyError:
+    pass
+
+import os
+try:
+    funcs.write_columns(path + '.bad', {'objs': [None]})
+    assert False
+except TypeError:
+    pass
+os.remove(path + '.bad')
+)",
+        Py_file_input, globals, globals));
+}
@@ -0,0 +1,105 @@
+/** Tests for the concurrent hash maps.
+ */
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/concurrent_map.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Concurrent tables count from many threads", "[Concurrent_table]")
+{
+    Concurrent_table<std::int64_t> table(5);
+    CHECK(table.n_shards() == 8);
+
+    const int n_threads = 4;
+    const int n_rounds = 10000;
+    const std::int64_t n_keys = 100;
+
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&]() {
+            for (int j = 0; j < n_rounds; ++j) {
+                std::int64_t res;
+                table.increment(j % n_keys, 1, res);
+            }
+        });
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+
+    CHECK(table.size() == n_keys);
+    std::int64_t total = 0;
+    table.for_each([&](std::int64_t, const Concurrent_value& value) {
+        total += value.count;
+    });
+    CHECK(total == n_threads * n_rounds);
+
+    Concurrent_value value{};
+    REQUIRE(table.take(0, value));
+    CHECK(value.count == n_threads * n_rounds / n_keys);
+    CHECK(table.size() == n_keys - 1);
+}
+
+TEST_CASE("Concurrent maps implement the mapping protocol",
+    "[Concurrent_map]")
+{
+    using Map = Concurrent_map<std::string>;
+    Handle map = Map::create();
+
+    REQUIRE(PyObject_SetItem(map, Handle("s", "a"), Handle(1l)) == 0);
+    Handle obj("[i]", 1);
+    REQUIRE(PyObject_SetItem(map, Handle("s", "b"), obj) == 0);
+    CHECK(PyMapping_Length(map) == 2);
+    CHECK(Handle(PyObject_GetItem(map, Handle("s", "b"))).get() == obj.get());
+    CHECK(PySequence_Contains(map, Handle("s", "a")) == 1);
+
+    SECTION("with atomic counters")
+    {
+        Handle res(PyObject_CallMethod(map, "increment", "sL", "a", 5ll));
+        CHECK(res.as<long>() == 6);
+        res = Handle(PyObject_CallMethod(map, "increment", "s", "c"));
+        CHECK(res.as<long>() == 1);
+
+        CHECK(PyObject_CallMethod(map, "increment", "s", "b") == nullptr);
+        CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+        PyErr_Clear();
+    }
+
+    SECTION("with atomic insertion and removal")
+    {
+        Handle res(PyObject_CallMethod(map, "setdefault", "si", "a", 10));
+        CHECK(res.as<long>() == 1);
+        res = Handle(PyObject_CallMethod(map, "setdefault", "si", "c", 10));
+        CHECK(res.as<long>() == 10);
+
+        res = Handle(PyObject_CallMethod(map, "pop", "s", "b"));
+        CHECK(res.get() == obj.get());
+        res = Handle(PyObject_CallMethod(map, "pop", "si", "b", 0));
+        CHECK(res.as<long>() == 0);
+        res = Handle(PyObject_CallMethod(map, "get", "s", "b"));
+        CHECK(res.get() == Py_None);
+        CHECK(PyMapping_Length(map) == 2);
+    }
+
+    SECTION("with snapshots")
+    {
+        Handle items(PyObject_CallMethod(map, "items", nullptr));
+        CHECK(PyList_Size(items) == 2);
+        Handle keys(PySequence_List(map));
+        REQUIRE(PyList_Sort(keys) == 0);
+        CHECK(keys == Handle("[ss]", "a", "b"));
+
+        Handle res(PyObject_CallMethod(map, "clear", nullptr));
+        CHECK(PyMapping_Length(map) == 0);
+    }
+}
@@ -0,0 +1,130 @@
+/** Tests for the executor of batched calls.
+ */
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/executor.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Executors run calls from native threads", "[Batch_executor]")
+{
+    Handle operator_mod(PyImport_ImportModule("operator"));
+    Handle add = operator_mod.getattr("add");
+
+    Batch_executor executor(16);
+    executor.start();
+
+    const int n_threads = 4;
+    const long n_calls = 100;
+    std::vector<long> sums(n_threads, 0);
+
+    Py_BEGIN_ALLOW_THREADS;
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            std::vector<std::future<long>> results{};
+            for (long j = 0; j < n_calls; ++j) {
+                results.push_back(executor.submit<long>(add, j, 1l));
+            }
+            for (auto& j : results) {
+                sums[i] += j.get();
+            }
+        });
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+    Py_END_ALLOW_THREADS;
+
+    for (auto i : sums) {
+        CHECK(i == n_calls * (n_calls + 1) / 2);
+    }
+    CHECK(executor.n_jobs() == n_threads * n_calls);
+    CHECK(executor.n_batches() <= executor.n_jobs());
+
+    SECTION("with Python exceptions given to the futures")
+    {
+        Handle int_type(reinterpret_cast<PyObject*>(&PyLong_Type), NEW);
+        auto res = executor.submit<long>(int_type, "abc");
+        Py_BEGIN_ALLOW_THREADS;
+        res.wait();
+        Py_END_ALLOW_THREADS;
+        CHECK_THROWS_AS(res.get(), Call_error);
+        CHECK(PyErr_Occurred() == nullptr);
+    }
+
+    SECTION("with results ignored")
+    {
+        Handle list(PyList_New(0));
+        Handle append = list.getattr("append");
+        auto res = executor.submit<void>(append, 1l);
+        Py_BEGIN_ALLOW_THREADS;
+        res.wait();
+        Py_END_ALLOW_THREADS;
+        CHECK(list == Handle("[i]", 1));
+    }
+
+    SECTION("with the thread state kept between the batches")
+    {
+        Handle globals(PyDict_New());
+        PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+        Handle res(PyRun_String(R"(
+import threading
+local = threading.local()
+def count():
+    local.n = getattr(local, 'n', 0) + 1
+    return local.n
+)",
+            Py_file_input, globals, globals));
+        Handle count(PyDict_GetItemString(globals, "count"), NEW);
+
+        long n = 0;
+        Py_BEGIN_ALLOW_THREADS;
+        for (int i = 0; i < 3; ++i) {
+            n = executor.submit<long>(count).get();
+        }
+        Py_END_ALLOW_THREADS;
+        CHECK(n == 3);
+    }
+
+    executor.stop();
+}
+
+TEST_CASE("Executors can be drained by threads with the GIL",
+    "[Batch_executor]")
+{
+    Handle builtins(PyEval_GetBuiltins(), NEW);
+    Handle abs(PyDict_GetItemString(builtins, "abs"), NEW);
+
+    Batch_executor executor{};
+    std::future<long> res;
+    std::thread submitter([&]() { res = executor.submit<long>(abs, -3l); });
+    submitter.join();
+
+    CHECK(executor.run_pending(10) == 1);
+    CHECK(res.get() == 3);
+    CHECK(executor.run_pending(10) == 0);
+}
+
+TEST_CASE("Jobs never run have their futures broken", "[Batch_executor]")
+{
+    Handle builtins(PyEval_GetBuiltins(), NEW);
+    Handle abs(PyDict_GetItemString(builtins, "abs"), NEW);
+
+    std::future<long> res;
+    {
+        Batch_executor executor{};
+        std::thread submitter(
+            [&]() { res = executor.submit<long>(abs, -3l); });
+        submitter.join();
+    }
+    CHECK_THROWS_AS(res.get(), std::future_error);
+}
@@ -0,0 +1,202 @@
+/** Tests for the deep memory footprints of objects.
+ */
+
+#include <string>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/footprint.hpp>
+
+using namespace cpypp;
+
+namespace {
+
+const Footprint_group* find_group(
+    const std::vector<Footprint_group>& groups, const std::string& name)
+{
+    for (const auto& i : groups) {
+        if (i.name == name) {
+            return &i;
+        }
+    }
+    return nullptr;
+}
+}
+
+TEST_CASE("Allocator rounding is applied", "[Footprint_walker]")
+{
+    CHECK(Footprint_walker::allocated(0) == 0);
+    CHECK(Footprint_walker::allocated(1) == 16);
+    CHECK(Footprint_walker::allocated(56) == 64);
+    CHECK(Footprint_walker::allocated(512) == 512);
+    CHECK(Footprint_walker::allocated(513) == 528);
+    CHECK(Footprint_walker::allocated(1000) == 1008);
+}
+
+TEST_CASE("Footprints of object graphs are computed", "[footprint]")
+{
+    Handle globals(PyDict_New());
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+    Handle res(PyRun_String("class Rec:\n"
+                            "    def __init__(self, name):\n"
+                            "        self.name = name\n"
+                            "shared = 'x' * 1000\n"
+                            "data = {\n"
+                            "    'names': [str(i) * 10 for i in range(100)],\n"
+                            "    'blobs': [shared, shared, shared],\n"
+                            "    'recs': [Rec(str(i)) for i in range(10)],\n"
+                            "}\n"
+                            "data['self'] = data\n",
+        Py_file_input, globals, globals));
+    Handle data(PyDict_GetItemString(globals, "data"), NEW);
+
+    Footprint report = footprint(data);
+
+    // Objects shared or in cycles are only counted once.
+    const Footprint_group* str = find_group(report.by_type, "str");
+    REQUIRE(str != nullptr);
+    const Footprint_group* blobs
+        = find_group(report.by_path, "$['blobs'][*]");
+    REQUIRE(blobs != nullptr);
+    CHECK(blobs->n_objects == 1);
+    CHECK(blobs->n_bytes >= 1000);
+
+    const Footprint_group* names
+        = find_group(report.by_path, "$['names'][*]");
+    REQUIRE(names != nullptr);
+    CHECK(names->n_objects >= 90);
+
+    const Footprint_group* recs = find_group(report.by_type, "Rec");
+    REQUIRE(recs != nullptr);
+    CHECK(recs->n_objects == 10);
+    // The class itself is not walked into.
+    CHECK(find_group(report.by_type, "type") == nullptr);
+
+    std::size_t n_objects = 0, n_bytes = 0;
+    for (const auto& i : report.by_type) {
+        n_objects += i.n_objects;
+        n_bytes += i.n_bytes;
+        CHECK(i.n_bytes % 16 == 0);
+    }
+    CHECK(n_objects == report.n_objects);
+    CHECK(n_bytes == report.n_bytes);
+    for (std::size_t i = 1; i < report.by_path.size(); ++i) {
+        CHECK(report.by_path[i - 1].n_bytes >= report.by_path[i].n_bytes);
+    }
+    CHECK_FALSE(report.if_truncated);
+
+    // The sizes are at least those by sys.getsizeof.
+    Handle getsizeof(PyRun_String("lambda x: __import__('sys').getsizeof(x)",
+        Py_eval_input, globals, globals));
+    CHECK(footprint(Handle(PyList_New(0))).n_bytes
+        >= static_cast<std::size_t>(
+            getsizeof.call(Handle(PyList_New(0))).as<long>()));
+
+    Footprint_options options{};
+    options.max_objects = 5;
+    Footprint truncated = footprint(data, options);
+    CHECK(truncated.n_objects == 5);
+    CHECK(truncated.if_truncated);
+}
+
+TEST_CASE("Sizes of built-in objects are computed natively", "[footprint]")
+{
+    Handle globals(PyDict_New());
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+    Handle objs(PyRun_String("[0, True, 2 ** 100, -7, 'abc', 'd\\xe9f',\n"
+                             " '\\u4e2d' * 10, b'xyz' * 5, ('\\u4e2d' * 3)]\n",
+        Py_eval_input, globals, globals));
+    Handle getsizeof(PyRun_String("lambda x: __import__('sys').getsizeof(x)",
+        Py_eval_input, globals, globals));
+    // Gets the UTF-8 cached in the last string.
+    PyUnicode_AsUTF8(PyList_GET_ITEM(objs.get(), 8));
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(objs.get()); ++i) {
+        Handle obj(PyList_GET_ITEM(objs.get(), i), NEW);
+        std::size_t size = 0;
+        REQUIRE(Footprint_walker::builtin_size(obj, size));
+        CHECK(size
+            == static_cast<std::size_t>(getsizeof.call(obj).as<long>()));
+    }
+
+    Handle list(PyRun_String("[None] * 100", Py_eval_input, globals, globals));
+    Handle set(
+        PyRun_String("set(range(100))", Py_eval_input, globals, globals));
+    Handle dict(PyRun_String("dict.fromkeys(range(100))", Py_eval_input,
+        globals, globals));
+    for (PyObject* i : { list.get(), set.get(), dict.get() }) {
+        std::size_t size = 0;
+        // Dictionaries are only sized natively before Python 3.13.
+        if (PY_VERSION_HEX >= 0x030D0000 && i == dict.get()) {
+            CHECK_FALSE(Footprint_walker::builtin_size(i, size));
+            continue;
+        }
+        REQUIRE(Footprint_walker::builtin_size(i, size));
+        // The header of the garbage collector is added by sys.getsizeof.
+        CHECK(size + 2 * sizeof(void*)
+            == static_cast<std::size_t>(
+                getsizeof.call(Handle(i, NEW)).as<long>()));
+    }
+
+    std::size_t size = 0;
+    CHECK_FALSE(Footprint_walker::builtin_size(Py_None, size));
+}
+
+TEST_CASE("Graphs changed during the walk are walked safely", "[footprint]")
+{
+    Handle globals(PyDict_New());
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+    Handle res(PyRun_String("class Clearing:\n"
+                            "    def __sizeof__(self):\n"
+                            "        holder.clear()\n"
+                            "        return 16\n"
+                            "holder = {\n"
+                            "    'first': Clearing(),\n"
+                            "    'second': [object() for _ in range(10)],\n"
+                            "}\n"
+                            "items = [\n"
+                            "    Clearing(), [object() for _ in range(5)],\n"
+                            "]\n",
+        Py_file_input, globals, globals));
+
+    Handle holder(PyDict_GetItemString(globals, "holder"), NEW);
+    Footprint report = footprint(holder);
+    const Footprint_group* objects = find_group(report.by_type, "object");
+    REQUIRE(objects != nullptr);
+    CHECK(objects->n_objects == 10);
+    CHECK(PyDict_Size(holder) == 0);
+
+    // The list is cleared by the sizes of its items, with another holder.
+    REQUIRE(PyDict_SetItemString(globals, "holder",
+                PyDict_GetItemString(globals, "items"))
+        == 0);
+    Handle items(PyDict_GetItemString(globals, "items"), NEW);
+    report = footprint(items);
+    objects = find_group(report.by_type, "object");
+    REQUIRE(objects != nullptr);
+    CHECK(objects->n_objects == 5);
+    CHECK(PyList_GET_SIZE(items.get()) == 0);
+}
+
+TEST_CASE("Footprints are available to Python", "[footprint]")
+{
+    Handle mod(PyModule_New("footprintmod"));
+    REQUIRE(PyModule_AddFunctions(mod, Footprint::methods()) == 0);
+    Handle func(PyObject_GetAttrString(mod, "footprint"));
+
+    Handle data(Py_BuildValue("{s:[iii]}", "values", 1000, 2000, 3000));
+    Handle report(PyObject_CallFunction(func, "(Oi)", data.get(), 1));
+    CHECK(PyObject_TypeCheck(report, Footprint::type().tp()));
+    Handle n_objects(PyObject_GetAttrString(report, "n_objects"));
+    CHECK(n_objects.as<long>() == 6);
+
+    Handle by_path(PyObject_GetAttrString(report, "by_path"));
+    CHECK(PyDict_GetItemString(by_path, "$['values']") != nullptr);
+    CHECK(PyDict_GetItemString(by_path, "$['values'][*]") == nullptr);
+}
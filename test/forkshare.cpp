@@ -0,0 +1,65 @@
+/** Tests for the sharing of data with forked workers.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/fork_share.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Frozen buffers keep read-only copies", "[Frozen_buffer]")
+{
+    std::vector<std::int64_t> ids{ 3, -1, 4, 1, 5 };
+    Handle frozen = Frozen_buffer::create(ids.data(), ids.size());
+    REQUIRE(Frozen_buffer::check(frozen));
+    CHECK(Frozen_buffer::nbytes(frozen) == 40);
+    CHECK(Frozen_buffer::data(frozen) != ids.data());
+    CHECK(PyObject_Length(frozen) == 5);
+
+    {
+        Buffer buf(frozen);
+        CHECK(buf.readonly());
+        CHECK(buf.as_array<std::int64_t>()[1] == -1);
+    }
+
+    CHECK_THROWS_AS(
+        Buffer(frozen, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE),
+        Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_BufferError));
+    PyErr_Clear();
+
+    // Copies of other buffers from Python, with the formats kept.
+    Handle src(PyRun_String("__import__('array').array('d', [0.5, 1.5])",
+        Py_eval_input, PyEval_GetBuiltins(), nullptr));
+    Handle copied(PyObject_CallFunctionObjArgs(
+        Frozen_buffer::type().tp_obj(), src.get(), nullptr));
+    Handle view(PyMemoryView_FromObject(copied));
+    Handle list(PyObject_CallMethod(view, "tolist", nullptr));
+    Handle expected(Py_BuildValue("[dd]", 0.5, 1.5));
+    CHECK(list == expected);
+
+    Handle empty = Frozen_buffer::create<std::uint8_t>(nullptr, 0);
+    CHECK(Buffer(empty).nbytes() == 0);
+}
+
+TEST_CASE("Objects are frozen before forking", "[prepare_fork]")
+{
+    Handle gc(PyImport_ImportModule("gc"));
+    prepare_fork();
+    Handle count(PyObject_CallMethod(gc, "get_freeze_count", nullptr));
+    CHECK(count.as<long>() > 0);
+    Handle unfrozen(PyObject_CallMethod(gc, "unfreeze", nullptr));
+
+    Handle module(PyModule_New("cpypp_fork_share_test"));
+    REQUIRE(PyModule_AddFunctions(module, fork_share_methods()) == 0);
+    Handle res(PyObject_CallMethod(module, "prepare_fork", "i", 0));
+    count = Handle(PyObject_CallMethod(gc, "get_freeze_count", nullptr));
+    CHECK(count.as<long>() > 0);
+    unfrozen = Handle(PyObject_CallMethod(gc, "unfreeze", nullptr));
+}
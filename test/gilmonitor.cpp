@@ -0,0 +1,106 @@
+/** Tests for the monitor of the GIL.
+ */
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/gil_monitor.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Histograms bucket values by powers of two", "[Log2_histogram]")
+{
+    Log2_histogram hist{};
+    CHECK(hist.quantile(0.5) == 0);
+
+    for (std::int64_t i : { 0, 1, 2, 3, 4, 1000 }) {
+        hist.record(i);
+    }
+    CHECK(hist.count() == 6);
+    CHECK(hist.sum() == 1010);
+    CHECK(hist.max() == 1000);
+    CHECK(hist.bucket(0) == 1);
+    CHECK(hist.bucket(1) == 1);
+    CHECK(hist.bucket(2) == 2);
+    CHECK(hist.bucket(3) == 1);
+    CHECK(hist.bucket(10) == 1);
+    CHECK(hist.quantile(0.5) == 3);
+    CHECK(hist.quantile(1.0) == 1000);
+
+    hist.reset();
+    CHECK(hist.count() == 0);
+    CHECK(hist.bucket(2) == 0);
+}
+
+TEST_CASE("GIL monitors record the guards", "[Gil_monitor]")
+{
+    Gil_monitor monitor(std::chrono::microseconds(100));
+    monitor.start();
+    CHECK(Gil_observer::installed() == &monitor);
+
+    const int n_threads = 2;
+    const int n_acquires = 50;
+    {
+        Gil_release released{};
+        std::vector<std::thread> threads{};
+        for (int i = 0; i < n_threads; ++i) {
+            threads.emplace_back([&]() {
+                for (int j = 0; j < n_acquires; ++j) {
+                    Gil_acquire acquired{};
+                    Handle res("i", j);
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            });
+        }
+        for (auto& i : threads) {
+            i.join();
+        }
+    }
+
+    monitor.stop();
+    CHECK(Gil_observer::installed() == nullptr);
+    CHECK(monitor.n_samples() > 0);
+
+    std::uint64_t n_acquired = 0;
+    std::uint64_t n_handoffs = 0;
+    std::uint64_t n_held = 0;
+    monitor.for_each([&](const Gil_thread_stats& stats) {
+        n_acquired += stats.wait.count();
+        n_handoffs += stats.n_handoffs.load();
+        n_held += stats.n_samples_held.load();
+        CHECK(stats.hold.count() <= stats.wait.count());
+    });
+    // Plus the main thread taking the GIL back.
+    CHECK(n_acquired == n_threads * n_acquires + 1);
+    CHECK(n_handoffs > 0);
+    CHECK(n_held > 0);
+
+    SECTION("with the report for Python")
+    {
+        Handle report = monitor.report();
+        CHECK(PyObject_TypeCheck(report, Gil_monitor::report_type().tp()));
+        Handle threads = report.getattr("threads");
+        CHECK(PyTuple_Size(threads) == 3);
+
+        Handle func = monitor.report_function();
+        Handle called = func.call();
+        Handle entry(PySequence_GetItem(called.getattr("threads"), 0));
+        CHECK(entry.getattr("n_acquired").as<long>() >= 1);
+        CHECK(PyTuple_Check(entry.getattr("hold_hist").get()));
+    }
+
+    SECTION("with the statistics reset")
+    {
+        monitor.reset();
+        CHECK(monitor.n_samples() == 0);
+        monitor.for_each([&](const Gil_thread_stats& stats) {
+            CHECK(stats.wait.count() == 0);
+        });
+    }
+}
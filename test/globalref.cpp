@@ -0,0 +1,87 @@
+/** Tests for the cached references to module globals.
+ */
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/global_ref.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Global references are resolved lazily and cached", "[Global_ref]")
+{
+    static Global_ref decimal("decimal", "Decimal");
+    CHECK(decimal.n_resolved() == 0);
+
+    Handle value = decimal.call("1.5");
+    CHECK(PyObject_IsInstance(value, decimal.get()) == 1);
+    for (int i = 0; i < 10; ++i) {
+        decimal.get();
+    }
+    CHECK(decimal.n_resolved() == 1);
+
+    Global_ref math("math");
+    CHECK(PyModule_Check(math.get().get()));
+    Handle sqrt = Handle(math.get()).getattr("sqrt");
+    CHECK(sqrt.call(4.0).as<double>() == 2.0);
+
+    Global_ref missing("math", "no_such_attribute");
+    CHECK_THROWS_AS(missing.get(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_AttributeError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Global references follow changes to modules", "[Global_ref]")
+{
+    Handle globals(PyDict_New());
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+    Handle res(PyRun_String("import sys, types\n"
+                            "mod = types.ModuleType('cpypp_globalref_test')\n"
+                            "mod.CONFIG = 1\n"
+                            "sys.modules[mod.__name__] = mod\n",
+        Py_file_input, globals, globals));
+    Handle mod(PyDict_GetItemString(globals, "mod"), NEW);
+
+    Global_ref config("cpypp_globalref_test", "CONFIG");
+    CHECK(config.get().as<long>() == 1);
+    CHECK(config.get().as<long>() == 1);
+    CHECK(config.n_resolved() == 1);
+
+    // Changes to other entries, seen by the versions of the whole
+    // dictionaries before Python 3.12.
+    REQUIRE(PyObject_SetAttrString(mod, "OTHER", Handle(0l)) == 0);
+    Handle imported(PyImport_ImportModule("colorsys"));
+    CHECK(config.get().as<long>() == 1);
+#if PY_VERSION_HEX >= 0x030C0000
+    CHECK(config.n_resolved() == 1);
+#endif
+    std::size_t n_resolved = config.n_resolved();
+
+    // Reassignment of the attribute.
+    REQUIRE(PyObject_SetAttrString(mod, "CONFIG", Handle(2l)) == 0);
+    CHECK(config.get().as<long>() == 2);
+    CHECK(config.n_resolved() == n_resolved + 1);
+
+    // Replacement of the module.
+    Handle replaced(PyRun_String("types.ModuleType('cpypp_globalref_test')",
+        Py_eval_input, globals, globals));
+    REQUIRE(PyObject_SetAttrString(replaced, "CONFIG", Handle(3l)) == 0);
+    REQUIRE(PyDict_SetItemString(
+                PyImport_GetModuleDict(), "cpypp_globalref_test", replaced)
+        == 0);
+    CHECK(config.get().as<long>() == 3);
+
+    // Removal of the attribute.
+    REQUIRE(PyObject_DelAttrString(replaced, "CONFIG") == 0);
+    CHECK_THROWS_AS(config.get(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_AttributeError));
+    PyErr_Clear();
+
+    config.invalidate();
+    REQUIRE(PyDict_DelItemString(
+                PyImport_GetModuleDict(), "cpypp_globalref_test")
+        == 0);
+}
@@ -0,0 +1,115 @@
+/** Tests for the conversions of integers through their bytes.
+ */
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/int_bytes.hpp>
+
+using namespace cpypp;
+
+namespace {
+
+Handle eval(const char* code)
+{
+    return Handle(
+        PyRun_String(code, Py_eval_input, PyEval_GetBuiltins(), nullptr));
+}
+}
+
+TEST_CASE("Integers are converted through bytes", "[int_bytes]")
+{
+    unsigned char bytes[] = { 0x01, 0x02, 0x03, 0x84 };
+    CHECK(int_from_bytes(bytes, 4, false) == eval("0x84030201"));
+    CHECK(int_from_bytes(bytes, 4, true) == eval("0x84030201 - 2 ** 32"));
+
+    unsigned char out[4];
+    int_to_bytes(eval("-2"), out, 4, true);
+    CHECK(out[0] == 0xfe);
+    CHECK(out[3] == 0xff);
+
+    CHECK_THROWS_AS(int_to_bytes(eval("2 ** 32"), out, 4, false), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+    CHECK_THROWS_AS(int_to_bytes(eval("-1"), out, 4, false), Exc_set);
+    PyErr_Clear();
+    CHECK_THROWS_AS(int_to_bytes(eval("1.5"), out, 4, false), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+
+    // Limbs go from the least significant one.
+    std::array<std::uint64_t, 3> limbs{ { 1, 2, 3 } };
+    Handle big = make_int(limbs);
+    CHECK(big == eval("1 + (2 << 64) + (3 << 128)"));
+    CHECK(as_limbs<3>(big) == limbs);
+    CHECK_THROWS_AS(as_limbs<2>(big), Exc_set);
+    PyErr_Clear();
+}
+
+#ifdef __SIZEOF_INT128__
+
+TEST_CASE("128-bit integers are converted", "[int_bytes]")
+{
+    Uint128 max = ~static_cast<Uint128>(0);
+    CHECK(make_int(max) == eval("2 ** 128 - 1"));
+    CHECK(as_uint128(eval("2 ** 128 - 1")) == max);
+    CHECK(make_int(static_cast<Uint128>(7)) == eval("7"));
+
+    Int128 min = static_cast<Int128>(static_cast<Uint128>(1) << 127);
+    CHECK(make_int(min) == eval("-2 ** 127"));
+    CHECK(as_int128(eval("-2 ** 127")) == min);
+    CHECK(make_int(static_cast<Int128>(-5)) == eval("-5"));
+    CHECK(as_int128(eval("-5")) == -5);
+
+    Int128 hash = static_cast<Int128>(0x0123456789abcdefULL) << 64
+        | static_cast<Int128>(0xfedcba9876543210ULL);
+    CHECK(as_int128(make_int(hash)) == hash);
+
+    CHECK_THROWS_AS(as_int128(eval("2 ** 127")), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+}
+
+#endif
+
+TEST_CASE("Columns of integers are packed and unpacked", "[int_bytes]")
+{
+    Handle ints = eval("[0, 1, 2 ** 100, 2 ** 128 - 1]");
+    std::vector<unsigned char> packed(4 * 16);
+    ints_to_bytes(ints, packed.data(), 16, 4, false);
+    CHECK(packed[16] == 1);
+    CHECK(packed[32 + 12] == 0x10);
+    CHECK(ints_from_bytes(packed.data(), 16, 4, false) == ints);
+
+    Handle module(PyModule_New("cpypp_int_bytes_test"));
+    REQUIRE(PyModule_AddFunctions(module, int_bytes_methods()) == 0);
+    Handle signed_ints = eval("[-2 ** 70, -1, 0, 2 ** 70]");
+    Handle args(Py_BuildValue("(Oi)", signed_ints.get(), 9));
+    Handle kwargs(Py_BuildValue("{sO}", "signed", Py_True));
+    Handle pack(PyObject_GetAttrString(module, "pack_ints"));
+    Handle bytes(PyObject_Call(pack, args, kwargs));
+    CHECK(PyBytes_GET_SIZE(bytes.get()) == 36);
+
+    Handle unpack(PyObject_GetAttrString(module, "unpack_ints"));
+    Handle unpack_args(Py_BuildValue("(Oi)", bytes.get(), 9));
+    Handle unpacked(PyObject_Call(unpack, unpack_args, kwargs));
+    CHECK(unpacked == signed_ints);
+
+    Handle odd_args(Py_BuildValue("(Oi)", bytes.get(), 5));
+    CHECK(PyObject_Call(unpack, odd_args, nullptr) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+
+    // Widths overflowing the size of the bytes are rejected before packing.
+    Handle huge_args(Py_BuildValue(
+        "(On)", signed_ints.get(), Py_ssize_t(1) << 62));
+    CHECK(PyObject_Call(pack, huge_args, nullptr) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_OverflowError));
+    PyErr_Clear();
+}
@@ -0,0 +1,149 @@
+/** Tests for the hash maps with native integer keys.
+ */
+
+#include <cstdint>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/int_map.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Integer tables store native entries", "[Int_table]")
+{
+    Int_table<double> table{};
+    const std::int64_t n = 1000;
+
+    for (std::int64_t i = 0; i < n; ++i) {
+        *table.emplace(i * 7).first = i / 2.0;
+    }
+    CHECK(table.size() == n);
+    CHECK(table.capacity() * 7 >= table.size() * 8);
+
+    SECTION("gives the stored values")
+    {
+        for (std::int64_t i = 0; i < n; ++i) {
+            auto v = table.find(i * 7);
+            REQUIRE(v != nullptr);
+            CHECK(*v == i / 2.0);
+        }
+        CHECK(table.find(1) == nullptr);
+        CHECK_FALSE(table.emplace(7).second);
+    }
+
+    SECTION("removes entries")
+    {
+        for (std::int64_t i = 0; i < n; i += 2) {
+            CHECK(table.erase(i * 7));
+        }
+        CHECK_FALSE(table.erase(0));
+        CHECK(table.size() == n / 2);
+        for (std::int64_t i = 0; i < n; ++i) {
+            CHECK((table.find(i * 7) != nullptr) == (i % 2 == 1));
+        }
+
+        std::size_t n_visited = 0;
+        auto cap = table.capacity();
+        for (auto i = table.next(0); i < cap; i = table.next(i + 1)) {
+            CHECK(table.key_at(i) % 14 == 7);
+            ++n_visited;
+        }
+        CHECK(n_visited == n / 2);
+    }
+}
+
+TEST_CASE("Integer maps implement the mapping protocol", "[Int_map]")
+{
+    Handle map = Int_map<std::int64_t>::create();
+    CHECK(Int_map<std::int64_t>::check(map));
+
+    for (long i = 0; i < 10; ++i) {
+        REQUIRE(PyObject_SetItem(map, Handle(i), Handle(i * i)) == 0);
+    }
+    CHECK(PyMapping_Length(map) == 10);
+    CHECK(Handle(PyObject_GetItem(map, Handle(3l))).as<long>() == 9);
+    CHECK(PySequence_Contains(map, Handle(9l)) == 1);
+    CHECK(PySequence_Contains(map, Handle(10l)) == 0);
+
+    CHECK(PyObject_GetItem(map, Handle(10l)) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_KeyError));
+    PyErr_Clear();
+
+    REQUIRE(PyObject_DelItem(map, Handle(0l)) == 0);
+    CHECK(PyMapping_Length(map) == 9);
+
+    long sum = 0;
+    Handle items(PyObject_CallMethod(map, "items", nullptr));
+    for (const auto& i : items) {
+        Handle key(PySequence_GetItem(i, 0));
+        Handle value(PySequence_GetItem(i, 1));
+        CHECK(value.as<long>() == key.as<long>() * key.as<long>());
+        sum += key.as<long>();
+    }
+    CHECK(sum == 45);
+
+    Handle size(PyObject_CallMethod(map, "__sizeof__", nullptr));
+    CHECK(size.as<unsigned long>() >= 16 * 17);
+
+    // Iterators are invalidated by the rehashing of the table.
+    Handle iter(PyObject_GetIter(map));
+    Handle first(PyIter_Next(iter));
+    Handle reserved(PyObject_CallMethod(map, "reserve", "n", 1000));
+    CHECK(PyIter_Next(iter) == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_RuntimeError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Integer maps have bulk operations on buffers", "[Int_map][Buffer]")
+{
+    Handle array_mod(PyImport_ImportModule("array"));
+    Handle keys(
+        PyObject_CallMethod(array_mod, "array", "s[iii]", "q", 1, 2, 3));
+    Handle values(
+        PyObject_CallMethod(array_mod, "array", "s[ddd]", "d", 0.5, 1.5, 2.5));
+
+    Handle map = Int_map<double>::create();
+    Handle res(
+        PyObject_CallMethod(map, "update", "OO", keys.get(), values.get()));
+    CHECK(PyMapping_Length(map) == 3);
+
+    SECTION("can look up keys into buffers")
+    {
+        Handle query(
+            PyObject_CallMethod(array_mod, "array", "s[iii]", "q", 3, 4, 1));
+        Handle out(PyObject_CallMethod(
+            array_mod, "array", "s[ddd]", "d", 0.0, 0.0, 0.0));
+        Handle n_found(PyObject_CallMethod(
+            map, "lookup_many", "OOd", query.get(), out.get(), -1.0));
+        CHECK(n_found.as<long>() == 2);
+
+        Buffer buf(out);
+        auto arr = buf.as_array<double>();
+        CHECK(arr[0] == 2.5);
+        CHECK(arr[1] == -1.0);
+        CHECK(arr[2] == 0.5);
+    }
+
+    SECTION("rejects buffers of wrong types")
+    {
+        CHECK(PyObject_CallMethod(map, "update", "OO", values.get(), keys.get())
+            == nullptr);
+        CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+        PyErr_Clear();
+    }
+
+    SECTION("works for object values")
+    {
+        Handle obj_map = Int_map<Handle>::create();
+        Handle objs("[sss]", "a", "b", "c");
+        Handle res(PyObject_CallMethod(
+            obj_map, "update", "OO", keys.get(), objs.get()));
+
+        Handle found(
+            PyObject_CallMethod(obj_map, "lookup_many", "O", keys.get()));
+        CHECK(found == objs);
+    }
+}
@@ -0,0 +1,165 @@
+/** Tests for the sequences of records in memory-mapped files.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/mmap_seq.hpp>
+
+using namespace cpypp;
+
+/** Directory removed with its files at the end of the tests.
+ */
+
+struct Temp_dir {
+    std::string path;
+
+    Temp_dir()
+    {
+        char templ[] = "/tmp/cpypp-test-XXXXXX";
+        REQUIRE(mkdtemp(templ) != nullptr);
+        path = templ;
+    }
+
+    ~Temp_dir() { std::system(("rm -rf " + path).c_str()); }
+};
+
+static std::string as_str(std::pair<const char*, std::size_t> record)
+{
+    return std::string(record.first, record.second);
+}
+
+TEST_CASE("Records of any sizes are kept in files", "[Record_file]")
+{
+    Temp_dir dir;
+    std::string path = dir.path + "/records";
+
+    {
+        Record_file file(path.c_str());
+        CHECK(file.size() == 0);
+        file.append("hello", 5);
+        file.append("", 0);
+        CHECK(file.size() == 2);
+
+        // Records appended are read back before and after they are written.
+        CHECK(as_str(file.item(0)) == "hello");
+        for (int i = 0; i < 1000; ++i) {
+            std::string record(i % 50, static_cast<char>('a' + i % 26));
+            file.append(record.data(), record.size());
+        }
+        CHECK(file.item(1).second == 0);
+        CHECK(as_str(file.item(1001)) == std::string(49, 'l'));
+    }
+
+    Record_file file(path.c_str(), 0, false);
+    REQUIRE(file.size() == 1002);
+    CHECK(as_str(file.item(0)) == "hello");
+    CHECK(as_str(file.item(500)) == std::string(48, 'e'));
+    CHECK(file.item(999).second == 47);
+
+    file.advise(MADV_RANDOM);
+    CHECK(as_str(file.item(0)) == "hello");
+    file.prefetch(0, file.size());
+    file.evict();
+    CHECK(as_str(file.item(2)) == "");
+
+    CHECK_THROWS_AS(file.append("x", 1), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Records of the same size are kept in files", "[Record_file]")
+{
+    Temp_dir dir;
+    std::string path = dir.path + "/fixed";
+
+    {
+        Record_file file(path.c_str(), 8);
+        for (std::int64_t i = 0; i < 100; ++i) {
+            file.append(&i, sizeof(i));
+        }
+        CHECK_THROWS_AS(file.append("abc", 3), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+    }
+    CHECK(access((path + ".idx").c_str(), F_OK) != 0);
+
+    Record_file file(path.c_str(), 8);
+    REQUIRE(file.size() == 100);
+    std::int64_t value;
+    std::memcpy(&value, file.item(42).first, sizeof(value));
+    CHECK(value == 42);
+
+    CHECK_THROWS_AS(Record_file(path.c_str(), 3), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+
+    CHECK_THROWS_AS(Record_file((dir.path + "/none").c_str(), 0, false),
+        Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_FileNotFoundError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Sequences of records are used from Python", "[Mmap_seq]")
+{
+    Temp_dir dir;
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "MmapSeq", Mmap_seq::type().tp_obj());
+    PyDict_SetItemString(
+        globals, "path", Handle(PyUnicode_FromString(dir.path.c_str())));
+
+    Handle res(PyRun_String(R"(
+seq = MmapSeq(path + '/seq', access='sequential')
+assert len(seq) == 0
+seq.append(b'first')
+seq.extend(str(i).encode() for i in range(100))
+seq.append(bytearray(b'last'))
+assert len(seq) == 102
+assert seq[0] == b'first'
+assert seq[-1] == b'last'
+assert seq[1:4] == [b'0', b'1', b'2']
+assert seq[100:0:-50] == [b'99', b'49']
+assert list(seq)[50] == b'49'
+seq.flush()
+seq.advise('random')
+seq.prefetch(10)
+seq.evict()
+
+try:
+    seq[102]
+    assert False
+except IndexError:
+    pass
+
+try:
+    seq.advise('backward')
+    assert False
+except ValueError:
+    pass
+
+del seq
+seq = MmapSeq(path + '/seq', writable=False)
+assert len(seq) == 102 and seq[51] == b'50'
+
+fixed = MmapSeq(path + '/fixed', record_size=4)
+fixed.extend([b'abcd', b'efgh'])
+assert fixed[:] == [b'abcd', b'efgh']
+try:
+    fixed.append(b'ab')
+    assert False
+except ValueError:
+    pass
+)",
+        Py_file_input, globals, globals));
+}
@@ -0,0 +1,95 @@
+/** Tests for the visibility of native code to profilers.
+ */
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/monitoring.hpp>
+
+using namespace cpypp;
+
+namespace {
+
+/** Finds the entry in the statistics of a profiler for the given code.
+ */
+
+PyObject* find_entry(const Handle& stats, PyObject* code)
+{
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(stats.get()); ++i) {
+        PyObject* entry = PyList_GET_ITEM(stats.get(), i);
+        if (PyStructSequence_GetItem(entry, 0) == code) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+/** Tests if an entry in the statistics has a callee with the given name.
+ */
+
+bool has_callee(PyObject* entry, const char* name)
+{
+    PyObject* calls = PyStructSequence_GetItem(entry, 5);
+    if (calls == Py_None) {
+        return false;
+    }
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(calls); ++i) {
+        PyObject* code = PyStructSequence_GetItem(PyList_GET_ITEM(calls, i), 0);
+        if (PyCode_Check(code)
+            && PyUnicode_CompareWithASCIIString(
+                   reinterpret_cast<PyCodeObject*>(code)->co_name, name)
+                == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+TEST_CASE("Native sites are seen by profilers", "[Native_scope]")
+{
+    static Native_site site(__FILE__, "native_caller", __LINE__);
+    static Native_site failing(__FILE__, "native_failing", __LINE__);
+
+    Handle globals(PyDict_New());
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+    Handle res(PyRun_String("import cProfile\n"
+                            "profiler = cProfile.Profile()\n"
+                            "def callback(x):\n"
+                            "    return x * 2\n",
+        Py_file_input, globals, globals));
+    Handle profiler(PyDict_GetItemString(globals, "profiler"), NEW);
+    Handle callback(PyDict_GetItemString(globals, "callback"), NEW);
+
+    // Without any profiler, scopes do nothing.
+    CHECK(call_from(site, callback, 3l).as<long>() == 6);
+
+    profiler.getattr("enable").call();
+    for (long i = 0; i < 3; ++i) {
+        CHECK(call_from(site, callback, i).as<long>() == i * 2);
+    }
+    {
+        Native_scope scope(failing);
+        PyErr_SetString(PyExc_ValueError, "failed");
+    }
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+    profiler.getattr("disable").call();
+
+    Handle stats = profiler.getattr("getstats").call();
+    bool if_supported = PY_VERSION_HEX < 0x030C0000
+        || PY_VERSION_HEX >= 0x030D0000;
+    if (if_supported) {
+        PyObject* entry
+            = find_entry(stats, reinterpret_cast<PyObject*>(site.code()));
+        REQUIRE(entry != nullptr);
+        CHECK(PyLong_AsLong(PyStructSequence_GetItem(entry, 1)) == 3);
+        CHECK(has_callee(entry, "callback"));
+
+        CHECK(find_entry(stats, reinterpret_cast<PyObject*>(failing.code()))
+            != nullptr);
+    }
+}
@@ -38,3 +38,18 @@ TEST_CASE("Integer can be built and parsed", "[Handle]")
 
     Py_DECREF(one);
 }
+
+TEST_CASE("Float can be built and parsed", "[Handle]")
+{
+    Handle from_double(1.5);
+    CHECK(PyFloat_CheckExact(from_double.get()));
+    CHECK(from_double.as<double>() == 1.5);
+
+    // Integers are converted as by the float constructor.
+    CHECK(Handle(2l).as<double>() == 2.0);
+
+    Handle str(PyUnicode_FromString("x"));
+    CHECK_THROWS_AS(str.as<double>(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
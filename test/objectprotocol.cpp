@@ -109,3 +109,21 @@ TEST_CASE("Handles support comparison operations", "[Handle]")
         PyErr_Clear();
     }
 }
+
+TEST_CASE("Handles can call objects", "[Handle]")
+{
+    Handle builtins(PyEval_GetBuiltins(), NEW);
+    Handle max(PyDict_GetItemString(builtins, "max"), NEW);
+
+    CHECK(max.call(1l, Handle(3l), 2l).as<long>() == 3);
+    CHECK(max.call(Handle("[ii]", 4, 5).get()).as<long>() == 5);
+    CHECK(Handle(PyDict_GetItemString(builtins, "len"), NEW)
+              .call("abc")
+              .as<long>()
+        == 3);
+    CHECK(max.getattr("__name__").getattr("upper").call() == Handle("s", "MAX"));
+
+    CHECK_THROWS_AS(max.call(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
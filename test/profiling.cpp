@@ -0,0 +1,39 @@
+/** Tests for the utilities for profiling.
+ */
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Perf trampolines can be toggled", "[enable_perf_trampoline]")
+{
+    Handle sys(PyImport_ImportModule("sys"));
+    bool if_supported
+        = PyObject_HasAttrString(sys, "activate_stack_trampoline");
+
+    CHECK(enable_perf_trampoline() == if_supported);
+    if (if_supported) {
+        Handle active(
+            PyObject_CallMethod(sys, "is_stack_trampoline_active", nullptr));
+        CHECK(active.get() == Py_True);
+    }
+    disable_perf_trampoline();
+    CHECK(PyErr_Occurred() == nullptr);
+
+    // Calls through the probed boundaries work the same.
+    Handle builtins(PyEval_GetBuiltins(), NEW);
+    Handle abs(PyDict_GetItemString(builtins, "abs"), NEW);
+    CHECK(abs.call(-2l).as<long>() == 2);
+}
+
+TEST_CASE("Perf profiling can be configured", "[enable_perf_profiling]")
+{
+    PyConfig config;
+    PyConfig_InitPythonConfig(&config);
+    CHECK(enable_perf_profiling(config) == (PY_VERSION_HEX >= 0x030C0000));
+    PyConfig_Clear(&config);
+}
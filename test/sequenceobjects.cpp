@@ -1,6 +1,9 @@
 /** Tests for the utility for sequence objects.
  */
 
+#include <string>
+#include <vector>
+
 #include <catch.hpp>
 
 #include <Python.h>
@@ -21,6 +24,36 @@ TEST_CASE("Tuples can be constructed", "[Handle][Tuple]")
     CHECK(tup == ref);
 }
 
+TEST_CASE("Strings can be built and parsed", "[Handle]")
+{
+    std::string content("caf\xc3\xa9 \0end", 9);
+    Handle str(content);
+    CHECK(PyUnicode_CheckExact(str.get()));
+    CHECK(PyUnicode_GET_LENGTH(str.get()) == 8);
+    CHECK(str.as<std::string>() == content);
+
+    CHECK_THROWS_AS(Handle(1l).as<std::string>(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
+
+TEST_CASE("Sequences can be parsed into vectors", "[Handle]")
+{
+    Handle nums("(ldd)", 1l, 2.5, 3.0);
+    auto vec = nums.as<std::vector<double>>();
+    CHECK(vec == std::vector<double>{ 1.0, 2.5, 3.0 });
+
+    Handle nested(Py_BuildValue("[[ss][]]", "a", "b"));
+    auto strs = nested.as<std::vector<std::vector<std::string>>>();
+    REQUIRE(strs.size() == 2);
+    CHECK(strs[0] == std::vector<std::string>{ "a", "b" });
+    CHECK(strs[1].empty());
+
+    CHECK_THROWS_AS(Handle(1l).as<std::vector<long>>(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+}
+
 //
 // Test of building of struct sequences
 //
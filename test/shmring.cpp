@@ -0,0 +1,218 @@
+/** Tests for the rings of records in shared memory.
+ */
+
+#include <cstring>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/shm_ring.hpp>
+
+using namespace cpypp;
+
+/** Makes a name of a ring unique to the current process.
+ */
+
+static std::string ring_name(const char* tag)
+{
+    return "/cpypp-test-" + std::to_string(getpid()) + "-" + tag;
+}
+
+TEST_CASE("Records pass through rings", "[Shm_ring_buffer]")
+{
+    std::string name = ring_name("basic");
+    Shm_ring_buffer producer = Shm_ring_buffer::create(name.c_str(), 100);
+    Shm_ring_buffer consumer = Shm_ring_buffer::open(name.c_str());
+    Mapped_region::unlink_shm(name.c_str());
+    CHECK(producer.capacity() == 4096);
+
+    const unsigned char* data;
+    std::size_t size;
+    CHECK_FALSE(consumer.try_next(data, size));
+
+    unsigned char* dest = producer.try_reserve(5);
+    REQUIRE(dest != nullptr);
+    std::memcpy(dest, "hello", 5);
+    dest = producer.try_reserve(0);
+    REQUIRE(dest != nullptr);
+
+    // Nothing is seen before the batch is published.
+    CHECK_FALSE(consumer.try_next(data, size));
+    producer.publish();
+
+    REQUIRE(consumer.try_next(data, size));
+    CHECK(std::string(reinterpret_cast<const char*>(data), size) == "hello");
+    REQUIRE(consumer.try_next(data, size));
+    CHECK(size == 0);
+    CHECK_FALSE(consumer.try_next(data, size));
+    consumer.release();
+
+    // Records wrap around the end of the data as a whole.
+    for (int i = 0; i < 100; ++i) {
+        std::string record(i * 37 % 1000, static_cast<char>('a' + i % 26));
+        dest = producer.try_reserve(record.size());
+        REQUIRE(dest != nullptr);
+        std::memcpy(dest, record.data(), record.size());
+        producer.publish();
+
+        REQUIRE(consumer.try_next(data, size));
+        CHECK(std::string(reinterpret_cast<const char*>(data), size)
+            == record);
+        consumer.release();
+    }
+
+    // Full rings refuse new records until the room is released.
+    CHECK(producer.max_record() == 2040);
+    CHECK(producer.try_reserve(2041) == nullptr);
+    int n_reserved = 0;
+    while (producer.try_reserve(2000) != nullptr) {
+        ++n_reserved;
+    }
+    CHECK(n_reserved >= 1);
+    CHECK(n_reserved <= 2);
+    producer.publish();
+    REQUIRE(consumer.try_next(data, size));
+    CHECK(producer.try_reserve(2000) == nullptr);
+    while (consumer.try_next(data, size)) {
+    }
+    consumer.release();
+    CHECK(producer.try_reserve(2040) != nullptr);
+}
+
+TEST_CASE("Rings are opened only when valid", "[Shm_ring_buffer]")
+{
+    std::string name = ring_name("invalid");
+    CHECK_THROWS_AS(Shm_ring_buffer::open(name.c_str()), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_FileNotFoundError));
+    PyErr_Clear();
+
+    {
+        Shm_ring_buffer ring = Shm_ring_buffer::create(name.c_str(), 4096);
+        CHECK_THROWS_AS(Shm_ring_buffer::create(name.c_str(), 4096), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_FileExistsError));
+        PyErr_Clear();
+    }
+    Mapped_region::unlink_shm(name.c_str());
+    Mapped_region::open_shm(name.c_str(), 4096);
+    CHECK_THROWS_AS(Shm_ring_buffer::open(name.c_str()), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+    Mapped_region::unlink_shm(name.c_str());
+}
+
+TEST_CASE("Rings are used from Python", "[Shm_ring]")
+{
+    Handle globals(PyDict_New());
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyDict_SetItemString(globals, "ShmRing", Shm_ring::type().tp_obj());
+    PyDict_SetItemString(
+        globals, "name", Handle(PyUnicode_FromString(ring_name("py").c_str())));
+
+    Handle res(PyRun_String(R"(
+producer = ShmRing(name, 4096)
+consumer = ShmRing(name)
+ShmRing.unlink(name)
+
+assert consumer.consume(timeout=0) == []
+assert producer.publish([b'abc', bytearray(b'de'), memoryview(b'')]) == 3
+views = consumer.consume()
+assert [bytes(i) for i in views] == [b'abc', b'de', b'']
+assert all(i.readonly for i in views)
+consumer.release()
+
+assert producer.publish([b'x' * 100] * 10) == 10
+assert len(consumer.consume(max_records=4)) == 4
+assert len(consumer.consume()) == 6
+consumer.release()
+
+# Only the records fitting before the timeout are published.
+assert producer.publish([b'y' * 1000] * 10, timeout=0.01) == 3
+assert len(consumer.consume()) == 3
+consumer.release()
+
+# The records before an oversized one are still published.
+try:
+    producer.publish([b'a', b'b', b'z' * 3000, b'c'])
+    assert False
+except ValueError as exc:
+    assert exc.n_published == 2
+assert [bytes(i) for i in consumer.consume()] == [b'a', b'b']
+consumer.release()
+
+try:
+    producer.publish([b'd', None])
+    assert False
+except TypeError as exc:
+    assert exc.n_published == 1
+assert [bytes(i) for i in consumer.consume()] == [b'd']
+)",
+        Py_file_input, globals, globals));
+}
+
+TEST_CASE("Rings pass records between processes", "[Shm_ring_buffer]")
+{
+    const int n_records = 10000;
+    std::string name = ring_name("fork");
+    Shm_ring_buffer consumer = Shm_ring_buffer::create(name.c_str(), 4096);
+    Shm_ring_buffer producer = Shm_ring_buffer::open(name.c_str());
+    Mapped_region::unlink_shm(name.c_str());
+
+    // The shared mappings are inherited by the child.
+    PyOS_BeforeFork();
+    pid_t pid = fork();
+    if (pid == 0) {
+        PyOS_AfterFork_Child();
+        for (int i = 0; i < n_records; ++i) {
+            unsigned char* dest;
+            while ((dest = producer.try_reserve(sizeof(i))) == nullptr) {
+                auto key = producer.writable().prepare();
+                if ((dest = producer.try_reserve(sizeof(i))) != nullptr) {
+                    producer.writable().cancel();
+                    break;
+                }
+                producer.writable().wait(key, 1000000000);
+            }
+            std::memcpy(dest, &i, sizeof(i));
+            if (i % 16 == 15) {
+                producer.publish();
+            }
+        }
+        producer.publish();
+        _exit(0);
+    }
+    PyOS_AfterFork_Parent();
+    REQUIRE(pid > 0);
+
+    int n_seen = 0;
+    bool if_ordered = true;
+    while (n_seen < n_records) {
+        const unsigned char* data;
+        std::size_t size;
+        auto key = consumer.readable().prepare();
+        if (!consumer.try_next(data, size)) {
+            consumer.readable().wait(key, 1000000000);
+            continue;
+        }
+        consumer.readable().cancel();
+        do {
+            int value;
+            std::memcpy(&value, data, sizeof(value));
+            if_ordered = if_ordered && size == sizeof(value)
+                && value == n_seen;
+            ++n_seen;
+        } while (consumer.try_next(data, size));
+        consumer.release();
+    }
+    CHECK(if_ordered);
+
+    int status;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == 0);
+}
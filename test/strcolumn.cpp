@@ -0,0 +1,128 @@
+/** Tests for the compact columns of strings.
+ */
+
+#include <cstdint>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/str_column.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Packed strings store items contiguously", "[Packed_strs]")
+{
+    Packed_strs strs{};
+    strs.push_back("ab", 2);
+    strs.push_back("", 0);
+    strs.push_back("cde", 3);
+
+    CHECK(strs.size() == 3);
+    CHECK(strs.data().size() == 5);
+    CHECK(strs.item(2).second == 3);
+    CHECK(strs.equals(0, "ab", 2));
+    CHECK_FALSE(strs.equals(0, "a", 1));
+    CHECK(strs.equals(1, "", 0));
+    CHECK(strs.hash(0) != strs.hash(2));
+
+    std::int64_t bad_offsets[] = { 0, 3, 2, 5 };
+    CHECK_FALSE(strs.assign("abcde", 5, bad_offsets, 4));
+    CHECK(strs.size() == 3);
+}
+
+TEST_CASE("String columns implement the sequence protocol", "[Str_column]")
+{
+    Handle strs("[sss]", "alpha", "\xce\xb2\xce\xb7\xcf\x84\xce\xb1", "alpha");
+    Handle col(PyObject_CallFunctionObjArgs(
+        Str_column::type().tp_obj(), strs.get(), nullptr));
+
+    CHECK(PySequence_Length(col) == 3);
+    CHECK(Handle(PySequence_List(col)) == strs);
+    CHECK(Handle(PySequence_GetItem(col, 1))
+        == Handle(PyList_GetItem(strs, 1), BORROW));
+    CHECK(Handle(PyObject_GetItem(col, Handle(-1l))) == Handle("s", "alpha"));
+
+    CHECK(PySequence_Contains(col, Handle("s", "alpha")) == 1);
+    CHECK(PySequence_Contains(col, Handle("s", "gamma")) == 0);
+    CHECK(PySequence_Contains(col, Handle(1l)) == 0);
+    CHECK(Handle(PyObject_CallMethod(col, "count", "s", "alpha")).as<long>()
+        == 2);
+
+    SECTION("caches the strings on request")
+    {
+        Handle kwargs("{sO}", "cache", Py_True);
+        Handle cached(PyObject_Call(
+            Str_column::type().tp_obj(), Handle("(O)", strs.get()), kwargs));
+        Handle first(PySequence_GetItem(cached, 0));
+        CHECK(Handle(PySequence_GetItem(cached, 0)).get() == first.get());
+        CHECK(Handle(PySequence_GetItem(col, 0)).get()
+            != Handle(PySequence_GetItem(col, 0)).get());
+    }
+
+    SECTION("gives slices as columns")
+    {
+        Handle step(-2l);
+        Handle rev(PyObject_GetItem(
+            col, Handle(PySlice_New(nullptr, nullptr, step))));
+        CHECK(Str_column::check(rev));
+        CHECK(Handle(PySequence_List(rev)) == Handle("[ss]", "alpha", "alpha"));
+
+        Handle copied(PySequence_GetSlice(col, 0, 3));
+        CHECK(copied == col);
+        CHECK(rev != col);
+    }
+
+    SECTION("can be extended")
+    {
+        Handle res(PyObject_CallMethod(col, "append", "s", "gamma"));
+        res = Handle(PyObject_CallMethod(
+            col, "extend", "(O)", Handle("(ss)", "delta", "").get()));
+        CHECK(PySequence_Length(col) == 6);
+        CHECK(Handle(PyObject_CallMethod(col, "index", "s", "")).as<long>()
+            == 5);
+
+        CHECK(PyObject_CallMethod(col, "append", "l", 1l) == nullptr);
+        CHECK(PyErr_ExceptionMatches(PyExc_TypeError));
+        PyErr_Clear();
+
+        // By itself, with the strings before the extension.
+        Handle expected(PySequence_List(col));
+        Handle doubled(PySequence_Concat(expected, expected));
+        res = Handle(PyObject_CallMethod(col, "extend", "(O)", col.get()));
+        CHECK(PySequence_Length(col) == 12);
+        CHECK(Handle(PySequence_List(col)) == doubled);
+    }
+}
+
+TEST_CASE("String columns have bulk operations on buffers", "[Str_column]")
+{
+    Handle array_mod(PyImport_ImportModule("array"));
+    Handle offsets(PyObject_CallMethod(
+        array_mod, "array", "sO", "q", Handle("[iiii]", 0, 1, 3, 4).get()));
+    Handle col(PyObject_CallMethod(Str_column::type().tp_obj(),
+        "from_buffers", "OO", Handle("y", "abcb").get(), offsets.get()));
+    CHECK(Handle(PySequence_List(col)) == Handle("[sss]", "a", "bc", "b"));
+
+    Handle mask(PyByteArray_FromStringAndSize(nullptr, 3));
+    CHECK(Handle(PyObject_CallMethod(col, "equal", "sO", "b", mask.get()))
+              .as<long>()
+        == 1);
+    CHECK(mask == Handle(PyByteArray_FromStringAndSize("\0\0\1", 3)));
+
+    Handle hashes(PyObject_CallMethod(
+        array_mod, "array", "sO", "q", Handle("[iii]", 0, 0, 0).get()));
+    Handle res(PyObject_CallMethod(col, "hashes", "O", hashes.get()));
+    auto hash = [&](Py_ssize_t i) {
+        return Handle(PySequence_GetItem(hashes, i)).as<long>();
+    };
+    CHECK(hash(0) != hash(1));
+    CHECK(hash(0) == static_cast<long>(Str_column::strs(col).hash(0)));
+
+    CHECK(PyObject_CallMethod(Str_column::type().tp_obj(), "from_buffers",
+              "OO", Handle("y", "ab").get(), offsets.get())
+        == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
@@ -0,0 +1,94 @@
+/** Tests for the pools of sub-interpreters.
+ */
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/subinterp_pool.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Interpreter pools run named functions", "[Interp_pool]")
+{
+    Interp_pool pool(2, R"(
+counter = 0
+
+def count(x):
+    global counter
+    counter += 1
+    return [x] * 2
+)");
+    CHECK(pool.size() == 2);
+
+    SECTION("from modules")
+    {
+        auto res = pool.submit("operator:add", Handle("(ii)", 1, 2));
+        CHECK(res.get().as<long>() == 3);
+        CHECK(res.get().as<long>() == 3);
+        CHECK(res.done());
+
+        Handle items(PyObject_CallFunction(
+            reinterpret_cast<PyObject*>(&PyRange_Type), "i", 6));
+        Handle factorials = pool.map("math.factorial", items);
+        CHECK(factorials == Handle("[iiiiii]", 1, 1, 2, 6, 24, 120));
+    }
+
+    SECTION("from the initialization code")
+    {
+        auto res = pool.submit("__main__:count", Handle("(s)", "a"));
+        CHECK(res.get() == Handle("[ss]", "a", "a"));
+
+        // The globals of the sub-interpreters are isolated.
+        Handle main(PyImport_AddModule("__main__"), BORROW);
+        CHECK_FALSE(PyObject_HasAttrString(main, "counter"));
+    }
+
+    SECTION("with exceptions raised again")
+    {
+        auto res = pool.submit("operator:truediv", Handle("(ii)", 1, 0));
+        CHECK_THROWS_AS(res.get(), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ZeroDivisionError));
+        PyErr_Clear();
+
+        res = pool.submit("operator:nothing", Handle("()"));
+        CHECK_THROWS_AS(res.get(), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_AttributeError));
+        PyErr_Clear();
+
+        // Arguments not supported by marshal fail right at the submission.
+        Handle obj(PyObject_CallObject(
+            reinterpret_cast<PyObject*>(&PyBaseObject_Type), nullptr));
+        CHECK_THROWS_AS(pool.submit("builtins:id", Handle("(O)", obj.get())),
+            Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+    }
+}
+
+TEST_CASE("Interpreter pools are exposed to Python", "[Subinterp_pool]")
+{
+    Handle pool = Subinterp_pool::create(2);
+    CHECK(Subinterp_pool::check(pool));
+    CHECK(Subinterp_pool::pool(pool).size() == 2);
+
+    Handle fut(
+        PyObject_CallMethod(pool, "submit", "sii", "operator:mul", 3, 4));
+    CHECK(Subinterp_future::check(fut));
+    Handle res(PyObject_CallMethod(fut, "result", nullptr));
+    CHECK(res.as<long>() == 12);
+    Handle done(PyObject_CallMethod(fut, "done", nullptr));
+    CHECK(done.get() == Py_True);
+
+    res = Handle(PyObject_CallMethod(
+        pool, "map", "sO", "builtins:abs", Handle("[ii]", -1, -2).get()));
+    CHECK(res == Handle("[ii]", 1, 2));
+
+    res = Handle(PyObject_CallMethod(pool, "shutdown", nullptr));
+    CHECK_THROWS_AS(
+        Handle(PyObject_CallMethod(pool, "submit", "s", "builtins:abs")),
+        Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_RuntimeError));
+    PyErr_Clear();
+}
@@ -0,0 +1,139 @@
+/** Tests for the utilities for thread states and the GIL.
+ */
+
+#include <exception>
+#include <thread>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("GIL guards can be nested", "[Gil_acquire]")
+{
+    CHECK(holds_gil());
+
+    {
+        Gil_release released{};
+        CHECK_FALSE(holds_gil());
+        {
+            Gil_acquire acquired{};
+            CHECK(holds_gil());
+            Handle res("i", 1);
+            CHECK(res.as<long>() == 1);
+        }
+        CHECK_FALSE(holds_gil());
+    }
+
+    CHECK(holds_gil());
+}
+
+TEST_CASE("GIL holding is told for each thread", "[Gil_acquire]")
+{
+    // The GIL is held by the main thread rather than the new thread.
+    bool if_held = true;
+    std::thread thread([&]() { if_held = holds_gil(); });
+    thread.join();
+    CHECK_FALSE(if_held);
+    CHECK(holds_gil());
+}
+
+TEST_CASE("GIL guards work on threads without thread states", "[Gil_acquire]")
+{
+    bool if_held = false;
+    bool if_held_after = true;
+    long res = 0;
+
+    Gil_release released{};
+    std::thread thread([&]() {
+        {
+            Gil_acquire acquired{};
+            if_held = holds_gil();
+            {
+                Gil_acquire nested{};
+                res = Handle("i", 2).as<long>();
+            }
+        }
+        if_held_after = holds_gil();
+    });
+    thread.join();
+
+    CHECK(if_held);
+    CHECK_FALSE(if_held_after);
+    CHECK(res == 2);
+}
+
+TEST_CASE("GIL guards reuse the bound thread states", "[Thread_binding]")
+{
+    PyInterpreterState* interp = PyInterpreterState_Get();
+    PyThreadState* used = nullptr;
+    PyThreadState* bound = nullptr;
+
+    Gil_release released{};
+    std::thread thread([&]() {
+        Thread_binding& binding = Thread_binding::current();
+        binding.tstate = PyThreadState_New(interp);
+        bound = binding.tstate;
+
+        for (int i = 0; i < 3; ++i) {
+            Gil_acquire acquired{};
+            Gil_acquire nested{};
+            PyThreadState* curr = PyThreadState_Get();
+            if (used == nullptr) {
+                used = curr;
+            } else if (used != curr) {
+                used = nullptr;
+                break;
+            }
+        }
+
+        PyEval_RestoreThread(binding.tstate);
+        PyThreadState_Clear(binding.tstate);
+        PyThreadState_DeleteCurrent();
+        binding.tstate = nullptr;
+    });
+    thread.join();
+
+    CHECK(used != nullptr);
+    CHECK(used == bound);
+}
+
+TEST_CASE("Python exceptions can be captured across threads", "[Captured_exc]")
+{
+    Handle int_type(reinterpret_cast<PyObject*>(&PyLong_Type), NEW);
+    std::exception_ptr failure{};
+
+    Gil_release released{};
+    std::thread thread([&]() {
+        // The exception is captured before the thread state holding it is
+        // gone with the guard.
+        Gil_acquire acquired{};
+        try {
+            Handle res(PyObject_CallFunction(int_type, "s", "abc"));
+        } catch (const Exc_set&) {
+            failure = std::make_exception_ptr(Captured_exc::capture());
+        }
+    });
+    thread.join();
+
+    Gil_acquire acquired{};
+    REQUIRE(failure != nullptr);
+    CHECK(PyErr_Occurred() == nullptr);
+    try {
+        std::rethrow_exception(failure);
+    } catch (const Captured_exc& exc) {
+        CHECK(PyErr_GivenExceptionMatches(exc.get(), PyExc_ValueError));
+        CHECK_THROWS_AS(exc.rethrow(), Exc_set);
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+
+        // The exception is kept for restoring again.
+        Captured_exc copied = exc;
+        copied.restore();
+        CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+        PyErr_Clear();
+    }
+}
@@ -0,0 +1,156 @@
+/** Tests for the recording of spans into Chrome traces.
+ */
+
+#include <string>
+#include <thread>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/trace.hpp>
+
+using namespace cpypp;
+
+namespace {
+
+/** Loads the JSON of a trace into Python objects.
+ */
+
+Handle load_trace(const std::string& content)
+{
+    Handle json(PyImport_ImportModule("json"));
+    Handle text(
+        PyUnicode_FromStringAndSize(content.data(), content.size()));
+    return json.getattr("loads").call(text);
+}
+
+/** Tests if the trace has a beginning event of the given category and name.
+ */
+
+bool has_begin(const Handle& trace, const char* cat, const char* name)
+{
+    Handle events(PyDict_GetItemString(trace, "traceEvents"), NEW);
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(events.get()); ++i) {
+        PyObject* event = PyList_GET_ITEM(events.get(), i);
+        PyObject* ph = PyDict_GetItemString(event, "ph");
+        PyObject* cat_i = PyDict_GetItemString(event, "cat");
+        PyObject* name_i = PyDict_GetItemString(event, "name");
+        if (ph != nullptr && cat_i != nullptr && name_i != nullptr
+            && PyUnicode_CompareWithASCIIString(ph, "B") == 0
+            && PyUnicode_CompareWithASCIIString(cat_i, cat) == 0
+            && PyUnicode_CompareWithASCIIString(name_i, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+TEST_CASE("Spans at the boundaries are recorded", "[Span_recorder]")
+{
+    Span_recorder& recorder = Span_recorder::global();
+    recorder.clear();
+    recorder.enable();
+    CHECK(recorder.enabled());
+    CHECK(Span_tracer::installed() == &recorder);
+
+    Handle builtins(PyEval_GetBuiltins(), NEW);
+    Handle abs(PyDict_GetItemString(builtins, "abs"), NEW);
+    {
+        Trace_span span("outer \"scope\"");
+        CHECK(abs.call(-2l).as<long>() == 2);
+    }
+
+    std::thread waiter([]() { Gil_acquire acquired{}; });
+    {
+        Gil_release released{};
+        waiter.join();
+    }
+
+    recorder.disable();
+    CHECK_FALSE(recorder.enabled());
+    CHECK(Span_tracer::installed() == nullptr);
+    // Spans are no longer recorded.
+    abs.call(-3l);
+
+    Handle trace = load_trace(recorder.dump());
+    CHECK(has_begin(trace, "call", "abs"));
+    CHECK(has_begin(trace, "convert", "as int"));
+    CHECK(has_begin(trace, "gil", "gil wait"));
+    CHECK(has_begin(trace, "scope", "outer \"scope\""));
+
+    Handle events(PyDict_GetItemString(trace, "traceEvents"), NEW);
+    Py_ssize_t n_events = PyList_GET_SIZE(events.get());
+    recorder.clear();
+    Handle cleared = load_trace(recorder.dump());
+    Handle left(PyDict_GetItemString(cleared, "traceEvents"), NEW);
+    CHECK(PyList_GET_SIZE(left.get()) < n_events);
+    CHECK_FALSE(has_begin(cleared, "call", "abs"));
+}
+
+TEST_CASE("Threads switching between recorders keep their buffers",
+    "[Span_recorder]")
+{
+    Span_recorder first(16);
+    Span_recorder second(16);
+    first.enable();
+    second.enable();
+    for (int i = 0; i < 10; ++i) {
+        first.begin_scope("first");
+        first.end_scope();
+        second.begin_scope("second");
+        second.end_scope();
+    }
+    first.disable();
+    second.disable();
+
+    for (Span_recorder* i : { &first, &second }) {
+        std::string dumped = i->dump();
+        std::size_t n_buffers = 0;
+        for (std::size_t pos = dumped.find("thread_name");
+             pos != std::string::npos;
+             pos = dumped.find("thread_name", pos + 1)) {
+            ++n_buffers;
+        }
+        CHECK(n_buffers == 1);
+    }
+}
+
+TEST_CASE("Span recording is controlled from Python", "[Span_recorder]")
+{
+    Handle mod(PyModule_New("tracemod"));
+    REQUIRE(PyModule_AddFunctions(mod, Span_recorder::methods()) == 0);
+    Handle globals(PyModule_GetDict(mod), NEW);
+    REQUIRE(PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins())
+        == 0);
+
+    Handle res(PyRun_String("trace_clear()\n"
+                            "trace_enable()\n"
+                            "enabled = trace_enabled()\n"
+                            "def work(x):\n"
+                            "    return x + 1\n"
+                            "trace_begin('py scope')\n"
+                            "trace_end()\n",
+        Py_file_input, globals, globals));
+    CHECK(PyDict_GetItemString(globals, "enabled") == Py_True);
+
+    Handle work(PyDict_GetItemString(globals, "work"), NEW);
+    CHECK(work.call(1l).as<long>() == 2);
+
+    Handle disable(PyDict_GetItemString(globals, "trace_disable"), NEW);
+    disable.call();
+    CHECK_FALSE(Span_recorder::global().enabled());
+
+    Handle dump(PyDict_GetItemString(globals, "trace_dump"), NEW);
+    Handle content = dump.call();
+    Handle trace = load_trace(PyUnicode_AsUTF8(content));
+    CHECK(has_begin(trace, "call", "work"));
+    CHECK(has_begin(trace, "scope", "py scope"));
+
+    CHECK(PyObject_CallFunction(dump, "(s)", "/nonexistent/trace.json")
+        == nullptr);
+    CHECK(PyErr_ExceptionMatches(PyExc_OSError));
+    PyErr_Clear();
+}
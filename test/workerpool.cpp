@@ -0,0 +1,118 @@
+/** Tests for the pools of workers with persistent thread states.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <Python.h>
+
+#include <cpypp.hpp>
+#include <cpypp/worker_pool.hpp>
+
+using namespace cpypp;
+
+TEST_CASE("Worker pools reuse their thread states", "[Worker_pool]")
+{
+    Worker_pool pool(2);
+    CHECK(pool.size() == 2);
+    CHECK(pool.interp() == PyInterpreterState_Get());
+
+    Handle operator_mod(PyImport_ImportModule("operator"));
+    Handle add = operator_mod.getattr("add");
+
+    const int n_tasks = 50;
+    std::vector<std::future<PyThreadState*>> tstates{};
+    std::vector<std::future<long>> sums{};
+    for (int i = 0; i < n_tasks; ++i) {
+        tstates.push_back(pool.submit([]() {
+            Gil_acquire acquired{};
+            return PyThreadState_Get();
+        }));
+        sums.push_back(pool.submit([&add, i]() {
+            Gil_acquire acquired{};
+            return add.call(static_cast<long>(i), 1l).as<long>();
+        }));
+    }
+
+    std::set<PyThreadState*> distinct{};
+    long total = 0;
+    {
+        Gil_release released{};
+        for (auto& i : tstates) {
+            distinct.insert(i.get());
+        }
+        for (auto& i : sums) {
+            total += i.get();
+        }
+    }
+    CHECK(distinct.size() >= 1);
+    CHECK(distinct.size() <= 2);
+    CHECK(distinct.count(PyThreadState_Get()) == 0);
+    CHECK(total == n_tasks * (n_tasks + 1) / 2);
+
+    SECTION("with exceptions given to the futures")
+    {
+        auto res = pool.submit([]() -> int {
+            throw std::invalid_argument("failed");
+        });
+        Gil_release released{};
+        CHECK_THROWS_AS(res.get(), std::invalid_argument);
+    }
+
+    SECTION("with submission refused after the shutdown")
+    {
+        pool.shutdown();
+        pool.shutdown();
+        CHECK_THROWS_AS(pool.submit([]() {}), std::runtime_error);
+    }
+}
+
+TEST_CASE("Task groups fail fast", "[Task_group]")
+{
+    Worker_pool pool(2);
+    Handle int_type(reinterpret_cast<PyObject*>(&PyLong_Type), NEW);
+    std::atomic<int> n_run{ 0 };
+
+    Task_group group(pool);
+    group.run([&]() {
+        Gil_acquire acquired{};
+        Handle res(PyObject_CallFunction(int_type, "s", "abc"));
+    });
+    for (int i = 0; i < 100; ++i) {
+        group.run([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++n_run;
+        });
+    }
+
+    CHECK_THROWS_AS(group.wait(), Exc_set);
+    CHECK(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+    CHECK(n_run.load() < 100);
+
+    SECTION("with the group reusable")
+    {
+        group.run([&]() { ++n_run; });
+        int before = n_run.load();
+        group.wait();
+        CHECK(n_run.load() >= before);
+        CHECK_FALSE(group.cancelled());
+    }
+
+    SECTION("with Python exceptions captured for plain submissions")
+    {
+        auto res = pool.submit([&]() {
+            Gil_acquire acquired{};
+            Handle res(PyObject_CallFunction(int_type, "s", "abc"));
+        });
+        Gil_release released{};
+        CHECK_THROWS_AS(res.get(), Captured_exc);
+    }
+}